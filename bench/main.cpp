@@ -0,0 +1,737 @@
+#include "opt_parser.h"
+#include "rcli.h"
+#include "rcli_autopipe.h"
+#include "rcli_loader.h"
+#include "rcli_pipeline.h"
+#include "rcli_pubsub.h"
+#include "rcli_stream.h"
+#include "rcli_tls.h"
+#include "rcli_window.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <vector>
+#ifdef RCLI_WITH_TEST_SERVER
+#    include "resp_server.h"
+#    include <unistd.h>
+#endif
+
+#define BENCH_KEY_PREFIX "rcli_bench"
+
+typedef struct bench_opt {
+    std::string host;
+    uint32_t port = 6379;
+    std::string pwd;
+    std::string unix_path;  // connect here instead of host:port when set
+    RedisTlsContext* tls = nullptr;
+    std::vector<std::string> workloads{"set", "get", "hset", "zadd", "zrange"};
+    size_t requests = 100000;
+    size_t value_size = 64;
+    size_t keyspace = 10000;
+    size_t threads = 1;
+    size_t pipeline = 1;  // commands per round trip, 1 runs the plain synchronous calls
+    int32_t range = 10;   // ZRANGE length
+    bool auto_pipeline = false;  // the threads share one RedisAutoPipeline instead of a connection each
+    uint32_t window_us = 0;      // its auto_options_t::window_us
+    size_t window_depth = 0;     // commands in flight through a RedisWindowPipeline instead of -P batches
+    bool json = false;
+} bench_opt_t;
+
+typedef struct bench_result {
+    std::string workload;
+    size_t requests = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    std::vector<uint32_t> latency_us;  // one sample per request
+    double avg_batch = 0;              // commands per write with -A
+} bench_result_t;
+
+enum {
+    WORKLOAD_SET = 0,
+    WORKLOAD_GET,
+    WORKLOAD_HSET,
+    WORKLOAD_ZADD,
+    WORKLOAD_ZRANGE,
+    WORKLOAD_CONNECT,  // reconnect and PING, what a handshake costs
+    WORKLOAD_PUBLISH,  // PUBLISH to a RedisSubscriber, timed until it handled every message
+    WORKLOAD_XADD,     // XADD trimmed to about keyspace entries
+    WORKLOAD_XREAD,    // entries of a filled stream read by a consumer group and acked, -P per XREADGROUP
+    WORKLOAD_LOAD,     // SET commands in RESP through a RedisBulkLoader, -c connections, -P in flight on each
+    WORKLOAD_UNKNOWN,
+};
+
+static int workload_type(const std::string& name) {
+    static const char* names[] = {"set",     "get",     "hset", "zadd",  "zrange",
+                                  "connect", "publish", "xadd", "xread", "load"};
+    for (int i = 0; i < WORKLOAD_UNKNOWN; i++) {
+        if (name == names[i]) {
+            return i;
+        }
+    }
+    return WORKLOAD_UNKNOWN;
+}
+
+static void split(const std::string& s, char delim, std::vector<std::string>* ret) {
+    size_t last = 0;
+    size_t index = s.find(delim, last);
+    while (index != std::string::npos) {
+        ret->push_back(s.substr(last, index - last));
+        last = index + 1;
+        index = s.find(delim, last);
+    }
+    ret->push_back(s.substr(last));
+}
+
+// xorshift64, one per worker so key selection does not contend
+class BenchRandom {
+public:
+    explicit BenchRandom(uint64_t seed) : state_(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+    uint64_t next() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return state_;
+    }
+
+private:
+    uint64_t state_;
+};
+
+class BenchWorker {
+public:
+    BenchWorker(const bench_opt_t& opt, int type, size_t id)
+      : opt_(opt), type_(type), id_(id), rand_(id + 1), value_(opt.value_size, 'x') {}
+
+    // the calls go through shared, which is connected already
+    void share(RedisAutoPipeline* shared) { shared_ = shared; }
+
+    bool connect(std::string& error) {
+        if (shared_) {
+            return true;
+        }
+        RedisClient::options_t cli_opts;
+        cli_opts.unix_path = opt_.unix_path;
+        cli_opts.tls = opt_.tls;
+        cli_.init(opt_.host, opt_.port, opt_.pwd, cli_opts);
+        if (!cli_.connect()) {
+            error = cli_.get_last_error();
+            return false;
+        }
+        return true;
+    }
+
+    void run(size_t requests, bench_result_t& result) {
+        result.latency_us.reserve(requests);
+        if (shared_) {
+            run_sync(requests, result);
+        } else if (type_ == WORKLOAD_XREAD) {
+            run_xread(requests, result);
+        } else if (opt_.window_depth > 0) {
+            run_window(requests, result);
+        } else if (opt_.pipeline > 1 && type_ != WORKLOAD_CONNECT) {
+            run_pipeline(requests, result);
+        } else {
+            run_sync(requests, result);
+        }
+    }
+
+private:
+    typedef std::chrono::steady_clock clock_t;
+
+    static uint32_t elapsed_us(clock_t::time_point start) {
+        return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(clock_t::now() - start).count();
+    }
+
+    const std::string& next_key() {
+        uint64_t n = rand_.next() % opt_.keyspace;
+        key_.assign(BENCH_KEY_PREFIX ":");
+        key_.append(std::to_string(n));
+        return key_;
+    }
+
+    const std::string& next_field() {
+        uint64_t n = rand_.next() % opt_.keyspace;
+        field_.assign("f");
+        field_.append(std::to_string(n));
+        return field_;
+    }
+
+    bool run_shared() {
+        switch (type_) {
+            case WORKLOAD_SET: return shared_->set(next_key(), value_);
+            case WORKLOAD_GET: {
+                int err = shared_->commanda_for_string(out_str_, "GET", next_key());
+                return err == RCLI_RET_OK || err == RCLI_RET_NIL;
+            }
+            case WORKLOAD_HSET: return shared_->hset(BENCH_KEY_PREFIX ":hash", next_field(), value_, out_int_);
+            case WORKLOAD_ZADD: {
+                score_member_.first = (double) (rand_.next() % 1000000);
+                score_member_.second = next_field();
+                return shared_->zadd(BENCH_KEY_PREFIX ":zset", score_member_, out_int_);
+            }
+            case WORKLOAD_ZRANGE: return shared_->zrange(BENCH_KEY_PREFIX ":zset", 0, opt_.range - 1, out_vec_);
+            case WORKLOAD_PUBLISH:
+                return shared_->commanda_for_integer(out_int_, "PUBLISH", BENCH_KEY_PREFIX ":channel", value_)
+                       == RCLI_RET_OK;
+            default: return false;
+        }
+    }
+
+    bool run_one() {
+        if (shared_) {
+            return run_shared();
+        }
+        switch (type_) {
+            case WORKLOAD_SET: return cli_.set(next_key(), value_);
+            case WORKLOAD_GET: {
+                // a missing key is still a served request
+                int err = cli_.commanda_for_string(out_str_, "GET", next_key());
+                return err == RCLI_RET_OK || err == RCLI_RET_NIL;
+            }
+            case WORKLOAD_HSET: return cli_.hset(BENCH_KEY_PREFIX ":hash", next_field(), value_, out_int_);
+            case WORKLOAD_ZADD: {
+                score_member_.first = (double) (rand_.next() % 1000000);
+                score_member_.second = next_field();
+                return cli_.zadd(BENCH_KEY_PREFIX ":zset", score_member_, out_int_);
+            }
+            case WORKLOAD_ZRANGE: {
+                out_vec_.clear();
+                return cli_.zrange(BENCH_KEY_PREFIX ":zset", 0, opt_.range - 1, out_vec_);
+            }
+            case WORKLOAD_CONNECT: return cli_.reconnect() && cli_.ping();
+            case WORKLOAD_PUBLISH:
+                return cli_.commanda_for_integer(out_int_, "PUBLISH", BENCH_KEY_PREFIX ":channel", value_)
+                       == RCLI_RET_OK;
+            case WORKLOAD_XADD: return cli_.xadd(BENCH_KEY_PREFIX ":stream", stream_fields(), out_str_, opt_.keyspace);
+            default: return false;
+        }
+    }
+
+    void run_sync(size_t requests, bench_result_t& result) {
+        for (size_t i = 0; i < requests; i++) {
+            clock_t::time_point start = clock_t::now();
+            if (!run_one()) {
+                result.errors++;
+            }
+            result.latency_us.push_back(elapsed_us(start));
+        }
+        result.requests += requests;
+    }
+
+    void append_one(RedisPipeline& pipe, size_t slot) {
+        switch (type_) {
+            case WORKLOAD_SET: pipe.set(next_key(), value_); break;
+            case WORKLOAD_GET: pipe.get(next_key(), out_strs_[slot]); break;
+            case WORKLOAD_HSET: pipe.hset(BENCH_KEY_PREFIX ":hash", next_field(), value_, out_ints_[slot]); break;
+            case WORKLOAD_ZADD: {
+                score_member_.first = (double) (rand_.next() % 1000000);
+                score_member_.second = next_field();
+                pipe.zadd(BENCH_KEY_PREFIX ":zset", score_member_, out_ints_[slot]);
+                break;
+            }
+            case WORKLOAD_ZRANGE: {
+                out_vecs_[slot].clear();
+                pipe.zrange(BENCH_KEY_PREFIX ":zset", 0, opt_.range - 1, out_vecs_[slot]);
+                break;
+            }
+            case WORKLOAD_PUBLISH: {
+                pipe.appenda_for_integer(out_ints_[slot], "PUBLISH", BENCH_KEY_PREFIX ":channel", value_);
+                break;
+            }
+            case WORKLOAD_XADD: {
+                pipe.xadd(BENCH_KEY_PREFIX ":stream", stream_fields(), out_strs_[slot], opt_.keyspace);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    // every command of a batch is charged the latency of the whole batch
+    void run_pipeline(size_t requests, bench_result_t& result) {
+        out_strs_.resize(opt_.pipeline);
+        out_ints_.resize(opt_.pipeline);
+        out_vecs_.resize(opt_.pipeline);
+        RedisPipeline pipe = cli_.pipeline();
+        for (size_t done = 0; done < requests;) {
+            size_t batch = std::min(opt_.pipeline, requests - done);
+            clock_t::time_point start = clock_t::now();
+            for (size_t i = 0; i < batch; i++) {
+                append_one(pipe, i);
+            }
+            int err = pipe.exec();
+            uint32_t us = elapsed_us(start);
+            for (size_t i = 0; i < batch; i++) {
+                int st = err == RCLI_RET_OK ? pipe.status(i) : RCLI_ERROR;
+                if (st != RCLI_RET_OK && st != RCLI_RET_NIL) {
+                    result.errors++;
+                }
+                result.latency_us.push_back(us);
+            }
+            if (err != RCLI_RET_OK) {
+                cli_.check_alive();
+            }
+            done += batch;
+        }
+        result.requests += requests;
+    }
+
+    int add_one(RedisWindowPipeline& window) {
+        switch (type_) {
+            case WORKLOAD_SET: return window.add("SET", next_key(), value_);
+            case WORKLOAD_GET: return window.add("GET", next_key());
+            case WORKLOAD_HSET: return window.add("HSET", BENCH_KEY_PREFIX ":hash", next_field(), value_);
+            case WORKLOAD_ZADD: {
+                double score = (double) (rand_.next() % 1000000);
+                return window.add("ZADD", BENCH_KEY_PREFIX ":zset", score, next_field());
+            }
+            case WORKLOAD_ZRANGE: return window.add("ZRANGE", BENCH_KEY_PREFIX ":zset", 0, opt_.range - 1);
+            case WORKLOAD_PUBLISH: return window.add("PUBLISH", BENCH_KEY_PREFIX ":channel", value_);
+            default: return RCLI_ERROR;
+        }
+    }
+
+    // every command is charged from its add to its reply, the window keeps
+    // -W of them in flight
+    void run_window(size_t requests, bench_result_t& result) {
+        RedisWindowPipeline::window_options_t window_opts;
+        window_opts.max_in_flight = opt_.window_depth;
+        RedisWindowPipeline window(&cli_, window_opts);
+        // one more slot than in flight, the slot of a command being added is free
+        std::vector<clock_t::time_point> added(opt_.window_depth + 1);
+        window.on_reply([&](uint64_t seq, int status, const std::string& error) {
+            if (status != RCLI_RET_OK && status != RCLI_RET_NIL) {
+                result.errors++;
+            }
+            result.latency_us.push_back(elapsed_us(added[seq % added.size()]));
+        });
+        size_t done = 0;
+        for (; done < requests; done++) {
+            added[done % added.size()] = clock_t::now();
+            if (add_one(window) != RCLI_RET_OK) {
+                break;
+            }
+        }
+        window.drain();
+        // lost with the connection
+        result.errors += requests - window.stats().replies;
+        result.requests += requests;
+    }
+
+    const std::vector<RedisClient::field_value_t>& stream_fields() {
+        if (fields_.empty()) {
+            fields_.emplace_back("value", value_);
+        }
+        return fields_;
+    }
+
+    // every entry of a batch is charged the latency of its XREADGROUP, the acks
+    // of the previous batch go out in front of it
+    void run_xread(size_t requests, bench_result_t& result) {
+        RedisStreamConsumer consumer(&cli_, "bench", "bench-" + std::to_string(id_));
+        consumer.count((uint32_t) std::max<size_t>(opt_.pipeline, 1)).ack_batch(opt_.pipeline * 2);
+        RedisStreamBatch batch;
+        size_t done = 0;
+        while (done < requests) {
+            clock_t::time_point start = clock_t::now();
+            int err = consumer.read({BENCH_KEY_PREFIX ":stream"}, batch);
+            uint32_t us = elapsed_us(start);
+            if (err == RCLI_RET_NIL) {
+                // the other workers took the rest
+                break;
+            }
+            if (err != RCLI_RET_OK) {
+                result.errors++;
+                result.latency_us.push_back(us);
+                done++;
+                continue;
+            }
+            for (size_t i = 0; i < batch.size(); i++) {
+                consumer.ack(batch, i);
+                result.latency_us.push_back(us);
+            }
+            done += batch.size();
+        }
+        consumer.flush_acks();
+        result.requests += done;
+    }
+
+    const bench_opt_t& opt_;
+    int type_;
+    size_t id_;
+    RedisAutoPipeline* shared_ = nullptr;
+    BenchRandom rand_;
+    RedisClient cli_;
+    std::string value_;
+    std::string key_;
+    std::string field_;
+    RedisClient::score_member_t score_member_;
+    std::string out_str_;
+    int64_t out_int_ = 0;
+    std::vector<std::string> out_vec_;
+    std::vector<std::string> out_strs_;
+    std::vector<int64_t> out_ints_;
+    std::vector<std::vector<std::string>> out_vecs_;
+    std::vector<RedisClient::field_value_t> fields_;
+};
+
+// the whole input is encoded up front, only the load is timed
+static bool run_load(const bench_opt_t& opt, bench_result_t& result) {
+    std::string resp;
+    RedisCommandEncoder enc(resp);
+    std::string value(opt.value_size, 'x');
+    for (size_t i = 0; i < opt.requests; i++) {
+        enc.command("SET", BENCH_KEY_PREFIX ":" + std::to_string(i % opt.keyspace), value);
+    }
+    std::istringstream in(resp);
+
+    RedisBulkLoader loader;
+    RedisBulkLoader::loader_options_t load_opts;
+    load_opts.conn.unix_path = opt.unix_path;
+    load_opts.conn.tls = opt.tls;
+    load_opts.connections = (uint32_t) opt.threads;
+    if (opt.pipeline > 1) {
+        load_opts.window = opt.pipeline;
+    }
+    loader.init(opt.host, opt.port, opt.pwd, load_opts);
+    RedisBulkLoader::loader_stats_t st;
+    if (loader.load(in, RedisBulkLoader::FORMAT_RESP, st) == RCLI_ERROR) {
+        fprintf(stderr, "load %s:%u error: %s\n", opt.host.c_str(), opt.port, loader.get_last_error().c_str());
+        return false;
+    }
+    result.requests = st.replies;
+    result.errors = st.errors;
+    result.seconds = st.seconds;
+    return true;
+}
+
+static bool run_workload(const bench_opt_t& opt, const std::string& name, bench_result_t& result) {
+    result.workload = name;
+    int type = workload_type(name);
+    if (type == WORKLOAD_UNKNOWN) {
+        fprintf(stderr, "unknown workload: %s\n", name.c_str());
+        return false;
+    }
+    if (opt.window_depth > 0 && (opt.auto_pipeline || type == WORKLOAD_CONNECT || type >= WORKLOAD_XADD)) {
+        fprintf(stderr, "workload %s does not run with -W\n", name.c_str());
+        return false;
+    }
+    if (type == WORKLOAD_LOAD) {
+        if (opt.auto_pipeline) {
+            fprintf(stderr, "workload %s does not run with -A\n", name.c_str());
+            return false;
+        }
+        return run_load(opt, result);
+    }
+
+    // every message published is counted once handled
+    RedisSubscriber sub;
+    std::atomic<size_t> handled(0);
+    if (type == WORKLOAD_PUBLISH) {
+        RedisSubscriber::subscriber_options_t sub_opts;
+        sub_opts.conn.unix_path = opt.unix_path;
+        sub_opts.conn.tls = opt.tls;
+        sub.init(opt.host, opt.port, opt.pwd, sub_opts);
+        sub.set_handler(
+          [&](const RedisSubscriber::message_t& msg) { handled.fetch_add(1, std::memory_order_relaxed); });
+        sub.subscribe({BENCH_KEY_PREFIX ":channel"});
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        bool started = sub.start();
+        while (started && sub.stats().subscriptions == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (sub.stats().subscriptions == 0) {
+            fprintf(stderr, "subscribe %s:%u error: %s\n", opt.host.c_str(), opt.port, sub.get_last_error().c_str());
+            return false;
+        }
+    }
+
+    // a fresh stream of requests entries, read from the start by the group
+    if (type == WORKLOAD_XREAD) {
+        RedisClient::options_t cli_opts;
+        cli_opts.unix_path = opt.unix_path;
+        cli_opts.tls = opt.tls;
+        RedisClient cli;
+        cli.init(opt.host, opt.port, opt.pwd, cli_opts);
+        const std::string key(BENCH_KEY_PREFIX ":stream");
+        std::vector<RedisClient::field_value_t> fields{{"value", std::string(opt.value_size, 'x')}};
+        std::vector<std::string> ids(1000);
+        bool filled = cli.connect();
+        cli.del(key);
+        RedisPipeline pipe = cli.pipeline();
+        for (size_t added = 0; added < opt.requests;) {
+            size_t n = std::min(ids.size(), opt.requests - added);
+            for (size_t i = 0; i < n; i++) {
+                pipe.xadd(key, fields, ids[i]);
+            }
+            filled = filled && pipe.exec() == RCLI_RET_OK;
+            added += n;
+        }
+        RedisStreamConsumer group(&cli, "bench", "fill");
+        if (!filled || group.create_group(key, "0") != RCLI_RET_OK) {
+            fprintf(stderr, "fill %s error: %s\n", key.c_str(), cli.get_last_error().c_str());
+            return false;
+        }
+    }
+
+    // every thread's calls coalesced on one connection
+    RedisAutoPipeline shared;
+    if (opt.auto_pipeline) {
+        if (type == WORKLOAD_CONNECT || type >= WORKLOAD_XADD) {
+            fprintf(stderr, "workload %s does not run with -A\n", name.c_str());
+            return false;
+        }
+        RedisAutoPipeline::auto_options_t auto_opts;
+        auto_opts.conn.unix_path = opt.unix_path;
+        auto_opts.conn.tls = opt.tls;
+        auto_opts.window_us = opt.window_us;
+        shared.init(opt.host, opt.port, opt.pwd, auto_opts);
+        if (!shared.connect()) {
+            fprintf(stderr, "connect %s:%u error: %s\n", opt.host.c_str(), opt.port, shared.get_last_error().c_str());
+            return false;
+        }
+    }
+
+    std::vector<std::unique_ptr<BenchWorker>> workers;
+    for (size_t i = 0; i < opt.threads; i++) {
+        std::unique_ptr<BenchWorker> worker(new BenchWorker(opt, type, i));
+        if (opt.auto_pipeline) {
+            worker->share(&shared);
+        }
+        std::string error;
+        if (!worker->connect(error)) {
+            fprintf(stderr, "connect %s:%u error: %s\n", opt.host.c_str(), opt.port, error.c_str());
+            return false;
+        }
+        workers.emplace_back(std::move(worker));
+    }
+
+    std::vector<bench_result_t> parts(opt.threads);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+    for (size_t i = 0; i < opt.threads; i++) {
+        size_t requests = opt.requests / opt.threads + (i < opt.requests % opt.threads ? 1 : 0);
+        threads.emplace_back([&, i, requests]() {
+            ready++;
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            workers[i]->run(requests, parts[i]);
+        });
+    }
+    while (ready.load() < opt.threads) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (type == WORKLOAD_PUBLISH) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (handled.load() < opt.requests && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        // messages lost on the way count as errors
+        result.errors += opt.requests - std::min(handled.load(), opt.requests);
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto& part : parts) {
+        result.requests += part.requests;
+        result.errors += part.errors;
+        result.latency_us.insert(result.latency_us.end(), part.latency_us.begin(), part.latency_us.end());
+    }
+    std::sort(result.latency_us.begin(), result.latency_us.end());
+    if (opt.auto_pipeline) {
+        result.avg_batch = shared.stats().avg_batch();
+    }
+    return true;
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+static double average(const std::vector<uint32_t>& samples) {
+    if (samples.empty()) {
+        return 0;
+    }
+    double sum = 0;
+    for (uint32_t us : samples) {
+        sum += us;
+    }
+    return sum / samples.size();
+}
+
+static void print_text(const bench_result_t& r) {
+    fprintf(stdout,
+            "[%-7s] %zu requests, %zu errors, %.2fs, %.0f ops/s, latency(us) avg %.1f p50 %u p99 %u p999 %u max %u\n",
+            r.workload.c_str(), r.requests, r.errors, r.seconds, r.seconds > 0 ? r.requests / r.seconds : 0,
+            average(r.latency_us), percentile(r.latency_us, 0.5), percentile(r.latency_us, 0.99),
+            percentile(r.latency_us, 0.999), r.latency_us.empty() ? 0 : r.latency_us.back());
+    if (r.avg_batch > 0) {
+        fprintf(stdout, "          %.1f commands per write\n", r.avg_batch);
+    }
+}
+
+static void print_json(const bench_opt_t& opt, const std::vector<bench_result_t>& results) {
+    fprintf(stdout,
+            "{\"host\":\"%s:%u\",\"threads\":%zu,\"pipeline\":%zu,\"value_size\":%zu,\"keyspace\":%zu,\"results\":[",
+            opt.host.c_str(), opt.port, opt.threads, opt.pipeline, opt.value_size, opt.keyspace);
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result_t& r = results[i];
+        fprintf(stdout,
+                "%s{\"workload\":\"%s\",\"requests\":%zu,\"errors\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+                "\"latency_us\":{\"avg\":%.1f,\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u},\"avg_batch\":%.1f}",
+                i ? "," : "", r.workload.c_str(), r.requests, r.errors, r.seconds,
+                r.seconds > 0 ? r.requests / r.seconds : 0, average(r.latency_us), percentile(r.latency_us, 0.5),
+                percentile(r.latency_us, 0.99), percentile(r.latency_us, 0.999),
+                r.latency_us.empty() ? 0 : r.latency_us.back(), r.avg_batch);
+    }
+    fprintf(stdout, "]}\n");
+}
+
+static void usage(const char* app) {
+    fprintf(stderr,
+            "usage: %s -h host:port:pwd | -s [options]\n"
+            "  -w workloads   comma separated: set,get,hset,zadd,zrange,connect,publish,xadd,xread,\n"
+            "                 load (default the first five)\n"
+            "  -n requests    requests per workload (default 100000)\n"
+            "  -d size        value size in bytes (default 64)\n"
+            "  -k keyspace    number of distinct keys or members (default 10000)\n"
+            "  -c threads     worker threads, one connection each (default 1)\n"
+            "  -P depth       commands per pipeline, 1 for synchronous calls (default 1)\n"
+            "  -r range       ZRANGE length (default 10)\n"
+            "  -W depth       commands in flight on each connection, streamed through a RedisWindowPipeline\n"
+            "  -A             the threads share one connection, their calls coalesced by RedisAutoPipeline\n"
+            "  --window usec  how long -A waits for a batch to fill (default 0)\n"
+            "  -s             run against an embedded in-process server\n"
+            "  -L usec        reply latency of the embedded server (default 0)\n"
+            "  -u path        connect over this unix socket, with -s the server listens on it too\n"
+            "  --tls          connect with TLS, with -s the server listens for TLS and is trusted\n"
+            "  --cacert file  CA to verify the server with instead of the system's\n"
+            "  --sni name     server name to send and verify instead of the host\n"
+            "  --no-resume    full TLS handshake on every connect\n"
+            "  --json         print one JSON document\n",
+            app);
+}
+
+int main(int argc, char* argv[]) {
+    bench_opt_t opt;
+    std::string host;
+    bool help = false;
+    bool server = false;
+    uint32_t latency_us = 0;
+    bool tls = false;
+    RedisTlsContext::tls_options_t tls_opts;
+    std::vector<std::string> tmp_files;  // removed once loaded
+
+    OptionParser optr;
+    optr.add_opt("-h", true, [&](int id, const char* str) { host.assign(str); });
+    optr.add_opt("-w", true, [&](int id, const char* str) {
+        opt.workloads.clear();
+        split(str, ',', &opt.workloads);
+    });
+    optr.add_opt("-n", true, [&](int id, const char* str) { opt.requests = strtoul(str, nullptr, 10); });
+    optr.add_opt("-d", true, [&](int id, const char* str) { opt.value_size = strtoul(str, nullptr, 10); });
+    optr.add_opt("-k", true, [&](int id, const char* str) { opt.keyspace = strtoul(str, nullptr, 10); });
+    optr.add_opt("-c", true, [&](int id, const char* str) { opt.threads = strtoul(str, nullptr, 10); });
+    optr.add_opt("-P", true, [&](int id, const char* str) { opt.pipeline = strtoul(str, nullptr, 10); });
+    optr.add_opt("-r", true, [&](int id, const char* str) { opt.range = atoi(str); });
+    optr.add_opt("-W", true, [&](int id, const char* str) { opt.window_depth = strtoul(str, nullptr, 10); });
+    optr.add_opt("-A", false, [&](int id, const char* str) { opt.auto_pipeline = true; });
+    optr.add_opt("--window", true,
+                 [&](int id, const char* str) { opt.window_us = (uint32_t) strtoul(str, nullptr, 10); });
+    optr.add_opt("-s", false, [&](int id, const char* str) { server = true; });
+    optr.add_opt("-L", true, [&](int id, const char* str) { latency_us = (uint32_t) strtoul(str, nullptr, 10); });
+    optr.add_opt("-u", true, [&](int id, const char* str) { opt.unix_path.assign(str); });
+    optr.add_opt("--tls", false, [&](int id, const char* str) { tls = true; });
+    optr.add_opt("--cacert", true, [&](int id, const char* str) { tls_opts.ca_file.assign(str); });
+    optr.add_opt("--sni", true, [&](int id, const char* str) { tls_opts.server_name.assign(str); });
+    optr.add_opt("--no-resume", false, [&](int id, const char* str) { tls_opts.resume = false; });
+    optr.add_opt("--json", false, [&](int id, const char* str) { opt.json = true; });
+    optr.add_opt("--help", false, [&](int id, const char* str) { help = true; });
+    optr.cmdline(argc, argv);
+
+#ifdef RCLI_WITH_TEST_SERVER
+    RespServer resp_server;
+    if (server) {
+        resp_server.set_password("rcli");
+        resp_server.set_latency_us(latency_us);
+        bool ok = resp_server.listen_tcp("127.0.0.1", 0)
+                  && (opt.unix_path.empty() || resp_server.listen_unix(opt.unix_path));
+        host = "127.0.0.1:" + std::to_string(resp_server.port()) + ":rcli";
+#    ifdef RCLI_WITH_SSL
+        // its self-signed certificate is trusted through a file
+        if (ok && tls) {
+            tmp_files.push_back("/tmp/bench_rcli_" + std::to_string(getpid()) + ".crt");
+            tmp_files.push_back("/tmp/bench_rcli_" + std::to_string(getpid()) + ".key");
+            ok = resp_server.listen_tls("127.0.0.1", 0) && resp_server.write_tls_cert(tmp_files[0], tmp_files[1]);
+            host = "127.0.0.1:" + std::to_string(resp_server.tls_port()) + ":rcli";
+            tls_opts.ca_file = tmp_files[0];
+            tls_opts.server_name = "localhost";
+        }
+#    endif
+        if (!ok || !resp_server.start()) {
+            fprintf(stderr, "embedded server error: %s\n", resp_server.get_last_error().c_str());
+            return 1;
+        }
+    }
+#else
+    if (server) {
+        fprintf(stderr, "-s is not supported on this platform\n");
+        return 1;
+    }
+#endif
+
+    // 127.0.0.1:6379:pwd
+    std::vector<std::string> host_vec;
+    split(host, ':', &host_vec);
+    if (help || host_vec.size() != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    opt.host = host_vec[0];
+    opt.port = (uint32_t) atoi(host_vec[1].c_str());
+    opt.pwd = host_vec[2];
+    opt.threads = std::max<size_t>(opt.threads, 1);
+    opt.pipeline = std::max<size_t>(opt.pipeline, 1);
+    opt.keyspace = std::max<size_t>(opt.keyspace, 1);
+    RedisTlsContext tls_ctx;
+    bool tls_ok = !tls || tls_ctx.init(tls_opts);
+    for (auto& file : tmp_files) {
+        remove(file.c_str());
+    }
+    if (tls) {
+        if (!tls_ok) {
+            fprintf(stderr, "TLS error: %s\n", tls_ctx.get_last_error().c_str());
+            return 1;
+        }
+        opt.tls = &tls_ctx;
+    }
+
+    std::vector<bench_result_t> results;
+    for (auto& name : opt.workloads) {
+        bench_result_t result;
+        if (!run_workload(opt, name, result)) {
+            return 1;
+        }
+        if (!opt.json) {
+            print_text(result);
+        }
+        results.emplace_back(std::move(result));
+    }
+    if (opt.json) {
+        print_json(opt, results);
+    }
+    return 0;
+}
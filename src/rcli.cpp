@@ -1,72 +1,180 @@
-#include "rcli.h"
-#include <hiredis/hiredis.h>
-
-#ifdef _MSC_VER
-#    include <winsock2.h>
-#    ifndef strcasecmp
-#        define strcasecmp stricmp
-#    endif
-#    ifndef strncasecmp
-#        define strncasecmp strnicmp
-#    endif
-#endif
-
-class RedisClientImpl {
-public:
-    bool connect(const std::string& host, uint32_t port);
-    bool reconnect();
-    redisContext* get_context() { return ctx_.get(); }
-    int check_reply_type(const redisReply* reply);
-    int get_reply_status(const redisReply* reply);
-    int get_reply_integer(const redisReply* reply, int64_t& retval);
-    int get_reply_string(const redisReply* reply, std::string& retval);
-    int get_reply_vector(const redisReply* reply, std::vector<std::string>& retval);
-    int get_reply_double(const redisReply* reply, double& retval);
-    int cmp_reply_string(const redisReply* reply, const std::string& val);
-
-    CSmartPtr<redisContext, redisFree> ctx_;
-    std::string error_str_;
-};
+#include "rcli_impl.h"
+#include "rcli_pipeline.h"
+#include "rcli_scan.h"
+#include "rcli_transaction.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <hiredis/sockcompat.h>
+
+// scratch command buffers larger than this are not kept between calls
+#define RCLI_CMD_BUF_KEEP (64 * 1024)
+
+namespace {
+
+struct timeval to_timeval(int64_t us) {
+    struct timeval tv;
+    tv.tv_sec = (long) (us / 1000000);
+    tv.tv_usec = (long) (us % 1000000);
+    return tv;
+}
+
+}  // namespace
 
-bool RedisClientImpl::connect(const std::string& host, uint32_t port) {
+bool RedisClientImpl::connect(const std::string& host, uint32_t port, const RedisClient::options_t& opts) {
     if (ctx_) {
         return true;
     }
+    opts_ = opts;
+    host_ = host;
+    peer_ = opts.unix_path.empty() ? host + ":" + std::to_string(port) : opts.unix_path;
     redisOptions redis_opts = {0};
-    REDIS_OPTIONS_SET_TCP(&redis_opts, host.c_str(), port);
+    struct timeval connect_timeout;
+    set_endpoint(redis_opts, host_, port, opts_, connect_timeout);
+    command_timeout_us_ = (int64_t) opts.command_timeout_ms * 1000;
     ctx_.reset(redisConnectWithOptions(&redis_opts));
-    struct timeval timeout_val;
-    timeout_val.tv_sec = 30;
-    timeout_val.tv_usec = 0;
-    redisSetTimeout(ctx_.get(), timeout_val);
-    redisEnableKeepAlive(ctx_.get());
     if (ctx_ == nullptr) {
         error_str_ = "Redis Context nullptr!";
         return false;
-    } else if (ctx_->err) {
+    }
+    // kept by the context for reconnects
+    struct timeval command_timeout = to_timeval(command_timeout_us_);
+    redisSetTimeout(ctx_.get(), command_timeout);
+    socket_timeout_us_ = command_timeout_us_;
+    if (ctx_->err == 0 && !start_tls()) {
+        return false;
+    }
+    wrap_io();
+    if (ctx_->err) {
         error_str_.assign(ctx_->errstr);
         return false;
     }
+    connects_++;
+    return tune_socket();
+}
+
+void RedisClientImpl::set_endpoint(redisOptions& redis_opts, const std::string& host, uint32_t port,
+                                   const RedisClient::options_t& opts, struct timeval& connect_timeout) {
+    if (opts.unix_path.empty()) {
+        REDIS_OPTIONS_SET_TCP(&redis_opts, host.c_str(), port);
+        if (!opts.source_addr.empty()) {
+            redis_opts.endpoint.tcp.source_addr = opts.source_addr.c_str();
+        }
+    } else {
+        REDIS_OPTIONS_SET_UNIX(&redis_opts, opts.unix_path.c_str());
+    }
+    connect_timeout = to_timeval((int64_t) opts.connect_timeout_ms * 1000);
+    if (opts.connect_timeout_ms > 0) {
+        redis_opts.connect_timeout = &connect_timeout;
+    }
+}
+
+redisContext* RedisClientImpl::open(const std::string& host, uint32_t port, const RedisClient::options_t& opts,
+                                    std::string& error) {
+    redisOptions redis_opts = {0};
+    struct timeval connect_timeout;
+    set_endpoint(redis_opts, host, port, opts, connect_timeout);
+    CSmartPtr<redisContext, redisFree> ctx(redisConnectWithOptions(&redis_opts));
+    if (ctx == nullptr) {
+        error = "Redis Context nullptr!";
+        return nullptr;
+    } else if (ctx->err) {
+        error.assign(ctx->errstr);
+        return nullptr;
+    }
+    redisSetTimeout(ctx.get(), to_timeval((int64_t) opts.command_timeout_ms * 1000));
+    std::string peer = opts.unix_path.empty() ? host + ":" + std::to_string(port) : opts.unix_path;
+    if (opts.tls && !opts.tls->handshake(ctx.get(), host, peer, error)) {
+        return nullptr;
+    }
+    if (!tune_socket(ctx.get(), opts, error)) {
+        return nullptr;
+    }
+    return ctx.release();
+}
+
+bool RedisClientImpl::start_tls() {
+    if (opts_.tls == nullptr) {
+        return true;
+    }
+    std::string error;
+    if (!opts_.tls->handshake(ctx_.get(), host_, peer_, error)) {
+        error_str_ = error;
+        return false;
+    }
     return true;
 }
 
 bool RedisClientImpl::reconnect() {
     if (ctx_ == nullptr) {
         return false;
-    } else {
-        int ret = redisReconnect(ctx_.get());
-        return ret == REDIS_OK;
     }
+    // a new connection starts without tracking or unread replies
+    drop_tracking();
+    unread_token_ = 0;
+    if (redisReconnect(ctx_.get()) != REDIS_OK) {
+        error_str_.assign(ctx_->errstr);
+        return false;
+    }
+    if (!start_tls()) {
+        return false;
+    }
+    wrap_io();
+    connects_++;
+    return tune_socket();
+}
+
+void RedisClientImpl::drop_tracking() {
+    if (cache_ && tracking_reader_ != 0) {
+        cache_->drop_reader(tracking_reader_);
+    }
+    tracking_id_ = 0;
+    tracking_reader_ = 0;
+}
+
+bool RedisClientImpl::tune_socket() { return tune_socket(ctx_.get(), opts_, error_str_); }
+
+bool RedisClientImpl::tune_socket(redisContext* ctx, const RedisClient::options_t& opts, std::string& error) {
+    const char* failed = nullptr;
+    if (opts.sndbuf > 0 && setsockopt(ctx->fd, SOL_SOCKET, SO_SNDBUF, (const char*) &opts.sndbuf, sizeof(int)) != 0) {
+        failed = "setsockopt(SO_SNDBUF)";
+    } else if (opts.rcvbuf > 0
+               && setsockopt(ctx->fd, SOL_SOCKET, SO_RCVBUF, (const char*) &opts.rcvbuf, sizeof(int)) != 0) {
+        failed = "setsockopt(SO_RCVBUF)";
+    }
+    if (failed) {
+        error = std::string(failed) + ": " + strerror(errno);
+        return false;
+    }
+    if (ctx->connection_type != REDIS_CONN_TCP) {
+        return true;
+    }
+    // hiredis turns TCP_NODELAY on for every TCP connection
+    int off = 0;
+    if (!opts.tcp_nodelay && setsockopt(ctx->fd, IPPROTO_TCP, TCP_NODELAY, (const char*) &off, sizeof(off)) != 0) {
+        error = std::string("setsockopt(TCP_NODELAY): ") + strerror(errno);
+        return false;
+    }
+    if (opts.keepalive_interval_s > 0
+        && redisEnableKeepAliveWithInterval(ctx, (int) opts.keepalive_interval_s) != REDIS_OK) {
+        error.assign(ctx->errstr);
+        return false;
+    }
+    if (opts.tcp_user_timeout_ms > 0) {
+        redisSetTcpUserTimeout(ctx, opts.tcp_user_timeout_ms);
+    }
+    return true;
 }
 
 int RedisClientImpl::check_reply_type(const redisReply* reply) {
     error_str_.clear();
     if (NULL == reply) {
-        if (ctx_->err) {
+        if (ctx_ && ctx_->err) {
             error_str_.assign(ctx_->errstr);
-        } else {
-            error_str_ = "Redis reply is null!";
+            return ctx_->err == REDIS_ERR_TIMEOUT ? RCLI_TIMEOUT : RCLI_ERROR;
         }
+        error_str_ = "Redis reply is null!";
         return RCLI_ERROR;
     }
 
@@ -77,6 +185,12 @@ int RedisClientImpl::check_reply_type(const redisReply* reply) {
         case REDIS_REPLY_INTEGER: err = RCLI_RET_OK; break;
         case REDIS_REPLY_STATUS: err = RCLI_RET_OK; break;
         case REDIS_REPLY_DOUBLE: err = RCLI_RET_OK; break;
+        // RESP3
+        case REDIS_REPLY_MAP: err = RCLI_RET_OK; break;
+        case REDIS_REPLY_SET: err = RCLI_RET_OK; break;
+        case REDIS_REPLY_BOOL: err = RCLI_RET_OK; break;
+        case REDIS_REPLY_BIGNUM: err = RCLI_RET_OK; break;
+        case REDIS_REPLY_VERB: err = RCLI_RET_OK; break;
         // error
         case REDIS_REPLY_NIL: {
             err = RCLI_RET_NIL;
@@ -88,6 +202,7 @@ int RedisClientImpl::check_reply_type(const redisReply* reply) {
             error_str_.assign(reply->str, reply->len);
             break;
         }
+        // a PUSH here was not consumed by the push callback
         default: err = RCLI_RET_UNKNOWN; break;
     }
     return err;
@@ -96,7 +211,7 @@ int RedisClientImpl::check_reply_type(const redisReply* reply) {
 int RedisClientImpl::get_reply_status(const redisReply* reply) {
     int ret = check_reply_type(reply);
     if (ret == RCLI_RET_OK) {
-        if (REDIS_REPLY_STATUS == reply->type) {
+        if (REDIS_REPLY_STATUS == reply->type || REDIS_REPLY_MAP == reply->type) {
             ret = RCLI_RET_OK;
         } else if (REDIS_REPLY_STRING == reply->type) {
             ret = reply->str && reply->len >= 2 && strcasecmp(reply->str, "OK") == 0 ? RCLI_RET_OK : RCLI_RET_FAIL;
@@ -110,7 +225,12 @@ int RedisClientImpl::get_reply_status(const redisReply* reply) {
 int RedisClientImpl::get_reply_integer(const redisReply* reply, int64_t& retval) {
     int err = check_reply_type(reply);
     if (err == RCLI_RET_OK) {
-        retval = reply->integer;
+        switch (reply->type) {
+            case REDIS_REPLY_DOUBLE: retval = (int64_t) reply->dval; break;
+            case REDIS_REPLY_STRING:
+            case REDIS_REPLY_BIGNUM: retval = strtoll(reply->str, nullptr, 10); break;
+            default: retval = reply->integer; break;
+        }
     }
     return err;
 }
@@ -118,7 +238,8 @@ int RedisClientImpl::get_reply_integer(const redisReply* reply, int64_t& retval)
 int RedisClientImpl::get_reply_string(const redisReply* reply, std::string& retval) {
     int err = check_reply_type(reply);
     if (err == RCLI_RET_OK) {
-        retval.assign(reply->str, reply->len);
+        retval.clear();
+        append_element(reply, retval);
     }
     return err;
 }
@@ -126,10 +247,9 @@ int RedisClientImpl::get_reply_string(const redisReply* reply, std::string& retv
 int RedisClientImpl::get_reply_vector(const redisReply* reply, std::vector<std::string>& retval) {
     int err = check_reply_type(reply);
     if (err == RCLI_RET_OK) {
-        retval.reserve(reply->elements);
+        retval.reserve(retval.size() + reply->elements);
         for (size_t i = 0; i < reply->elements; i++) {
-            std::string val(reply->element[i]->str, reply->element[i]->len);
-            retval.emplace_back(val);
+            append_flat(reply->element[i], retval);
         }
     }
     return err;
@@ -138,11 +258,93 @@ int RedisClientImpl::get_reply_vector(const redisReply* reply, std::vector<std::
 int RedisClientImpl::get_reply_double(const redisReply* reply, double& retval) {
     int err = check_reply_type(reply);
     if (err == RCLI_RET_OK) {
-        retval = reply->dval;
+        switch (reply->type) {
+            // RESP3 sends scores as doubles, already parsed by hiredis
+            case REDIS_REPLY_DOUBLE: retval = reply->dval; break;
+            case REDIS_REPLY_INTEGER:
+            case REDIS_REPLY_BOOL: retval = (double) reply->integer; break;
+            case REDIS_REPLY_STRING:
+            case REDIS_REPLY_STATUS:
+            case REDIS_REPLY_VERB:
+            case REDIS_REPLY_BIGNUM: retval = strtod(reply->str, nullptr); break;
+            // an aggregate has no str
+            default: {
+                err = RCLI_RET_UNKNOWN;
+                error_str_ = "Redis reply is not a number, type " + std::to_string(reply->type);
+                break;
+            }
+        }
     }
     return err;
 }
 
+int RedisClientImpl::get_reply_map(const redisReply* reply, std::unordered_map<std::string, std::string>& retval) {
+    int err = check_reply_type(reply);
+    if (err == RCLI_RET_OK) {
+        // a RESP3 map, or the flat key value array of RESP2, both have 2 * pairs elements
+        retval.reserve(retval.size() + reply->elements / 2);
+        std::string key;
+        for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+            key.clear();
+            append_element(reply->element[i], key);
+            std::string& val = retval[key];
+            val.clear();
+            append_element(reply->element[i + 1], val);
+        }
+    }
+    return err;
+}
+
+void RedisClientImpl::append_element(const redisReply* reply, std::string& out) {
+    switch (reply->type) {
+        case REDIS_REPLY_INTEGER:
+        case REDIS_REPLY_BOOL: out.append(std::to_string(reply->integer)); break;
+        case REDIS_REPLY_NIL:
+        case REDIS_REPLY_ARRAY:
+        case REDIS_REPLY_MAP:
+        case REDIS_REPLY_SET: break;
+        // string, status, error, double, bignum and verbatim, without its format prefix
+        default: out.append(reply->str, reply->len); break;
+    }
+}
+
+void RedisClientImpl::append_flat(const redisReply* reply, std::vector<std::string>& out) {
+    if (reply->type == REDIS_REPLY_ARRAY || reply->type == REDIS_REPLY_MAP || reply->type == REDIS_REPLY_SET) {
+        for (size_t i = 0; i < reply->elements; i++) {
+            append_flat(reply->element[i], out);
+        }
+    } else {
+        out.emplace_back();
+        append_element(reply, out.back());
+    }
+}
+
+int RedisClientImpl::get_reply_visitor(const redisReply* reply, RedisReplyVisitor& visitor) {
+    int err = check_reply_type(reply);
+    if (err == RCLI_RET_OK || err == RCLI_RET_NIL) {
+        visit_reply(reply, visitor, 0);
+    }
+    return err;
+}
+
+void RedisClientImpl::visit_reply(const redisReply* reply, RedisReplyVisitor& visitor, int depth) {
+    switch (reply->type) {
+        case REDIS_REPLY_ARRAY:
+        case REDIS_REPLY_SET:
+        case REDIS_REPLY_PUSH: visitor.on_array(depth, reply->elements); break;
+        case REDIS_REPLY_MAP: visitor.on_map(depth, reply->elements / 2); break;
+        case REDIS_REPLY_INTEGER:
+        case REDIS_REPLY_BOOL: visitor.on_integer(depth, reply->integer); return;
+        case REDIS_REPLY_DOUBLE: visitor.on_double(depth, reply->dval, reply->str, reply->len); return;
+        case REDIS_REPLY_NIL: visitor.on_nil(depth); return;
+        case REDIS_REPLY_ERROR: visitor.on_error(depth, reply->str, reply->len); return;
+        default: visitor.on_string(depth, reply->str, reply->len); return;
+    }
+    for (size_t i = 0; i < reply->elements; i++) {
+        visit_reply(reply->element[i], visitor, depth + 1);
+    }
+}
+
 int RedisClientImpl::cmp_reply_string(const redisReply* reply, const std::string& val) {
     int err = check_reply_type(reply);
     if (err == RCLI_RET_OK) {
@@ -153,19 +355,368 @@ int RedisClientImpl::cmp_reply_string(const redisReply* reply, const std::string
     return err;
 }
 
+int RedisClientImpl::read_reply(RedisReplyVisitor& visitor) {
+    redisContext* ctx = get_context();
+    if (ctx == nullptr) {
+        error_str_ = "Redis Context nullptr!";
+        return RCLI_ERROR;
+    }
+    void* reply = nullptr;
+    RedisReplySink sink(ctx, visitor);
+    redisGetReply(ctx, &reply);
+    if (!RedisReplySink::is_marker(reply)) {
+        // connection error, or a PUSH nobody consumed
+        CSmartPtr<void, freeReplyObject> reply_sp(reply);
+        return check_reply_type((redisReply*) reply);
+    }
+
+    int err = sink.status();
+    if (err == RCLI_RET_NIL) {
+        error_str_.assign("Redis reply nil");
+    } else if (err == RCLI_RET_ERROR) {
+        error_str_ = sink.error();
+    } else {
+        error_str_.clear();
+    }
+    return err;
+}
+
+bool RedisClientImpl::append_formatted(const std::string& cmd) {
+    drop_unread();
+    redisContext* ctx = get_context();
+    return ctx && redisAppendFormattedCommand(ctx, cmd.data(), cmd.size()) == REDIS_OK;
+}
+
+void RedisClientImpl::drop_unread() {
+    redisContext* ctx = get_context();
+    if (unread_token_ == 0 || ctx == nullptr) {
+        return;
+    }
+    unread_token_ = 0;
+    void* reply = nullptr;
+    // a failed read leaves ctx->err set for the command that follows
+    if (ctx->err == 0 && redisGetReply(ctx, &reply) == REDIS_OK) {
+        freeReplyObject(reply);
+    }
+}
+
+void* RedisClientImpl::formatted_command(std::string& cmd) {
+    void* reply = nullptr;
+    bool appended = append_formatted(cmd);
+    if (cmd.capacity() > RCLI_CMD_BUF_KEEP) {
+        std::string().swap(cmd);
+    }
+    if (appended) {
+        redisGetReply(get_context(), &reply);
+    }
+    return reply;
+}
+
+namespace {
+
+ssize_t wrapped_read(redisContext* ctx, char* buf, size_t len) {
+    RedisClientImpl* cli = (RedisClientImpl*) ctx->privdata;
+    if (!cli->apply_deadline(ctx)) {
+        return -1;
+    }
+    ssize_t n = cli->orig_funcs_->read(ctx, buf, len);
+    if (n > 0) {
+        cli->bytes_read_ += (uint64_t) n;
+    } else if (n < 0) {
+        cli->check_timeout(ctx, errno);
+    }
+    return n;
+}
+
+ssize_t wrapped_write(redisContext* ctx) {
+    RedisClientImpl* cli = (RedisClientImpl*) ctx->privdata;
+    if (!cli->apply_deadline(ctx)) {
+        return -1;
+    }
+    ssize_t n = cli->orig_funcs_->write(ctx);
+    if (n > 0) {
+        cli->bytes_written_ += (uint64_t) n;
+    } else if (n < 0) {
+        cli->check_timeout(ctx, errno);
+    }
+    return n;
+}
+
+void set_timeout_error(redisContext* ctx, const char* errstr) {
+    ctx->err = REDIS_ERR_TIMEOUT;
+    snprintf(ctx->errstr, sizeof(ctx->errstr), "%s", errstr);
+}
+
+}  // namespace
+
+void RedisClientImpl::wrap_io() {
+    redisContext* ctx = get_context();
+    if (ctx == nullptr || ctx->funcs == &io_funcs_) {
+        return;
+    }
+    orig_funcs_ = ctx->funcs;
+    io_funcs_ = *orig_funcs_;
+    io_funcs_.read = wrapped_read;
+    io_funcs_.write = wrapped_write;
+    ctx->privdata = this;
+    ctx->funcs = &io_funcs_;
+}
+
+bool RedisClientImpl::apply_deadline(redisContext* ctx) {
+    int64_t timeout_us = command_timeout_us_;
+    if (deadline_us_ > 0) {
+        int64_t left_us = deadline_us_ - RedisCallRecorder::now_us();
+        if (left_us <= 0) {
+            set_timeout_error(ctx, "deadline exceeded");
+            return false;
+        }
+        timeout_us = timeout_us > 0 ? std::min(timeout_us, left_us) : left_us;
+    }
+    // only costs a syscall while a deadline is set or was just cleared
+    if (timeout_us != socket_timeout_us_) {
+        redisSetTimeout(ctx, to_timeval(timeout_us));
+        socket_timeout_us_ = timeout_us;
+    }
+    return true;
+}
+
+void RedisClientImpl::check_timeout(redisContext* ctx, int err) {
+    if (ctx->err == REDIS_ERR_IO && (err == EAGAIN || err == EWOULDBLOCK || err == ETIMEDOUT)) {
+        set_timeout_error(ctx, deadline_us_ > 0 ? "deadline exceeded" : "command timeout");
+    }
+}
+
+RedisCallRecorder::RedisCallRecorder(RedisClientImpl* cli, const RedisStringView& verb) : cli_(cli) {
+    if (cli->stats_) {
+        verb_len_ = std::min(verb.size(), sizeof(verb_));
+        memcpy(verb_, verb.data(), verb_len_);
+        start_ = std::chrono::steady_clock::now();
+        bytes_read_ = cli->bytes_read_;
+        bytes_written_ = cli->bytes_written_;
+    }
+}
+
+RedisStringView RedisCallRecorder::resp_verb(const std::string& cmd) {
+    // *<argc>\r\n$<len>\r\n<verb>\r\n
+    size_t pos = cmd.find("\r\n");
+    if (cmd.empty() || cmd[0] != '*' || pos == std::string::npos || pos + 2 >= cmd.size() || cmd[pos + 2] != '$') {
+        return RedisStringView();
+    }
+    size_t len = strtoul(cmd.c_str() + pos + 3, nullptr, 10);
+    size_t start = cmd.find("\r\n", pos + 2);
+    if (start == std::string::npos) {
+        return RedisStringView();
+    }
+    start += 2;
+    return RedisStringView(cmd.data() + start, std::min(len, cmd.size() - start));
+}
+
+RedisStringView RedisCallRecorder::format_verb(const char* format) {
+    const char* end = format;
+    while (*end && *end != ' ') {
+        end++;
+    }
+    return RedisStringView(format, end - format);
+}
+
+int RedisCallRecorder::done(int err) {
+    cli_->status_ = err;
+    if (cli_->stats_) {
+        uint64_t us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start_)
+                        .count();
+        bool error = err == RCLI_RET_ERROR || err == RCLI_RET_UNKNOWN || err == RCLI_ERROR || err == RCLI_TIMEOUT;
+        cli_->stats_->record(RedisStringView(verb_, verb_len_), us, error, cli_->bytes_written_ - bytes_written_,
+                             cli_->bytes_read_ - bytes_read_);
+    }
+    return err;
+}
+
+namespace {
+
+// stands in for every element built by a RedisReplySink
+redisReply g_sink_marker;
+
+int task_depth(const redisReadTask* task, const redisReadTask*& root) {
+    int depth = 0;
+    while (task->parent) {
+        task = task->parent;
+        depth++;
+    }
+    root = task;
+    return depth;
+}
+
+}  // namespace
+
+redisReplyObjectFunctions RedisReplySink::functions_ = {
+  RedisReplySink::create_string, RedisReplySink::create_array, RedisReplySink::create_integer,
+  RedisReplySink::create_double, RedisReplySink::create_nil,   RedisReplySink::create_bool,
+  RedisReplySink::free_object,
+};
+
+RedisReplySink::RedisReplySink(redisContext* ctx, RedisReplyVisitor& visitor) : visitor_(visitor) {
+    if (ctx && ctx->reader) {
+        reader_ = ctx->reader;
+        orig_fn_ = reader_->fn;
+        orig_privdata_ = reader_->privdata;
+        reader_->fn = &functions_;
+        reader_->privdata = this;
+        // the tasks of a reply split over two non-blocking reads still point at
+        // the sink that began it
+        for (int i = 0; i <= reader_->ridx; i++) {
+            reader_->task[i]->privdata = this;
+        }
+    }
+}
+
+RedisReplySink::~RedisReplySink() {
+    if (reader_) {
+        reader_->fn = orig_fn_;
+        reader_->privdata = orig_privdata_;
+    }
+}
+
+bool RedisReplySink::is_marker(const void* reply) { return reply == &g_sink_marker; }
+
+int RedisReplySink::status() const {
+    switch (root_type_) {
+        case 0:
+        case REDIS_REPLY_STRING:
+        case REDIS_REPLY_ARRAY:
+        case REDIS_REPLY_INTEGER:
+        case REDIS_REPLY_STATUS:
+        case REDIS_REPLY_DOUBLE:
+        case REDIS_REPLY_MAP:
+        case REDIS_REPLY_SET:
+        case REDIS_REPLY_BOOL:
+        case REDIS_REPLY_VERB:
+        case REDIS_REPLY_BIGNUM: return RCLI_RET_OK;
+        // error
+        case REDIS_REPLY_NIL: return RCLI_RET_NIL;
+        case REDIS_REPLY_ERROR: return RCLI_RET_ERROR;
+        default: return RCLI_RET_UNKNOWN;
+    }
+}
+
+bool RedisReplySink::enter(const redisReadTask* task, int& depth) {
+    const redisReadTask* root = nullptr;
+    depth = task_depth(task, root);
+    if (root->type == REDIS_REPLY_PUSH && orig_fn_) {
+        return false;
+    }
+    if (depth == 0) {
+        root_type_ = task->type;
+    }
+    return true;
+}
+
+void* RedisReplySink::create_string(const redisReadTask* task, char* str, size_t len) {
+    RedisReplySink* sink = (RedisReplySink*) task->privdata;
+    int depth = 0;
+    if (!sink->enter(task, depth)) {
+        return sink->orig_fn_->createString(task, str, len);
+    }
+    if (task->type == REDIS_REPLY_ERROR) {
+        if (depth == 0) {
+            sink->error_.assign(str, len);
+        } else {
+            sink->visitor_.on_error(depth, str, len);
+        }
+    } else if (task->type == REDIS_REPLY_VERB && len >= 4) {
+        // skip the "txt:" format prefix
+        sink->visitor_.on_string(depth, str + 4, len - 4);
+    } else {
+        sink->visitor_.on_string(depth, str, len);
+    }
+    return &g_sink_marker;
+}
+
+void* RedisReplySink::create_array(const redisReadTask* task, size_t elements) {
+    RedisReplySink* sink = (RedisReplySink*) task->privdata;
+    int depth = 0;
+    if (!sink->enter(task, depth)) {
+        return sink->orig_fn_->createArray(task, elements);
+    }
+    if (task->type == REDIS_REPLY_MAP) {
+        // hiredis counts keys and values
+        sink->visitor_.on_map(depth, elements / 2);
+    } else {
+        sink->visitor_.on_array(depth, elements);
+    }
+    return &g_sink_marker;
+}
+
+void* RedisReplySink::create_integer(const redisReadTask* task, long long value) {
+    RedisReplySink* sink = (RedisReplySink*) task->privdata;
+    int depth = 0;
+    if (!sink->enter(task, depth)) {
+        return sink->orig_fn_->createInteger(task, value);
+    }
+    sink->visitor_.on_integer(depth, value);
+    return &g_sink_marker;
+}
+
+void* RedisReplySink::create_double(const redisReadTask* task, double value, char* str, size_t len) {
+    RedisReplySink* sink = (RedisReplySink*) task->privdata;
+    int depth = 0;
+    if (!sink->enter(task, depth)) {
+        return sink->orig_fn_->createDouble(task, value, str, len);
+    }
+    sink->visitor_.on_double(depth, value, str, len);
+    return &g_sink_marker;
+}
+
+void* RedisReplySink::create_nil(const redisReadTask* task) {
+    RedisReplySink* sink = (RedisReplySink*) task->privdata;
+    int depth = 0;
+    if (!sink->enter(task, depth)) {
+        return sink->orig_fn_->createNil(task);
+    }
+    if (depth == 0) {
+        // the RESP2 null array *-1 arrives as a nil task of array type
+        sink->root_type_ = REDIS_REPLY_NIL;
+    }
+    sink->visitor_.on_nil(depth);
+    return &g_sink_marker;
+}
+
+void* RedisReplySink::create_bool(const redisReadTask* task, int bval) {
+    RedisReplySink* sink = (RedisReplySink*) task->privdata;
+    int depth = 0;
+    if (!sink->enter(task, depth)) {
+        return sink->orig_fn_->createBool(task, bval);
+    }
+    sink->visitor_.on_integer(depth, bval ? 1 : 0);
+    return &g_sink_marker;
+}
+
+void RedisReplySink::free_object(void* reply) {
+    if (!is_marker(reply)) {
+        freeReplyObject(reply);
+    }
+}
+
 RedisClient::RedisClient() { impl_ = new RedisClientImpl; }
 
 RedisClient::~RedisClient() {
     if (impl_) {
         RedisClientImpl* cli = (RedisClientImpl*) impl_;
+        // the server forgets the tracking with the connection
+        cli->drop_tracking();
         delete cli;
     }
 }
 
 void RedisClient::init(const std::string& host, uint32_t port, const std::string& pwd) {
+    init(host, port, pwd, options_t());
+}
+
+void RedisClient::init(const std::string& host, uint32_t port, const std::string& pwd, const options_t& opts) {
     host_ = host;
     port_ = port;
     pwd_ = pwd;
+    opts_ = opts;
 }
 
 const std::string& RedisClient::get_last_error() {
@@ -173,19 +724,400 @@ const std::string& RedisClient::get_last_error() {
     return cli->error_str_;
 }
 
+int RedisClient::get_last_status() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    return cli->status_;
+}
+
+int RedisClient::get_protocol() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    return cli->protocol_;
+}
+
+void RedisClient::set_deadline(uint32_t timeout_ms) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    cli->deadline_us_ = RedisCallRecorder::now_us() + (int64_t) timeout_ms * 1000;
+}
+
+void RedisClient::clear_deadline() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    cli->deadline_us_ = 0;
+}
+
 bool RedisClient::connect() {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
-    if (cli->connect(host_, port_)) {
-        return auth();
+    if (cli->connect(host_, port_, opts_)) {
+        return handshake();
     } else {
         return false;
     }
 }
 
+RedisPipeline RedisClient::pipeline() { return RedisPipeline(this); }
+
+RedisTransaction RedisClient::transaction() { return RedisTransaction(this); }
+
+RedisScanner RedisClient::scan() { return RedisScanner(this, "SCAN", std::string()); }
+
+RedisScanner RedisClient::hscan(const std::string& key) { return RedisScanner(this, "HSCAN", key); }
+
+RedisScanner RedisClient::sscan(const std::string& key) { return RedisScanner(this, "SSCAN", key); }
+
+RedisScanner RedisClient::zscan(const std::string& key) { return RedisScanner(this, "ZSCAN", key); }
+
+void RedisClient::set_stats(RedisStats* stats) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    cli->stats_ = stats;
+}
+
+RedisStats* RedisClient::get_stats() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    return cli->stats_;
+}
+
+void RedisClient::set_health(RedisHealthMonitor* monitor) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    cli->health_ = monitor;
+}
+
+RedisHealthMonitor* RedisClient::get_health() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    return cli->health_;
+}
+
+void RedisClient::set_cache(RedisNearCache* cache) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    cli->drop_tracking();
+    cli->cache_ = cache;
+}
+
+RedisNearCache* RedisClient::get_cache() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    return cli->cache_;
+}
+
+void RedisClient::set_scripts(RedisScriptRegistry* registry) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    cli->scripts_ = registry;
+}
+
+RedisScriptRegistry* RedisClient::get_scripts() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    return cli->scripts_;
+}
+
+bool RedisClient::check_alive() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    if (cli->health_ && !cli->health_->is_up()) {
+        cli->error_str_ = "Redis node is down: " + cli->health_->get_last_error();
+        cli->status_ = RCLI_ERROR;
+        return false;
+    }
+    redisContext* ctx = cli->get_context();
+    if (ctx == nullptr) {
+        cli->error_str_ = "Redis Context nullptr!";
+        cli->status_ = RCLI_ERROR;
+        return false;
+    }
+    // broken by an earlier command, e.g. while the node was down
+    return ctx->err == 0 || recover();
+}
+
+bool RedisClient::recover() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    if (cli->health_) {
+        cli->health_->report_failure();
+    }
+    if (!cli->reconnect()) {
+        cli->status_ = RCLI_ERROR;
+        if (cli->health_) {
+            cli->health_->mark_down(cli->error_str_);
+        }
+        return false;
+    }
+    // a failed AUTH, e.g. past the deadline, says nothing about the node
+    return handshake();
+}
+
+int RedisClient::cached_for_string(std::string& retval, const char* verb, const std::string& key,
+                                   const std::string* field) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisNearCache* cache = cli->cache_;
+    if (cache == nullptr) {
+        return field ? commanda_for_string(retval, verb, key, *field) : commanda_for_string(retval, verb, key);
+    }
+    std::string sub(verb);
+    if (field) {
+        sub.push_back(' ');
+        sub.append(*field);
+    }
+    int err = RCLI_RET_OK;
+    if (cache->lookup(key, sub, retval, err)) {
+        cli->status_ = err;
+        cli->error_str_ = err == RCLI_RET_NIL ? "Redis reply nil" : "";
+        return err;
+    }
+
+    // the server only reports changes of keys this connection read after CLIENT TRACKING
+    uint64_t id = cache->client_id();
+    if (id != 0 && !cache->is_bcast() && cli->tracking_id_ != id) {
+        if (commandv_for_status(cache->tracking_command(id)) == RCLI_RET_OK) {
+            cli->tracking_id_ = id;
+            cli->tracking_reader_ = cache->new_reader();
+        } else {
+            id = 0;
+        }
+    }
+    uint64_t token = cache->reserve(key, sub, id, cli->tracking_reader_);
+    err = field ? commanda_for_string(retval, verb, key, *field) : commanda_for_string(retval, verb, key);
+    if (err == RCLI_RET_OK || err == RCLI_RET_NIL) {
+        cache->store(token, key, sub, retval, err);
+    } else {
+        cache->release(token, key, sub);
+    }
+    return err;
+}
+
+void RedisClient::drop_cached(const std::string& key) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    if (cli->cache_) {
+        cli->cache_->invalidate(key);
+    }
+}
+
+namespace {
+
+// the elements of one MGET, stored from out[begin] on
+class RedisMgetVisitor : public RedisReplyVisitor {
+public:
+    RedisMgetVisitor(std::vector<std::string>& out, std::vector<bool>& found, size_t begin)
+      : out_(out), found_(found), next_(begin) {}
+
+    void on_string(int depth, const char* str, size_t len) override {
+        if (depth == 1 && next_ < out_.size()) {
+            out_[next_].assign(str, len);
+            found_[next_++] = true;
+        }
+    }
+    void on_integer(int depth, int64_t val) override {
+        std::string str = std::to_string(val);
+        on_string(depth, str.data(), str.size());
+    }
+    void on_nil(int depth) override {
+        if (depth == 1) {
+            next_++;
+        }
+    }
+
+private:
+    std::vector<std::string>& out_;
+    std::vector<bool>& found_;
+    size_t next_;
+};
+
+// the integer reply of DEL or EXISTS
+class RedisCountVisitor : public RedisReplyVisitor {
+public:
+    void on_integer(int depth, int64_t val) override {
+        if (depth == 0) {
+            count = val;
+        }
+    }
+
+    int64_t count = 0;
+};
+
+}  // namespace
+
+int RedisClient::multi_key(const char* verb, size_t count, size_t chunk,
+                           const std::function<void(RedisCommandEncoder& enc, size_t begin, size_t end)>& encode,
+                           const std::function<int(size_t begin, size_t end)>& read) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    if (count == 0) {
+        return RCLI_RET_OK;
+    }
+    RedisCallRecorder rec(cli, verb);
+    chunk = std::max<size_t>(chunk, 1);
+    RedisCommandEncoder enc = encoder();
+    for (size_t begin = 0; begin < count; begin += chunk) {
+        encode(enc, begin, std::min(count, begin + chunk));
+    }
+    bool appended = cli->append_formatted(cmd_buf_);
+    if (cmd_buf_.capacity() > RCLI_CMD_BUF_KEEP) {
+        std::string().swap(cmd_buf_);
+    }
+    if (!appended) {
+        return rec.done(cli->check_reply_type(nullptr));
+    }
+
+    // every reply is read to keep the connection in step, the first error is kept
+    int first = RCLI_RET_OK;
+    std::string first_error;
+    for (size_t begin = 0; begin < count; begin += chunk) {
+        int err = read(begin, std::min(count, begin + chunk));
+        if (err == RCLI_ERROR || err == RCLI_TIMEOUT) {
+            return rec.done(err);
+        }
+        if (err != RCLI_RET_OK && first == RCLI_RET_OK) {
+            first = err;
+            first_error = cli->error_str_;
+        }
+    }
+    cli->error_str_ = first_error;
+    return rec.done(first);
+}
+
+bool RedisClient::mget(const std::vector<std::string>& keys, std::vector<std::string>& out, size_t chunk) {
+    std::vector<bool> found;
+    return mget(keys, out, found, chunk);
+}
+
+bool RedisClient::mget(const std::vector<std::string>& keys, std::vector<std::string>& out, std::vector<bool>& found,
+                       size_t chunk) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    int err = RCLI_ERROR;
+    BEGIN_CHECK_ALIVE();
+    out.assign(keys.size(), std::string());
+    found.assign(keys.size(), false);
+    err = multi_key(
+      "MGET", keys.size(), chunk,
+      [&](RedisCommandEncoder& enc, size_t begin, size_t end) {
+          enc.begin(1 + end - begin);
+          enc.arg("MGET");
+          for (size_t i = begin; i < end; i++) {
+              enc.arg(keys[i]);
+          }
+      },
+      [&](size_t begin, size_t /*end*/) {
+          RedisMgetVisitor visitor(out, found, begin);
+          return cli->read_reply(visitor);
+      });
+    END_CHECK_ALIVE();
+    return err == RCLI_RET_OK;
+}
+
+bool RedisClient::mset(const std::vector<key_value_t>& in, size_t chunk) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    int err = RCLI_ERROR;
+    BEGIN_CHECK_ALIVE();
+    err = multi_key(
+      "MSET", in.size(), chunk,
+      [&](RedisCommandEncoder& enc, size_t begin, size_t end) {
+          enc.begin(1 + (end - begin) * 2);
+          enc.arg("MSET");
+          for (size_t i = begin; i < end; i++) {
+              enc.arg(in[i].first);
+              enc.arg(in[i].second);
+          }
+      },
+      [&](size_t /*begin*/, size_t /*end*/) {
+          RedisReplyVisitor visitor;
+          return cli->read_reply(visitor);
+      });
+    END_CHECK_ALIVE();
+    for (auto& kv : in) {
+        drop_cached(kv.first);
+    }
+    return err == RCLI_RET_OK;
+}
+
+bool RedisClient::del(const std::vector<std::string>& keys, int64_t& out, size_t chunk) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    int err = RCLI_ERROR;
+    BEGIN_CHECK_ALIVE();
+    out = 0;
+    err = multi_key(
+      "DEL", keys.size(), chunk,
+      [&](RedisCommandEncoder& enc, size_t begin, size_t end) {
+          enc.begin(1 + end - begin);
+          enc.arg("DEL");
+          for (size_t i = begin; i < end; i++) {
+              enc.arg(keys[i]);
+          }
+      },
+      [&](size_t /*begin*/, size_t /*end*/) {
+          RedisCountVisitor visitor;
+          int err = cli->read_reply(visitor);
+          out += visitor.count;
+          return err;
+      });
+    END_CHECK_ALIVE();
+    for (auto& key : keys) {
+        drop_cached(key);
+    }
+    return err == RCLI_RET_OK;
+}
+
+bool RedisClient::exist(const std::vector<std::string>& keys, std::vector<bool>& out) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    int err = RCLI_ERROR;
+    BEGIN_CHECK_ALIVE();
+    out.assign(keys.size(), false);
+    err = multi_key(
+      "EXISTS", keys.size(), 1,
+      [&](RedisCommandEncoder& enc, size_t begin, size_t /*end*/) { enc.command("EXISTS", keys[begin]); },
+      [&](size_t begin, size_t /*end*/) {
+          RedisCountVisitor visitor;
+          int err = cli->read_reply(visitor);
+          out[begin] = visitor.count > 0;
+          return err;
+      });
+    END_CHECK_ALIVE();
+    return err == RCLI_RET_OK;
+}
+
+int RedisClient::formatted_for_status() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::resp_verb(cmd_buf_));
+    CSmartPtr<void, freeReplyObject> reply_sp(cli->formatted_command(cmd_buf_));
+    return rec.done(cli->get_reply_status((redisReply*) reply_sp.get()));
+}
+
+int RedisClient::formatted_for_integer(int64_t& retval) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::resp_verb(cmd_buf_));
+    CSmartPtr<void, freeReplyObject> reply_sp(cli->formatted_command(cmd_buf_));
+    return rec.done(cli->get_reply_integer((redisReply*) reply_sp.get(), retval));
+}
+
+int RedisClient::formatted_for_double(double& retval) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::resp_verb(cmd_buf_));
+    CSmartPtr<void, freeReplyObject> reply_sp(cli->formatted_command(cmd_buf_));
+    return rec.done(cli->get_reply_double((redisReply*) reply_sp.get(), retval));
+}
+
+int RedisClient::formatted_for_string(std::string& retval) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::resp_verb(cmd_buf_));
+    CSmartPtr<void, freeReplyObject> reply_sp(cli->formatted_command(cmd_buf_));
+    return rec.done(cli->get_reply_string((redisReply*) reply_sp.get(), retval));
+}
+
+int RedisClient::formatted_for_vector(std::vector<std::string>& retval) {
+    RedisVectorVisitor visitor(retval);
+    return formatted_for_visitor(visitor);
+}
+
+int RedisClient::formatted_for_map(std::unordered_map<std::string, std::string>& retval) {
+    RedisMapVisitor visitor(retval);
+    return formatted_for_visitor(visitor);
+}
+
+int RedisClient::formatted_for_visitor(RedisReplyVisitor& visitor) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::resp_verb(cmd_buf_));
+    bool appended = cli->append_formatted(cmd_buf_);
+    if (cmd_buf_.capacity() > RCLI_CMD_BUF_KEEP) {
+        std::string().swap(cmd_buf_);
+    }
+    return rec.done(appended ? cli->read_reply(visitor) : cli->check_reply_type(nullptr));
+}
+
 bool RedisClient::reconnect() {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
     if (cli->reconnect()) {
-        return auth();
+        return handshake();
     } else {
         return false;
     }
@@ -193,117 +1125,224 @@ bool RedisClient::reconnect() {
 
 int RedisClient::command_for_status(const char* cmd, ...) {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::format_verb(cmd));
+    cli->drop_unread();
     va_list args;
     va_start(args, cmd);
     CSmartPtr<void, freeReplyObject> reply_sp(redisvCommand(cli->get_context(), cmd, args));
     va_end(args);
-    return cli->get_reply_status((redisReply*) reply_sp.get());
+    return rec.done(cli->get_reply_status((redisReply*) reply_sp.get()));
 }
 
 int RedisClient::command_for_integer(int64_t& retval, const char* cmd, ...) {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::format_verb(cmd));
+    cli->drop_unread();
     va_list args;
     va_start(args, cmd);
     CSmartPtr<void, freeReplyObject> reply_sp(redisvCommand(cli->get_context(), cmd, args));
     va_end(args);
-    return cli->get_reply_integer((redisReply*) reply_sp.get(), retval);
+    return rec.done(cli->get_reply_integer((redisReply*) reply_sp.get(), retval));
 }
 
 int RedisClient::command_for_double(double& retval, const char* cmd, ...) {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::format_verb(cmd));
+    cli->drop_unread();
     va_list args;
     va_start(args, cmd);
     CSmartPtr<void, freeReplyObject> reply_sp(redisvCommand(cli->get_context(), cmd, args));
     va_end(args);
-    return cli->get_reply_double((redisReply*) reply_sp.get(), retval);
+    return rec.done(cli->get_reply_double((redisReply*) reply_sp.get(), retval));
 }
 
 int RedisClient::command_for_string(std::string& retval, const char* cmd, ...) {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::format_verb(cmd));
+    cli->drop_unread();
     va_list args;
     va_start(args, cmd);
     CSmartPtr<void, freeReplyObject> reply_sp(redisvCommand(cli->get_context(), cmd, args));
     va_end(args);
-    return cli->get_reply_string((redisReply*) reply_sp.get(), retval);
+    return rec.done(cli->get_reply_string((redisReply*) reply_sp.get(), retval));
 }
 
 int RedisClient::command_for_vector(std::vector<std::string>& retval, const char* cmd, ...) {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    RedisCallRecorder rec(cli, RedisCallRecorder::format_verb(cmd));
+    cli->drop_unread();
     va_list args;
     va_start(args, cmd);
-    CSmartPtr<void, freeReplyObject> reply_sp(redisvCommand(cli->get_context(), cmd, args));
+    int ret = cli->get_context() ? redisvAppendCommand(cli->get_context(), cmd, args) : REDIS_ERR;
     va_end(args);
-    return cli->get_reply_vector((redisReply*) reply_sp.get(), retval);
+    RedisVectorVisitor visitor(retval);
+    return rec.done(ret == REDIS_OK ? cli->read_reply(visitor) : cli->check_reply_type(nullptr));
 }
 
-int RedisClient::commandv_for_status(const std::vector<std::string>& cmd) {
+int RedisClient::command_for_visitor(RedisReplyVisitor& visitor, const char* cmd, ...) {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
-    std::vector<const char*> argv(cmd.size());
-    std::vector<size_t> argvlen(cmd.size());
-    int n = 0;
-    for (auto it = cmd.begin(); it != cmd.end(); ++it, ++n) {
-        argv[n] = it->c_str();
-        argvlen[n] = it->size();
-    }
-    CSmartPtr<void, freeReplyObject> reply_sp(
-      redisCommandArgv(cli->get_context(), argv.size(), &(argv[0]), &(argvlen[0])));
-    return cli->get_reply_status((redisReply*) reply_sp.get());
+    RedisCallRecorder rec(cli, RedisCallRecorder::format_verb(cmd));
+    cli->drop_unread();
+    va_list args;
+    va_start(args, cmd);
+    int ret = cli->get_context() ? redisvAppendCommand(cli->get_context(), cmd, args) : REDIS_ERR;
+    va_end(args);
+    return rec.done(ret == REDIS_OK ? cli->read_reply(visitor) : cli->check_reply_type(nullptr));
+}
+
+int RedisClient::commandv_for_status(const std::vector<std::string>& cmd) {
+    encode_argv(cmd);
+    return formatted_for_status();
 }
 
 int RedisClient::commandv_for_integer(int64_t& retval, const std::vector<std::string>& cmd) {
-    RedisClientImpl* cli = (RedisClientImpl*) impl_;
-    std::vector<const char*> argv(cmd.size());
-    std::vector<size_t> argvlen(cmd.size());
-    int n = 0;
-    for (auto it = cmd.begin(); it != cmd.end(); ++it, ++n) {
-        argv[n] = it->c_str();
-        argvlen[n] = it->size();
-    }
-    CSmartPtr<void, freeReplyObject> reply_sp(
-      redisCommandArgv(cli->get_context(), argv.size(), &(argv[0]), &(argvlen[0])));
-    return cli->get_reply_integer((redisReply*) reply_sp.get(), retval);
+    encode_argv(cmd);
+    return formatted_for_integer(retval);
 }
 
 int RedisClient::commandv_for_string(std::string& retval, const std::vector<std::string>& cmd) {
-    RedisClientImpl* cli = (RedisClientImpl*) impl_;
-    std::vector<const char*> argv(cmd.size());
-    std::vector<size_t> argvlen(cmd.size());
-    int n = 0;
-    for (auto it = cmd.begin(); it != cmd.end(); ++it, ++n) {
-        argv[n] = it->c_str();
-        argvlen[n] = it->size();
-    }
-    CSmartPtr<void, freeReplyObject> reply_sp(
-      redisCommandArgv(cli->get_context(), argv.size(), &(argv[0]), &(argvlen[0])));
-    return cli->get_reply_string((redisReply*) reply_sp.get(), retval);
+    encode_argv(cmd);
+    return formatted_for_string(retval);
 }
 
 int RedisClient::commandv_for_vector(std::vector<std::string>& retval, const std::vector<std::string>& cmd) {
-    RedisClientImpl* cli = (RedisClientImpl*) impl_;
-    std::vector<const char*> argv(cmd.size());
-    std::vector<size_t> argvlen(cmd.size());
-    int n = 0;
-    for (auto it = cmd.begin(); it != cmd.end(); ++it, ++n) {
-        argv[n] = it->c_str();
-        argvlen[n] = it->size();
-    }
-    CSmartPtr<void, freeReplyObject> reply_sp(
-      redisCommandArgv(cli->get_context(), argv.size(), &(argv[0]), &(argvlen[0])));
-    return cli->get_reply_vector((redisReply*) reply_sp.get(), retval);
+    encode_argv(cmd);
+    return formatted_for_vector(retval);
+}
+
+int RedisClient::commandv_for_visitor(RedisReplyVisitor& visitor, const std::vector<std::string>& cmd) {
+    encode_argv(cmd);
+    return formatted_for_visitor(visitor);
+}
+
+int RedisClient::commandv_for_status(std::initializer_list<RedisStringView> cmd) {
+    encode_argv(cmd);
+    return formatted_for_status();
+}
+
+int RedisClient::commandv_for_integer(int64_t& retval, std::initializer_list<RedisStringView> cmd) {
+    encode_argv(cmd);
+    return formatted_for_integer(retval);
+}
+
+int RedisClient::commandv_for_string(std::string& retval, std::initializer_list<RedisStringView> cmd) {
+    encode_argv(cmd);
+    return formatted_for_string(retval);
+}
+
+int RedisClient::commandv_for_vector(std::vector<std::string>& retval, std::initializer_list<RedisStringView> cmd) {
+    encode_argv(cmd);
+    return formatted_for_vector(retval);
+}
+
+int RedisClient::commandv_for_visitor(RedisReplyVisitor& visitor, std::initializer_list<RedisStringView> cmd) {
+    encode_argv(cmd);
+    return formatted_for_visitor(visitor);
 }
 
 bool RedisClient::auth() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    cli->protocol_ = 2;
+    int err = RCLI_RET_OK;
+    if (opts_.protocol == 3 && hello(err)) {
+        return err == RCLI_RET_OK;
+    }
     if (pwd_.size() > 0) {
-        return command_for_status("AUTH %s", pwd_.c_str()) == RCLI_RET_OK;
+        return commanda_for_status("AUTH", pwd_) == RCLI_RET_OK;
     } else {
         return true;
     }
 }
 
+bool RedisClient::handshake() {
+    if (!auth()) {
+        return false;
+    }
+    load_scripts();
+    return true;
+}
+
+void RedisClient::load_scripts() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    if (cli->scripts_ == nullptr) {
+        return;
+    }
+    std::vector<const RedisScript*> scripts = cli->scripts_->scripts();
+    if (scripts.empty()) {
+        return;
+    }
+    // written directly, a pipeline would check_alive() and could recover() back into here
+    RedisCommandEncoder enc = encoder();
+    for (auto script : scripts) {
+        enc.command("SCRIPT", "LOAD", script->source());
+    }
+    RedisCallRecorder rec(cli, "SCRIPT");
+    bool appended = cli->append_formatted(cmd_buf_);
+    if (cmd_buf_.capacity() > RCLI_CMD_BUF_KEEP) {
+        std::string().swap(cmd_buf_);
+    }
+    int err = RCLI_RET_OK;
+    for (size_t i = 0; appended && i < scripts.size(); i++) {
+        void* reply = nullptr;
+        redisGetReply(cli->get_context(), &reply);
+        CSmartPtr<void, freeReplyObject> reply_sp(reply);
+        int ret = cli->check_reply_type((redisReply*) reply);
+        err = ret == RCLI_RET_OK ? err : ret;
+        if (reply == nullptr) {
+            break;
+        }
+    }
+    rec.done(appended ? err : cli->check_reply_type(nullptr));
+}
+
+RedisCommandEncoder RedisClient::begin_eval(const RedisScript& script, bool by_sha1, size_t numkeys,
+                                            size_t numargs) {
+    RedisCommandEncoder enc = encoder();
+    enc.begin(3 + numkeys + numargs);
+    if (by_sha1) {
+        enc.arg("EVALSHA");
+        enc.arg(script.sha1());
+    } else {
+        enc.arg("EVAL");
+        enc.arg(script.source());
+    }
+    enc.arg(numkeys);
+    return enc;
+}
+
+bool RedisClient::is_noscript() {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    return cli->error_str_.compare(0, 8, "NOSCRIPT") == 0;
+}
+
+bool RedisClient::hello(int& err) {
+    RedisClientImpl* cli = (RedisClientImpl*) impl_;
+    if (pwd_.empty()) {
+        encoder().command("HELLO", 3);
+    } else {
+        encoder().command("HELLO", 3, "AUTH", "default", pwd_);
+    }
+    RedisCallRecorder rec(cli, "HELLO");
+    CSmartPtr<void, freeReplyObject> reply_sp(cli->formatted_command(cmd_buf_));
+    const redisReply* reply = (const redisReply*) reply_sp.get();
+    err = cli->get_reply_status(reply);
+    if (err == RCLI_RET_ERROR && (strncasecmp(reply->str, "ERR unknown command", 19) == 0
+                                  || strncasecmp(reply->str, "NOPROTO", 7) == 0)) {
+        // redis before 6, the caller falls back to AUTH
+        rec.done(err);
+        return false;
+    }
+    if (err == RCLI_RET_OK && reply->type == REDIS_REPLY_MAP) {
+        cli->protocol_ = 3;
+    }
+    rec.done(err);
+    return true;
+}
+
 bool RedisClient::ping() {
     RedisClientImpl* cli = (RedisClientImpl*) impl_;
-    bool ret = false;
-    CSmartPtr<void, freeReplyObject> reply_sp(redisCommand(cli->get_context(), "PING"));
-    redisReply* reply = (redisReply*) reply_sp.get();
-    return cli->cmp_reply_string((redisReply*) reply_sp.get(), "PONG") == RCLI_RET_OK;
+    encoder().command("PING");
+    RedisCallRecorder rec(cli, "PING");
+    CSmartPtr<void, freeReplyObject> reply_sp(cli->formatted_command(cmd_buf_));
+    return rec.done(cli->cmp_reply_string((redisReply*) reply_sp.get(), "PONG")) == RCLI_RET_OK;
 }
@@ -4,9 +4,15 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
 #include <memory>
 #include <string>
 #include <string.h>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 template <class T, void (*deleter)(T*)>
@@ -22,29 +28,265 @@ public:
 #define RCLI_RET_ERROR -2
 #define RCLI_RET_UNKNOWN -3
 #define RCLI_ERROR -4
+#define RCLI_TIMEOUT -5
 
 #define RCLI_TRY_COUNT 3
 
+// keys per command of the multi-key helpers, mget() and the like
+#define RCLI_MULTI_KEY_CHUNK 100
+
+// commands fail fast when check_alive() says the node is unusable, and are
+// retried after a connection error only when recover() reopened the connection
 #define BEGIN_CHECK_ALIVE()                                                                                            \
     int n = RCLI_TRY_COUNT;                                                                                            \
-    do {
+    do {                                                                                                               \
+        if (!check_alive()) {                                                                                          \
+            break;                                                                                                     \
+        }
 #define END_CHECK_ALIVE()                                                                                              \
     }                                                                                                                  \
-    while (n-- && err == RCLI_ERROR && !check_alive())
+    while (err == RCLI_ERROR && n-- > 0 && recover())
+
+// non-owning reference to a binary-safe string
+class RedisStringView {
+public:
+    RedisStringView() : data_(nullptr), size_(0) {}
+    RedisStringView(const char* data, size_t size) : data_(data), size_(size) {}
+    RedisStringView(const char* str) : data_(str), size_(strlen(str)) {}
+    RedisStringView(const std::string& str) : data_(str.data()), size_(str.size()) {}
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::string to_string() const { return std::string(data_, size_); }
+
+    bool operator==(const RedisStringView& other) const {
+        return size_ == other.size_ && (size_ == 0 || memcmp(data_, other.data_, size_) == 0);
+    }
+    bool operator!=(const RedisStringView& other) const { return !(*this == other); }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+// Serializes command arguments straight into RESP, "*<argc>\r\n" followed by
+// "$<len>\r\n<arg>\r\n" for each argument. Strings are binary safe, integers and
+// doubles are formatted in place without a temporary std::string.
+//
+//     RedisCommandEncoder enc(buf);
+//     enc.command("HINCRBY", key, field, 1);
+//     enc.begin(2 + members.size());
+//     enc.arg("SADD");
+//     ...
+class RedisCommandEncoder {
+public:
+    explicit RedisCommandEncoder(std::string& buf) : buf_(buf) {}
+
+    // append a whole command
+    template <class... Args>
+    void command(const Args&... args) {
+        begin(sizeof...(Args));
+        append_args(args...);
+    }
+
+    // start a command of argc arguments, to be followed by argc calls to arg()
+    void begin(size_t argc) { header('*', argc); }
+
+    void arg(const RedisStringView& val) {
+        header('$', val.size());
+        buf_.append(val.data(), val.size());
+        buf_.append("\r\n", 2);
+    }
+    void arg(const std::string& val) { arg(RedisStringView(val)); }
+    void arg(const char* val) { arg(RedisStringView(val)); }
+
+    template <class T>
+    typename std::enable_if<std::is_integral<T>::value>::type arg(T val) {
+        char digits[24];
+        char* end = digits + sizeof(digits);
+        char* begin = format_unsigned(end, val < 0 ? 0 - (uint64_t) val : (uint64_t) val);
+        if (val < 0) {
+            *--begin = '-';
+        }
+        arg(RedisStringView(begin, end - begin));
+    }
+
+    // shortest of %.15g and %.17g that parses back to the same value
+    void arg(double val) {
+        char str[32];
+        int len = snprintf(str, sizeof(str), "%.15g", val);
+        if (strtod(str, nullptr) != val) {
+            len = snprintf(str, sizeof(str), "%.17g", val);
+        }
+        arg(RedisStringView(str, (size_t) len));
+    }
+    void arg(float val) { arg((double) val); }
+
+private:
+    void append_args() {}
+
+    template <class T, class... Rest>
+    void append_args(const T& first, const Rest&... rest) {
+        arg(first);
+        append_args(rest...);
+    }
+
+    static char* format_unsigned(char* end, uint64_t val) {
+        do {
+            *--end = (char) ('0' + val % 10);
+            val /= 10;
+        } while (val);
+        return end;
+    }
+
+    void header(char type, size_t len) {
+        char str[24];
+        char* end = str + sizeof(str);
+        end[-1] = '\n';
+        end[-2] = '\r';
+        char* begin = format_unsigned(end - 2, len);
+        *--begin = type;
+        buf_.append(begin, end - begin);
+    }
+
+    std::string& buf_;
+};
+
+// Receives reply elements while hiredis parses them, no redisReply tree is built.
+// depth is 0 for the reply itself and grows by one inside each array. strings
+// point into the read buffer and are only valid during the call.
+class RedisReplyVisitor {
+public:
+    virtual ~RedisReplyVisitor() {}
+    virtual void on_array(int /*depth*/, size_t /*len*/) {}
+    // RESP3 map, its keys and values follow alternately one level deeper
+    virtual void on_map(int depth, size_t pairs) { on_array(depth, pairs * 2); }
+    virtual void on_string(int /*depth*/, const char* /*str*/, size_t /*len*/) {}
+    virtual void on_integer(int /*depth*/, int64_t /*val*/) {}
+    virtual void on_double(int depth, double /*val*/, const char* str, size_t len) { on_string(depth, str, len); }
+    virtual void on_nil(int /*depth*/) {}
+    // error nested in an array, a top level error is returned as RCLI_RET_ERROR
+    virtual void on_error(int /*depth*/, const char* /*str*/, size_t /*len*/) {}
+};
+
+// scalar elements of a reply packed into one buffer
+class RedisFlatReply : public RedisReplyVisitor {
+public:
+    size_t size() const { return offsets_.size(); }
+    bool empty() const { return offsets_.empty(); }
+    RedisStringView operator[](size_t index) const {
+        size_t begin = index == 0 ? 0 : offsets_[index - 1];
+        return RedisStringView(data_.data() + begin, offsets_[index] - begin);
+    }
+    void clear() {
+        data_.clear();
+        offsets_.clear();
+    }
+
+    void on_array(int /*depth*/, size_t len) override { offsets_.reserve(offsets_.size() + len); }
+    void on_string(int /*depth*/, const char* str, size_t len) override {
+        data_.append(str, len);
+        offsets_.push_back(data_.size());
+    }
+    void on_integer(int /*depth*/, int64_t val) override {
+        data_.append(std::to_string(val));
+        offsets_.push_back(data_.size());
+    }
+    void on_nil(int /*depth*/) override { offsets_.push_back(data_.size()); }
+    void on_error(int depth, const char* str, size_t len) override { on_string(depth, str, len); }
+
+private:
+    std::string data_;
+    std::vector<size_t> offsets_;  // end of each element in data_
+};
+
+class RedisHealthMonitor;
+class RedisNearCache;
+class RedisPipeline;
+class RedisScanner;
+class RedisScript;
+class RedisScriptRegistry;
+class RedisStats;
+class RedisStreamConsumer;
+class RedisSubscriberImpl;
+class RedisTlsContext;
+class RedisTransaction;
 
 class RedisClient {
+    friend class RedisPipeline;
+    friend class RedisScanner;
+    friend class RedisStreamConsumer;
+    friend class RedisSubscriberImpl;
+    friend class RedisTransaction;
+    friend class RedisWindowPipeline;
+
 public:
+    typedef struct options {
+        uint32_t connect_timeout_ms = 5000;   // 0 waits for the system
+        uint32_t command_timeout_ms = 30000;  // bounds every read and write, 0 waits forever
+        uint32_t tcp_user_timeout_ms = 0;     // TCP_USER_TIMEOUT where supported, 0 keeps the system default
+        // 3 switches to RESP3 with HELLO, which also authenticates. servers without
+        // HELLO (before redis 6) are spoken to in RESP2
+        int protocol = 2;
+        // connect to this unix socket instead of host:port, the TCP options below then do not apply
+        std::string unix_path;
+        std::string source_addr;               // local address to bind, empty lets the system choose
+        bool tcp_nodelay = true;               // false lets Nagle coalesce small writes
+        uint32_t keepalive_interval_s = 15;    // TCP keepalive probes, 0 turns keepalive off
+        int sndbuf = 0;                        // SO_SNDBUF bytes, 0 keeps the system default
+        int rcvbuf = 0;                        // SO_RCVBUF bytes, 0 keeps the system default
+        RedisTlsContext* tls = nullptr;        // encrypt the connection, see rcli_tls.h
+    } options_t;
+
     RedisClient();
     virtual ~RedisClient();
 
     void init(const std::string& host, uint32_t port, const std::string& pwd);
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const options_t& opts);
     const std::string& get_last_error();
+    // RCLI_* of the last command, tells RCLI_TIMEOUT and RCLI_RET_NIL apart when a method returned false
+    int get_last_status();
+    // RESP version of the connection, 2 or 3
+    int get_protocol();
+
+    // commands issued until clear_deadline() must complete within timeout_ms from
+    // now, the one running when it passes returns RCLI_TIMEOUT. see RedisDeadline
+    void set_deadline(uint32_t timeout_ms);
+    void clear_deadline();
 
     bool connect();
     bool reconnect();
     bool auth();
     bool ping();
 
+    // batch commands into a single round trip, see rcli_pipeline.h
+    RedisPipeline pipeline();
+    // MULTI/EXEC and WATCH retries, see rcli_transaction.h
+    RedisTransaction transaction();
+
+    // walk the keyspace or one collection a batch at a time, see rcli_scan.h
+    RedisScanner scan();
+    RedisScanner hscan(const std::string& key);
+    RedisScanner sscan(const std::string& key);
+    RedisScanner zscan(const std::string& key);
+
+    // record every command into stats, nullptr stops recording. see rcli_stats.h
+    void set_stats(RedisStats* stats);
+    RedisStats* get_stats();
+
+    // fail fast while monitor reports the node down, see rcli_health.h
+    void set_health(RedisHealthMonitor* monitor);
+    RedisHealthMonitor* get_health();
+
+    // serve get() and hget() from cache while the server reports no change, see rcli_cache.h
+    void set_cache(RedisNearCache* cache);
+    RedisNearCache* get_cache();
+
+    // SCRIPT LOAD the scripts of registry after every connect, see rcli_script.h
+    void set_scripts(RedisScriptRegistry* registry);
+    RedisScriptRegistry* get_scripts();
+
     int command_for_status(const char* cmd, ...);
     int command_for_integer(int64_t& retval, const char* cmd, ...);
     int command_for_double(double& retval, const char* cmd, ...);
@@ -56,20 +298,87 @@ public:
     int commandv_for_string(std::string& retval, const std::vector<std::string>& cmd);
     int commandv_for_vector(std::vector<std::string>& retval, const std::vector<std::string>& cmd);
 
-    bool check_alive() {
-        if (!ping()) {
-            fprintf(stdout, "ping error, reconnect...\n");
-            return reconnect();
-        }
-        return true;
+    // arguments are only referenced, e.g. commandv_for_integer(out, {"HSET", key, field, value})
+    int commandv_for_status(std::initializer_list<RedisStringView> cmd);
+    int commandv_for_integer(int64_t& retval, std::initializer_list<RedisStringView> cmd);
+    int commandv_for_string(std::string& retval, std::initializer_list<RedisStringView> cmd);
+    int commandv_for_vector(std::vector<std::string>& retval, std::initializer_list<RedisStringView> cmd);
+
+    // stream the reply into visitor instead of building it in memory first
+    int command_for_visitor(RedisReplyVisitor& visitor, const char* cmd, ...);
+    int commandv_for_visitor(RedisReplyVisitor& visitor, const std::vector<std::string>& cmd);
+    int commandv_for_visitor(RedisReplyVisitor& visitor, std::initializer_list<RedisStringView> cmd);
+
+    // arguments are encoded by RedisCommandEncoder, e.g. commanda_for_integer(out, "HINCRBY", key, field, 1)
+    template <class... Args>
+    int commanda_for_status(const Args&... args) {
+        encoder().command(args...);
+        return formatted_for_status();
+    }
+    template <class... Args>
+    int commanda_for_integer(int64_t& retval, const Args&... args) {
+        encoder().command(args...);
+        return formatted_for_integer(retval);
+    }
+    template <class... Args>
+    int commanda_for_double(double& retval, const Args&... args) {
+        encoder().command(args...);
+        return formatted_for_double(retval);
+    }
+    template <class... Args>
+    int commanda_for_string(std::string& retval, const Args&... args) {
+        encoder().command(args...);
+        return formatted_for_string(retval);
+    }
+    template <class... Args>
+    int commanda_for_vector(std::vector<std::string>& retval, const Args&... args) {
+        encoder().command(args...);
+        return formatted_for_vector(retval);
     }
+    // a RESP3 map, or the flat key value array of RESP2
+    template <class... Args>
+    int commanda_for_map(std::unordered_map<std::string, std::string>& retval, const Args&... args) {
+        encoder().command(args...);
+        return formatted_for_map(retval);
+    }
+    template <class... Args>
+    int commanda_for_visitor(RedisReplyVisitor& visitor, const Args&... args) {
+        encoder().command(args...);
+        return formatted_for_visitor(visitor);
+    }
+
+    // EVALSHA of script, sent again as EVAL when the server does not know it.
+    // keys and args are binary safe, e.g. eval_for_integer(out, *script, {key}, {member, "60"})
+    template <class Keys = std::initializer_list<RedisStringView>, class Args = std::initializer_list<RedisStringView>>
+    int eval_for_status(const RedisScript& script, const Keys& keys = {}, const Args& args = {}) {
+        return eval(script, keys, args, [&] { return formatted_for_status(); });
+    }
+    template <class Keys = std::initializer_list<RedisStringView>, class Args = std::initializer_list<RedisStringView>>
+    int eval_for_integer(int64_t& retval, const RedisScript& script, const Keys& keys = {}, const Args& args = {}) {
+        return eval(script, keys, args, [&] { return formatted_for_integer(retval); });
+    }
+    template <class Keys = std::initializer_list<RedisStringView>, class Args = std::initializer_list<RedisStringView>>
+    int eval_for_string(std::string& retval, const RedisScript& script, const Keys& keys = {},
+                        const Args& args = {}) {
+        return eval(script, keys, args, [&] { return formatted_for_string(retval); });
+    }
+    template <class Keys = std::initializer_list<RedisStringView>, class Args = std::initializer_list<RedisStringView>>
+    int eval_for_vector(std::vector<std::string>& retval, const RedisScript& script, const Keys& keys = {},
+                        const Args& args = {}) {
+        // a reply cut short by NOSCRIPT added nothing
+        return eval(script, keys, args, [&] { return formatted_for_vector(retval); });
+    }
+
+    // false when the node is marked down or the connection is broken and could
+    // not be reopened. no round trip is made on a healthy connection.
+    bool check_alive();
 
     // keys
 
     bool exist(const std::string& key) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_status("EXISTS %s", key.c_str());
+        err = commanda_for_status("EXISTS", key);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -77,7 +386,7 @@ public:
     bool get(const std::string& key, std::string& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_string(out, "GET %s", key.c_str());
+        err = cached_for_string(out, "GET", key, nullptr);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -85,92 +394,132 @@ public:
     bool set(const std::string& key, const std::string& in) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_status("SET %s %s", key.c_str(), in.c_str());
+        err = commanda_for_status("SET", key, in);
         END_CHECK_ALIVE();
+        drop_cached(key);
         return err == RCLI_RET_OK;
     }
 
     bool del(const std::string& key) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_status("DEL %s", key.c_str());
+        err = commanda_for_status("DEL", key);
         END_CHECK_ALIVE();
+        drop_cached(key);
         return err == RCLI_RET_OK;
     }
 
     bool expire(const std::string& key, uint32_t second) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_status("EXPIRE %s %u", key.c_str(), second);
+        err = commanda_for_status("EXPIRE", key, second);
         END_CHECK_ALIVE();
+        drop_cached(key);
         return err == RCLI_RET_OK;
     }
 
     bool expireat(const std::string& key, uint32_t timestamp) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_status("EXPIREAT %s %u", key.c_str(), timestamp);
+        err = commanda_for_status("EXPIREAT", key, timestamp);
         END_CHECK_ALIVE();
+        drop_cached(key);
         return err == RCLI_RET_OK;
     }
 
     bool pexpire(const std::string& key, uint32_t milliseconds) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_status("PEXPIRE %s %u", key.c_str(), milliseconds);
+        err = commanda_for_status("PEXPIRE", key, milliseconds);
         END_CHECK_ALIVE();
+        drop_cached(key);
         return err == RCLI_RET_OK;
     }
 
+    // multi-key: one command per chunk keys, every chunk in the same write.
+    // results follow the order of the keys
+
+    typedef std::pair<std::string, std::string> key_value_t;
+
+    // out[i] is the value of keys[i], empty when it does not exist. found[i]
+    // tells a missing key from an empty value. the near cache is bypassed
+    bool mget(const std::vector<std::string>& keys, std::vector<std::string>& out,
+              size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    bool mget(const std::vector<std::string>& keys, std::vector<std::string>& out, std::vector<bool>& found,
+              size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    bool mset(const std::vector<key_value_t>& in, size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    // out is the number of keys removed
+    bool del(const std::vector<std::string>& keys, int64_t& out, size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    // out[i] tells whether keys[i] exists. EXISTS of several keys only counts
+    // them, so each key is sent in an EXISTS of its own, pipelined
+    bool exist(const std::vector<std::string>& keys, std::vector<bool>& out);
+
     // hash map
 
     bool hexist(const std::string& key, const std::string& field) {
         int err = RCLI_ERROR;
-        std::vector<std::string> cmdv{"HEXISTS", key, field};
         BEGIN_CHECK_ALIVE();
-        err = commandv_for_status(cmdv);
+        err = commanda_for_status("HEXISTS", key, field);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
 
     bool hget(const std::string& key, const std::string& field, std::string& out) {
         int err = RCLI_ERROR;
-        std::vector<std::string> cmdv{"HGET", key, field};
         BEGIN_CHECK_ALIVE();
-        err = commandv_for_string(out, cmdv);
+        err = cached_for_string(out, "HGET", key, &field);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
 
     bool hset(const std::string& key, const std::string& field, const std::string& in, int64_t& out) {
         int err = RCLI_ERROR;
-        std::vector<std::string> cmdv{"HSET", key, field, in};
         BEGIN_CHECK_ALIVE();
-        err = commandv_for_integer(out, cmdv);
+        err = commanda_for_integer(out, "HSET", key, field, in);
         END_CHECK_ALIVE();
+        drop_cached(key);
         return err == RCLI_RET_OK;
     }
 
     bool hincrby(const std::string& key, const std::string& field, const int64_t& in, int64_t& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_integer(out, "HINCRBY %s %s %lld", key.c_str(), field.c_str(), in);
+        err = commanda_for_integer(out, "HINCRBY", key, field, in);
         END_CHECK_ALIVE();
+        drop_cached(key);
         return err == RCLI_RET_OK;
     }
 
     bool hdel(const std::string& key, const std::string& field) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_status("HDEL %s %s", key.c_str(), field.c_str());
+        err = commanda_for_status("HDEL", key, field);
+        END_CHECK_ALIVE();
+        drop_cached(key);
+        return err == RCLI_RET_OK;
+    }
+
+    bool hgetall(const std::string& key, std::unordered_map<std::string, std::string>& out) {
+        int err = RCLI_ERROR;
+        BEGIN_CHECK_ALIVE();
+        err = commanda_for_map(out, "HGETALL", key);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
 
+    // the whole hash in one reply, hscan() reads a large one in batches
     bool hkeys(const std::string& key, std::vector<std::string>& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_vector(out, "HKEYS %s", key.c_str());
+        err = commanda_for_vector(out, "HKEYS", key);
+        END_CHECK_ALIVE();
+        return err == RCLI_RET_OK;
+    }
+
+    bool hkeys(const std::string& key, RedisFlatReply& out) {
+        int err = RCLI_ERROR;
+        BEGIN_CHECK_ALIVE();
+        err = commanda_for_visitor(out, "HKEYS", key);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -183,20 +532,23 @@ public:
     bool zadd(const std::string& key, const score_member_t& in, int64_t& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_integer(out, "ZADD %s %f %s", key.c_str(), in.first, in.second.c_str());
+        err = commanda_for_integer(out, "ZADD", key, in.first, in.second);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
 
     bool zadd(const std::string& key, const std::vector<score_member_t>& in, int64_t& out) {
         int err = RCLI_ERROR;
-        std::vector<std::string> cmdv{"ZADD", key};
+        BEGIN_CHECK_ALIVE();
+        RedisCommandEncoder enc = encoder();
+        enc.begin(2 + in.size() * 2);
+        enc.arg("ZADD");
+        enc.arg(key);
         for (auto& kv : in) {
-            cmdv.emplace_back(std::to_string(kv.first));
-            cmdv.emplace_back(kv.second);
+            enc.arg(kv.first);
+            enc.arg(kv.second);
         }
-        BEGIN_CHECK_ALIVE();
-        err = commandv_for_integer(out, cmdv);
+        err = formatted_for_integer(out);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -204,7 +556,7 @@ public:
     bool zcard(const std::string& key, int64_t& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_integer(out, "ZCARD %s", key.c_str());
+        err = commanda_for_integer(out, "ZCARD", key);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -212,7 +564,15 @@ public:
     bool zincrby(const std::string& key, const incre_member_t& in, int64_t& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_integer(out, "ZINCRBY %s %f %s", key.c_str(), in.first, in.second.c_str());
+        err = commanda_for_integer(out, "ZINCRBY", key, in.first, in.second);
+        END_CHECK_ALIVE();
+        return err == RCLI_RET_OK;
+    }
+
+    bool zincrby(const std::string& key, const incre_member_t& in, double& out) {
+        int err = RCLI_ERROR;
+        BEGIN_CHECK_ALIVE();
+        err = commanda_for_double(out, "ZINCRBY", key, in.first, in.second);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -222,9 +582,21 @@ public:
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
         if (withscore) {
-            err = command_for_vector(out, "ZRANGE %s %d %d WITHSCORES", key.c_str(), start, stop);
+            err = commanda_for_vector(out, "ZRANGE", key, start, stop, "WITHSCORES");
+        } else {
+            err = commanda_for_vector(out, "ZRANGE", key, start, stop);
+        }
+        END_CHECK_ALIVE();
+        return err == RCLI_RET_OK;
+    }
+
+    bool zrange(const std::string& key, int32_t start, int32_t stop, RedisFlatReply& out, bool withscore = false) {
+        int err = RCLI_ERROR;
+        BEGIN_CHECK_ALIVE();
+        if (withscore) {
+            err = commanda_for_visitor(out, "ZRANGE", key, start, stop, "WITHSCORES");
         } else {
-            err = command_for_vector(out, "ZRANGE %s %d %d", key.c_str(), start, stop);
+            err = commanda_for_visitor(out, "ZRANGE", key, start, stop);
         }
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
@@ -235,9 +607,9 @@ public:
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
         if (withscore) {
-            err = command_for_vector(out, "ZRANGEBYSCORE %s %f %f WITHSCORES", key.c_str(), min, max);
+            err = commanda_for_vector(out, "ZRANGEBYSCORE", key, min, max, "WITHSCORES");
         } else {
-            err = command_for_vector(out, "ZRANGEBYSCORE %s %f %f", key.c_str(), min, max);
+            err = commanda_for_vector(out, "ZRANGEBYSCORE", key, min, max);
         }
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
@@ -246,7 +618,7 @@ public:
     bool zrank(const std::string& key, const std::string& member, int64_t& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_integer(out, "ZRANK %s %s", key.c_str(), member.c_str());
+        err = commanda_for_integer(out, "ZRANK", key, member);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -254,11 +626,7 @@ public:
     bool zscore(const std::string& key, const std::string& member, double& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        std::string out_str;
-        err = command_for_string(out_str, "ZSCORE %s %s", key.c_str(), member.c_str());
-        if (err == RCLI_RET_OK) {
-            out = std::stod(out_str);
-        }
+        err = commanda_for_double(out, "ZSCORE", key, member);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
@@ -266,14 +634,138 @@ public:
     bool zrem(const std::string& key, const std::string& member, int64_t& out) {
         int err = RCLI_ERROR;
         BEGIN_CHECK_ALIVE();
-        err = command_for_integer(out, "ZREM %s %s", key.c_str(), member.c_str());
+        err = commanda_for_integer(out, "ZREM", key, member);
+        END_CHECK_ALIVE();
+        return err == RCLI_RET_OK;
+    }
+
+    // stream, consumer groups are read through RedisStreamConsumer, see rcli_stream.h
+
+    typedef std::pair<std::string, std::string> field_value_t;
+
+    // out is the id the server assigned. maxlen > 0 trims the stream to about
+    // that many entries, exactly when approx is false
+    bool xadd(const std::string& key, const std::vector<field_value_t>& in, std::string& out, size_t maxlen = 0,
+              bool approx = true) {
+        int err = RCLI_ERROR;
+        BEGIN_CHECK_ALIVE();
+        RedisCommandEncoder enc = encoder();
+        enc.begin(3 + (maxlen ? 3 : 0) + in.size() * 2);
+        enc.arg("XADD");
+        enc.arg(key);
+        if (maxlen) {
+            enc.arg("MAXLEN");
+            enc.arg(approx ? "~" : "=");
+            enc.arg(maxlen);
+        }
+        enc.arg("*");
+        for (auto& kv : in) {
+            enc.arg(kv.first);
+            enc.arg(kv.second);
+        }
+        err = formatted_for_string(out);
+        END_CHECK_ALIVE();
+        return err == RCLI_RET_OK;
+    }
+
+    bool xlen(const std::string& key, int64_t& out) {
+        int err = RCLI_ERROR;
+        BEGIN_CHECK_ALIVE();
+        err = commanda_for_integer(out, "XLEN", key);
         END_CHECK_ALIVE();
         return err == RCLI_RET_OK;
     }
 
 private:
+    // after a connection error: tell the health monitor and reopen the connection
+    bool recover();
+    // HELLO 3 with AUTH folded in, false when the server does not know HELLO
+    bool hello(int& err);
+    // auth() and, when it succeeded, load_scripts()
+    bool handshake();
+    // SCRIPT LOAD every registered script in one round trip, failures are left to the NOSCRIPT fallback
+    void load_scripts();
+
+    // EVALSHA, then EVAL when the reply was NOSCRIPT
+    template <class Keys, class Args, class Read>
+    int eval(const RedisScript& script, const Keys& keys, const Args& args, Read read) {
+        encode_eval(script, true, keys, args);
+        int err = read();
+        if (err == RCLI_RET_ERROR && is_noscript()) {
+            encode_eval(script, false, keys, args);
+            err = read();
+        }
+        return err;
+    }
+    template <class Keys, class Args>
+    void encode_eval(const RedisScript& script, bool by_sha1, const Keys& keys, const Args& args) {
+        RedisCommandEncoder enc = begin_eval(script, by_sha1, keys.size(), args.size());
+        for (auto& key : keys) {
+            enc.arg(key);
+        }
+        for (auto& arg : args) {
+            enc.arg(arg);
+        }
+    }
+    // EVALSHA sha1 numkeys or EVAL source numkeys, keys and args follow
+    RedisCommandEncoder begin_eval(const RedisScript& script, bool by_sha1, size_t numkeys, size_t numargs);
+    bool is_noscript();
+
+    // encode(enc, begin, end) appends the command of keys [begin, end) for
+    // every chunk, then read(begin, end) reads each reply in turn. RCLI_* of
+    // the first chunk that failed
+    int multi_key(const char* verb, size_t count, size_t chunk,
+                  const std::function<void(RedisCommandEncoder& enc, size_t begin, size_t end)>& encode,
+                  const std::function<int(size_t begin, size_t end)>& read);
+
+    // GET or HGET through the attached RedisNearCache
+    int cached_for_string(std::string& retval, const char* verb, const std::string& key, const std::string* field);
+    // a write through this client must not be followed by a cached read of the old value
+    void drop_cached(const std::string& key);
+
+    // encoder over the cleared scratch buffer sent by formatted_for_*()
+    RedisCommandEncoder encoder() {
+        cmd_buf_.clear();
+        return RedisCommandEncoder(cmd_buf_);
+    }
+    template <class Container>
+    void encode_argv(const Container& cmd) {
+        RedisCommandEncoder enc = encoder();
+        enc.begin(cmd.size());
+        for (auto& arg : cmd) {
+            enc.arg(arg);
+        }
+    }
+    int formatted_for_status();
+    int formatted_for_integer(int64_t& retval);
+    int formatted_for_double(double& retval);
+    int formatted_for_string(std::string& retval);
+    int formatted_for_vector(std::vector<std::string>& retval);
+    int formatted_for_map(std::unordered_map<std::string, std::string>& retval);
+    int formatted_for_visitor(RedisReplyVisitor& visitor);
+
     void* impl_ = nullptr;
+    std::string cmd_buf_;
     std::string host_;
     uint32_t port_;
     std::string pwd_;
+    options_t opts_;
+};
+
+// deadline for the calls made on cli within a scope
+//
+//     {
+//         RedisDeadline deadline(rcli, 50);
+//         if (!rcli->get("key", out) && rcli->get_last_status() == RCLI_TIMEOUT) { ... }
+//     }
+class RedisDeadline {
+public:
+    RedisDeadline(RedisClient* cli, uint32_t timeout_ms) : cli_(cli) { cli_->set_deadline(timeout_ms); }
+    ~RedisDeadline() { cli_->clear_deadline(); }
+
+    RedisDeadline(const RedisDeadline&) = delete;
+    RedisDeadline& operator=(const RedisDeadline&) = delete;
+
+private:
+    RedisClient* cli_;
 };
\ No newline at end of file
@@ -0,0 +1,513 @@
+#include "rcli_async.h"
+#include "rcli_impl.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <hiredis/async.h>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#    include <hiredis/sockcompat.h>
+#else
+#    include <fcntl.h>
+#    include <poll.h>
+#    include <unistd.h>
+#endif
+
+#define RCLI_ASYNC_EV_READ 1
+#define RCLI_ASYNC_EV_WRITE 2
+
+namespace {
+
+struct async_request {
+    virtual ~async_request() {}
+    // err is the RCLI_* when there is no reply
+    virtual void complete(RedisClientImpl& conv, const redisReply* reply, const char* errstr, int err = RCLI_ERROR) = 0;
+    std::string cmd;
+};
+
+int convert_reply(RedisClientImpl& conv, const redisReply* reply, bool& retval) {
+    int err = conv.get_reply_status(reply);
+    retval = err == RCLI_RET_OK;
+    return err;
+}
+
+int convert_reply(RedisClientImpl& conv, const redisReply* reply, int64_t& retval) {
+    return conv.get_reply_integer(reply, retval);
+}
+
+int convert_reply(RedisClientImpl& conv, const redisReply* reply, double& retval) {
+    return conv.get_reply_double(reply, retval);
+}
+
+int convert_reply(RedisClientImpl& conv, const redisReply* reply, std::string& retval) {
+    return conv.get_reply_string(reply, retval);
+}
+
+int convert_reply(RedisClientImpl& conv, const redisReply* reply, std::vector<std::string>& retval) {
+    return conv.get_reply_vector(reply, retval);
+}
+
+template <class T>
+struct typed_request : public async_request {
+    std::function<void(RedisAsyncResult<T>&)> cb;
+
+    void complete(RedisClientImpl& conv, const redisReply* reply, const char* errstr, int err) override {
+        RedisAsyncResult<T> result;
+        if (reply == nullptr) {
+            result.err = err;
+            result.error = errstr && *errstr ? errstr : "Redis connection lost!";
+        } else {
+            result.err = convert_reply(conv, reply, result.value);
+            if (result.err != RCLI_RET_OK) {
+                result.error = conv.error_str_;
+            }
+        }
+        if (cb) {
+            cb(result);
+        }
+    }
+};
+
+}  // namespace
+
+class AsyncRedisClientImpl {
+public:
+    AsyncRedisClientImpl() : running_(false), pending_(0) {}
+
+    bool start();
+    void stop();
+    void submit(async_request* req);
+    void run();
+
+    bool open_context();
+    void process_queue();
+    void fail_queue(const char* errstr);
+    void wakeup();
+
+    static void on_reply(redisAsyncContext* ac, void* reply, void* privdata);
+    static void ev_add_read(void* data) { ((AsyncRedisClientImpl*) data)->ev_flags_ |= RCLI_ASYNC_EV_READ; }
+    static void ev_del_read(void* data) { ((AsyncRedisClientImpl*) data)->ev_flags_ &= ~RCLI_ASYNC_EV_READ; }
+    static void ev_add_write(void* data) { ((AsyncRedisClientImpl*) data)->ev_flags_ |= RCLI_ASYNC_EV_WRITE; }
+    static void ev_del_write(void* data) { ((AsyncRedisClientImpl*) data)->ev_flags_ &= ~RCLI_ASYNC_EV_WRITE; }
+    static void ev_cleanup(void* data) {
+        AsyncRedisClientImpl* impl = (AsyncRedisClientImpl*) data;
+        impl->ev_flags_ = 0;
+        impl->timer_us_ = 0;
+        impl->ac_ = nullptr;
+    }
+    // hiredis rearms it on every read and write, with the connect timeout
+    // while connecting and the command timeout after
+    static void ev_schedule_timer(void* data, struct timeval tv) {
+        ((AsyncRedisClientImpl*) data)->timer_us_ =
+          RedisCallRecorder::now_us() + (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+    // fail what waits for a reply once the timer passed
+    void check_timer();
+
+    std::string host_;
+    uint32_t port_ = 0;
+    std::string pwd_;
+    RedisClient::options_t opts_;
+
+    // owned by the I/O thread
+    redisAsyncContext* ac_ = nullptr;
+    int ev_flags_ = 0;
+    // in steady_clock microseconds, 0 when not armed
+    int64_t timer_us_ = 0;
+    RedisClientImpl conv_;
+
+    std::thread io_thread_;
+    std::atomic<bool> running_;
+    std::atomic<size_t> pending_;
+    std::mutex mutex_;
+    std::vector<async_request*> queue_;
+    std::string error_str_;
+    int wake_fd_[2] = {-1, -1};
+};
+
+bool AsyncRedisClientImpl::start() {
+    if (running_) {
+        return true;
+    }
+#ifndef _WIN32
+    if (pipe(wake_fd_) != 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_str_ = "AsyncRedisClient create pipe error!";
+        return false;
+    }
+    fcntl(wake_fd_[0], F_SETFL, fcntl(wake_fd_[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_fd_[1], F_SETFL, fcntl(wake_fd_[1], F_GETFL) | O_NONBLOCK);
+#endif
+    running_ = true;
+    io_thread_ = std::thread(&AsyncRedisClientImpl::run, this);
+    return true;
+}
+
+void AsyncRedisClientImpl::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    wakeup();
+    if (io_thread_.joinable()) {
+        io_thread_.join();
+    }
+#ifndef _WIN32
+    ::close(wake_fd_[0]);
+    ::close(wake_fd_[1]);
+    wake_fd_[0] = wake_fd_[1] = -1;
+#endif
+}
+
+void AsyncRedisClientImpl::wakeup() {
+#ifndef _WIN32
+    char c = 0;
+    ssize_t ret = write(wake_fd_[1], &c, 1);
+    (void) ret;
+#endif
+}
+
+void AsyncRedisClientImpl::submit(async_request* req) {
+    pending_++;
+    bool was_empty = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            error_str_ = "AsyncRedisClient is not connected!";
+        } else {
+            was_empty = queue_.empty();
+            queue_.push_back(req);
+            req = nullptr;
+        }
+    }
+    if (req) {
+        req->complete(conv_, nullptr, "AsyncRedisClient is not connected!");
+        delete req;
+        pending_--;
+        return;
+    }
+    // the I/O thread drains the whole queue on a single wakeup
+    if (was_empty) {
+        wakeup();
+    }
+}
+
+bool AsyncRedisClientImpl::open_context() {
+    if (opts_.tls) {
+        // RedisTlsContext handshakes on a blocking socket
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_str_ = "AsyncRedisClient does not support TLS!";
+        return false;
+    }
+    redisOptions redis_opts = {0};
+    struct timeval connect_timeout;
+    RedisClientImpl::set_endpoint(redis_opts, host_, port_, opts_, connect_timeout);
+    redisAsyncContext* ac = redisAsyncConnectWithOptions(&redis_opts);
+    std::string error;
+    if (ac == nullptr) {
+        error = "Redis Context nullptr!";
+    } else if (ac->err) {
+        error.assign(ac->errstr);
+    } else if (RedisClientImpl::tune_socket(&ac->c, opts_, error) && opts_.command_timeout_ms > 0) {
+        struct timeval command_timeout;
+        command_timeout.tv_sec = opts_.command_timeout_ms / 1000;
+        command_timeout.tv_usec = (opts_.command_timeout_ms % 1000) * 1000;
+        if (redisAsyncSetTimeout(ac, command_timeout) != REDIS_OK) {
+            error.assign(ac->errstr);
+        }
+    }
+    if (!error.empty()) {
+        if (ac) {
+            redisAsyncFree(ac);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_str_ = error;
+        return false;
+    }
+
+    ac->data = this;
+    ac->ev.data = this;
+    ac->ev.addRead = ev_add_read;
+    ac->ev.delRead = ev_del_read;
+    ac->ev.addWrite = ev_add_write;
+    ac->ev.delWrite = ev_del_write;
+    ac->ev.cleanup = ev_cleanup;
+    ac->ev.scheduleTimer = ev_schedule_timer;
+    ac_ = ac;
+    // the connect began before the timer could be scheduled
+    timer_us_ = opts_.connect_timeout_ms > 0 ? RedisCallRecorder::now_us() + opts_.connect_timeout_ms * 1000LL : 0;
+
+    // the connection is not usable before it is authenticated, queue AUTH first
+    if (pwd_.size() > 0) {
+        typed_request<bool>* req = new typed_request<bool>;
+        req->cb = [this](RedisAsyncResult<bool>& result) {
+            if (result.err != RCLI_RET_OK) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                error_str_ = result.error;
+            }
+        };
+        const char* argv[] = {"AUTH", pwd_.c_str()};
+        size_t argvlen[] = {4, pwd_.size()};
+        pending_++;
+        if (redisAsyncCommandArgv(ac_, on_reply, req, 2, argv, argvlen) != REDIS_OK) {
+            delete req;
+            pending_--;
+        }
+    }
+    return true;
+}
+
+void AsyncRedisClientImpl::on_reply(redisAsyncContext* ac, void* reply, void* privdata) {
+    AsyncRedisClientImpl* impl = (AsyncRedisClientImpl*) ac->data;
+    async_request* req = (async_request*) privdata;
+    req->complete(impl->conv_, (const redisReply*) reply, ac->errstr,
+                  ac->err == REDIS_ERR_TIMEOUT ? RCLI_TIMEOUT : RCLI_ERROR);
+    delete req;
+    impl->pending_--;
+}
+
+void AsyncRedisClientImpl::fail_queue(const char* errstr) {
+    std::vector<async_request*> queue;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue.swap(queue_);
+    }
+    for (auto req : queue) {
+        req->complete(conv_, nullptr, errstr);
+        delete req;
+        pending_--;
+    }
+}
+
+void AsyncRedisClientImpl::process_queue() {
+    std::vector<async_request*> queue;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()) {
+            return;
+        }
+        queue.swap(queue_);
+    }
+    if (ac_ == nullptr && !open_context()) {
+        std::string errstr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            errstr = error_str_;
+            queue_.insert(queue_.begin(), queue.begin(), queue.end());
+        }
+        fail_queue(errstr.c_str());
+        return;
+    }
+    for (size_t i = 0; i < queue.size(); i++) {
+        async_request* req = queue[i];
+        if (ac_ == nullptr
+            || redisAsyncFormattedCommand(ac_, on_reply, req, req->cmd.data(), req->cmd.size()) != REDIS_OK) {
+            req->complete(conv_, nullptr, ac_ ? ac_->errstr : nullptr);
+            delete req;
+            pending_--;
+        }
+    }
+}
+
+void AsyncRedisClientImpl::check_timer() {
+    if (ac_ == nullptr || timer_us_ == 0 || RedisCallRecorder::now_us() < timer_us_) {
+        return;
+    }
+    // nothing happens when no reply is awaited, else every callback gets
+    // "Timeout" and the connection is dropped, the next command reopens it
+    timer_us_ = 0;
+    redisAsyncHandleTimeout(ac_);
+}
+
+void AsyncRedisClientImpl::run() {
+    while (running_) {
+        process_queue();
+
+        struct pollfd fds[2];
+        int nfds = 0;
+        int timeout_ms = 100;
+#ifndef _WIN32
+        fds[nfds].fd = wake_fd_[0];
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+#else
+        timeout_ms = 1;
+#endif
+        int ac_index = -1;
+        if (ac_ && ev_flags_) {
+            ac_index = nfds;
+            fds[nfds].fd = ac_->c.fd;
+            fds[nfds].events = 0;
+            fds[nfds].revents = 0;
+            if (ev_flags_ & RCLI_ASYNC_EV_READ) {
+                fds[nfds].events |= POLLIN;
+            }
+            if (ev_flags_ & RCLI_ASYNC_EV_WRITE) {
+                fds[nfds].events |= POLLOUT;
+            }
+            nfds++;
+        }
+        if (nfds == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+            continue;
+        }
+        if (ac_ && timer_us_ > 0) {
+            int64_t left_ms = (timer_us_ - RedisCallRecorder::now_us() + 999) / 1000;
+            timeout_ms = (int) std::max<int64_t>(0, std::min<int64_t>(timeout_ms, left_ms));
+        }
+        if (poll(fds, nfds, timeout_ms) <= 0) {
+            check_timer();
+            continue;
+        }
+#ifndef _WIN32
+        if (fds[0].revents) {
+            char buf[256];
+            while (read(wake_fd_[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+#endif
+        if (ac_index >= 0) {
+            short revents = fds[ac_index].revents;
+            if (ac_ && (revents & (POLLIN | POLLERR | POLLHUP))) {
+                redisAsyncHandleRead(ac_);
+            }
+            // the context is gone if reading found the connection closed
+            if (ac_ && (revents & POLLOUT)) {
+                redisAsyncHandleWrite(ac_);
+            }
+        }
+        check_timer();
+    }
+
+    if (ac_) {
+        redisAsyncFree(ac_);
+        ac_ = nullptr;
+    }
+    fail_queue("AsyncRedisClient closed!");
+}
+
+AsyncRedisClient::AsyncRedisClient() { impl_ = new AsyncRedisClientImpl; }
+
+AsyncRedisClient::~AsyncRedisClient() {
+    if (impl_) {
+        AsyncRedisClientImpl* cli = (AsyncRedisClientImpl*) impl_;
+        cli->stop();
+        delete cli;
+    }
+}
+
+void AsyncRedisClient::init(const std::string& host, uint32_t port, const std::string& pwd) {
+    init(host, port, pwd, RedisClient::options_t());
+}
+
+void AsyncRedisClient::init(const std::string& host, uint32_t port, const std::string& pwd,
+                            const RedisClient::options_t& opts) {
+    AsyncRedisClientImpl* cli = (AsyncRedisClientImpl*) impl_;
+    cli->host_ = host;
+    cli->port_ = port;
+    cli->pwd_ = pwd;
+    cli->opts_ = opts;
+}
+
+std::string AsyncRedisClient::get_last_error() {
+    AsyncRedisClientImpl* cli = (AsyncRedisClientImpl*) impl_;
+    std::lock_guard<std::mutex> lock(cli->mutex_);
+    return cli->error_str_;
+}
+
+bool AsyncRedisClient::connect() {
+    AsyncRedisClientImpl* cli = (AsyncRedisClientImpl*) impl_;
+    if (!cli->start()) {
+        return false;
+    }
+    // a PING behind the AUTH tells whether the connection is usable, the I/O
+    // thread fails it after the connect or the command timeout
+    std::future<status_result_t> fut = with_future<status_result_t>(
+      [&](status_cb_t cb) { commanda_for_status(std::move(cb), "PING"); });
+    status_result_t result = fut.get();
+    if (result.err != RCLI_RET_OK) {
+        std::lock_guard<std::mutex> lock(cli->mutex_);
+        if (cli->error_str_.empty()) {
+            cli->error_str_ = result.error;
+        }
+        return false;
+    }
+    return true;
+}
+
+void AsyncRedisClient::close() {
+    AsyncRedisClientImpl* cli = (AsyncRedisClientImpl*) impl_;
+    cli->stop();
+}
+
+size_t AsyncRedisClient::pending() {
+    AsyncRedisClientImpl* cli = (AsyncRedisClientImpl*) impl_;
+    return cli->pending_.load();
+}
+
+template <class T>
+static void submit_formatted(AsyncRedisClientImpl* cli, std::string& cmd,
+                             std::function<void(RedisAsyncResult<T>&)> cb) {
+    typed_request<T>* req = new typed_request<T>;
+    req->cb = std::move(cb);
+    req->cmd.swap(cmd);
+    cli->submit(req);
+}
+
+template <class T>
+static void submit_command(AsyncRedisClientImpl* cli, const std::vector<std::string>& cmd,
+                           std::function<void(RedisAsyncResult<T>&)> cb) {
+    std::string buf;
+    RedisCommandEncoder enc(buf);
+    enc.begin(cmd.size());
+    for (auto& arg : cmd) {
+        enc.arg(arg);
+    }
+    submit_formatted<T>(cli, buf, std::move(cb));
+}
+
+void AsyncRedisClient::command_for_status(const std::vector<std::string>& cmd, status_cb_t cb) {
+    submit_command<bool>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::command_for_integer(const std::vector<std::string>& cmd, integer_cb_t cb) {
+    submit_command<int64_t>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::command_for_double(const std::vector<std::string>& cmd, double_cb_t cb) {
+    submit_command<double>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::command_for_string(const std::vector<std::string>& cmd, string_cb_t cb) {
+    submit_command<std::string>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::command_for_vector(const std::vector<std::string>& cmd, vector_cb_t cb) {
+    submit_command<std::vector<std::string>>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::formatted_for_status(std::string& cmd, status_cb_t cb) {
+    submit_formatted<bool>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::formatted_for_integer(std::string& cmd, integer_cb_t cb) {
+    submit_formatted<int64_t>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::formatted_for_double(std::string& cmd, double_cb_t cb) {
+    submit_formatted<double>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::formatted_for_string(std::string& cmd, string_cb_t cb) {
+    submit_formatted<std::string>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
+
+void AsyncRedisClient::formatted_for_vector(std::string& cmd, vector_cb_t cb) {
+    submit_formatted<std::vector<std::string>>((AsyncRedisClientImpl*) impl_, cmd, std::move(cb));
+}
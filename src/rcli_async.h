@@ -0,0 +1,292 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include <functional>
+#include <future>
+
+template <class T>
+struct RedisAsyncResult {
+    int err = RCLI_ERROR;
+    std::string error;
+    T value = T();
+};
+
+// Non-blocking counterpart of RedisClient on a single connection.
+//
+// Commands are queued by the calling thread and written by an internal I/O
+// thread, so many requests can be in flight at once. Every command takes a
+// callback, which runs on the I/O thread and must not block, or returns a
+// future when called without one.
+//
+//     AsyncRedisClient acli;
+//     acli.init("127.0.0.1", 6379, "pwd");
+//     acli.connect();
+//     acli.set("key", "val", [](AsyncRedisClient::status_result_t& r) { ... });
+//     auto fut = acli.get("key");
+//     if (fut.get().err == RCLI_RET_OK) { ... }
+class AsyncRedisClient {
+public:
+    typedef RedisAsyncResult<bool> status_result_t;
+    typedef RedisAsyncResult<int64_t> integer_result_t;
+    typedef RedisAsyncResult<double> double_result_t;
+    typedef RedisAsyncResult<std::string> string_result_t;
+    typedef RedisAsyncResult<std::vector<std::string>> vector_result_t;
+
+    typedef std::function<void(status_result_t&)> status_cb_t;
+    typedef std::function<void(integer_result_t&)> integer_cb_t;
+    typedef std::function<void(double_result_t&)> double_cb_t;
+    typedef std::function<void(string_result_t&)> string_cb_t;
+    typedef std::function<void(vector_result_t&)> vector_cb_t;
+
+    AsyncRedisClient();
+    virtual ~AsyncRedisClient();
+
+    AsyncRedisClient(const AsyncRedisClient&) = delete;
+    AsyncRedisClient& operator=(const AsyncRedisClient&) = delete;
+
+    void init(const std::string& host, uint32_t port, const std::string& pwd);
+    // connect_timeout_ms bounds the connect, command_timeout_ms how long the
+    // commands in flight wait without a byte read or written before they all
+    // fail with RCLI_TIMEOUT and the connection is dropped. opts.tls is not supported
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const RedisClient::options_t& opts);
+    std::string get_last_error();
+
+    // connect, authenticate and start the I/O thread. a lost connection is
+    // reopened by the I/O thread when the next command is queued.
+    bool connect();
+    // stop the I/O thread, pending callbacks receive RCLI_ERROR
+    void close();
+
+    // number of commands queued or waiting for a reply
+    size_t pending();
+
+    void command_for_status(const std::vector<std::string>& cmd, status_cb_t cb);
+    void command_for_integer(const std::vector<std::string>& cmd, integer_cb_t cb);
+    void command_for_double(const std::vector<std::string>& cmd, double_cb_t cb);
+    void command_for_string(const std::vector<std::string>& cmd, string_cb_t cb);
+    void command_for_vector(const std::vector<std::string>& cmd, vector_cb_t cb);
+
+    // arguments are encoded by RedisCommandEncoder, see RedisClient::commanda_for_*,
+    // e.g. commanda_for_integer(cb, "HINCRBY", key, field, 1)
+    template <class... Args>
+    void commanda_for_status(status_cb_t cb, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        formatted_for_status(cmd, std::move(cb));
+    }
+    template <class... Args>
+    void commanda_for_integer(integer_cb_t cb, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        formatted_for_integer(cmd, std::move(cb));
+    }
+    template <class... Args>
+    void commanda_for_double(double_cb_t cb, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        formatted_for_double(cmd, std::move(cb));
+    }
+    template <class... Args>
+    void commanda_for_string(string_cb_t cb, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        formatted_for_string(cmd, std::move(cb));
+    }
+    template <class... Args>
+    void commanda_for_vector(vector_cb_t cb, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        formatted_for_vector(cmd, std::move(cb));
+    }
+
+    // keys
+
+    void exist(const std::string& key, status_cb_t cb) { commanda_for_status(std::move(cb), "EXISTS", key); }
+    std::future<status_result_t> exist(const std::string& key) {
+        return with_future<status_result_t>([&](status_cb_t cb) { exist(key, std::move(cb)); });
+    }
+
+    void get(const std::string& key, string_cb_t cb) { commanda_for_string(std::move(cb), "GET", key); }
+    std::future<string_result_t> get(const std::string& key) {
+        return with_future<string_result_t>([&](string_cb_t cb) { get(key, std::move(cb)); });
+    }
+
+    void set(const std::string& key, const std::string& in, status_cb_t cb) {
+        commanda_for_status(std::move(cb), "SET", key, in);
+    }
+    std::future<status_result_t> set(const std::string& key, const std::string& in) {
+        return with_future<status_result_t>([&](status_cb_t cb) { set(key, in, std::move(cb)); });
+    }
+
+    void del(const std::string& key, status_cb_t cb) { commanda_for_status(std::move(cb), "DEL", key); }
+    std::future<status_result_t> del(const std::string& key) {
+        return with_future<status_result_t>([&](status_cb_t cb) { del(key, std::move(cb)); });
+    }
+
+    void expire(const std::string& key, uint32_t second, status_cb_t cb) {
+        commanda_for_status(std::move(cb), "EXPIRE", key, second);
+    }
+    std::future<status_result_t> expire(const std::string& key, uint32_t second) {
+        return with_future<status_result_t>([&](status_cb_t cb) { expire(key, second, std::move(cb)); });
+    }
+
+    void expireat(const std::string& key, uint32_t timestamp, status_cb_t cb) {
+        commanda_for_status(std::move(cb), "EXPIREAT", key, timestamp);
+    }
+    std::future<status_result_t> expireat(const std::string& key, uint32_t timestamp) {
+        return with_future<status_result_t>([&](status_cb_t cb) { expireat(key, timestamp, std::move(cb)); });
+    }
+
+    void pexpire(const std::string& key, uint32_t milliseconds, status_cb_t cb) {
+        commanda_for_status(std::move(cb), "PEXPIRE", key, milliseconds);
+    }
+    std::future<status_result_t> pexpire(const std::string& key, uint32_t milliseconds) {
+        return with_future<status_result_t>([&](status_cb_t cb) { pexpire(key, milliseconds, std::move(cb)); });
+    }
+
+    // hash map
+
+    void hexist(const std::string& key, const std::string& field, status_cb_t cb) {
+        commanda_for_status(std::move(cb), "HEXISTS", key, field);
+    }
+    std::future<status_result_t> hexist(const std::string& key, const std::string& field) {
+        return with_future<status_result_t>([&](status_cb_t cb) { hexist(key, field, std::move(cb)); });
+    }
+
+    void hget(const std::string& key, const std::string& field, string_cb_t cb) {
+        commanda_for_string(std::move(cb), "HGET", key, field);
+    }
+    std::future<string_result_t> hget(const std::string& key, const std::string& field) {
+        return with_future<string_result_t>([&](string_cb_t cb) { hget(key, field, std::move(cb)); });
+    }
+
+    void hset(const std::string& key, const std::string& field, const std::string& in, integer_cb_t cb) {
+        commanda_for_integer(std::move(cb), "HSET", key, field, in);
+    }
+    std::future<integer_result_t> hset(const std::string& key, const std::string& field, const std::string& in) {
+        return with_future<integer_result_t>([&](integer_cb_t cb) { hset(key, field, in, std::move(cb)); });
+    }
+
+    void hincrby(const std::string& key, const std::string& field, int64_t in, integer_cb_t cb) {
+        commanda_for_integer(std::move(cb), "HINCRBY", key, field, in);
+    }
+    std::future<integer_result_t> hincrby(const std::string& key, const std::string& field, int64_t in) {
+        return with_future<integer_result_t>([&](integer_cb_t cb) { hincrby(key, field, in, std::move(cb)); });
+    }
+
+    void hdel(const std::string& key, const std::string& field, status_cb_t cb) {
+        commanda_for_status(std::move(cb), "HDEL", key, field);
+    }
+    std::future<status_result_t> hdel(const std::string& key, const std::string& field) {
+        return with_future<status_result_t>([&](status_cb_t cb) { hdel(key, field, std::move(cb)); });
+    }
+
+    void hkeys(const std::string& key, vector_cb_t cb) { commanda_for_vector(std::move(cb), "HKEYS", key); }
+    std::future<vector_result_t> hkeys(const std::string& key) {
+        return with_future<vector_result_t>([&](vector_cb_t cb) { hkeys(key, std::move(cb)); });
+    }
+
+    // sorted set
+
+    void zadd(const std::string& key, const RedisClient::score_member_t& in, integer_cb_t cb) {
+        commanda_for_integer(std::move(cb), "ZADD", key, in.first, in.second);
+    }
+    std::future<integer_result_t> zadd(const std::string& key, const RedisClient::score_member_t& in) {
+        return with_future<integer_result_t>([&](integer_cb_t cb) { zadd(key, in, std::move(cb)); });
+    }
+
+    void zadd(const std::string& key, const std::vector<RedisClient::score_member_t>& in, integer_cb_t cb) {
+        std::string cmd;
+        RedisCommandEncoder enc(cmd);
+        enc.begin(2 + in.size() * 2);
+        enc.arg("ZADD");
+        enc.arg(key);
+        for (auto& kv : in) {
+            enc.arg(kv.first);
+            enc.arg(kv.second);
+        }
+        formatted_for_integer(cmd, std::move(cb));
+    }
+    std::future<integer_result_t> zadd(const std::string& key, const std::vector<RedisClient::score_member_t>& in) {
+        return with_future<integer_result_t>([&](integer_cb_t cb) { zadd(key, in, std::move(cb)); });
+    }
+
+    void zcard(const std::string& key, integer_cb_t cb) { commanda_for_integer(std::move(cb), "ZCARD", key); }
+    std::future<integer_result_t> zcard(const std::string& key) {
+        return with_future<integer_result_t>([&](integer_cb_t cb) { zcard(key, std::move(cb)); });
+    }
+
+    void zincrby(const std::string& key, const RedisClient::incre_member_t& in, double_cb_t cb) {
+        commanda_for_double(std::move(cb), "ZINCRBY", key, in.first, in.second);
+    }
+    std::future<double_result_t> zincrby(const std::string& key, const RedisClient::incre_member_t& in) {
+        return with_future<double_result_t>([&](double_cb_t cb) { zincrby(key, in, std::move(cb)); });
+    }
+
+    void zrange(const std::string& key, int32_t start, int32_t stop, bool withscore, vector_cb_t cb) {
+        if (withscore) {
+            commanda_for_vector(std::move(cb), "ZRANGE", key, start, stop, "WITHSCORES");
+        } else {
+            commanda_for_vector(std::move(cb), "ZRANGE", key, start, stop);
+        }
+    }
+    std::future<vector_result_t> zrange(const std::string& key, int32_t start, int32_t stop, bool withscore = false) {
+        return with_future<vector_result_t>(
+          [&](vector_cb_t cb) { zrange(key, start, stop, withscore, std::move(cb)); });
+    }
+
+    void zrangebyscore(const std::string& key, double min, double max, bool withscore, vector_cb_t cb) {
+        if (withscore) {
+            commanda_for_vector(std::move(cb), "ZRANGEBYSCORE", key, min, max, "WITHSCORES");
+        } else {
+            commanda_for_vector(std::move(cb), "ZRANGEBYSCORE", key, min, max);
+        }
+    }
+    std::future<vector_result_t> zrangebyscore(const std::string& key, double min, double max,
+                                               bool withscore = false) {
+        return with_future<vector_result_t>(
+          [&](vector_cb_t cb) { zrangebyscore(key, min, max, withscore, std::move(cb)); });
+    }
+
+    void zrank(const std::string& key, const std::string& member, integer_cb_t cb) {
+        commanda_for_integer(std::move(cb), "ZRANK", key, member);
+    }
+    std::future<integer_result_t> zrank(const std::string& key, const std::string& member) {
+        return with_future<integer_result_t>([&](integer_cb_t cb) { zrank(key, member, std::move(cb)); });
+    }
+
+    void zscore(const std::string& key, const std::string& member, double_cb_t cb) {
+        commanda_for_double(std::move(cb), "ZSCORE", key, member);
+    }
+    std::future<double_result_t> zscore(const std::string& key, const std::string& member) {
+        return with_future<double_result_t>([&](double_cb_t cb) { zscore(key, member, std::move(cb)); });
+    }
+
+    void zrem(const std::string& key, const std::string& member, integer_cb_t cb) {
+        commanda_for_integer(std::move(cb), "ZREM", key, member);
+    }
+    std::future<integer_result_t> zrem(const std::string& key, const std::string& member) {
+        return with_future<integer_result_t>([&](integer_cb_t cb) { zrem(key, member, std::move(cb)); });
+    }
+
+private:
+    // queue a command already in RESP, cmd is taken over
+    void formatted_for_status(std::string& cmd, status_cb_t cb);
+    void formatted_for_integer(std::string& cmd, integer_cb_t cb);
+    void formatted_for_double(std::string& cmd, double_cb_t cb);
+    void formatted_for_string(std::string& cmd, string_cb_t cb);
+    void formatted_for_vector(std::string& cmd, vector_cb_t cb);
+
+    // call the callback flavour of a command with a callback fulfilling a promise
+    template <class R, class F>
+    std::future<R> with_future(F issue) {
+        std::shared_ptr<std::promise<R>> promise(new std::promise<R>);
+        issue([promise](R& result) { promise->set_value(std::move(result)); });
+        return promise->get_future();
+    }
+
+    void* impl_ = nullptr;
+};
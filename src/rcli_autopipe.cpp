@@ -0,0 +1,168 @@
+#include "rcli_autopipe.h"
+#include "rcli_pipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace {
+
+thread_local std::string t_last_error;
+thread_local int t_last_status = RCLI_RET_OK;
+
+// a call waiting on the stack of its thread
+typedef struct auto_call {
+    const std::string* cmd;
+    int type;
+    void* retval;
+    int err = RCLI_ERROR;
+    std::string error;
+    bool done = false;
+} auto_call_t;
+
+// pipeline taking commands already encoded by the callers
+class RedisAutoBatch : public RedisPipeline {
+public:
+    explicit RedisAutoBatch(RedisClient* cli) : RedisPipeline(cli) {}
+
+    // the CALL_* of RedisAutoPipeline in the order of the SLOT_*
+    void add(const std::string& cmd, int type, void* retval) {
+        static const int slot_types[] = {SLOT_STATUS, SLOT_INTEGER, SLOT_DOUBLE, SLOT_STRING, SLOT_VECTOR};
+        encoder();
+        buf_.append(cmd);
+        add_slot(slot_types[type], retval);
+    }
+};
+
+}  // namespace
+
+class RedisAutoPipelineImpl {
+public:
+    RedisAutoPipelineImpl() : batch_(&cli_) {}
+
+    int submit(const std::string& cmd, int type, void* retval);
+
+    // write a batch of what is queued and hand out the replies, called with mutex_ held
+    void flush(std::unique_lock<std::mutex>& lock);
+
+    RedisAutoPipeline::auto_options_t opts_;
+    RedisClient cli_;
+    // only used by the flusher
+    RedisAutoBatch batch_;
+    std::vector<auto_call_t*> sending_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<auto_call_t*> queue_;
+    bool flushing_ = false;
+    RedisAutoPipeline::auto_stats_t stats_;
+};
+
+int RedisAutoPipelineImpl::submit(const std::string& cmd, int type, void* retval) {
+    auto_call_t call;
+    call.cmd = &cmd;
+    call.type = type;
+    call.retval = retval;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_.push_back(&call);
+    if (flushing_ && opts_.window_us > 0 && queue_.size() >= opts_.max_batch) {
+        // a flusher waiting out the window can go now
+        cond_.notify_all();
+    }
+    while (!call.done) {
+        if (flushing_) {
+            cond_.wait(lock);
+            continue;
+        }
+        // the connection is free: this caller sends what is queued, its own
+        // command included unless the queue holds more than a batch
+        flushing_ = true;
+        flush(lock);
+        flushing_ = false;
+        cond_.notify_all();
+    }
+    lock.unlock();
+
+    t_last_status = call.err;
+    t_last_error.swap(call.error);
+    return call.err;
+}
+
+void RedisAutoPipelineImpl::flush(std::unique_lock<std::mutex>& lock) {
+    size_t max_batch = std::max<size_t>(opts_.max_batch, 1);
+    if (opts_.window_us > 0 && queue_.size() < max_batch) {
+        cond_.wait_for(lock, std::chrono::microseconds(opts_.window_us),
+                       [&] { return queue_.size() >= max_batch; });
+    }
+    size_t n = std::min(queue_.size(), max_batch);
+    sending_.assign(queue_.begin(), queue_.begin() + n);
+    queue_.erase(queue_.begin(), queue_.begin() + n);
+
+    // the callers wait for done, their commands and outputs are ours until then
+    lock.unlock();
+    for (auto call : sending_) {
+        batch_.add(*call->cmd, call->type, call->retval);
+    }
+    int err = batch_.exec();
+    for (size_t i = 0; i < sending_.size(); i++) {
+        sending_[i]->err = batch_.status(i);
+        sending_[i]->error = batch_.error(i);
+    }
+    batch_.clear();
+    lock.lock();
+
+    for (auto call : sending_) {
+        call->done = true;
+    }
+    stats_.commands += n;
+    stats_.batches++;
+    stats_.max_batch = std::max<uint64_t>(stats_.max_batch, n);
+    stats_.errors += err == RCLI_RET_OK ? 0 : 1;
+    sending_.clear();
+}
+
+RedisAutoPipeline::RedisAutoPipeline() { impl_ = new RedisAutoPipelineImpl; }
+
+RedisAutoPipeline::~RedisAutoPipeline() { delete (RedisAutoPipelineImpl*) impl_; }
+
+void RedisAutoPipeline::init(const std::string& host, uint32_t port, const std::string& pwd,
+                             const auto_options_t& opts) {
+    RedisAutoPipelineImpl* impl = (RedisAutoPipelineImpl*) impl_;
+    impl->opts_ = opts;
+    impl->cli_.init(host, port, pwd, opts.conn);
+}
+
+void RedisAutoPipeline::set_stats(RedisStats* stats) {
+    RedisAutoPipelineImpl* impl = (RedisAutoPipelineImpl*) impl_;
+    impl->cli_.set_stats(stats);
+}
+
+void RedisAutoPipeline::set_health(RedisHealthMonitor* monitor) {
+    RedisAutoPipelineImpl* impl = (RedisAutoPipelineImpl*) impl_;
+    impl->cli_.set_health(monitor);
+}
+
+bool RedisAutoPipeline::connect() {
+    RedisAutoPipelineImpl* impl = (RedisAutoPipelineImpl*) impl_;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    bool ok = impl->cli_.connect();
+    t_last_status = ok ? RCLI_RET_OK : RCLI_ERROR;
+    t_last_error = ok ? std::string() : impl->cli_.get_last_error();
+    return ok;
+}
+
+const std::string& RedisAutoPipeline::get_last_error() { return t_last_error; }
+
+int RedisAutoPipeline::get_last_status() { return t_last_status; }
+
+RedisAutoPipeline::auto_stats_t RedisAutoPipeline::stats() {
+    RedisAutoPipelineImpl* impl = (RedisAutoPipelineImpl*) impl_;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    return impl->stats_;
+}
+
+int RedisAutoPipeline::submit(const std::string& cmd, int type, void* retval) {
+    RedisAutoPipelineImpl* impl = (RedisAutoPipelineImpl*) impl_;
+    return impl->submit(cmd, type, retval);
+}
@@ -0,0 +1,163 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+// One connection shared by many threads, with their commands coalesced.
+//
+// Every call queues its command and waits for the reply. One of the waiting
+// callers becomes the flusher: it takes what is queued, writes it in a single
+// write and reads the replies back into the callers' outputs, in order.
+// Commands queued meanwhile go out with the next batch, written by the first
+// of their callers to notice the connection is free, so batches grow with the
+// number of concurrent callers instead of each paying a round trip.
+//
+//     RedisAutoPipeline shared;
+//     RedisAutoPipeline::auto_options_t opts;
+//     opts.window_us = 50;
+//     shared.init("127.0.0.1", 6379, "pwd", opts);
+//     shared.connect();
+//     // on any thread
+//     shared.set("key", "val");
+//     shared.commanda_for_integer(out, "HINCRBY", key, field, 1);
+//     shared.stats().avg_batch();
+//
+// Like a pipeline a batch is written again after a reconnect only when it
+// could not be written. Commands that change the connection state (SELECT,
+// MULTI, WATCH, SUBSCRIBE, blocking reads) must not be sent through it.
+class RedisAutoPipeline {
+public:
+    typedef struct auto_options {
+        RedisClient::options_t conn;  // transport, RESP version and timeouts of the shared connection
+        // the flusher waits up to this long for the batch to fill before writing, 0 writes at once
+        uint32_t window_us = 0;
+        size_t max_batch = 512;  // commands per write
+    } auto_options_t;
+
+    typedef struct auto_stats {
+        uint64_t commands = 0;   // commands sent
+        uint64_t batches = 0;    // writes they were sent in
+        uint64_t max_batch = 0;  // most commands in one batch
+        uint64_t errors = 0;     // batches that failed on the connection
+        double avg_batch() const { return batches ? (double) commands / batches : 0; }
+    } auto_stats_t;
+
+    RedisAutoPipeline();
+    virtual ~RedisAutoPipeline();
+
+    RedisAutoPipeline(const RedisAutoPipeline&) = delete;
+    RedisAutoPipeline& operator=(const RedisAutoPipeline&) = delete;
+
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const auto_options_t& opts);
+    // set before connect(), see rcli_stats.h and rcli_health.h
+    void set_stats(RedisStats* stats);
+    void set_health(RedisHealthMonitor* monitor);
+    bool connect();
+
+    // of the calling thread's last command
+    const std::string& get_last_error();
+    int get_last_status();
+
+    // arguments are encoded by RedisCommandEncoder, see RedisClient::commanda_for_*
+    template <class... Args>
+    int commanda_for_status(const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        return submit(cmd, CALL_STATUS, nullptr);
+    }
+    template <class... Args>
+    int commanda_for_integer(int64_t& retval, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        return submit(cmd, CALL_INTEGER, &retval);
+    }
+    template <class... Args>
+    int commanda_for_double(double& retval, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        return submit(cmd, CALL_DOUBLE, &retval);
+    }
+    template <class... Args>
+    int commanda_for_string(std::string& retval, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        return submit(cmd, CALL_STRING, &retval);
+    }
+    template <class... Args>
+    int commanda_for_vector(std::vector<std::string>& retval, const Args&... args) {
+        std::string cmd;
+        RedisCommandEncoder(cmd).command(args...);
+        retval.clear();
+        return submit(cmd, CALL_VECTOR, &retval);
+    }
+
+    // keys
+
+    bool exist(const std::string& key) { return commanda_for_status("EXISTS", key) == RCLI_RET_OK; }
+
+    bool get(const std::string& key, std::string& out) { return commanda_for_string(out, "GET", key) == RCLI_RET_OK; }
+
+    bool set(const std::string& key, const std::string& in) {
+        return commanda_for_status("SET", key, in) == RCLI_RET_OK;
+    }
+
+    bool del(const std::string& key) { return commanda_for_status("DEL", key) == RCLI_RET_OK; }
+
+    bool expire(const std::string& key, uint32_t second) {
+        return commanda_for_status("EXPIRE", key, second) == RCLI_RET_OK;
+    }
+
+    // hash map
+
+    bool hget(const std::string& key, const std::string& field, std::string& out) {
+        return commanda_for_string(out, "HGET", key, field) == RCLI_RET_OK;
+    }
+
+    bool hset(const std::string& key, const std::string& field, const std::string& in, int64_t& out) {
+        return commanda_for_integer(out, "HSET", key, field, in) == RCLI_RET_OK;
+    }
+
+    bool hincrby(const std::string& key, const std::string& field, const int64_t& in, int64_t& out) {
+        return commanda_for_integer(out, "HINCRBY", key, field, in) == RCLI_RET_OK;
+    }
+
+    bool hdel(const std::string& key, const std::string& field) {
+        return commanda_for_status("HDEL", key, field) == RCLI_RET_OK;
+    }
+
+    // sorted set
+
+    bool zadd(const std::string& key, const RedisClient::score_member_t& in, int64_t& out) {
+        return commanda_for_integer(out, "ZADD", key, in.first, in.second) == RCLI_RET_OK;
+    }
+
+    bool zrange(const std::string& key, int32_t start, int32_t stop, std::vector<std::string>& out) {
+        return commanda_for_vector(out, "ZRANGE", key, start, stop) == RCLI_RET_OK;
+    }
+
+    bool zscore(const std::string& key, const std::string& member, double& out) {
+        return commanda_for_double(out, "ZSCORE", key, member) == RCLI_RET_OK;
+    }
+
+    bool zrem(const std::string& key, const std::string& member, int64_t& out) {
+        return commanda_for_integer(out, "ZREM", key, member) == RCLI_RET_OK;
+    }
+
+    auto_stats_t stats();
+
+private:
+    enum {
+        CALL_STATUS = 0,
+        CALL_INTEGER,
+        CALL_DOUBLE,
+        CALL_STRING,
+        CALL_VECTOR,
+    };
+
+    // queue cmd, RESP encoded, and wait until its reply was decoded into retval
+    int submit(const std::string& cmd, int type, void* retval);
+
+    void* impl_;
+};
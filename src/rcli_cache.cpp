@@ -0,0 +1,606 @@
+#include "rcli_cache.h"
+#include "rcli_impl.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#    include <hiredis/sockcompat.h>
+#else
+#    include <poll.h>
+#endif
+
+#define RCLI_CACHE_SHARDS 16
+
+namespace {
+
+typedef struct cache_value {
+    std::string sub;
+    std::string val;
+    int err = RCLI_RET_OK;
+    uint64_t token = 0;   // reserved by a read whose reply is not stored yet
+    uint64_t reader = 0;  // connection whose tracking reports changes of the key, 0 for BCAST
+    bool stored = false;
+    int64_t expire_us = 0;
+} cache_value_t;
+
+typedef struct cache_node {
+    std::list<std::string>::iterator lru;
+    std::vector<cache_value_t> values;
+} cache_node_t;
+
+// keys hashed to one lock, the lru front is the most recently used key
+typedef struct cache_shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, cache_node_t> nodes;
+    std::list<std::string> lru;
+    size_t entries = 0;
+    size_t bytes = 0;
+} cache_shard_t;
+
+size_t key_hash(const RedisStringView& key) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key.size(); i++) {
+        hash = (hash ^ (uint8_t) key.data()[i]) * 16777619u;
+    }
+    return hash;
+}
+
+size_t value_bytes(const std::string& key, const cache_value_t& value) {
+    return key.size() + value.sub.size() + value.val.size();
+}
+
+}  // namespace
+
+class RedisNearCacheImpl {
+public:
+    RedisNearCacheImpl()
+      : client_id_(0), next_token_(1), running_(false), hits_(0), misses_(0), invalidations_(0), flushes_(0),
+        evictions_(0), expired_(0) {}
+
+    cache_shard_t& shard(const RedisStringView& key) { return shards_[key_hash(key) % RCLI_CACHE_SHARDS]; }
+    void erase_node(cache_shard_t& shard, std::unordered_map<std::string, cache_node_t>::iterator it);
+    // the node goes with its last value
+    void erase_value(cache_shard_t& shard, std::unordered_map<std::string, cache_node_t>::iterator it,
+                     std::vector<cache_value_t>::iterator value);
+    void evict(cache_shard_t& shard);
+    void flush_all();
+
+    bool start();
+    void stop();
+    void run();
+    // connect, HELLO 3 and CLIENT ID, then BCAST tracking if asked
+    bool open();
+    // drop the connection and every entry
+    void close(const std::string& error);
+    void read_pushes();
+    void heartbeat();
+    void set_error(const std::string& error);
+    static void on_push(void* privdata, void* reply);
+
+    std::string host_;
+    uint32_t port_ = 0;
+    std::string pwd_;
+    RedisNearCache::cache_options_t opts_;
+    RedisClient::options_t conn_opts_;
+    size_t shard_entries_ = 0;
+    size_t shard_bytes_ = 0;
+
+    cache_shard_t shards_[RCLI_CACHE_SHARDS];
+
+    // 0 while the connection is down, nothing is served or stored then
+    std::atomic<uint64_t> client_id_;
+    std::atomic<uint64_t> next_token_;
+
+    // owned by the cache thread, or start() before it runs
+    CSmartPtr<redisContext, redisFree> ctx_;
+    bool ping_pending_ = false;
+    int64_t ping_us_ = 0;
+
+    std::atomic<bool> running_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::string error_str_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> invalidations_;
+    std::atomic<uint64_t> flushes_;
+    std::atomic<uint64_t> evictions_;
+    std::atomic<uint64_t> expired_;
+};
+
+void RedisNearCacheImpl::erase_node(cache_shard_t& shard, std::unordered_map<std::string, cache_node_t>::iterator it) {
+    for (auto& value : it->second.values) {
+        if (value.stored) {
+            shard.entries--;
+            shard.bytes -= value_bytes(it->first, value);
+        }
+    }
+    shard.lru.erase(it->second.lru);
+    shard.nodes.erase(it);
+}
+
+void RedisNearCacheImpl::erase_value(cache_shard_t& shard, std::unordered_map<std::string, cache_node_t>::iterator it,
+                                     std::vector<cache_value_t>::iterator value) {
+    if (value->stored) {
+        shard.entries--;
+        shard.bytes -= value_bytes(it->first, *value);
+    }
+    it->second.values.erase(value);
+    if (it->second.values.empty()) {
+        shard.lru.erase(it->second.lru);
+        shard.nodes.erase(it);
+    }
+}
+
+void RedisNearCacheImpl::evict(cache_shard_t& shard) {
+    while (!shard.lru.empty()
+           && (shard.entries > shard_entries_ || (shard_bytes_ > 0 && shard.bytes > shard_bytes_))) {
+        erase_node(shard, shard.nodes.find(shard.lru.back()));
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void RedisNearCacheImpl::flush_all() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.nodes.clear();
+        shard.lru.clear();
+        shard.entries = 0;
+        shard.bytes = 0;
+    }
+    flushes_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool RedisNearCacheImpl::start() {
+    if (running_) {
+        return true;
+    }
+    bool ok = open();
+    running_ = true;
+    thread_ = std::thread(&RedisNearCacheImpl::run, this);
+    return ok;
+}
+
+void RedisNearCacheImpl::stop() {
+    if (!running_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        cond_.notify_one();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (ctx_) {
+        close("RedisNearCache stopped");
+    }
+}
+
+void RedisNearCacheImpl::run() {
+    while (running_) {
+        if (ctx_ == nullptr) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait_for(lock, std::chrono::milliseconds(opts_.interval_ms), [this] { return !running_; });
+            }
+            if (running_) {
+                open();
+            }
+            continue;
+        }
+        struct pollfd pfd;
+        pfd.fd = ctx_->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 100) > 0) {
+            read_pushes();
+        }
+        if (ctx_) {
+            heartbeat();
+        }
+    }
+}
+
+bool RedisNearCacheImpl::open() {
+    std::string error;
+    ctx_.reset(RedisClientImpl::open(host_, port_, conn_opts_, error));
+    redisContext* ctx = ctx_.get();
+    if (ctx == nullptr) {
+        set_error(error);
+        return false;
+    }
+    ctx->privdata = this;
+    redisSetPushCallback(ctx, &RedisNearCacheImpl::on_push);
+
+    RedisClientImpl conv;
+    CSmartPtr<void, freeReplyObject> hello_sp(
+      pwd_.empty() ? redisCommand(ctx, "HELLO 3")
+                   : redisCommand(ctx, "HELLO 3 AUTH default %b", pwd_.data(), pwd_.size()));
+    const redisReply* hello = (const redisReply*) hello_sp.get();
+    if (hello == nullptr || hello->type != REDIS_REPLY_MAP) {
+        // without RESP3 no push would ever arrive
+        conv.check_reply_type(hello);
+        std::string error = hello ? conv.error_str_ : ctx->errstr;
+        set_error("RedisNearCache needs RESP3, HELLO 3: " + (error.empty() ? "not a map" : error));
+        ctx_.reset();
+        return false;
+    }
+
+    int64_t id = 0;
+    CSmartPtr<void, freeReplyObject> id_sp(redisCommand(ctx, "CLIENT ID"));
+    if (conv.get_reply_integer((const redisReply*) id_sp.get(), id) != RCLI_RET_OK || id <= 0) {
+        set_error("CLIENT ID: " + conv.error_str_);
+        ctx_.reset();
+        return false;
+    }
+    if (opts_.bcast) {
+        std::vector<const char*> argv = {"CLIENT", "TRACKING", "ON", "BCAST"};
+        std::vector<size_t> argvlen = {6, 8, 2, 5};
+        for (auto& prefix : opts_.prefixes) {
+            argv.push_back("PREFIX");
+            argvlen.push_back(6);
+            argv.push_back(prefix.data());
+            argvlen.push_back(prefix.size());
+        }
+        CSmartPtr<void, freeReplyObject> reply_sp(redisCommandArgv(ctx, (int) argv.size(), &argv[0], &argvlen[0]));
+        if (conv.get_reply_status((const redisReply*) reply_sp.get()) != RCLI_RET_OK) {
+            set_error("CLIENT TRACKING: " + conv.error_str_);
+            ctx_.reset();
+            return false;
+        }
+    }
+    ping_pending_ = false;
+    ping_us_ = RedisCallRecorder::now_us();
+    set_error("");
+    client_id_ = (uint64_t) id;
+    return true;
+}
+
+void RedisNearCacheImpl::close(const std::string& error) {
+    // clients stop reserving before the entries go, see reserve()
+    client_id_ = 0;
+    flush_all();
+    ctx_.reset();
+    set_error(error);
+}
+
+void RedisNearCacheImpl::read_pushes() {
+    redisContext* ctx = ctx_.get();
+    if (redisBufferRead(ctx) != REDIS_OK) {
+        close(ctx->errstr);
+        return;
+    }
+    void* reply = nullptr;
+    while (redisGetReplyFromReader(ctx, &reply) == REDIS_OK && reply) {
+        if (redisIsPushReply(reply)) {
+            // the callback owns the reply, as with redisGetReply
+            ctx->push_cb(ctx->privdata, reply);
+        } else {
+            // only PINGs are sent once tracking is set up
+            ping_pending_ = false;
+            freeReplyObject(reply);
+        }
+        reply = nullptr;
+    }
+    if (ctx->err) {
+        close(ctx->errstr);
+    }
+}
+
+void RedisNearCacheImpl::heartbeat() {
+    // a connection that silently went away would leave stale entries behind
+    int64_t now = RedisCallRecorder::now_us();
+    if (ping_pending_) {
+        if (now - ping_us_ > (int64_t) opts_.timeout_ms * 1000) {
+            close("PING timeout");
+        }
+        return;
+    }
+    if (now - ping_us_ < (int64_t) opts_.interval_ms * 1000) {
+        return;
+    }
+    int done = 0;
+    if (redisAppendCommand(ctx_.get(), "PING") != REDIS_OK || redisBufferWrite(ctx_.get(), &done) != REDIS_OK) {
+        close(ctx_->errstr);
+        return;
+    }
+    ping_pending_ = true;
+    ping_us_ = now;
+}
+
+void RedisNearCacheImpl::set_error(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_str_ = error;
+}
+
+void RedisNearCacheImpl::on_push(void* privdata, void* reply) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) privdata;
+    CSmartPtr<void, freeReplyObject> reply_sp(reply);
+    const redisReply* r = (const redisReply*) reply;
+    // >2 "invalidate" [key ...], nil instead of the keys after FLUSHALL
+    if (r->elements != 2 || r->element[0]->type != REDIS_REPLY_STRING
+        || strcasecmp(r->element[0]->str, "invalidate") != 0) {
+        return;
+    }
+    const redisReply* keys = r->element[1];
+    if (keys->type != REDIS_REPLY_ARRAY) {
+        impl->flush_all();
+        return;
+    }
+    for (size_t i = 0; i < keys->elements; i++) {
+        RedisStringView key(keys->element[i]->str, keys->element[i]->len);
+        cache_shard_t& shard = impl->shard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.nodes.find(key.to_string());
+        if (it != shard.nodes.end()) {
+            impl->erase_node(shard, it);
+        }
+        impl->invalidations_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+RedisNearCache::RedisNearCache() { impl_ = new RedisNearCacheImpl; }
+
+RedisNearCache::~RedisNearCache() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    impl->stop();
+    delete impl;
+}
+
+void RedisNearCache::init(const std::string& host, uint32_t port, const std::string& pwd,
+                          const cache_options_t& opts) {
+    init(host, port, pwd, opts, RedisClient::options_t());
+}
+
+void RedisNearCache::init(const std::string& host, uint32_t port, const std::string& pwd, const cache_options_t& opts,
+                          const RedisClient::options_t& conn_opts) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    impl->host_ = host;
+    impl->port_ = port;
+    impl->pwd_ = pwd;
+    impl->opts_ = opts;
+    impl->opts_.interval_ms = opts.interval_ms > 0 ? opts.interval_ms : 1;
+    impl->opts_.timeout_ms = opts.timeout_ms > 0 ? opts.timeout_ms : 1;
+    impl->conn_opts_ = conn_opts;
+    impl->conn_opts_.connect_timeout_ms = impl->opts_.timeout_ms;
+    impl->conn_opts_.command_timeout_ms = impl->opts_.timeout_ms;
+    impl->shard_entries_ = (std::max<size_t>(opts.max_entries, 1) + RCLI_CACHE_SHARDS - 1) / RCLI_CACHE_SHARDS;
+    impl->shard_bytes_ = (opts.max_bytes + RCLI_CACHE_SHARDS - 1) / RCLI_CACHE_SHARDS;
+}
+
+std::string RedisNearCache::get_last_error() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    return impl->error_str_;
+}
+
+bool RedisNearCache::start() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    return impl->start();
+}
+
+void RedisNearCache::stop() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    impl->stop();
+}
+
+uint64_t RedisNearCache::client_id() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    return impl->client_id_.load();
+}
+
+bool RedisNearCache::is_bcast() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    return impl->opts_.bcast;
+}
+
+std::vector<std::string> RedisNearCache::tracking_command(uint64_t id) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    if (impl->opts_.bcast) {
+        return std::vector<std::string>();
+    }
+    return {"CLIENT", "TRACKING", "ON", "REDIRECT", std::to_string(id)};
+}
+
+bool RedisNearCache::cacheable(const RedisStringView& key) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    if (!impl->opts_.bcast || impl->opts_.prefixes.empty()) {
+        return true;
+    }
+    for (auto& prefix : impl->opts_.prefixes) {
+        if (key.size() >= prefix.size() && memcmp(key.data(), prefix.data(), prefix.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RedisNearCache::lookup(const RedisStringView& key, const std::string& sub, std::string& out, int& err) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    if (impl->client_id_.load(std::memory_order_relaxed) == 0 || !cacheable(key)) {
+        return false;
+    }
+    cache_shard_t& shard = impl->shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.nodes.find(key.to_string());
+    if (it != shard.nodes.end()) {
+        auto& values = it->second.values;
+        for (auto value = values.begin(); value != values.end(); ++value) {
+            if (value->sub != sub || !value->stored || value->token != 0) {
+                continue;
+            }
+            if (value->expire_us > 0 && value->expire_us <= RedisCallRecorder::now_us()) {
+                impl->erase_value(shard, it, value);
+                impl->expired_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+            err = value->err;
+            if (err == RCLI_RET_OK) {
+                out = value->val;
+            }
+            impl->hits_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    impl->misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+uint64_t RedisNearCache::reserve(const RedisStringView& key, const std::string& sub, uint64_t id, uint64_t reader) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    if (id == 0 || !cacheable(key)) {
+        return 0;
+    }
+    uint64_t token = impl->next_token_.fetch_add(1, std::memory_order_relaxed);
+    cache_shard_t& shard = impl->shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // checked under the shard lock, a lost connection clears the id before the shards
+    if (impl->client_id_.load() != id) {
+        return 0;
+    }
+    auto it = shard.nodes.find(key.to_string());
+    if (it == shard.nodes.end()) {
+        shard.lru.push_front(key.to_string());
+        it = shard.nodes.emplace(shard.lru.front(), cache_node_t()).first;
+        it->second.lru = shard.lru.begin();
+    }
+    for (auto& value : it->second.values) {
+        if (value.sub == sub) {
+            value.token = token;
+            value.reader = reader;
+            return token;
+        }
+    }
+    cache_value_t value;
+    value.sub = sub;
+    value.token = token;
+    value.reader = reader;
+    it->second.values.emplace_back(std::move(value));
+    return token;
+}
+
+void RedisNearCache::store(uint64_t token, const RedisStringView& key, const std::string& sub, const std::string& val,
+                           int err) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    if (token == 0) {
+        return;
+    }
+    cache_shard_t& shard = impl->shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.nodes.find(key.to_string());
+    if (it == shard.nodes.end()) {
+        // invalidated while the reply was on its way
+        return;
+    }
+    for (auto& value : it->second.values) {
+        if (value.sub != sub || value.token != token) {
+            continue;
+        }
+        if (value.stored) {
+            shard.entries--;
+            shard.bytes -= value_bytes(it->first, value);
+        }
+        value.val = err == RCLI_RET_OK ? val : std::string();
+        value.err = err;
+        value.token = 0;
+        value.stored = true;
+        value.expire_us = impl->opts_.ttl_ms > 0 ? RedisCallRecorder::now_us() + (int64_t) impl->opts_.ttl_ms * 1000
+                                                 : 0;
+        shard.entries++;
+        shard.bytes += value_bytes(it->first, value);
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+        impl->evict(shard);
+        return;
+    }
+}
+
+void RedisNearCache::release(uint64_t token, const RedisStringView& key, const std::string& sub) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    if (token == 0) {
+        return;
+    }
+    cache_shard_t& shard = impl->shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.nodes.find(key.to_string());
+    if (it == shard.nodes.end()) {
+        return;
+    }
+    auto& values = it->second.values;
+    for (auto value = values.begin(); value != values.end(); ++value) {
+        if (value->sub == sub && value->token == token) {
+            impl->erase_value(shard, it, value);
+            return;
+        }
+    }
+}
+
+uint64_t RedisNearCache::new_reader() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    return impl->next_token_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RedisNearCache::drop_reader(uint64_t reader) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    if (reader == 0) {
+        return;
+    }
+    for (auto& shard : impl->shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.nodes.begin(); it != shard.nodes.end();) {
+            auto next = std::next(it);
+            auto& values = it->second.values;
+            for (size_t i = values.size(); i > 0; i--) {
+                if (values[i - 1].reader == reader) {
+                    // from the back, so only the value at 0 can take the node with it
+                    impl->erase_value(shard, it, values.begin() + (i - 1));
+                    impl->invalidations_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            it = next;
+        }
+    }
+}
+
+void RedisNearCache::invalidate(const RedisStringView& key) {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    cache_shard_t& shard = impl->shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.nodes.find(key.to_string());
+    if (it != shard.nodes.end()) {
+        impl->erase_node(shard, it);
+    }
+    impl->invalidations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RedisNearCache::flush() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    impl->flush_all();
+}
+
+RedisNearCache::cache_stats_t RedisNearCache::stats() {
+    RedisNearCacheImpl* impl = (RedisNearCacheImpl*) impl_;
+    cache_stats_t stats;
+    stats.hits = impl->hits_.load();
+    stats.misses = impl->misses_.load();
+    stats.invalidations = impl->invalidations_.load();
+    stats.flushes = impl->flushes_.load();
+    stats.evictions = impl->evictions_.load();
+    stats.expired = impl->expired_.load();
+    for (auto& shard : impl->shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.entries += shard.entries;
+        stats.bytes += shard.bytes;
+    }
+    return stats;
+}
@@ -0,0 +1,105 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+// Client side cache of GET and HGET replies, kept coherent by redis 6+ CLIENT
+// TRACKING.
+//
+// The cache keeps its own RESP3 connection that receives the server's
+// invalidation pushes through hiredis's push callback on a background thread.
+// In default mode every attached client turns tracking on with REDIRECT to that
+// connection, so the server remembers the keys each one read. In BCAST mode the
+// cache connection subscribes to the prefixes itself and only keys under them
+// are cached.
+//
+//     RedisNearCache cache;
+//     RedisNearCache::cache_options_t opts;
+//     opts.max_entries = 100000;
+//     cache.init("127.0.0.1", 6379, "pwd", opts);
+//     cache.start();
+//     rcli->set_cache(&cache);
+//     rcli->get("key", out);  // served locally until the key changes on the server
+//
+// Nothing is served while the cache connection is down, losing it drops every
+// entry. A client that reconnects drops the entries it read, the server forgot
+// its tracking with the old connection. Writes made through an attached client
+// drop the key right away, other writers are seen once their invalidation
+// arrives. One cache can be shared by all clients of a node and must outlive
+// them.
+class RedisNearCache {
+public:
+    typedef struct cache_options {
+        size_t max_entries = 10000;  // cached replies, least recently used keys are evicted first
+        size_t max_bytes = 0;        // keys and values, 0 is unbounded
+        uint32_t ttl_ms = 60000;     // upper bound on the age of a reply served locally, 0 is unbounded
+        bool bcast = false;
+        std::vector<std::string> prefixes;  // BCAST only, empty tracks every key
+        uint32_t interval_ms = 1000;        // PING and reconnect interval of the cache connection
+        uint32_t timeout_ms = 1000;         // connect and PING timeout of the cache connection
+    } cache_options_t;
+
+    typedef struct cache_stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t invalidations = 0;  // keys named by invalidation pushes or local writes
+        uint64_t flushes = 0;        // whole cache dropped, on FLUSHALL or a lost connection
+        uint64_t evictions = 0;      // keys dropped for max_entries or max_bytes
+        uint64_t expired = 0;        // replies older than ttl_ms
+        size_t entries = 0;
+        size_t bytes = 0;
+    } cache_stats_t;
+
+    RedisNearCache();
+    virtual ~RedisNearCache();
+
+    RedisNearCache(const RedisNearCache&) = delete;
+    RedisNearCache& operator=(const RedisNearCache&) = delete;
+
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const cache_options_t& opts);
+    // the cache connection is made the way clients with conn_opts connect, TLS
+    // included, its timeouts replaced by opts.timeout_ms
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const cache_options_t& opts,
+              const RedisClient::options_t& conn_opts);
+    std::string get_last_error();
+
+    // open the cache connection, then keep it open on the cache thread. false
+    // when the first attempt failed, the cache keeps retrying and serves nothing meanwhile
+    bool start();
+    void stop();
+
+    // client id of the cache connection, 0 while it is down
+    uint64_t client_id();
+    bool is_bcast();
+    // CLIENT TRACKING command an attached client sends for client id, empty in BCAST mode
+    std::vector<std::string> tracking_command(uint64_t id);
+    // key may be cached, always true in default mode
+    bool cacheable(const RedisStringView& key);
+
+    // used by RedisClient. sub tells replies of one key apart, e.g. "GET" or
+    // "HGET field". err is RCLI_RET_OK or RCLI_RET_NIL on a hit
+    bool lookup(const RedisStringView& key, const std::string& sub, std::string& out, int& err);
+    // register a read about to be sent by a client tracking with id, 0 when the
+    // reply must not be cached. an invalidation of key before store() drops it.
+    // reader is the connection's from new_reader(), 0 in BCAST mode
+    uint64_t reserve(const RedisStringView& key, const std::string& sub, uint64_t id, uint64_t reader = 0);
+    void store(uint64_t token, const RedisStringView& key, const std::string& sub, const std::string& val, int err);
+    // the read failed, nothing will be stored
+    void release(uint64_t token, const RedisStringView& key, const std::string& sub);
+
+    // a client connection that turned tracking on. the server forgets its
+    // tracking when it reconnects or closes, drop_reader() then drops what was
+    // read through it since no invalidation would arrive for those keys
+    uint64_t new_reader();
+    void drop_reader(uint64_t reader);
+
+    void invalidate(const RedisStringView& key);
+    void flush();
+
+    cache_stats_t stats();
+
+private:
+    void* impl_;
+};
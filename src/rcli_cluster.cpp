@@ -0,0 +1,575 @@
+#include "rcli_cluster.h"
+#include "rcli_impl.h"
+#include "rcli_pipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <hiredis/hiredis.h>
+
+#define RCLI_CLUSTER_NO_NODE 0xffff
+#define RCLI_CLUSTER_REFRESH_MIN_MS 100
+#define RCLI_CLUSTER_CONNECT_TIMEOUT_MS 1000
+
+namespace {
+
+// CRC16-CCITT (XMODEM), the hash used by redis cluster
+const uint16_t crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+uint16_t crc16(const char* buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t) ((crc << 8) ^ crc16_table[((crc >> 8) ^ (uint8_t) buf[i]) & 0x00ff]);
+    }
+    return crc;
+}
+
+thread_local std::string t_last_error;
+
+// "MOVED 3999 127.0.0.1:6381" or "ASK 3999 127.0.0.1:6381"
+bool parse_redirect(const std::string& err, bool& ask, std::string& addr) {
+    if (err.compare(0, 6, "MOVED ") == 0) {
+        ask = false;
+    } else if (err.compare(0, 4, "ASK ") == 0) {
+        ask = true;
+    } else {
+        return false;
+    }
+    size_t pos = err.rfind(' ');
+    if (pos == std::string::npos || pos + 1 >= err.size()) {
+        return false;
+    }
+    addr = err.substr(pos + 1);
+    return true;
+}
+
+bool split_addr(const std::string& addr, std::string& host, uint32_t& port) {
+    size_t pos = addr.rfind(':');
+    if (pos == std::string::npos || pos == 0) {
+        return false;
+    }
+    host = addr.substr(0, pos);
+    port = (uint32_t) atoi(addr.c_str() + pos + 1);
+    return port > 0;
+}
+
+}  // namespace
+
+RedisClusterClient::RedisClusterClient() {}
+
+RedisClusterClient::~RedisClusterClient() { close(); }
+
+void RedisClusterClient::init(const std::vector<std::string>& seeds, const std::string& pwd, size_t pool_min_size,
+                              size_t pool_max_size, uint32_t refresh_interval_ms) {
+    init(seeds, pwd, RedisClient::options_t(), pool_min_size, pool_max_size, refresh_interval_ms);
+}
+
+void RedisClusterClient::init(const std::vector<std::string>& seeds, const std::string& pwd,
+                              const RedisClient::options_t& opts, size_t pool_min_size, size_t pool_max_size,
+                              uint32_t refresh_interval_ms) {
+    seeds_ = seeds;
+    pwd_ = pwd;
+    opts_ = opts;
+    // every node has an address of its own
+    opts_.unix_path.clear();
+    pool_min_size_ = pool_min_size;
+    pool_max_size_ = pool_max_size;
+    refresh_interval_ms_ = refresh_interval_ms;
+}
+
+const std::string& RedisClusterClient::get_last_error() { return t_last_error; }
+
+uint16_t RedisClusterClient::key_slot(const std::string& key) {
+    // only the part inside the first non-empty {...} is hashed
+    size_t start = key.find('{');
+    if (start != std::string::npos) {
+        size_t end = key.find('}', start + 1);
+        if (end != std::string::npos && end != start + 1) {
+            return crc16(key.data() + start + 1, end - start - 1) & (RCLI_CLUSTER_SLOTS - 1);
+        }
+    }
+    return crc16(key.data(), key.size()) & (RCLI_CLUSTER_SLOTS - 1);
+}
+
+bool RedisClusterClient::connect() {
+    std::string error;
+    if (!load_topology(error)) {
+        t_last_error = error;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(refresh_mutex_);
+    if (!running_) {
+        running_ = true;
+        refresh_thread_ = std::thread(&RedisClusterClient::refresh_loop, this);
+    }
+    return true;
+}
+
+void RedisClusterClient::close() {
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    refresh_cond_.notify_all();
+    if (refresh_thread_.joinable()) {
+        refresh_thread_.join();
+    }
+}
+
+void RedisClusterClient::refresh() {
+    {
+        std::lock_guard<std::mutex> lock(refresh_mutex_);
+        refresh_requested_ = true;
+    }
+    refresh_cond_.notify_one();
+}
+
+void RedisClusterClient::refresh_loop() {
+    auto last_refresh = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(refresh_mutex_);
+    while (running_) {
+        refresh_cond_.wait_for(lock, std::chrono::milliseconds(refresh_interval_ms_),
+                               [this]() { return !running_ || refresh_requested_; });
+        if (!running_) {
+            break;
+        }
+        // a burst of redirects results in a single reload
+        auto since = std::chrono::steady_clock::now() - last_refresh;
+        if (refresh_requested_ && since < std::chrono::milliseconds(RCLI_CLUSTER_REFRESH_MIN_MS)) {
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(RCLI_CLUSTER_REFRESH_MIN_MS) - since);
+            lock.lock();
+        }
+        refresh_requested_ = false;
+        lock.unlock();
+        std::string error;
+        load_topology(error);
+        last_refresh = std::chrono::steady_clock::now();
+        lock.lock();
+    }
+}
+
+std::shared_ptr<RedisClientPool> RedisClusterClient::get_node(const std::string& addr) {
+    std::lock_guard<std::mutex> lock(nodes_mutex_);
+    auto it = nodes_.find(addr);
+    if (it != nodes_.end()) {
+        return it->second;
+    }
+    std::string host;
+    uint32_t port = 0;
+    if (!split_addr(addr, host, port)) {
+        return nullptr;
+    }
+    // connections are opened lazily by acquire()
+    std::shared_ptr<RedisClientPool> pool(new RedisClientPool);
+    pool->init(host, port, pwd_, pool_min_size_, pool_max_size_);
+    pool->set_options(opts_);
+    nodes_.insert(std::make_pair(addr, pool));
+    return pool;
+}
+
+bool RedisClusterClient::load_topology(std::string& error) {
+    // known nodes first, the seeds may have left the cluster
+    std::vector<std::string> candidates;
+    {
+        std::lock_guard<std::mutex> lock(nodes_mutex_);
+        for (auto& kv : nodes_) {
+            candidates.push_back(kv.first);
+        }
+    }
+    candidates.insert(candidates.end(), seeds_.begin(), seeds_.end());
+    for (auto& addr : candidates) {
+        if (load_topology_from(addr, error)) {
+            return true;
+        }
+    }
+    if (candidates.empty()) {
+        error = "RedisClusterClient no seed node!";
+    }
+    return false;
+}
+
+bool RedisClusterClient::load_topology_from(const std::string& addr, std::string& error) {
+    std::string host;
+    uint32_t port = 0;
+    if (!split_addr(addr, host, port)) {
+        error = "RedisClusterClient bad node address: " + addr;
+        return false;
+    }
+
+    RedisClient::options_t opts = opts_;
+    opts.connect_timeout_ms = RCLI_CLUSTER_CONNECT_TIMEOUT_MS;
+    opts.command_timeout_ms = RCLI_CLUSTER_CONNECT_TIMEOUT_MS;
+    CSmartPtr<redisContext, redisFree> ctx(RedisClientImpl::open(host, port, opts, error));
+    if (ctx == nullptr) {
+        return false;
+    }
+
+    if (pwd_.size() > 0) {
+        const char* argv[] = {"AUTH", pwd_.c_str()};
+        size_t argvlen[] = {4, pwd_.size()};
+        CSmartPtr<void, freeReplyObject> reply_sp(redisCommandArgv(ctx.get(), 2, argv, argvlen));
+        redisReply* reply = (redisReply*) reply_sp.get();
+        if (reply == nullptr || reply->type == REDIS_REPLY_ERROR) {
+            error = reply ? std::string(reply->str, reply->len) : std::string(ctx->errstr);
+            return false;
+        }
+    }
+
+    CSmartPtr<void, freeReplyObject> reply_sp(redisCommand(ctx.get(), "CLUSTER SLOTS"));
+    redisReply* reply = (redisReply*) reply_sp.get();
+    if (reply == nullptr) {
+        error.assign(ctx->errstr);
+        return false;
+    } else if (reply->type == REDIS_REPLY_ERROR) {
+        error.assign(reply->str, reply->len);
+        return false;
+    } else if (reply->type != REDIS_REPLY_ARRAY || reply->elements == 0) {
+        error = "RedisClusterClient empty CLUSTER SLOTS reply!";
+        return false;
+    }
+
+    // [[start, end, [ip, port, id], replicas...], ...]
+    std::shared_ptr<topology_t> topo(new topology_t);
+    std::fill(topo->slots, topo->slots + RCLI_CLUSTER_SLOTS, (uint16_t) RCLI_CLUSTER_NO_NODE);
+    std::map<std::string, uint16_t> node_index;
+    for (size_t i = 0; i < reply->elements; i++) {
+        redisReply* range = reply->element[i];
+        if (range->type != REDIS_REPLY_ARRAY || range->elements < 3 || range->element[2]->type != REDIS_REPLY_ARRAY
+            || range->element[2]->elements < 2) {
+            continue;
+        }
+        int64_t start = range->element[0]->integer;
+        int64_t end = range->element[1]->integer;
+        redisReply* master = range->element[2];
+        std::string node_host(master->element[0]->str, master->element[0]->len);
+        if (node_host.empty() || node_host == "?") {
+            // an empty ip means the node we are talking to
+            node_host = host;
+        }
+        std::string node_addr = node_host + ":" + std::to_string(master->element[1]->integer);
+
+        auto it = node_index.find(node_addr);
+        if (it == node_index.end()) {
+            std::shared_ptr<RedisClientPool> pool = get_node(node_addr);
+            if (pool == nullptr) {
+                continue;
+            }
+            it = node_index.insert(std::make_pair(node_addr, (uint16_t) topo->nodes.size())).first;
+            topo->nodes.push_back(pool);
+        }
+        for (int64_t slot = start; slot <= end && slot < RCLI_CLUSTER_SLOTS; slot++) {
+            topo->slots[slot] = it->second;
+        }
+    }
+
+    std::atomic_store(&topology_, std::shared_ptr<const topology_t>(topo));
+    return true;
+}
+
+bool RedisClusterClient::route(const std::string& key, const std::function<bool(RedisClient*)>& fn) {
+    std::shared_ptr<const topology_t> topo = std::atomic_load(&topology_);
+    if (topo == nullptr) {
+        t_last_error = "RedisClusterClient is not connected!";
+        return false;
+    }
+    uint16_t slot = key_slot(key);
+    uint16_t index = topo->slots[slot];
+    if (index == RCLI_CLUSTER_NO_NODE) {
+        t_last_error = "RedisClusterClient slot " + std::to_string(slot) + " is not covered!";
+        refresh();
+        return false;
+    }
+
+    std::shared_ptr<RedisClientPool> node = topo->nodes[index];
+    bool asking = false;
+    for (int n = 0; n <= RCLI_CLUSTER_MAX_REDIRECT; n++) {
+        RedisClientPool::Lease cli = node->acquire();
+        if (!cli) {
+            t_last_error = node->get_last_error();
+            refresh();
+            return false;
+        }
+        if (asking && cli->command_for_status("ASKING") != RCLI_RET_OK) {
+            t_last_error = cli->get_last_error();
+            return false;
+        }
+        if (fn(cli.get())) {
+            return true;
+        }
+
+        t_last_error = cli->get_last_error();
+        std::string addr;
+        if (!parse_redirect(t_last_error, asking, addr)) {
+            return false;
+        }
+        // MOVED means our map is stale, ASK is a one-off during slot migration
+        if (!asking) {
+            refresh();
+        }
+        node = get_node(addr);
+        if (node == nullptr) {
+            return false;
+        }
+    }
+    t_last_error = "RedisClusterClient too many redirects!";
+    return false;
+}
+
+// the keys of one slot sent in one command, it reads its own reply
+struct RedisClusterClient::key_chunk : public RedisReplyVisitor {
+    uint16_t slot;
+    std::vector<size_t> index;  // of the keys, in the caller's order
+
+    std::shared_ptr<RedisClientPool> node;
+    bool asking = false;
+    int err = RCLI_ERROR;
+    std::string error;
+
+    // MGET values, or the integer reply of DEL and EXISTS
+    std::vector<std::string> values;
+    std::vector<bool> found;
+    int64_t count = 0;
+
+    void clear() {
+        values.clear();
+        found.clear();
+        count = 0;
+    }
+
+    void on_string(int depth, const char* str, size_t len) override {
+        if (depth == 1) {
+            values.emplace_back(str, len);
+            found.push_back(true);
+        }
+    }
+    void on_integer(int depth, int64_t val) override {
+        if (depth == 0) {
+            count = val;
+        } else if (depth == 1) {
+            std::string str = std::to_string(val);
+            on_string(depth, str.data(), str.size());
+        }
+    }
+    void on_nil(int depth) override {
+        if (depth == 1) {
+            values.emplace_back();
+            found.push_back(false);
+        }
+    }
+};
+
+std::vector<RedisClusterClient::key_chunk> RedisClusterClient::chunk_by_slot(
+  size_t count, size_t size, const std::function<const std::string&(size_t)>& key) {
+    std::map<uint16_t, std::vector<size_t>> groups;
+    for (size_t i = 0; i < count; i++) {
+        groups[key_slot(key(i))].push_back(i);
+    }
+    size = std::max<size_t>(size, 1);
+    std::vector<key_chunk> chunks;
+    for (auto& group : groups) {
+        for (size_t begin = 0; begin < group.second.size(); begin += size) {
+            size_t end = std::min(group.second.size(), begin + size);
+            chunks.emplace_back();
+            chunks.back().slot = group.first;
+            chunks.back().index.assign(group.second.begin() + begin, group.second.begin() + end);
+        }
+    }
+    return chunks;
+}
+
+bool RedisClusterClient::exec_chunks(std::vector<key_chunk>& chunks,
+                                     const std::function<size_t(RedisPipeline&, key_chunk&)>& append) {
+    std::shared_ptr<const topology_t> topo = std::atomic_load(&topology_);
+    if (topo == nullptr) {
+        t_last_error = "RedisClusterClient is not connected!";
+        return false;
+    }
+    std::vector<key_chunk*> pending;
+    for (auto& chunk : chunks) {
+        uint16_t index = topo->slots[chunk.slot];
+        if (index == RCLI_CLUSTER_NO_NODE) {
+            chunk.error = "RedisClusterClient slot " + std::to_string(chunk.slot) + " is not covered!";
+            refresh();
+            continue;
+        }
+        chunk.node = topo->nodes[index];
+        pending.push_back(&chunk);
+    }
+
+    std::vector<size_t> slots;
+    for (int n = 0; !pending.empty(); n++) {
+        if (n > RCLI_CLUSTER_MAX_REDIRECT) {
+            for (auto chunk : pending) {
+                chunk->err = RCLI_ERROR;
+                chunk->error = "RedisClusterClient too many redirects!";
+            }
+            break;
+        }
+        std::map<RedisClientPool*, std::vector<key_chunk*>> by_node;
+        for (auto chunk : pending) {
+            by_node[chunk->node.get()].push_back(chunk);
+        }
+        pending.clear();
+
+        bool moved = false;
+        for (auto& kv : by_node) {
+            RedisClientPool::Lease cli = kv.first->acquire();
+            if (!cli) {
+                for (auto chunk : kv.second) {
+                    chunk->err = RCLI_ERROR;
+                    chunk->error = kv.first->get_last_error();
+                }
+                refresh();
+                continue;
+            }
+            RedisPipeline pipe(cli.get());
+            slots.clear();
+            for (auto chunk : kv.second) {
+                if (chunk->asking) {
+                    pipe.appenda_for_status("ASKING");
+                }
+                chunk->clear();
+                slots.push_back(append(pipe, *chunk));
+            }
+            pipe.exec();
+
+            for (size_t i = 0; i < kv.second.size(); i++) {
+                key_chunk* chunk = kv.second[i];
+                chunk->err = pipe.status(slots[i]);
+                chunk->error = pipe.error(slots[i]);
+                std::string addr;
+                if (chunk->err == RCLI_RET_OK || !parse_redirect(chunk->error, chunk->asking, addr)) {
+                    continue;
+                }
+                // MOVED means our map is stale, ASK is a one-off during slot migration
+                moved |= !chunk->asking;
+                chunk->node = get_node(addr);
+                if (chunk->node != nullptr) {
+                    pending.push_back(chunk);
+                }
+            }
+        }
+        if (moved) {
+            refresh();
+        }
+    }
+
+    for (auto& chunk : chunks) {
+        if (chunk.err != RCLI_RET_OK) {
+            t_last_error = chunk.error;
+            return false;
+        }
+    }
+    t_last_error.clear();
+    return true;
+}
+
+bool RedisClusterClient::mget(const std::vector<std::string>& keys, std::vector<std::string>& out, size_t chunk) {
+    std::vector<bool> found;
+    return mget(keys, out, found, chunk);
+}
+
+bool RedisClusterClient::mget(const std::vector<std::string>& keys, std::vector<std::string>& out,
+                              std::vector<bool>& found, size_t chunk) {
+    out.assign(keys.size(), std::string());
+    found.assign(keys.size(), false);
+    std::vector<key_chunk> chunks =
+      chunk_by_slot(keys.size(), chunk, [&](size_t i) -> const std::string& { return keys[i]; });
+    std::vector<std::string> cmd;
+    bool ok = exec_chunks(chunks, [&](RedisPipeline& pipe, key_chunk& c) {
+        cmd.assign(1, "MGET");
+        for (size_t i : c.index) {
+            cmd.push_back(keys[i]);
+        }
+        return pipe.append_for_visitor(c, cmd);
+    });
+    for (auto& c : chunks) {
+        for (size_t j = 0; j < c.index.size() && j < c.values.size(); j++) {
+            out[c.index[j]].swap(c.values[j]);
+            found[c.index[j]] = c.found[j];
+        }
+    }
+    return ok;
+}
+
+bool RedisClusterClient::mset(const std::vector<RedisClient::key_value_t>& in, size_t chunk) {
+    std::vector<key_chunk> chunks =
+      chunk_by_slot(in.size(), chunk, [&](size_t i) -> const std::string& { return in[i].first; });
+    std::vector<std::string> cmd;
+    return exec_chunks(chunks, [&](RedisPipeline& pipe, key_chunk& c) {
+        cmd.assign(1, "MSET");
+        for (size_t i : c.index) {
+            cmd.push_back(in[i].first);
+            cmd.push_back(in[i].second);
+        }
+        return pipe.append_for_visitor(c, cmd);
+    });
+}
+
+bool RedisClusterClient::del(const std::vector<std::string>& keys, int64_t& out, size_t chunk) {
+    std::vector<key_chunk> chunks =
+      chunk_by_slot(keys.size(), chunk, [&](size_t i) -> const std::string& { return keys[i]; });
+    std::vector<std::string> cmd;
+    bool ok = exec_chunks(chunks, [&](RedisPipeline& pipe, key_chunk& c) {
+        cmd.assign(1, "DEL");
+        for (size_t i : c.index) {
+            cmd.push_back(keys[i]);
+        }
+        return pipe.append_for_visitor(c, cmd);
+    });
+    out = 0;
+    for (auto& c : chunks) {
+        out += c.count;
+    }
+    return ok;
+}
+
+bool RedisClusterClient::exist(const std::vector<std::string>& keys, std::vector<bool>& out) {
+    // EXISTS of several keys only counts them, one key per command
+    std::vector<key_chunk> chunks =
+      chunk_by_slot(keys.size(), 1, [&](size_t i) -> const std::string& { return keys[i]; });
+    bool ok = exec_chunks(chunks, [&](RedisPipeline& pipe, key_chunk& c) {
+        return pipe.appenda_for_visitor(c, "EXISTS", keys[c.index[0]]);
+    });
+    out.assign(keys.size(), false);
+    for (auto& c : chunks) {
+        out[c.index[0]] = c.count > 0;
+    }
+    return ok;
+}
@@ -0,0 +1,210 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include "rcli_pool.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#define RCLI_CLUSTER_SLOTS 16384
+#define RCLI_CLUSTER_MAX_REDIRECT 5
+
+// Routes RedisClient commands to the node owning the key's hash slot.
+//
+// The CLUSTER SLOTS topology is cached and refreshed by a background thread,
+// periodically and whenever a request sees MOVED or a connection error.
+// Requests follow MOVED/ASK redirects themselves so they never wait for the
+// refresh. Each node is served by its own RedisClientPool, so the client can
+// be shared by many threads.
+//
+//     RedisClusterClient cluster;
+//     cluster.init({"10.0.0.1:6379", "10.0.0.2:6379"}, "pwd");
+//     cluster.connect();
+//     cluster.hset("user:{42}:profile", "name", "cs", out);
+class RedisClusterClient {
+public:
+    RedisClusterClient();
+    virtual ~RedisClusterClient();
+
+    RedisClusterClient(const RedisClusterClient&) = delete;
+    RedisClusterClient& operator=(const RedisClusterClient&) = delete;
+
+    // seeds are "host:port"
+    void init(const std::vector<std::string>& seeds, const std::string& pwd, size_t pool_min_size = 1,
+              size_t pool_max_size = 8, uint32_t refresh_interval_ms = 10000);
+    // every node is connected to with opts, TLS included but not unix_path.
+    // the topology connection keeps its own short timeouts
+    void init(const std::vector<std::string>& seeds, const std::string& pwd, const RedisClient::options_t& opts,
+              size_t pool_min_size = 1, size_t pool_max_size = 8, uint32_t refresh_interval_ms = 10000);
+    // last error of the calling thread
+    const std::string& get_last_error();
+
+    // load the topology from the seeds and start the refresh thread
+    bool connect();
+    void close();
+
+    // ask the refresh thread to reload the topology
+    void refresh();
+
+    static uint16_t key_slot(const std::string& key);
+
+    // run fn on a client of the node owning key, following redirects.
+    // fn returns false on failure, the reason is read from get_last_error().
+    bool route(const std::string& key, const std::function<bool(RedisClient*)>& fn);
+
+    // keys
+
+    bool exist(const std::string& key) {
+        return route(key, [&](RedisClient* cli) { return cli->exist(key); });
+    }
+
+    bool get(const std::string& key, std::string& out) {
+        return route(key, [&](RedisClient* cli) { return cli->get(key, out); });
+    }
+
+    bool set(const std::string& key, const std::string& in) {
+        return route(key, [&](RedisClient* cli) { return cli->set(key, in); });
+    }
+
+    bool del(const std::string& key) {
+        return route(key, [&](RedisClient* cli) { return cli->del(key); });
+    }
+
+    bool expire(const std::string& key, uint32_t second) {
+        return route(key, [&](RedisClient* cli) { return cli->expire(key, second); });
+    }
+
+    bool expireat(const std::string& key, uint32_t timestamp) {
+        return route(key, [&](RedisClient* cli) { return cli->expireat(key, timestamp); });
+    }
+
+    bool pexpire(const std::string& key, uint32_t milliseconds) {
+        return route(key, [&](RedisClient* cli) { return cli->pexpire(key, milliseconds); });
+    }
+
+    // multi-key, see RedisClient::mget(). keys are grouped by hash slot and
+    // chunked, the chunks of a node go in one pipeline and each chunk follows
+    // its own redirects. results follow the order of the keys
+
+    bool mget(const std::vector<std::string>& keys, std::vector<std::string>& out,
+              size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    bool mget(const std::vector<std::string>& keys, std::vector<std::string>& out, std::vector<bool>& found,
+              size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    // chunks on other slots are still written when one fails
+    bool mset(const std::vector<RedisClient::key_value_t>& in, size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    bool del(const std::vector<std::string>& keys, int64_t& out, size_t chunk = RCLI_MULTI_KEY_CHUNK);
+    bool exist(const std::vector<std::string>& keys, std::vector<bool>& out);
+
+    // hash map
+
+    bool hexist(const std::string& key, const std::string& field) {
+        return route(key, [&](RedisClient* cli) { return cli->hexist(key, field); });
+    }
+
+    bool hget(const std::string& key, const std::string& field, std::string& out) {
+        return route(key, [&](RedisClient* cli) { return cli->hget(key, field, out); });
+    }
+
+    bool hset(const std::string& key, const std::string& field, const std::string& in, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->hset(key, field, in, out); });
+    }
+
+    bool hincrby(const std::string& key, const std::string& field, const int64_t& in, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->hincrby(key, field, in, out); });
+    }
+
+    bool hdel(const std::string& key, const std::string& field) {
+        return route(key, [&](RedisClient* cli) { return cli->hdel(key, field); });
+    }
+
+    bool hkeys(const std::string& key, std::vector<std::string>& out) {
+        return route(key, [&](RedisClient* cli) { return cli->hkeys(key, out); });
+    }
+
+    // sorted set
+
+    bool zadd(const std::string& key, const RedisClient::score_member_t& in, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zadd(key, in, out); });
+    }
+
+    bool zadd(const std::string& key, const std::vector<RedisClient::score_member_t>& in, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zadd(key, in, out); });
+    }
+
+    bool zcard(const std::string& key, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zcard(key, out); });
+    }
+
+    bool zincrby(const std::string& key, const RedisClient::incre_member_t& in, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zincrby(key, in, out); });
+    }
+
+    bool zincrby(const std::string& key, const RedisClient::incre_member_t& in, double& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zincrby(key, in, out); });
+    }
+
+    bool zrange(const std::string& key, int32_t start, int32_t stop, std::vector<std::string>& out,
+                bool withscore = false) {
+        return route(key, [&](RedisClient* cli) { return cli->zrange(key, start, stop, out, withscore); });
+    }
+
+    bool zrangebyscore(const std::string& key, double min, double max, std::vector<std::string>& out,
+                       bool withscore = false) {
+        return route(key, [&](RedisClient* cli) { return cli->zrangebyscore(key, min, max, out, withscore); });
+    }
+
+    bool zrank(const std::string& key, const std::string& member, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zrank(key, member, out); });
+    }
+
+    bool zscore(const std::string& key, const std::string& member, double& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zscore(key, member, out); });
+    }
+
+    bool zrem(const std::string& key, const std::string& member, int64_t& out) {
+        return route(key, [&](RedisClient* cli) { return cli->zrem(key, member, out); });
+    }
+
+private:
+    typedef struct topology {
+        std::vector<std::shared_ptr<RedisClientPool>> nodes;
+        uint16_t slots[RCLI_CLUSTER_SLOTS];  // index into nodes, UINT16_MAX when not covered
+    } topology_t;
+
+    struct key_chunk;
+
+    std::shared_ptr<RedisClientPool> get_node(const std::string& addr);
+    // the keys by hash slot cut into chunks of at most size keys, key(i) is the i-th key
+    static std::vector<key_chunk> chunk_by_slot(size_t count, size_t size,
+                                                const std::function<const std::string&(size_t)>& key);
+    // run the chunks, append queues the command of one. false when any failed,
+    // the first error is kept
+    bool exec_chunks(std::vector<key_chunk>& chunks, const std::function<size_t(RedisPipeline&, key_chunk&)>& append);
+    bool load_topology(std::string& error);
+    bool load_topology_from(const std::string& addr, std::string& error);
+    void refresh_loop();
+
+    std::vector<std::string> seeds_;
+    std::string pwd_;
+    RedisClient::options_t opts_;
+    size_t pool_min_size_ = 1;
+    size_t pool_max_size_ = 8;
+    uint32_t refresh_interval_ms_ = 10000;
+
+    std::shared_ptr<const topology_t> topology_;
+
+    std::mutex nodes_mutex_;
+    std::map<std::string, std::shared_ptr<RedisClientPool>> nodes_;
+
+    std::mutex refresh_mutex_;
+    std::condition_variable refresh_cond_;
+    std::thread refresh_thread_;
+    bool refresh_requested_ = false;
+    bool running_ = false;
+};
@@ -0,0 +1,208 @@
+#include "rcli_health.h"
+#include "rcli_impl.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class RedisHealthMonitorImpl {
+public:
+    RedisHealthMonitorImpl() : state_(RCLI_NODE_UP), running_(false) {}
+
+    bool start();
+    void stop();
+    void run();
+    // connect if needed and PING, false marks the node down
+    bool probe();
+    // outcome of a probe
+    void set_state(int state, const std::string& error);
+    void wakeup();
+
+    std::string host_;
+    uint32_t port_ = 0;
+    std::string pwd_;
+    RedisClient::options_t opts_;
+    uint32_t interval_ms_ = 1000;
+
+    // owned by the monitor thread, or start() before it runs
+    RedisClientImpl probe_;
+
+    std::atomic<int> state_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool wake_ = false;
+    std::string error_str_;
+    RedisHealthMonitor::health_stats_t stats_;
+};
+
+bool RedisHealthMonitorImpl::start() {
+    if (running_) {
+        return true;
+    }
+    bool up = probe();
+    running_ = true;
+    thread_ = std::thread(&RedisHealthMonitorImpl::run, this);
+    return up;
+}
+
+void RedisHealthMonitorImpl::stop() {
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    wakeup();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    probe_.ctx_.reset();
+}
+
+void RedisHealthMonitorImpl::wakeup() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_ = true;
+    cond_.notify_one();
+}
+
+void RedisHealthMonitorImpl::run() {
+    while (running_) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait_for(lock, std::chrono::milliseconds(interval_ms_), [this] { return wake_; });
+            wake_ = false;
+        }
+        if (running_) {
+            probe();
+        }
+    }
+}
+
+bool RedisHealthMonitorImpl::probe() {
+    auto start = std::chrono::steady_clock::now();
+    redisContext* ctx = probe_.get_context();
+    if (ctx && ctx->err) {
+        // a broken probe connection says nothing yet, the reconnect below decides
+        probe_.ctx_.reset();
+        ctx = nullptr;
+    }
+    if (ctx == nullptr) {
+        std::string error;
+        probe_.ctx_.reset(RedisClientImpl::open(host_, port_, opts_, error));
+        ctx = probe_.get_context();
+        if (ctx == nullptr) {
+            set_state(RCLI_NODE_DOWN, error);
+            return false;
+        }
+        if (!pwd_.empty()) {
+            CSmartPtr<void, freeReplyObject> reply_sp(redisCommand(ctx, "AUTH %b", pwd_.data(), pwd_.size()));
+            if (probe_.get_reply_status((redisReply*) reply_sp.get()) != RCLI_RET_OK) {
+                set_state(RCLI_NODE_DOWN, probe_.error_str_);
+                probe_.ctx_.reset();
+                return false;
+            }
+        }
+    }
+
+    CSmartPtr<void, freeReplyObject> reply_sp(redisCommand(ctx, "PING"));
+    if (probe_.cmp_reply_string((redisReply*) reply_sp.get(), "PONG") != RCLI_RET_OK) {
+        set_state(RCLI_NODE_DOWN, probe_.error_str_.empty() ? "unexpected PING reply" : probe_.error_str_);
+        probe_.ctx_.reset();
+        return false;
+    }
+    uint64_t rtt_us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.last_rtt_us = rtt_us;
+    }
+    set_state(RCLI_NODE_UP, "");
+    return true;
+}
+
+void RedisHealthMonitorImpl::set_state(int state, const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.probes++;
+    if (state == RCLI_NODE_DOWN) {
+        stats_.probe_failures++;
+        if (state_ != RCLI_NODE_DOWN) {
+            stats_.down_count++;
+        }
+    }
+    error_str_ = error;
+    state_ = state;
+}
+
+RedisHealthMonitor::RedisHealthMonitor() { impl_ = new RedisHealthMonitorImpl; }
+
+RedisHealthMonitor::~RedisHealthMonitor() {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    impl->stop();
+    delete impl;
+}
+
+void RedisHealthMonitor::init(const std::string& host, uint32_t port, const std::string& pwd, uint32_t interval_ms,
+                              uint32_t timeout_ms) {
+    init(host, port, pwd, RedisClient::options_t(), interval_ms, timeout_ms);
+}
+
+void RedisHealthMonitor::init(const std::string& host, uint32_t port, const std::string& pwd,
+                              const RedisClient::options_t& opts, uint32_t interval_ms, uint32_t timeout_ms) {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    impl->host_ = host;
+    impl->port_ = port;
+    impl->pwd_ = pwd;
+    impl->opts_ = opts;
+    impl->opts_.connect_timeout_ms = timeout_ms > 0 ? timeout_ms : 1;
+    impl->opts_.command_timeout_ms = impl->opts_.connect_timeout_ms;
+    impl->interval_ms_ = interval_ms > 0 ? interval_ms : 1;
+}
+
+std::string RedisHealthMonitor::get_last_error() {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    return impl->error_str_;
+}
+
+bool RedisHealthMonitor::start() {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    return impl->start();
+}
+
+void RedisHealthMonitor::stop() {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    impl->stop();
+}
+
+int RedisHealthMonitor::state() {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    return impl->state_.load(std::memory_order_relaxed);
+}
+
+void RedisHealthMonitor::report_failure() {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    impl->wakeup();
+}
+
+void RedisHealthMonitor::mark_down(const std::string& error) {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        if (impl->state_ != RCLI_NODE_DOWN) {
+            impl->stats_.down_count++;
+        }
+        impl->error_str_ = error;
+        impl->state_ = RCLI_NODE_DOWN;
+    }
+    impl->wakeup();
+}
+
+RedisHealthMonitor::health_stats_t RedisHealthMonitor::stats() {
+    RedisHealthMonitorImpl* impl = (RedisHealthMonitorImpl*) impl_;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    health_stats_t stats = impl->stats_;
+    stats.state = impl->state_;
+    return stats;
+}
@@ -0,0 +1,71 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+enum {
+    RCLI_NODE_UP = 0,
+    RCLI_NODE_DOWN,
+};
+
+// Tracks whether a redis node is reachable from a background thread, so clients
+// do not have to probe it on the caller's thread after a failure.
+//
+// The monitor keeps its own connection and PINGs the node every interval_ms.
+// A probe that fails to connect, times out or gets no PONG marks the node down,
+// the next successful one marks it up again. Clients attached to a monitor fail
+// immediately with RCLI_ERROR while the node is down, and report broken
+// connections to it so it probes right away.
+//
+//     RedisHealthMonitor monitor;
+//     monitor.init("127.0.0.1", 6379, "pwd");
+//     monitor.start();
+//     rcli->set_health(&monitor);
+//
+// One monitor can be shared by all clients of a node and must outlive them.
+class RedisHealthMonitor {
+public:
+    typedef struct health_stats {
+        uint64_t probes = 0;
+        uint64_t probe_failures = 0;
+        uint64_t down_count = 0;    // transitions to RCLI_NODE_DOWN
+        uint64_t last_rtt_us = 0;   // of the last successful PING
+        int state = RCLI_NODE_UP;
+    } health_stats_t;
+
+    RedisHealthMonitor();
+    virtual ~RedisHealthMonitor();
+
+    RedisHealthMonitor(const RedisHealthMonitor&) = delete;
+    RedisHealthMonitor& operator=(const RedisHealthMonitor&) = delete;
+
+    // timeout_ms bounds both the connect and the PING of a probe
+    void init(const std::string& host, uint32_t port, const std::string& pwd, uint32_t interval_ms = 1000,
+              uint32_t timeout_ms = 1000);
+    // probe the way clients with opts connect, over TLS when opts.tls is set,
+    // its timeouts replaced by timeout_ms
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const RedisClient::options_t& opts,
+              uint32_t interval_ms = 1000, uint32_t timeout_ms = 1000);
+    // why the node is down
+    std::string get_last_error();
+
+    // probe once, then keep probing on the monitor thread. false when the
+    // first probe failed, the monitor runs anyway
+    bool start();
+    void stop();
+
+    int state();
+    bool is_up() { return state() == RCLI_NODE_UP; }
+
+    // a client lost its connection, probe now instead of at the next interval
+    void report_failure();
+    // a client could not reconnect either, mark the node down until a probe succeeds
+    void mark_down(const std::string& error);
+
+    health_stats_t stats();
+
+private:
+    void* impl_;
+};
@@ -0,0 +1,255 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include "rcli_cache.h"
+#include "rcli_health.h"
+#include "rcli_script.h"
+#include "rcli_stats.h"
+#include "rcli_tls.h"
+#include <chrono>
+#include <hiredis/hiredis.h>
+#include <unordered_map>
+
+#ifdef _MSC_VER
+#    include <winsock2.h>
+#    ifndef strcasecmp
+#        define strcasecmp stricmp
+#    endif
+#    ifndef strncasecmp
+#        define strncasecmp strnicmp
+#    endif
+#endif
+
+class RedisClientImpl {
+public:
+    bool connect(const std::string& host, uint32_t port, const RedisClient::options_t& opts);
+    bool reconnect();
+    // apply opts_ to the socket, hiredis does not keep these across redisReconnect
+    bool tune_socket();
+    // host:port or the unix socket of opts and its connect timeout, kept in
+    // connect_timeout. redis_opts points into host and opts
+    static void set_endpoint(redisOptions& redis_opts, const std::string& host, uint32_t port,
+                             const RedisClient::options_t& opts, struct timeval& connect_timeout);
+    // buffer sizes, TCP_NODELAY, keepalive and user timeout of opts on ctx's socket
+    static bool tune_socket(redisContext* ctx, const RedisClient::options_t& opts, std::string& error);
+    // a connection of its own made like connect() does, TLS included, for the
+    // monitor, the near cache and the cluster topology. nullptr with error on failure
+    static redisContext* open(const std::string& host, uint32_t port, const RedisClient::options_t& opts,
+                              std::string& error);
+    // TLS over the connection just made, before wrap_io() so that the SSL read and write get wrapped
+    bool start_tls();
+    redisContext* get_context() { return ctx_.get(); }
+    int check_reply_type(const redisReply* reply);
+    int get_reply_status(const redisReply* reply);
+    int get_reply_integer(const redisReply* reply, int64_t& retval);
+    int get_reply_string(const redisReply* reply, std::string& retval);
+    int get_reply_vector(const redisReply* reply, std::vector<std::string>& retval);
+    int get_reply_double(const redisReply* reply, double& retval);
+    int get_reply_map(const redisReply* reply, std::unordered_map<std::string, std::string>& retval);
+    // walk a reply already read like read_reply() does while reading it
+    int get_reply_visitor(const redisReply* reply, RedisReplyVisitor& visitor);
+    int cmp_reply_string(const redisReply* reply, const std::string& val);
+    // text of a scalar element, nothing for nil and aggregates
+    static void append_element(const redisReply* reply, std::string& out);
+    // scalar elements of reply, nested aggregates flattened
+    static void append_flat(const redisReply* reply, std::vector<std::string>& out);
+    static void visit_reply(const redisReply* reply, RedisReplyVisitor& visitor, int depth);
+    // read the next reply straight into visitor, see RedisReplySink
+    int read_reply(RedisReplyVisitor& visitor);
+    // queue a command already in RESP, false on connection error
+    bool append_formatted(const std::string& cmd);
+    // the server forgot this connection's tracking, drop what the cache has
+    // from it and turn tracking on again with the next cached read
+    void drop_tracking();
+    // read and drop the reply of a SCAN a RedisScanner sent ahead, before
+    // another command is queued behind it
+    void drop_unread();
+    // send cmd and wait for its reply, cmd is released when it grew large
+    void* formatted_command(std::string& cmd);
+    // route the connection's reads and writes through io_funcs_, which count
+    // bytes for RedisStats and enforce the deadline
+    void wrap_io();
+    // before each read or write: shorten the socket timeout to the deadline,
+    // false when it already passed
+    bool apply_deadline(redisContext* ctx);
+    // after a failed read or write: a socket timeout becomes REDIS_ERR_TIMEOUT
+    void check_timeout(redisContext* ctx, int err);
+
+    RedisHealthMonitor* health_ = nullptr;
+    RedisStats* stats_ = nullptr;
+    RedisNearCache* cache_ = nullptr;
+    RedisScriptRegistry* scripts_ = nullptr;
+    // cache connection this one redirects its invalidations to, 0 before CLIENT TRACKING
+    uint64_t tracking_id_ = 0;
+    // RedisNearCache::new_reader() of this connection's tracking, 0 without
+    uint64_t tracking_reader_ = 0;
+    // RedisScanner token of the reply still to be read, 0 when none
+    uint64_t unread_token_ = 0;
+    uint64_t next_token_ = 0;
+    // successful connects and reconnects, a WATCH does not survive a new one
+    uint64_t connects_ = 0;
+    uint64_t bytes_read_ = 0;
+    uint64_t bytes_written_ = 0;
+    int status_ = RCLI_RET_OK;
+    // RESP version negotiated by RedisClient::auth()
+    int protocol_ = 2;
+
+    // in steady_clock microseconds, 0 without deadline
+    int64_t deadline_us_ = 0;
+    int64_t command_timeout_us_ = 0;
+    // what the socket is set to now
+    int64_t socket_timeout_us_ = 0;
+
+    // declared before ctx_, redisFree still calls into it
+    redisContextFuncs io_funcs_;
+    const redisContextFuncs* orig_funcs_ = nullptr;
+
+    RedisClient::options_t opts_;
+    std::string host_;
+    // host:port or the unix path, names the server in RedisTlsContext's session cache
+    std::string peer_;
+    CSmartPtr<redisContext, redisFree> ctx_;
+    std::string error_str_;
+};
+
+// Keeps the RCLI_* status of one command and times it for the client's
+// RedisStats when one is attached.
+//
+//     RedisCallRecorder rec(cli, "GET");
+//     ...
+//     return rec.done(err);
+class RedisCallRecorder {
+public:
+    RedisCallRecorder(RedisClientImpl* cli, const RedisStringView& verb);
+    // verb of a RESP encoded command
+    static RedisStringView resp_verb(const std::string& cmd);
+    // first word of a format string
+    static RedisStringView format_verb(const char* format);
+
+    // record the call and return err
+    int done(int err);
+
+    static int64_t now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+    }
+
+private:
+    RedisClientImpl* cli_;
+    char verb_[RCLI_STATS_VERB_LEN];
+    size_t verb_len_ = 0;
+    std::chrono::steady_clock::time_point start_;
+    uint64_t bytes_read_ = 0;
+    uint64_t bytes_written_ = 0;
+};
+
+// Swaps the reader's reply functions for the lifetime of the sink so the next
+// reply is handed to a visitor element by element instead of being built as a
+// redisReply tree. Every element maps to one shared marker object, which is
+// what redisGetReply returns. PUSH messages still go to the default functions
+// so hiredis can dispatch them to the push callback.
+class RedisReplySink {
+public:
+    RedisReplySink(redisContext* ctx, RedisReplyVisitor& visitor);
+    ~RedisReplySink();
+
+    RedisReplySink(const RedisReplySink&) = delete;
+    RedisReplySink& operator=(const RedisReplySink&) = delete;
+
+    static bool is_marker(const void* reply);
+
+    int root_type() const { return root_type_; }
+    const std::string& error() const { return error_; }
+    // RCLI_RET_* of the last reply. an aggregate whose first element was read
+    // under an earlier sink, as by a non-blocking read, is RCLI_RET_OK
+    int status() const;
+
+private:
+    static void* create_string(const redisReadTask* task, char* str, size_t len);
+    static void* create_array(const redisReadTask* task, size_t elements);
+    static void* create_integer(const redisReadTask* task, long long value);
+    static void* create_double(const redisReadTask* task, double value, char* str, size_t len);
+    static void* create_nil(const redisReadTask* task);
+    static void* create_bool(const redisReadTask* task, int bval);
+    static void free_object(void* reply);
+
+    // false when task belongs to a PUSH message left to the default functions
+    bool enter(const redisReadTask* task, int& depth);
+
+    static redisReplyObjectFunctions functions_;
+
+    redisReader* reader_ = nullptr;
+    redisReplyObjectFunctions* orig_fn_ = nullptr;
+    void* orig_privdata_ = nullptr;
+    RedisReplyVisitor& visitor_;
+    int root_type_ = 0;
+    std::string error_;
+};
+
+// collects the elements of an array reply into a vector, nested arrays such
+// as the RESP3 [member, score] pairs of ZRANGE WITHSCORES are flattened
+class RedisVectorVisitor : public RedisReplyVisitor {
+public:
+    explicit RedisVectorVisitor(std::vector<std::string>& out) : out_(out) {}
+
+    void on_array(int /*depth*/, size_t len) override { out_.reserve(out_.size() + len); }
+    void on_string(int depth, const char* str, size_t len) override {
+        if (depth >= 1) {
+            out_.emplace_back(str, len);
+        }
+    }
+    void on_integer(int depth, int64_t val) override {
+        if (depth >= 1) {
+            out_.emplace_back(std::to_string(val));
+        }
+    }
+    void on_nil(int depth) override {
+        if (depth >= 1) {
+            out_.emplace_back();
+        }
+    }
+    void on_error(int depth, const char* str, size_t len) override { on_string(depth, str, len); }
+
+private:
+    std::vector<std::string>& out_;
+};
+
+// collects a RESP3 map, or the flat key value array RESP2 sends instead
+class RedisMapVisitor : public RedisReplyVisitor {
+public:
+    explicit RedisMapVisitor(std::unordered_map<std::string, std::string>& out) : out_(out) {}
+
+    void on_map(int depth, size_t pairs) override {
+        if (depth == 0) {
+            out_.reserve(out_.size() + pairs);
+        }
+    }
+    void on_array(int depth, size_t len) override { on_map(depth, len / 2); }
+    void on_string(int depth, const char* str, size_t len) override {
+        if (depth != 1) {
+            return;
+        }
+        if (key_) {
+            out_[key_str_].assign(str, len);
+            key_ = false;
+        } else {
+            key_str_.assign(str, len);
+            key_ = true;
+        }
+    }
+    void on_integer(int depth, int64_t val) override {
+        std::string str = std::to_string(val);
+        on_string(depth, str.data(), str.size());
+    }
+    void on_nil(int depth) override { on_string(depth, "", 0); }
+    void on_error(int depth, const char* str, size_t len) override { on_string(depth, str, len); }
+
+private:
+    std::unordered_map<std::string, std::string>& out_;
+    std::string key_str_;
+    bool key_ = false;
+};
@@ -0,0 +1,530 @@
+#include "rcli_loader.h"
+#include "rcli_window.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#define RCLI_LOADER_READ_SIZE (1024 * 1024)
+// chunks waiting for a connection, bounds what the reader runs ahead
+#define RCLI_LOADER_QUEUE 4
+#define RCLI_LOADER_POLL_MS 100
+
+namespace {
+
+// commands handed to a connection, RESP encoded back to back
+typedef struct load_chunk {
+    std::string data;
+    std::vector<size_t> ends;     // end of each command in data
+    std::vector<uint64_t> index;  // of each command in the input
+} load_chunk_t;
+
+// shared by the reader and the connections of one load
+typedef struct load_state {
+    std::atomic<bool> stop{false};
+    RedisBulkLoader::error_cb_t* error_cb = nullptr;
+    std::mutex mutex;
+    std::string error;  // what stopped the load
+    uint64_t errors = 0;
+    std::string first_error;
+} load_state_t;
+
+// Splits the input into RESP encoded commands.
+class RedisCommandReader {
+public:
+    RedisCommandReader(std::istream& in, int format) : in_(in), format_(format) {}
+
+    // append the next command to out and point key at its second argument, or
+    // the first without one. key is valid until the next call. false at the
+    // end of the input and on malformed input, see error()
+    bool next(std::string& out, RedisStringView& key);
+    const std::string& error() const { return error_; }
+
+private:
+    enum {
+        PARSED = 0,
+        MORE,  // the command continues past what was read
+        BAD,
+    };
+
+    int parse_resp(std::string& out, RedisStringView& key);
+    int parse_tsv(std::string& out, RedisStringView& key);
+    // "<digits>\r\n" at p, p is moved past it
+    int parse_length(const char*& p, const char* end, int64_t& val);
+    int bad(const char* what);
+    // read more of the input behind what is left unparsed, false once its end was seen
+    bool fill();
+
+    std::istream& in_;
+    int format_;
+    std::string buf_;
+    size_t pos_ = 0;
+    uint64_t offset_ = 0;  // of buf_ in the input
+    uint64_t line_ = 0;
+    bool eof_ = false;
+    std::string key_;
+    std::string arg_;
+    std::string error_;
+};
+
+bool RedisCommandReader::next(std::string& out, RedisStringView& key) {
+    while (error_.empty()) {
+        if (format_ == RedisBulkLoader::FORMAT_AUTO && pos_ < buf_.size()) {
+            format_ = buf_[pos_] == '*' ? RedisBulkLoader::FORMAT_RESP : RedisBulkLoader::FORMAT_TSV;
+        }
+        int ret = MORE;
+        if (format_ == RedisBulkLoader::FORMAT_RESP) {
+            ret = parse_resp(out, key);
+        } else if (format_ == RedisBulkLoader::FORMAT_TSV) {
+            ret = parse_tsv(out, key);
+        }
+        if (ret == PARSED) {
+            return true;
+        }
+        // at the end of the input fill() first sets eof_, for a last line without a newline
+        if (ret == MORE && !fill()) {
+            if (pos_ < buf_.size() && error_.empty()) {
+                bad("input ends");
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+int RedisCommandReader::parse_resp(std::string& out, RedisStringView& key) {
+    const char* begin = buf_.data() + pos_;
+    const char* end = buf_.data() + buf_.size();
+    const char* p = begin;
+    if (p == end) {
+        return MORE;
+    }
+    if (*p++ != '*') {
+        return bad("expected '*'");
+    }
+    int64_t argc = 0;
+    int ret = parse_length(p, end, argc);
+    if (ret != PARSED) {
+        return ret;
+    }
+    if (argc <= 0) {
+        return bad("empty command");
+    }
+    for (int64_t i = 0; i < argc; i++) {
+        if (p == end) {
+            return MORE;
+        }
+        if (*p++ != '$') {
+            return bad("expected '$'");
+        }
+        int64_t len = 0;
+        ret = parse_length(p, end, len);
+        if (ret != PARSED) {
+            return ret;
+        }
+        if (end - p < len + 2) {
+            return MORE;
+        }
+        if (p[len] != '\r' || p[len + 1] != '\n') {
+            return bad("bulk string not followed by CRLF");
+        }
+        if (i == 1 || argc == 1) {
+            key = RedisStringView(p, (size_t) len);
+        }
+        p += len + 2;
+    }
+    out.append(begin, p - begin);
+    pos_ += p - begin;
+    return PARSED;
+}
+
+int RedisCommandReader::parse_tsv(std::string& out, RedisStringView& key) {
+    while (true) {
+        const char* p = buf_.data() + pos_;
+        const char* end = buf_.data() + buf_.size();
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        if (eol == nullptr) {
+            // the last line may go without a newline
+            if (!eof_ || p == end) {
+                return MORE;
+            }
+            eol = end;
+        }
+        pos_ = eol - buf_.data() + (eol < end ? 1 : 0);
+        line_++;
+        if (eol > p && eol[-1] == '\r') {
+            eol--;
+        }
+        if (eol == p || *p == '#') {
+            continue;
+        }
+
+        static const char escapes[] = "tnr\\";
+        static const char unescaped[] = "\t\n\r\\";
+        RedisCommandEncoder enc(out);
+        enc.begin(1 + std::count(p, eol, '\t'));
+        for (size_t i = 0; p <= eol; i++) {
+            arg_.clear();
+            for (; p < eol && *p != '\t'; p++) {
+                const char* escaped = *p == '\\' && p + 1 < eol ? strchr(escapes, p[1]) : nullptr;
+                if (escaped == nullptr || p[1] == '\0') {
+                    arg_.push_back(*p);
+                    continue;
+                }
+                arg_.push_back(unescaped[escaped - escapes]);
+                p++;
+            }
+            p++;
+            enc.arg(arg_);
+            if (i <= 1) {
+                key_.swap(arg_);
+            }
+        }
+        key = RedisStringView(key_);
+        return PARSED;
+    }
+}
+
+int RedisCommandReader::parse_length(const char*& p, const char* end, int64_t& val) {
+    val = 0;
+    for (const char* start = p; p < end; p++) {
+        if (*p == '\r') {
+            if (p == start) {
+                return bad("expected a length");
+            }
+            if (p + 1 == end) {
+                return MORE;
+            }
+            if (p[1] != '\n') {
+                return bad("length not followed by CRLF");
+            }
+            p += 2;
+            return PARSED;
+        }
+        if (*p < '0' || *p > '9' || p - start >= 18) {
+            return bad("invalid length");
+        }
+        val = val * 10 + (*p - '0');
+    }
+    return MORE;
+}
+
+int RedisCommandReader::bad(const char* what) {
+    if (format_ == RedisBulkLoader::FORMAT_TSV) {
+        error_ = std::string(what) + " at line " + std::to_string(line_ + 1);
+    } else {
+        error_ = std::string(what) + " in the command at byte " + std::to_string(offset_ + pos_);
+    }
+    return BAD;
+}
+
+bool RedisCommandReader::fill() {
+    if (eof_) {
+        return false;
+    }
+    buf_.erase(0, pos_);
+    offset_ += pos_;
+    pos_ = 0;
+    size_t old = buf_.size();
+    buf_.resize(old + RCLI_LOADER_READ_SIZE);
+    in_.read(&buf_[old], RCLI_LOADER_READ_SIZE);
+    size_t n = (size_t) in_.gcount();
+    buf_.resize(old + n);
+    eof_ = n == 0;
+    return true;
+}
+
+// FNV-1a, spreads the keys over the connections
+uint64_t key_hash(const RedisStringView& key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key.size(); i++) {
+        hash = (hash ^ (uint8_t) key.data()[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+}  // namespace
+
+// One connection of a load and the thread writing to it. The commands of
+// the current chunk go through a RedisWindowPipeline as fast as its window
+// takes them.
+class RedisLoaderConn {
+public:
+    RedisLoaderConn(load_state_t* state, const RedisBulkLoader::loader_options_t& opts)
+      : state_(state), opts_(opts) {}
+
+    // wait for room in the queue, false when the load stopped
+    bool push(load_chunk_t&& chunk);
+    // no more chunks
+    void close();
+    void run();
+
+    RedisClient cli_;
+    std::thread thread_;
+    uint64_t replies_ = 0;
+    uint64_t bytes_ = 0;
+
+private:
+    // take the next chunk, waiting only when nothing is in flight. false once
+    // the queue was closed and drained
+    bool next_chunk(bool wait);
+    // add what the window takes, false after a connection error
+    bool feed(RedisWindowPipeline& window);
+    void on_error(uint64_t index, const std::string& error);
+    void fail(const std::string& error);
+
+    load_state_t* state_;
+    const RedisBulkLoader::loader_options_t& opts_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<load_chunk_t> queue_;
+    bool closed_ = false;
+
+    load_chunk_t chunk_;
+    size_t next_ = 0;  // first command of chunk_ not added yet
+    std::deque<uint64_t> in_flight_;  // index of each command waiting for its reply
+    uint64_t bytes_queued_ = 0;
+};
+
+bool RedisLoaderConn::push(load_chunk_t&& chunk) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // another connection stopping the load does not notify this one
+    while (queue_.size() >= RCLI_LOADER_QUEUE && !state_->stop) {
+        cond_.wait_for(lock, std::chrono::milliseconds(RCLI_LOADER_POLL_MS));
+    }
+    if (state_->stop) {
+        return false;
+    }
+    queue_.emplace_back(std::move(chunk));
+    cond_.notify_all();
+    return true;
+}
+
+void RedisLoaderConn::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    cond_.notify_all();
+}
+
+bool RedisLoaderConn::next_chunk(bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (wait && queue_.empty() && !closed_ && !state_->stop) {
+        cond_.wait_for(lock, std::chrono::milliseconds(RCLI_LOADER_POLL_MS));
+    }
+    if (queue_.empty()) {
+        return !closed_;
+    }
+    chunk_ = std::move(queue_.front());
+    queue_.pop_front();
+    next_ = 0;
+    cond_.notify_all();
+    return true;
+}
+
+void RedisLoaderConn::run() {
+    RedisWindowPipeline::window_options_t window_opts;
+    window_opts.max_in_flight = opts_.window;
+    window_opts.max_obuf = opts_.max_obuf;
+    RedisWindowPipeline window(&cli_, window_opts);
+    window.on_reply([this](uint64_t /*seq*/, int status, const std::string& error) {
+        uint64_t index = in_flight_.front();
+        in_flight_.pop_front();
+        if (status == RCLI_RET_ERROR) {
+            on_error(index, error);
+        }
+    });
+
+    bool more = true;
+    while (!state_->stop) {
+        if (next_ == chunk_.ends.size() && more) {
+            more = next_chunk(window.in_flight() == 0);
+        }
+        if (!feed(window)) {
+            break;
+        }
+        if (window.in_flight() == 0) {
+            if (!more) {
+                break;
+            }
+            continue;
+        }
+        if (window.pump(RCLI_LOADER_POLL_MS) != RCLI_RET_OK) {
+            fail(window.get_last_error());
+            break;
+        }
+    }
+    // stopped by another connection, what is in flight here still gets its replies
+    window.drain();
+    replies_ = window.stats().replies;
+    bytes_ = bytes_queued_;
+}
+
+bool RedisLoaderConn::feed(RedisWindowPipeline& window) {
+    size_t count = chunk_.ends.size();
+    while (next_ < count && !window.full()) {
+        // at least one command, then as many as fit, added in one piece
+        size_t room = opts_.max_obuf - std::min(window.obuf_bytes(), opts_.max_obuf);
+        size_t slots = opts_.window - window.in_flight();
+        size_t begin = next_ == 0 ? 0 : chunk_.ends[next_ - 1];
+        size_t last = next_;
+        do {
+            in_flight_.push_back(chunk_.index[last++]);
+        } while (last < count && last - next_ < slots && chunk_.ends[last] - begin <= room);
+        size_t len = chunk_.ends[last - 1] - begin;
+        if (window.add_formatted(RedisStringView(chunk_.data.data() + begin, len), last - next_) != RCLI_RET_OK) {
+            fail(window.get_last_error());
+            return false;
+        }
+        bytes_queued_ += len;
+        next_ = last;
+    }
+    return true;
+}
+
+void RedisLoaderConn::on_error(uint64_t index, const std::string& error) {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (state_->errors++ == 0) {
+        state_->first_error = "command " + std::to_string(index) + ": " + error;
+    }
+    if (state_->error_cb && *state_->error_cb) {
+        (*state_->error_cb)(index, error);
+    }
+}
+
+void RedisLoaderConn::fail(const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->error.empty()) {
+            state_->error = error + ", " + std::to_string(in_flight_.size()) + " commands without a reply";
+        }
+    }
+    state_->stop = true;
+}
+
+class RedisBulkLoaderImpl {
+public:
+    int load(std::istream& in, int format, RedisBulkLoader::loader_stats_t& out);
+
+    std::string host_;
+    uint32_t port_ = 0;
+    std::string pwd_;
+    RedisBulkLoader::loader_options_t opts_;
+    RedisBulkLoader::error_cb_t error_cb_;
+    std::string error_str_;
+};
+
+int RedisBulkLoaderImpl::load(std::istream& in, int format, RedisBulkLoader::loader_stats_t& out) {
+    out = RedisBulkLoader::loader_stats_t();
+    error_str_.clear();
+    load_state_t state;
+    state.error_cb = &error_cb_;
+
+    std::vector<std::unique_ptr<RedisLoaderConn>> conns;
+    for (uint32_t i = 0; i < std::max<uint32_t>(opts_.connections, 1); i++) {
+        conns.emplace_back(new RedisLoaderConn(&state, opts_));
+        RedisLoaderConn* conn = conns.back().get();
+        conn->cli_.init(host_, port_, pwd_, opts_.conn);
+        if (!conn->cli_.connect()) {
+            error_str_ = conn->cli_.get_last_error();
+            return RCLI_ERROR;
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (auto& conn : conns) {
+        conn->thread_ = std::thread(&RedisLoaderConn::run, conn.get());
+    }
+
+    RedisCommandReader reader(in, format);
+    std::vector<load_chunk_t> chunks(conns.size());
+    std::string cmd;
+    RedisStringView key;
+    while (!state.stop) {
+        cmd.clear();
+        if (!reader.next(cmd, key)) {
+            break;
+        }
+        size_t i = conns.size() > 1 ? key_hash(key) % conns.size() : 0;
+        load_chunk_t& chunk = chunks[i];
+        chunk.data.append(cmd);
+        chunk.ends.push_back(chunk.data.size());
+        chunk.index.push_back(out.commands++);
+        if (chunk.data.size() >= opts_.chunk_bytes) {
+            conns[i]->push(std::move(chunk));
+            chunk = load_chunk_t();
+        }
+    }
+    for (size_t i = 0; i < conns.size(); i++) {
+        if (!chunks[i].ends.empty()) {
+            conns[i]->push(std::move(chunks[i]));
+        }
+        conns[i]->close();
+    }
+    if (!reader.error().empty()) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.error = reader.error();
+        state.stop = true;
+    }
+    for (auto& conn : conns) {
+        conn->thread_.join();
+        out.replies += conn->replies_;
+        out.bytes += conn->bytes_;
+    }
+    out.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    out.errors = state.errors;
+    out.first_error = state.first_error;
+
+    if (!state.error.empty()) {
+        error_str_ = state.error;
+        return RCLI_ERROR;
+    }
+    if (out.errors > 0) {
+        error_str_ = out.first_error;
+        return RCLI_RET_ERROR;
+    }
+    return RCLI_RET_OK;
+}
+
+RedisBulkLoader::RedisBulkLoader() { impl_ = new RedisBulkLoaderImpl; }
+
+RedisBulkLoader::~RedisBulkLoader() { delete (RedisBulkLoaderImpl*) impl_; }
+
+void RedisBulkLoader::init(const std::string& host, uint32_t port, const std::string& pwd,
+                           const loader_options_t& opts) {
+    RedisBulkLoaderImpl* impl = (RedisBulkLoaderImpl*) impl_;
+    impl->host_ = host;
+    impl->port_ = port;
+    impl->pwd_ = pwd;
+    impl->opts_ = opts;
+}
+
+void RedisBulkLoader::set_error_callback(error_cb_t cb) {
+    RedisBulkLoaderImpl* impl = (RedisBulkLoaderImpl*) impl_;
+    impl->error_cb_ = std::move(cb);
+}
+
+const std::string& RedisBulkLoader::get_last_error() {
+    RedisBulkLoaderImpl* impl = (RedisBulkLoaderImpl*) impl_;
+    return impl->error_str_;
+}
+
+int RedisBulkLoader::load(std::istream& in, int format, loader_stats_t& out) {
+    RedisBulkLoaderImpl* impl = (RedisBulkLoaderImpl*) impl_;
+    return impl->load(in, format, out);
+}
+
+int RedisBulkLoader::load_file(const std::string& path, int format, loader_stats_t& out) {
+    RedisBulkLoaderImpl* impl = (RedisBulkLoaderImpl*) impl_;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        out = loader_stats_t();
+        impl->error_str_ = "open " + path + " error!";
+        return RCLI_ERROR;
+    }
+    return impl->load(in, format, out);
+}
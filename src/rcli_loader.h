@@ -0,0 +1,80 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include <istream>
+
+// Mass insertion, the embeddable counterpart of redis-cli --pipe.
+//
+// Commands are read from a stream, either raw RESP (arrays of bulk strings,
+// what redis-cli --pipe takes) or TSV with one command per line and its
+// arguments separated by tabs. They are written continuously over one or more
+// connections without waiting for replies, up to window commands in flight
+// per connection, while the replies are read as they arrive.
+//
+//     RedisBulkLoader loader;
+//     RedisBulkLoader::loader_options_t opts;
+//     opts.connections = 4;
+//     loader.init("127.0.0.1", 6379, "pwd", opts);
+//     RedisBulkLoader::loader_stats_t stats;
+//     if (loader.load_file("keys.tsv", RedisBulkLoader::FORMAT_AUTO, stats) != RCLI_RET_OK) {
+//         ... loader.get_last_error(), stats.errors ...
+//     }
+//
+// In TSV a backslash escapes a tab (\t), a newline (\n), a carriage return
+// (\r) and itself (\\), empty lines and lines starting with # are skipped.
+// With several connections the commands are spread by their key, the second
+// argument, so the commands on one key keep their order. Nothing is retried:
+// after a connection error the load stops, the commands without a reply may
+// or may not have been executed.
+class RedisBulkLoader {
+public:
+    enum {
+        FORMAT_AUTO = 0,  // RESP when the input starts with '*', TSV otherwise
+        FORMAT_RESP,
+        FORMAT_TSV,
+    };
+
+    typedef struct loader_options {
+        RedisClient::options_t conn;  // of every connection
+        uint32_t connections = 1;
+        size_t window = 4096;            // commands in flight per connection
+        size_t max_obuf = 1024 * 1024;   // bytes queued for a connection's socket
+        size_t chunk_bytes = 64 * 1024;  // commands handed to a connection at once
+    } loader_options_t;
+
+    typedef struct loader_stats {
+        uint64_t commands = 0;  // read from the input
+        uint64_t replies = 0;
+        uint64_t errors = 0;  // error replies
+        uint64_t bytes = 0;   // RESP written
+        double seconds = 0;
+        std::string first_error;  // first error reply, with the index of its command
+        double qps() const { return seconds > 0 ? replies / seconds : 0; }
+    } loader_stats_t;
+
+    // index of the command in the input, from 0, and the error it got. called on
+    // the connections' threads, one call at a time
+    typedef std::function<void(uint64_t index, const std::string& error)> error_cb_t;
+
+    RedisBulkLoader();
+    virtual ~RedisBulkLoader();
+
+    RedisBulkLoader(const RedisBulkLoader&) = delete;
+    RedisBulkLoader& operator=(const RedisBulkLoader&) = delete;
+
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const loader_options_t& opts);
+    void set_error_callback(error_cb_t cb);
+    const std::string& get_last_error();
+
+    // RCLI_RET_OK when every command got a reply and none was an error,
+    // RCLI_RET_ERROR after error replies, RCLI_ERROR when the input was
+    // malformed or a connection failed. out is filled in either way
+    int load(std::istream& in, int format, loader_stats_t& out);
+    int load_file(const std::string& path, int format, loader_stats_t& out);
+
+private:
+    void* impl_;
+};
@@ -0,0 +1,157 @@
+#include "rcli_pipeline.h"
+#include "rcli_impl.h"
+
+RedisPipeline::RedisPipeline(RedisClient* cli) : cli_(cli) {}
+
+void RedisPipeline::clear() {
+    buf_.clear();
+    slots_.clear();
+    executed_ = false;
+}
+
+size_t RedisPipeline::append(int type, void* retval, const std::vector<std::string>& cmd) {
+    RedisCommandEncoder enc = encoder();
+    enc.begin(cmd.size());
+    for (auto& arg : cmd) {
+        enc.arg(arg);
+    }
+    return add_slot(type, retval);
+}
+
+size_t RedisPipeline::add_slot(int type, void* retval) {
+    slot_t slot;
+    slot.type = type;
+    slot.retval = retval;
+    slot.err = RCLI_ERROR;
+    slots_.emplace_back(std::move(slot));
+    return slots_.size() - 1;
+}
+
+size_t RedisPipeline::append_for_status(const std::vector<std::string>& cmd) {
+    return append(SLOT_STATUS, nullptr, cmd);
+}
+
+size_t RedisPipeline::append_for_integer(int64_t& retval, const std::vector<std::string>& cmd) {
+    return append(SLOT_INTEGER, &retval, cmd);
+}
+
+size_t RedisPipeline::append_for_double(double& retval, const std::vector<std::string>& cmd) {
+    return append(SLOT_DOUBLE, &retval, cmd);
+}
+
+size_t RedisPipeline::append_for_string(std::string& retval, const std::vector<std::string>& cmd) {
+    return append(SLOT_STRING, &retval, cmd);
+}
+
+size_t RedisPipeline::append_for_vector(std::vector<std::string>& retval, const std::vector<std::string>& cmd) {
+    return append(SLOT_VECTOR, &retval, cmd);
+}
+
+size_t RedisPipeline::append_for_visitor(RedisReplyVisitor& visitor, const std::vector<std::string>& cmd) {
+    return append(SLOT_VISITOR, &visitor, cmd);
+}
+
+int RedisPipeline::flush() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    redisContext* ctx = cli->get_context();
+    if (ctx == nullptr) {
+        cli->error_str_ = "Redis Context nullptr!";
+        return RCLI_ERROR;
+    }
+    cli->drop_unread();
+    if (redisAppendFormattedCommand(ctx, buf_.data(), buf_.size()) != REDIS_OK) {
+        cli->error_str_.assign(ctx->errstr);
+        return RCLI_ERROR;
+    }
+    int done = 0;
+    do {
+        if (redisBufferWrite(ctx, &done) == REDIS_ERR) {
+            cli->error_str_.assign(ctx->errstr);
+            return ctx->err == REDIS_ERR_TIMEOUT ? RCLI_TIMEOUT : RCLI_ERROR;
+        }
+    } while (!done);
+    return RCLI_RET_OK;
+}
+
+void RedisPipeline::drain() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    redisContext* ctx = cli->get_context();
+    std::string first_error;
+    for (auto& slot : slots_) {
+        if (slot.type == SLOT_SKIP) {
+            continue;
+        }
+        if (slot.type == SLOT_VECTOR) {
+            RedisVectorVisitor visitor(*(std::vector<std::string>*) slot.retval);
+            slot.err = cli->read_reply(visitor);
+        } else if (slot.type == SLOT_VISITOR) {
+            slot.err = cli->read_reply(*(RedisReplyVisitor*) slot.retval);
+        } else {
+            void* reply = nullptr;
+            redisGetReply(ctx, &reply);
+            CSmartPtr<void, freeReplyObject> reply_sp(reply);
+            decode(slot, (const redisReply*) reply);
+        }
+        if (slot.err != RCLI_RET_OK && slot.err != RCLI_RET_FAIL) {
+            slot.error = cli->error_str_;
+            if (first_error.empty()) {
+                first_error = slot.error;
+            }
+        }
+    }
+    cli->error_str_ = first_error;
+}
+
+void RedisPipeline::decode(slot_t& slot, const redisReply* reply) {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    switch (slot.type) {
+        case SLOT_STATUS: slot.err = cli->get_reply_status(reply); break;
+        case SLOT_INTEGER: slot.err = cli->get_reply_integer(reply, *(int64_t*) slot.retval); break;
+        case SLOT_DOUBLE: slot.err = cli->get_reply_double(reply, *(double*) slot.retval); break;
+        case SLOT_STRING: slot.err = cli->get_reply_string(reply, *(std::string*) slot.retval); break;
+        case SLOT_VECTOR: slot.err = cli->get_reply_vector(reply, *(std::vector<std::string>*) slot.retval); break;
+        case SLOT_VISITOR: slot.err = cli->get_reply_visitor(reply, *(RedisReplyVisitor*) slot.retval); break;
+        default: break;
+    }
+}
+
+int RedisPipeline::exec() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    executed_ = true;
+    if (slots_.empty()) {
+        return RCLI_RET_OK;
+    }
+    // one call per batch, the commands in it are not broken down
+    RedisCallRecorder rec(cli, "PIPELINE");
+
+    // the whole batch is resent only when no byte of it reached the socket,
+    // the server may have applied a prefix written before the error, and once
+    // replies are being read the commands may have been applied.
+    int err = RCLI_ERROR;
+    if (cli_->check_alive()) {
+        uint64_t written = cli->bytes_written_;
+        err = flush();
+        for (int n = RCLI_TRY_COUNT; err == RCLI_ERROR && cli->bytes_written_ == written && n > 0 && cli_->recover();
+             n--) {
+            // recover() wrote its AUTH
+            written = cli->bytes_written_;
+            err = flush();
+        }
+    }
+    if (err != RCLI_RET_OK) {
+        for (auto& slot : slots_) {
+            slot.err = err;
+            slot.error = cli->error_str_;
+        }
+        buf_.clear();
+        return rec.done(err);
+    }
+    buf_.clear();
+
+    drain();
+    redisContext* ctx = cli->get_context();
+    if (ctx->err) {
+        return rec.done(ctx->err == REDIS_ERR_TIMEOUT ? RCLI_TIMEOUT : RCLI_ERROR);
+    }
+    return rec.done(RCLI_RET_OK);
+}
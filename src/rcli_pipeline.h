@@ -0,0 +1,237 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+struct redisReply;
+
+// Queue commands and send them to redis in a single write, then read all the
+// replies back into the typed slots registered by append_for_*().
+//
+//     RedisPipeline pipe = rcli->pipeline();
+//     int64_t out1, out2;
+//     pipe.hset("key", "f1", "v1", out1);
+//     pipe.zadd("zkey", std::make_pair(1.0, std::string("m1")), out2);
+//     if (pipe.exec() == RCLI_RET_OK && pipe.status(0) == RCLI_RET_OK) { ... }
+//
+// Output references must stay valid until exec() returns.
+class RedisPipeline {
+public:
+    explicit RedisPipeline(RedisClient* cli);
+
+    size_t size() const { return slots_.size(); }
+    void clear();
+
+    // return the slot index of the queued command
+    size_t append_for_status(const std::vector<std::string>& cmd);
+    size_t append_for_integer(int64_t& retval, const std::vector<std::string>& cmd);
+    size_t append_for_double(double& retval, const std::vector<std::string>& cmd);
+    size_t append_for_string(std::string& retval, const std::vector<std::string>& cmd);
+    size_t append_for_vector(std::vector<std::string>& retval, const std::vector<std::string>& cmd);
+    // the reply is walked by visitor, which must stay valid until exec() returns
+    size_t append_for_visitor(RedisReplyVisitor& visitor, const std::vector<std::string>& cmd);
+
+    // arguments are encoded by RedisCommandEncoder, see RedisClient::commanda_for_*
+    template <class... Args>
+    size_t appenda_for_status(const Args&... args) {
+        encoder().command(args...);
+        return add_slot(SLOT_STATUS, nullptr);
+    }
+    template <class... Args>
+    size_t appenda_for_integer(int64_t& retval, const Args&... args) {
+        encoder().command(args...);
+        return add_slot(SLOT_INTEGER, &retval);
+    }
+    template <class... Args>
+    size_t appenda_for_double(double& retval, const Args&... args) {
+        encoder().command(args...);
+        return add_slot(SLOT_DOUBLE, &retval);
+    }
+    template <class... Args>
+    size_t appenda_for_string(std::string& retval, const Args&... args) {
+        encoder().command(args...);
+        return add_slot(SLOT_STRING, &retval);
+    }
+    template <class... Args>
+    size_t appenda_for_vector(std::vector<std::string>& retval, const Args&... args) {
+        encoder().command(args...);
+        return add_slot(SLOT_VECTOR, &retval);
+    }
+    template <class... Args>
+    size_t appenda_for_visitor(RedisReplyVisitor& visitor, const Args&... args) {
+        encoder().command(args...);
+        return add_slot(SLOT_VISITOR, &visitor);
+    }
+
+    // flush all queued commands and read their replies.
+    // return RCLI_RET_OK if every reply was received, RCLI_ERROR on connection error and RCLI_TIMEOUT
+    // when the command timeout or deadline expired.
+    int exec();
+
+    // RCLI_RET_* of the command at index, valid after exec()
+    int status(size_t index) const { return slots_[index].err; }
+    const std::string& error(size_t index) const { return slots_[index].error; }
+
+    // keys
+
+    size_t exist(const std::string& key) { return appenda_for_status("EXISTS", key); }
+
+    size_t get(const std::string& key, std::string& out) { return appenda_for_string(out, "GET", key); }
+
+    size_t set(const std::string& key, const std::string& in) { return appenda_for_status("SET", key, in); }
+
+    size_t del(const std::string& key) { return appenda_for_status("DEL", key); }
+
+    size_t expire(const std::string& key, uint32_t second) {
+        return appenda_for_status("EXPIRE", key, second);
+    }
+
+    size_t expireat(const std::string& key, uint32_t timestamp) {
+        return appenda_for_status("EXPIREAT", key, timestamp);
+    }
+
+    size_t pexpire(const std::string& key, uint32_t milliseconds) {
+        return appenda_for_status("PEXPIRE", key, milliseconds);
+    }
+
+    // hash map
+
+    size_t hexist(const std::string& key, const std::string& field) {
+        return appenda_for_status("HEXISTS", key, field);
+    }
+
+    size_t hget(const std::string& key, const std::string& field, std::string& out) {
+        return appenda_for_string(out, "HGET", key, field);
+    }
+
+    size_t hset(const std::string& key, const std::string& field, const std::string& in, int64_t& out) {
+        return appenda_for_integer(out, "HSET", key, field, in);
+    }
+
+    size_t hincrby(const std::string& key, const std::string& field, const int64_t& in, int64_t& out) {
+        return appenda_for_integer(out, "HINCRBY", key, field, in);
+    }
+
+    size_t hdel(const std::string& key, const std::string& field) { return appenda_for_status("HDEL", key, field); }
+
+    size_t hkeys(const std::string& key, std::vector<std::string>& out) {
+        return appenda_for_vector(out, "HKEYS", key);
+    }
+
+    // sorted set
+
+    size_t zadd(const std::string& key, const RedisClient::score_member_t& in, int64_t& out) {
+        return appenda_for_integer(out, "ZADD", key, in.first, in.second);
+    }
+
+    size_t zadd(const std::string& key, const std::vector<RedisClient::score_member_t>& in, int64_t& out) {
+        RedisCommandEncoder enc = encoder();
+        enc.begin(2 + in.size() * 2);
+        enc.arg("ZADD");
+        enc.arg(key);
+        for (auto& kv : in) {
+            enc.arg(kv.first);
+            enc.arg(kv.second);
+        }
+        return add_slot(SLOT_INTEGER, &out);
+    }
+
+    size_t zcard(const std::string& key, int64_t& out) { return appenda_for_integer(out, "ZCARD", key); }
+
+    size_t zincrby(const std::string& key, const RedisClient::incre_member_t& in, double& out) {
+        return appenda_for_double(out, "ZINCRBY", key, in.first, in.second);
+    }
+
+    size_t zrange(const std::string& key, int32_t start, int32_t stop, std::vector<std::string>& out,
+                  bool withscore = false) {
+        if (withscore) {
+            return appenda_for_vector(out, "ZRANGE", key, start, stop, "WITHSCORES");
+        } else {
+            return appenda_for_vector(out, "ZRANGE", key, start, stop);
+        }
+    }
+
+    size_t zrangebyscore(const std::string& key, double min, double max, std::vector<std::string>& out,
+                         bool withscore = false) {
+        if (withscore) {
+            return appenda_for_vector(out, "ZRANGEBYSCORE", key, min, max, "WITHSCORES");
+        } else {
+            return appenda_for_vector(out, "ZRANGEBYSCORE", key, min, max);
+        }
+    }
+
+    size_t zrank(const std::string& key, const std::string& member, int64_t& out) {
+        return appenda_for_integer(out, "ZRANK", key, member);
+    }
+
+    size_t zscore(const std::string& key, const std::string& member, double& out) {
+        return appenda_for_double(out, "ZSCORE", key, member);
+    }
+
+    size_t zrem(const std::string& key, const std::string& member, int64_t& out) {
+        return appenda_for_integer(out, "ZREM", key, member);
+    }
+
+    // stream
+
+    size_t xadd(const std::string& key, const std::vector<RedisClient::field_value_t>& in, std::string& out,
+                size_t maxlen = 0, bool approx = true) {
+        RedisCommandEncoder enc = encoder();
+        enc.begin(3 + (maxlen ? 3 : 0) + in.size() * 2);
+        enc.arg("XADD");
+        enc.arg(key);
+        if (maxlen) {
+            enc.arg("MAXLEN");
+            enc.arg(approx ? "~" : "=");
+            enc.arg(maxlen);
+        }
+        enc.arg("*");
+        for (auto& kv : in) {
+            enc.arg(kv.first);
+            enc.arg(kv.second);
+        }
+        return add_slot(SLOT_STRING, &out);
+    }
+
+    size_t xlen(const std::string& key, int64_t& out) { return appenda_for_integer(out, "XLEN", key); }
+
+protected:
+    enum {
+        SLOT_STATUS = 0,
+        SLOT_INTEGER,
+        SLOT_DOUBLE,
+        SLOT_STRING,
+        SLOT_VECTOR,
+        SLOT_VISITOR,
+        SLOT_SKIP,
+    };
+
+    typedef struct slot {
+        int type;
+        void* retval;
+        int err;
+        std::string error;
+    } slot_t;
+
+    // encoder appending to buf_, starting a new batch after exec()
+    RedisCommandEncoder encoder() {
+        if (executed_) {
+            clear();
+        }
+        return RedisCommandEncoder(buf_);
+    }
+    size_t append(int type, void* retval, const std::vector<std::string>& cmd);
+    // register the reply slot of the command just encoded
+    size_t add_slot(int type, void* retval);
+    int flush();
+    void drain();
+    // the typed value of slot out of a reply tree
+    void decode(slot_t& slot, const redisReply* reply);
+
+    RedisClient* cli_;
+    std::string buf_;
+    std::vector<slot_t> slots_;
+    bool executed_ = false;
+};
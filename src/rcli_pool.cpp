@@ -0,0 +1,266 @@
+#include "rcli_pool.h"
+#include "rcli_health.h"
+
+enum {
+    ENTRY_FREE = 0,
+    ENTRY_USED,
+    ENTRY_CLOSED,
+};
+
+struct RedisClientPool::entry {
+    std::unique_ptr<RedisClient> cli;
+    std::atomic<int> state;
+    std::atomic<int64_t> last_used;  // steady_clock ticks
+};
+
+namespace {
+
+std::atomic<uint64_t> g_pool_id(1);
+
+// the client each thread returned last, per pool
+typedef std::pair<uint64_t, std::weak_ptr<void>> local_hint_t;
+thread_local std::vector<local_hint_t> t_local_hints;
+
+int64_t now_ticks() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+}  // namespace
+
+RedisClient* RedisClientPool::Lease::get() const { return entry_ ? entry_->cli.get() : nullptr; }
+
+void RedisClientPool::Lease::release() {
+    if (pool_ && entry_) {
+        pool_->release(entry_);
+    }
+    entry_.reset();
+    pool_ = nullptr;
+}
+
+RedisClientPool::RedisClientPool()
+  : id_(g_pool_id++), waiters_(0), acquire_count_(0), fast_count_(0), wait_count_(0), timeout_count_(0),
+    total_wait_us_(0), max_wait_us_(0), created_count_(0), closed_count_(0) {}
+
+RedisClientPool::~RedisClientPool() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+void RedisClientPool::init(const std::string& host, uint32_t port, const std::string& pwd, size_t min_size,
+                           size_t max_size, uint32_t idle_timeout_ms) {
+    host_ = host;
+    port_ = port;
+    pwd_ = pwd;
+    max_size_ = max_size > 0 ? max_size : 1;
+    min_size_ = min_size < max_size_ ? min_size : max_size_;
+    idle_timeout_ms_ = idle_timeout_ms;
+}
+
+std::string RedisClientPool::get_last_error() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_str_;
+}
+
+bool RedisClientPool::connect() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (entries_.size() < min_size_) {
+        lock.unlock();
+        std::shared_ptr<entry_t> entry = create_entry();
+        lock.lock();
+        if (entry == nullptr) {
+            return false;
+        }
+        entry->state = ENTRY_FREE;
+        entries_.emplace_back(std::move(entry));
+    }
+    return true;
+}
+
+std::shared_ptr<RedisClientPool::entry_t> RedisClientPool::create_entry() {
+    std::shared_ptr<entry_t> entry(new entry_t);
+    entry->cli.reset(new RedisClient);
+    entry->cli->init(host_, port_, pwd_, opts_);
+    entry->cli->set_stats(stats_);
+    entry->cli->set_health(health_);
+    entry->cli->set_cache(cache_);
+    entry->cli->set_scripts(scripts_);
+    entry->state = ENTRY_USED;
+    entry->last_used = now_ticks();
+    if (!entry->cli->connect()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_str_ = entry->cli->get_last_error();
+        return nullptr;
+    }
+    created_count_++;
+    return entry;
+}
+
+std::shared_ptr<RedisClientPool::entry_t> RedisClientPool::try_local() {
+    for (auto& hint : t_local_hints) {
+        if (hint.first != id_) {
+            continue;
+        }
+        std::shared_ptr<entry_t> entry = std::static_pointer_cast<entry_t>(hint.second.lock());
+        int expected = ENTRY_FREE;
+        if (entry && entry->state.compare_exchange_strong(expected, ENTRY_USED)) {
+            return entry;
+        }
+        return nullptr;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<RedisClientPool::entry_t> RedisClientPool::try_shared() {
+    for (auto& entry : entries_) {
+        int expected = ENTRY_FREE;
+        if (entry->state.compare_exchange_strong(expected, ENTRY_USED)) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+RedisClientPool::Lease RedisClientPool::acquire(uint32_t timeout_ms) {
+    if (health_ && !health_->is_up()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_str_ = "Redis node is down: " + health_->get_last_error();
+        return Lease();
+    }
+    std::shared_ptr<entry_t> entry = try_local();
+    if (entry) {
+        acquire_count_++;
+        fast_count_++;
+        return Lease(this, std::move(entry));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds(timeout_ms);
+    bool waited = false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        // announce the waiter before scanning so a concurrent release() either
+        // is seen by the scan or sees waiters_ and notifies
+        waiters_++;
+        entry = try_shared();
+        if (entry) {
+            waiters_--;
+            break;
+        }
+        if (entries_.size() + creating_ < max_size_) {
+            waiters_--;
+            creating_++;
+            lock.unlock();
+            entry = create_entry();
+            lock.lock();
+            creating_--;
+            if (entry) {
+                entries_.push_back(entry);
+                break;
+            }
+            cond_.notify_one();
+            return Lease();
+        }
+        waited = true;
+        std::cv_status st = cond_.wait_until(lock, deadline);
+        waiters_--;
+        if (st == std::cv_status::timeout) {
+            entry = try_shared();
+            if (entry) {
+                break;
+            }
+            timeout_count_++;
+            error_str_ = "RedisClientPool acquire timeout!";
+            record_wait(start);
+            return Lease();
+        }
+    }
+    if (waited) {
+        wait_count_++;
+    }
+    shrink_locked();
+    lock.unlock();
+
+    acquire_count_++;
+    record_wait(start);
+    return Lease(this, std::move(entry));
+}
+
+void RedisClientPool::release(const std::shared_ptr<entry_t>& entry) {
+    entry->last_used.store(now_ticks());
+    entry->state.store(ENTRY_FREE);
+
+    bool found = false;
+    for (auto& hint : t_local_hints) {
+        if (hint.first == id_) {
+            hint.second = entry;
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        t_local_hints.emplace_back(id_, entry);
+    }
+
+    if (waiters_.load() > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_one();
+    }
+}
+
+size_t RedisClientPool::shrink() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return shrink_locked();
+}
+
+size_t RedisClientPool::shrink_locked() {
+    size_t closed = 0;
+    int64_t now = now_ticks();
+    int64_t idle_timeout =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(idle_timeout_ms_))
+        .count();
+    for (auto it = entries_.begin(); it != entries_.end() && entries_.size() > min_size_;) {
+        std::shared_ptr<entry_t>& entry = *it;
+        int expected = ENTRY_FREE;
+        if (now - entry->last_used.load() > idle_timeout
+            && entry->state.compare_exchange_strong(expected, ENTRY_CLOSED)) {
+            it = entries_.erase(it);
+            closed++;
+        } else {
+            ++it;
+        }
+    }
+    closed_count_ += closed;
+    return closed;
+}
+
+void RedisClientPool::record_wait(std::chrono::steady_clock::time_point start) {
+    uint64_t us = elapsed_us(start);
+    total_wait_us_ += us;
+    uint64_t max_us = max_wait_us_.load();
+    while (us > max_us && !max_wait_us_.compare_exchange_weak(max_us, us)) {
+    }
+}
+
+RedisClientPool::pool_stats_t RedisClientPool::stats() {
+    pool_stats_t st;
+    st.acquire_count = acquire_count_.load();
+    st.fast_count = fast_count_.load();
+    st.wait_count = wait_count_.load();
+    st.timeout_count = timeout_count_.load();
+    st.total_wait_us = total_wait_us_.load();
+    st.max_wait_us = max_wait_us_.load();
+    st.created_count = created_count_.load();
+    st.closed_count = closed_count_.load();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    st.size = entries_.size();
+    for (auto& entry : entries_) {
+        if (entry->state.load() == ENTRY_FREE) {
+            st.idle++;
+        }
+    }
+    return st;
+}
@@ -0,0 +1,143 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// A bounded set of connected and authenticated RedisClients shared by many threads.
+//
+// acquire() first tries the client this thread returned last time without taking
+// the pool lock, then falls back to scanning the shared list, opening a new
+// connection while below max_size, or waiting for a release.
+//
+//     RedisClientPool pool;
+//     pool.init("127.0.0.1", 6379, "pwd", 4, 16);
+//     pool.connect();
+//     RedisClientPool::Lease cli = pool.acquire();
+//     if (cli) cli->set("key", "val");
+//
+// Leases must be returned before the pool is destroyed.
+class RedisClientPool {
+    struct entry;
+    typedef struct entry entry_t;
+
+public:
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(RedisClientPool* pool, std::shared_ptr<entry_t> entry) : pool_(pool), entry_(std::move(entry)) {}
+        ~Lease() { release(); }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) : pool_(other.pool_), entry_(std::move(other.entry_)) { other.pool_ = nullptr; }
+        Lease& operator=(Lease&& other) {
+            if (this != &other) {
+                release();
+                pool_ = other.pool_;
+                entry_ = std::move(other.entry_);
+                other.pool_ = nullptr;
+            }
+            return *this;
+        }
+
+        RedisClient* get() const;
+        RedisClient* operator->() const { return get(); }
+        RedisClient& operator*() const { return *get(); }
+        explicit operator bool() const { return entry_ != nullptr; }
+
+        // give the client back to the pool before the lease goes out of scope
+        void release();
+
+    private:
+        RedisClientPool* pool_ = nullptr;
+        std::shared_ptr<entry_t> entry_;
+    };
+
+    typedef struct pool_stats {
+        uint64_t acquire_count = 0;   // successful acquire()
+        uint64_t fast_count = 0;      // served from the thread cache without locking
+        uint64_t wait_count = 0;      // had to wait for a release
+        uint64_t timeout_count = 0;   // gave up after timeout_ms
+        uint64_t total_wait_us = 0;   // time spent in the slow path
+        uint64_t max_wait_us = 0;
+        uint64_t created_count = 0;   // connections opened
+        uint64_t closed_count = 0;    // connections closed by shrink()
+        size_t size = 0;              // connections owned now
+        size_t idle = 0;              // connections not leased now
+    } pool_stats_t;
+
+    RedisClientPool();
+    ~RedisClientPool();
+
+    RedisClientPool(const RedisClientPool&) = delete;
+    RedisClientPool& operator=(const RedisClientPool&) = delete;
+
+    void init(const std::string& host, uint32_t port, const std::string& pwd, size_t min_size, size_t max_size,
+              uint32_t idle_timeout_ms = 60000);
+    std::string get_last_error();
+    // options of every client of the pool, set before connect(). their RedisTlsContext shares its TLS sessions
+    void set_options(const RedisClient::options_t& opts) { opts_ = opts; }
+    // shared by every client of the pool, set before connect(). see rcli_stats.h
+    void set_stats(RedisStats* stats) { stats_ = stats; }
+    // shared by every client of the pool, set before connect(). see rcli_health.h
+    void set_health(RedisHealthMonitor* monitor) { health_ = monitor; }
+    // shared by every client of the pool, set before connect(). see rcli_cache.h
+    void set_cache(RedisNearCache* cache) { cache_ = cache; }
+    // loaded by every client of the pool when it connects, set before connect(). see rcli_script.h
+    void set_scripts(RedisScriptRegistry* registry) { scripts_ = registry; }
+
+    // open min_size connections
+    bool connect();
+
+    // an empty lease is returned when no client became available within timeout_ms,
+    // a new connection could not be established or the health monitor reports the node down
+    Lease acquire(uint32_t timeout_ms = 1000);
+
+    // close idle connections above min_size unused for idle_timeout_ms
+    size_t shrink();
+
+    pool_stats_t stats();
+
+private:
+    std::shared_ptr<entry_t> try_local();
+    std::shared_ptr<entry_t> try_shared();
+    std::shared_ptr<entry_t> create_entry();
+    void release(const std::shared_ptr<entry_t>& entry);
+    size_t shrink_locked();
+    void record_wait(std::chrono::steady_clock::time_point start);
+
+    const uint64_t id_;
+    std::string host_;
+    uint32_t port_ = 0;
+    std::string pwd_;
+    size_t min_size_ = 1;
+    size_t max_size_ = 1;
+    uint32_t idle_timeout_ms_ = 60000;
+    RedisClient::options_t opts_;
+    RedisStats* stats_ = nullptr;
+    RedisHealthMonitor* health_ = nullptr;
+    RedisNearCache* cache_ = nullptr;
+    RedisScriptRegistry* scripts_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<std::shared_ptr<entry_t>> entries_;
+    size_t creating_ = 0;
+    std::string error_str_;
+    std::atomic<int> waiters_;
+
+    std::atomic<uint64_t> acquire_count_;
+    std::atomic<uint64_t> fast_count_;
+    std::atomic<uint64_t> wait_count_;
+    std::atomic<uint64_t> timeout_count_;
+    std::atomic<uint64_t> total_wait_us_;
+    std::atomic<uint64_t> max_wait_us_;
+    std::atomic<uint64_t> created_count_;
+    std::atomic<uint64_t> closed_count_;
+};
@@ -0,0 +1,620 @@
+#include "rcli_pubsub.h"
+#include "rcli_impl.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#ifdef _WIN32
+#    include <hiredis/sockcompat.h>
+#else
+#    include <poll.h>
+#endif
+
+// names per SUBSCRIBE when subscribing again after a reconnect
+#define RCLI_PUBSUB_BATCH 1000
+
+namespace {
+
+enum {
+    SUB_CHANNEL = 0,
+    SUB_PATTERN,
+    SUB_SHARD,
+    SUB_KINDS,
+};
+
+const char* const subscribe_verbs[SUB_KINDS] = {"SUBSCRIBE", "PSUBSCRIBE", "SSUBSCRIBE"};
+const char* const unsubscribe_verbs[SUB_KINDS] = {"UNSUBSCRIBE", "PUNSUBSCRIBE", "SUNSUBSCRIBE"};
+
+typedef struct queued_message {
+    redisReply* reply = nullptr;  // owns what msg points into, freed once handled
+    RedisSubscriber::message_t msg;
+} queued_message_t;
+
+// single producer single consumer ring, the reader thread pushes and one
+// handler thread pops. each side only writes its own index
+class message_ring {
+public:
+    explicit message_ring(size_t size) : head_(0), tail_(0) {
+        size_t capacity = 2;
+        while (capacity < size) {
+            capacity <<= 1;
+        }
+        slots_.resize(capacity);
+        mask_ = capacity - 1;
+    }
+
+    bool push(const queued_message_t& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            return false;
+        }
+        slots_[tail & mask_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(queued_message_t& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // head first, tail never falls behind a head read before it
+    size_t size() const {
+        size_t head = head_.load(std::memory_order_acquire);
+        return tail_.load(std::memory_order_acquire) - head;
+    }
+    bool empty() const { return size() == 0; }
+
+private:
+    std::vector<queued_message_t> slots_;
+    size_t mask_ = 0;
+    // the indexes on cache lines of their own, the two threads would contend for one otherwise
+    char pad0_[64];
+    std::atomic<size_t> head_;
+    char pad1_[64];
+    std::atomic<size_t> tail_;
+    char pad2_[64];
+};
+
+typedef struct handler_thread {
+    explicit handler_thread(size_t size) : ring(size), sleeping(false) {}
+
+    message_ring ring;
+    // set while the thread waits on cond, the reader only notifies then
+    std::atomic<bool> sleeping;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+} handler_thread_t;
+
+bool is_word(const redisReply* reply, const char* word, size_t len) {
+    return reply->type == REDIS_REPLY_STRING && reply->len == len && memcmp(reply->str, word, len) == 0;
+}
+
+// views of a message, pmessage or smessage, false for every other reply
+bool parse_message(const redisReply* r, RedisSubscriber::message_t& msg) {
+    if ((r->type != REDIS_REPLY_ARRAY && r->type != REDIS_REPLY_PUSH) || r->elements < 3) {
+        return false;
+    }
+    for (size_t i = 1; i < r->elements; i++) {
+        if (r->element[i]->type != REDIS_REPLY_STRING) {
+            return false;
+        }
+    }
+    size_t first = 1;
+    if (r->elements == 4 && is_word(r->element[0], "pmessage", 8)) {
+        msg.kind = RedisSubscriber::PMESSAGE;
+        msg.pattern = RedisStringView(r->element[1]->str, r->element[1]->len);
+        first = 2;
+    } else if (r->elements == 3 && is_word(r->element[0], "message", 7)) {
+        msg.kind = RedisSubscriber::MESSAGE;
+    } else if (r->elements == 3 && is_word(r->element[0], "smessage", 8)) {
+        msg.kind = RedisSubscriber::SMESSAGE;
+    } else {
+        return false;
+    }
+    msg.channel = RedisStringView(r->element[first]->str, r->element[first]->len);
+    msg.payload = RedisStringView(r->element[first + 1]->str, r->element[first + 1]->len);
+    return true;
+}
+
+size_t channel_hash(const RedisStringView& channel) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < channel.size(); i++) {
+        hash = (hash ^ (uint8_t) channel.data()[i]) * 16777619u;
+    }
+    return hash;
+}
+
+}  // namespace
+
+class RedisSubscriberImpl {
+public:
+    RedisSubscriberImpl()
+      : running_(false), handling_(false), connected_(false), subscribed_(0), shard_subscribed_(0), received_(0),
+        handled_(0), dropped_(0), stalls_(0), reconnects_(0) {}
+
+    bool start();
+    void stop();
+    // reader thread
+    void run();
+    void handle(handler_thread_t* thread);
+    // connect, authenticate and subscribe to everything in subs_
+    bool open();
+    void close(const std::string& error);
+    // remember the change and queue its command for the reader when connected
+    void change(int kind, bool add, const std::vector<std::string>& names);
+    // write cmds out, they were encoded by RedisCommandEncoder
+    bool send(const std::string& cmds);
+    void read_replies();
+    // queue a message for its handler thread, or take note of another reply
+    void dispatch(redisReply* reply);
+    void on_reply(const redisReply* reply);
+    void wake(handler_thread_t& thread);
+    void heartbeat();
+    void set_error(const std::string& error);
+
+    RedisSubscriber::subscriber_options_t opts_;
+    RedisSubscriber::handler_t handler_;
+
+    // the subscriber connection, owned by the reader thread once started
+    RedisClient cli_;
+    bool opened_ = false;
+    bool ping_pending_ = false;
+    int64_t ping_us_ = 0;
+
+    std::vector<std::unique_ptr<handler_thread_t>> threads_;
+
+    std::atomic<bool> running_;
+    std::atomic<bool> handling_;
+    std::atomic<bool> connected_;
+    std::thread thread_;
+    // guards subs_, pending_, error_str_ and the threads_ vector
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::set<std::string> subs_[SUB_KINDS];
+    // commands of the changes made while connected, sent by the reader thread
+    std::string pending_;
+    std::string error_str_;
+
+    // counts of the last (un)subscribe replies, channels and patterns together, shard channels apart
+    std::atomic<int64_t> subscribed_;
+    std::atomic<int64_t> shard_subscribed_;
+    std::atomic<uint64_t> received_;
+    std::atomic<uint64_t> handled_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> stalls_;
+    std::atomic<uint64_t> reconnects_;
+};
+
+bool RedisSubscriberImpl::start() {
+    if (running_) {
+        return true;
+    }
+    handling_ = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < std::max<size_t>(opts_.threads, 1); i++) {
+            threads_.emplace_back(new handler_thread_t(opts_.queue_size));
+            threads_.back()->thread = std::thread(&RedisSubscriberImpl::handle, this, threads_.back().get());
+        }
+    }
+    bool ok = open();
+    running_ = true;
+    thread_ = std::thread(&RedisSubscriberImpl::run, this);
+    return ok;
+}
+
+void RedisSubscriberImpl::stop() {
+    if (!running_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+        cond_.notify_one();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    // nothing is pushed any more, the handlers drain their rings and return
+    handling_ = false;
+    for (auto& thread : threads_) {
+        {
+            std::lock_guard<std::mutex> lock(thread->mutex);
+            thread->cond.notify_one();
+        }
+        thread->thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.clear();
+    }
+    close("RedisSubscriber stopped");
+    // a later start() connects afresh
+    RedisClientImpl* cli = (RedisClientImpl*) cli_.impl_;
+    cli->ctx_.reset();
+}
+
+void RedisSubscriberImpl::run() {
+    while (running_) {
+        if (!connected_) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait_for(lock, std::chrono::milliseconds(opts_.interval_ms), [this] { return !running_; });
+            }
+            if (running_) {
+                open();
+            }
+            continue;
+        }
+        std::string cmds;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cmds.swap(pending_);
+        }
+        RedisClientImpl* cli = (RedisClientImpl*) cli_.impl_;
+        if (!send(cmds)) {
+            close(cli->get_context()->errstr);
+            continue;
+        }
+        // short, changes made by subscribe() wait for it
+        struct pollfd pfd;
+        pfd.fd = cli->get_context()->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 10) > 0) {
+            read_replies();
+        }
+        if (connected_) {
+            heartbeat();
+        }
+    }
+}
+
+void RedisSubscriberImpl::handle(handler_thread_t* thread) {
+    queued_message_t item;
+    while (true) {
+        if (thread->ring.pop(item)) {
+            if (handler_) {
+                handler_(item.msg);
+            }
+            freeReplyObject(item.reply);
+            handled_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (!handling_) {
+            // stop() ends handling once the reader is gone, what it pushed is visible now
+            if (thread->ring.empty()) {
+                return;
+            }
+            continue;
+        }
+        thread->sleeping.store(true);
+        // pairs with the fence in wake(): either the reader sees sleeping or this sees its push
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (thread->ring.empty()) {
+            std::unique_lock<std::mutex> lock(thread->mutex);
+            thread->cond.wait_for(lock, std::chrono::milliseconds(100),
+                                  [&] { return !thread->ring.empty() || !handling_; });
+        }
+        thread->sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool RedisSubscriberImpl::open() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_.impl_;
+    // a failed connect leaves a context behind for reconnect()
+    bool ok = cli->get_context() == nullptr ? cli_.connect() : cli_.reconnect();
+    if (!ok) {
+        set_error(cli_.get_last_error());
+        return false;
+    }
+
+    std::string cmds;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.clear();
+        RedisCommandEncoder enc(cmds);
+        for (int kind = 0; kind < SUB_KINDS; kind++) {
+            const std::set<std::string>& subs = subs_[kind];
+            auto it = subs.begin();
+            for (size_t left = subs.size(); left > 0;) {
+                size_t n = std::min<size_t>(left, RCLI_PUBSUB_BATCH);
+                enc.begin(1 + n);
+                enc.arg(subscribe_verbs[kind]);
+                for (size_t i = 0; i < n; i++, ++it) {
+                    enc.arg(*it);
+                }
+                left -= n;
+            }
+        }
+        connected_ = true;
+    }
+    if (!send(cmds)) {
+        close(cli->get_context()->errstr);
+        return false;
+    }
+    if (opened_) {
+        reconnects_++;
+    }
+    opened_ = true;
+    ping_pending_ = false;
+    ping_us_ = RedisCallRecorder::now_us();
+    set_error("");
+    return true;
+}
+
+void RedisSubscriberImpl::close(const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connected_ = false;
+        pending_.clear();
+    }
+    subscribed_ = 0;
+    shard_subscribed_ = 0;
+    set_error(error);
+}
+
+void RedisSubscriberImpl::change(int kind, bool add, const std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::set<std::string>& subs = subs_[kind];
+    if (add) {
+        subs.insert(names.begin(), names.end());
+    } else if (names.empty()) {
+        subs.clear();
+    } else {
+        for (auto& name : names) {
+            subs.erase(name);
+        }
+    }
+    // open() subscribes to subs_ as they are then
+    if (!connected_ || (add && names.empty())) {
+        return;
+    }
+    RedisCommandEncoder enc(pending_);
+    enc.begin(1 + names.size());
+    enc.arg(add ? subscribe_verbs[kind] : unsubscribe_verbs[kind]);
+    for (auto& name : names) {
+        enc.arg(name);
+    }
+}
+
+bool RedisSubscriberImpl::send(const std::string& cmds) {
+    if (cmds.empty()) {
+        return true;
+    }
+    RedisClientImpl* cli = (RedisClientImpl*) cli_.impl_;
+    redisContext* ctx = cli->get_context();
+    if (!cli->append_formatted(cmds)) {
+        return false;
+    }
+    int done = 0;
+    while (!done) {
+        if (redisBufferWrite(ctx, &done) != REDIS_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RedisSubscriberImpl::read_replies() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_.impl_;
+    redisContext* ctx = cli->get_context();
+    if (redisBufferRead(ctx) != REDIS_OK) {
+        close(ctx->errstr);
+        return;
+    }
+    // any bytes prove the connection alive, the PONG may queue behind messages the handlers are slow to take
+    ping_pending_ = false;
+    ping_us_ = RedisCallRecorder::now_us();
+    void* reply = nullptr;
+    while (redisGetReplyFromReader(ctx, &reply) == REDIS_OK && reply) {
+        dispatch((redisReply*) reply);
+        reply = nullptr;
+    }
+    if (ctx->err) {
+        close(ctx->errstr);
+    }
+}
+
+void RedisSubscriberImpl::dispatch(redisReply* reply) {
+    queued_message_t item;
+    if (!parse_message(reply, item.msg)) {
+        on_reply(reply);
+        freeReplyObject(reply);
+        return;
+    }
+    received_.fetch_add(1, std::memory_order_relaxed);
+    item.reply = reply;
+    size_t index = threads_.size() > 1 ? channel_hash(item.msg.channel) % threads_.size() : 0;
+    handler_thread_t& thread = *threads_[index];
+    if (!thread.ring.push(item)) {
+        if (opts_.drop_when_full) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            freeReplyObject(reply);
+            return;
+        }
+        // the socket is not read meanwhile, redis holds on to what follows
+        stalls_.fetch_add(1, std::memory_order_relaxed);
+        do {
+            wake(thread);
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            if (!running_) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                freeReplyObject(reply);
+                return;
+            }
+        } while (!thread.ring.push(item));
+        // the wait was ours, not a silent server
+        ping_pending_ = false;
+        ping_us_ = RedisCallRecorder::now_us();
+    }
+    wake(thread);
+}
+
+void RedisSubscriberImpl::on_reply(const redisReply* reply) {
+    if (reply->type == REDIS_REPLY_ERROR) {
+        set_error(std::string(reply->str, reply->len));
+        return;
+    }
+    if ((reply->type != REDIS_REPLY_ARRAY && reply->type != REDIS_REPLY_PUSH) || reply->elements == 0) {
+        // +PONG, PING is not answered with ["pong", ""] in RESP3
+        ping_pending_ = false;
+        return;
+    }
+    const redisReply* kind = reply->element[0];
+    if (is_word(kind, "pong", 4)) {
+        ping_pending_ = false;
+        return;
+    }
+    // [kind, name, count], count is what stays subscribed
+    if (reply->elements != 3 || reply->element[2]->type != REDIS_REPLY_INTEGER || kind->type != REDIS_REPLY_STRING) {
+        return;
+    }
+    int64_t count = reply->element[2]->integer;
+    if (is_word(kind, "ssubscribe", 10) || is_word(kind, "sunsubscribe", 12)) {
+        shard_subscribed_ = count;
+    } else {
+        subscribed_ = count;
+    }
+}
+
+void RedisSubscriberImpl::wake(handler_thread_t& thread) {
+    // pairs with the fence in handle()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (thread.sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        thread.cond.notify_one();
+    }
+}
+
+void RedisSubscriberImpl::heartbeat() {
+    // a subscriber that silently lost its connection would wait for messages forever
+    int64_t now = RedisCallRecorder::now_us();
+    if (ping_pending_) {
+        if (now - ping_us_ > (int64_t) opts_.timeout_ms * 1000) {
+            close("PING timeout");
+        }
+        return;
+    }
+    if (now - ping_us_ < (int64_t) opts_.interval_ms * 1000) {
+        return;
+    }
+    std::string cmd;
+    RedisCommandEncoder(cmd).command("PING");
+    if (!send(cmd)) {
+        RedisClientImpl* cli = (RedisClientImpl*) cli_.impl_;
+        close(cli->get_context()->errstr);
+        return;
+    }
+    ping_pending_ = true;
+    ping_us_ = now;
+}
+
+void RedisSubscriberImpl::set_error(const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_str_ = error;
+}
+
+RedisSubscriber::RedisSubscriber() { impl_ = new RedisSubscriberImpl; }
+
+RedisSubscriber::~RedisSubscriber() {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->stop();
+    delete impl;
+}
+
+void RedisSubscriber::init(const std::string& host, uint32_t port, const std::string& pwd,
+                           const subscriber_options_t& opts) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->opts_ = opts;
+    impl->opts_.interval_ms = opts.interval_ms > 0 ? opts.interval_ms : 1;
+    impl->opts_.timeout_ms = opts.timeout_ms > 0 ? opts.timeout_ms : 1;
+    impl->cli_.init(host, port, pwd, opts.conn);
+}
+
+void RedisSubscriber::set_handler(const handler_t& handler) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->handler_ = handler;
+}
+
+std::string RedisSubscriber::get_last_error() {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    std::lock_guard<std::mutex> lock(impl->mutex_);
+    return impl->error_str_;
+}
+
+bool RedisSubscriber::start() {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    return impl->start();
+}
+
+void RedisSubscriber::stop() {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->stop();
+}
+
+bool RedisSubscriber::connected() {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    return impl->connected_.load();
+}
+
+void RedisSubscriber::subscribe(const std::vector<std::string>& channels) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->change(SUB_CHANNEL, true, channels);
+}
+
+void RedisSubscriber::psubscribe(const std::vector<std::string>& patterns) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->change(SUB_PATTERN, true, patterns);
+}
+
+void RedisSubscriber::ssubscribe(const std::vector<std::string>& channels) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->change(SUB_SHARD, true, channels);
+}
+
+void RedisSubscriber::unsubscribe(const std::vector<std::string>& channels) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->change(SUB_CHANNEL, false, channels);
+}
+
+void RedisSubscriber::punsubscribe(const std::vector<std::string>& patterns) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->change(SUB_PATTERN, false, patterns);
+}
+
+void RedisSubscriber::sunsubscribe(const std::vector<std::string>& channels) {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    impl->change(SUB_SHARD, false, channels);
+}
+
+RedisSubscriber::subscriber_stats_t RedisSubscriber::stats() {
+    RedisSubscriberImpl* impl = (RedisSubscriberImpl*) impl_;
+    subscriber_stats_t stats;
+    stats.received = impl->received_.load();
+    stats.handled = impl->handled_.load();
+    stats.dropped = impl->dropped_.load();
+    stats.stalls = impl->stalls_.load();
+    stats.reconnects = impl->reconnects_.load();
+    {
+        // the rings go away in stop()
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        for (auto& thread : impl->threads_) {
+            stats.queued += thread->ring.size();
+        }
+    }
+    stats.subscriptions = (size_t) (impl->subscribed_.load() + impl->shard_subscribed_.load());
+    return stats;
+}
@@ -0,0 +1,98 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include <functional>
+
+// Pub/Sub on a connection of its own. A reader thread keeps the connection
+// open, reads the messages and hands them to the handler threads through
+// lock-free rings, one per thread, so a slow handler does not keep the socket
+// from being drained. Messages of one channel always go to the same thread and
+// are handled in the order they were published.
+//
+// Subscriptions are remembered: after a lost connection the subscriber
+// reconnects and subscribes to all of them again.
+//
+//     RedisSubscriber sub;
+//     RedisSubscriber::subscriber_options_t opts;
+//     opts.threads = 4;
+//     sub.init("127.0.0.1", 6379, "pwd", opts);
+//     sub.set_handler([](const RedisSubscriber::message_t& msg) { ... msg.payload ... });
+//     sub.subscribe({"orders"});
+//     sub.psubscribe({"events.*"});
+//     sub.start();
+//
+// message_t views point into the reply hiredis parsed, nothing is copied. they
+// are only valid while the handler runs.
+class RedisSubscriber {
+public:
+    enum {
+        MESSAGE = 0,  // from a SUBSCRIBE channel
+        PMESSAGE,     // from a PSUBSCRIBE pattern, message_t::pattern tells which
+        SMESSAGE,     // from an SSUBSCRIBE shard channel
+    };
+
+    typedef struct message {
+        int kind = MESSAGE;
+        RedisStringView pattern;  // empty except for PMESSAGE
+        RedisStringView channel;
+        RedisStringView payload;
+    } message_t;
+
+    typedef std::function<void(const message_t& msg)> handler_t;
+
+    typedef struct subscriber_options {
+        RedisClient::options_t conn;  // unix socket, TLS, RESP3 and timeouts of the subscriber connection
+        size_t threads = 1;           // handler threads
+        size_t queue_size = 8192;     // messages waiting per handler thread, rounded up to a power of two
+        // drop messages while a handler's queue is full instead of waiting for room,
+        // waiting stops reading the socket and redis buffers them meanwhile
+        bool drop_when_full = false;
+        uint32_t interval_ms = 1000;  // PING and reconnect interval
+        uint32_t timeout_ms = 1000;   // PING timeout
+    } subscriber_options_t;
+
+    typedef struct subscriber_stats {
+        uint64_t received = 0;     // messages read off the connection
+        uint64_t handled = 0;      // handler calls returned
+        uint64_t dropped = 0;      // discarded by drop_when_full
+        uint64_t stalls = 0;       // waits of the reader for room in a full queue
+        uint64_t reconnects = 0;   // connections opened after the first one
+        size_t queued = 0;         // messages waiting for a handler now
+        size_t subscriptions = 0;  // channels, patterns and shard channels the server confirmed
+    } subscriber_stats_t;
+
+    RedisSubscriber();
+    virtual ~RedisSubscriber();
+
+    RedisSubscriber(const RedisSubscriber&) = delete;
+    RedisSubscriber& operator=(const RedisSubscriber&) = delete;
+
+    void init(const std::string& host, uint32_t port, const std::string& pwd, const subscriber_options_t& opts);
+    // called on the handler threads, set before start()
+    void set_handler(const handler_t& handler);
+    std::string get_last_error();
+
+    // open the connection and start the threads. false when the first attempt
+    // failed, the reader keeps retrying every interval_ms
+    bool start();
+    // stop reading, the handlers finish the messages already queued
+    void stop();
+    bool connected();
+
+    // before or after start(), sent by the reader thread. an empty list
+    // unsubscribes from everything of that kind
+    void subscribe(const std::vector<std::string>& channels);
+    void psubscribe(const std::vector<std::string>& patterns);
+    void ssubscribe(const std::vector<std::string>& channels);
+    void unsubscribe(const std::vector<std::string>& channels);
+    void punsubscribe(const std::vector<std::string>& patterns);
+    void sunsubscribe(const std::vector<std::string>& channels);
+
+    subscriber_stats_t stats();
+
+private:
+    void* impl_;
+};
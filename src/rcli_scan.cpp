@@ -0,0 +1,226 @@
+#include "rcli_scan.h"
+#include "rcli_impl.h"
+#include <algorithm>
+
+namespace {
+
+// [cursor, [elements]]: keeps the cursor and hands the elements on one level up
+class RedisScanVisitor : public RedisReplyVisitor {
+public:
+    explicit RedisScanVisitor(RedisReplyVisitor& out) : out_(out) {}
+
+    const std::string& cursor() const { return cursor_; }
+    size_t elements() const { return elements_; }
+
+    void on_array(int depth, size_t len) override {
+        if (depth >= 1) {
+            out_.on_array(depth - 1, len);
+        }
+    }
+    void on_map(int depth, size_t pairs) override {
+        if (depth >= 1) {
+            out_.on_map(depth - 1, pairs);
+        }
+    }
+    void on_string(int depth, const char* str, size_t len) override {
+        if (depth == 1) {
+            cursor_.assign(str, len);
+        } else if (depth >= 2) {
+            elements_++;
+            out_.on_string(depth - 1, str, len);
+        }
+    }
+    void on_integer(int depth, int64_t val) override {
+        if (depth == 1) {
+            cursor_ = std::to_string(val);
+        } else if (depth >= 2) {
+            elements_++;
+            out_.on_integer(depth - 1, val);
+        }
+    }
+    void on_double(int depth, double val, const char* str, size_t len) override {
+        if (depth >= 2) {
+            elements_++;
+            out_.on_double(depth - 1, val, str, len);
+        }
+    }
+    void on_nil(int depth) override {
+        if (depth >= 2) {
+            elements_++;
+            out_.on_nil(depth - 1);
+        }
+    }
+    void on_error(int depth, const char* str, size_t len) override {
+        if (depth >= 2) {
+            out_.on_error(depth - 1, str, len);
+        }
+    }
+
+private:
+    RedisReplyVisitor& out_;
+    std::string cursor_;
+    size_t elements_ = 0;
+};
+
+}  // namespace
+
+RedisScanner::RedisScanner(RedisClient* cli, const char* verb, const std::string& key)
+  : cli_(cli), verb_(verb), key_(key) {}
+
+RedisScanner& RedisScanner::match(const std::string& pattern) {
+    match_ = pattern;
+    return *this;
+}
+
+RedisScanner& RedisScanner::type(const std::string& type) {
+    type_ = type;
+    return *this;
+}
+
+RedisScanner& RedisScanner::count(uint32_t count) {
+    count_ = count;
+    return *this;
+}
+
+RedisScanner& RedisScanner::budget_us(uint32_t budget_us, uint32_t min_count, uint32_t max_count) {
+    budget_us_ = budget_us;
+    min_count_ = std::max<uint32_t>(min_count, 1);
+    max_count_ = std::max(max_count, min_count_);
+    if (budget_us_ > 0) {
+        // the server's default of 10 when no COUNT was given
+        count_ = std::min(std::max(count_ > 0 ? count_ : 10, min_count_), max_count_);
+    }
+    return *this;
+}
+
+RedisScanner& RedisScanner::prefetch(bool on) {
+    prefetch_ = on;
+    return *this;
+}
+
+bool RedisScanner::next(std::vector<std::string>& out) {
+    out.clear();
+    RedisVectorVisitor visitor(out);
+    return next(static_cast<RedisReplyVisitor&>(visitor));
+}
+
+bool RedisScanner::next(RedisReplyVisitor& visitor) {
+    // MATCH and TYPE filter after the server walked COUNT slots, batches may be empty
+    while (!done_) {
+        size_t elements = 0;
+        status_ = fetch(visitor, elements);
+        if (status_ != RCLI_RET_OK) {
+            done_ = true;
+            return false;
+        }
+        if (elements > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int RedisScanner::fetch(RedisReplyVisitor& visitor, size_t& elements) {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    RedisCallRecorder rec(cli, verb_);
+    int64_t asked_us = RedisCallRecorder::now_us();
+    // the reply of the SCAN sent ahead is gone once another command dropped it
+    bool sent = token_ != 0 && cli->unread_token_ == token_;
+    token_ = 0;
+
+    // a SCAN only reads, it is sent again after a connection error as long as
+    // none of its elements were handed out
+    int err = RCLI_ERROR;
+    for (int n = RCLI_TRY_COUNT; n >= 0; n--) {
+        if (!sent) {
+            if (!cli_->check_alive()) {
+                return rec.done(RCLI_ERROR);
+            }
+            sent_us_ = RedisCallRecorder::now_us();
+            sent = send();
+        }
+        RedisScanVisitor scan(visitor);
+        if (sent) {
+            cli->unread_token_ = 0;
+            err = cli->read_reply(scan);
+        } else {
+            err = cli->check_reply_type(nullptr);
+        }
+        if (err == RCLI_RET_OK) {
+            elements = scan.elements();
+            cursor_ = scan.cursor();
+            break;
+        }
+        if (err != RCLI_ERROR || scan.elements() > 0 || n == 0 || !cli_->recover()) {
+            return rec.done(err);
+        }
+        sent = false;
+    }
+    adapt(sent_us_, asked_us, RedisCallRecorder::now_us());
+
+    if (cursor_.empty() || cursor_ == "0") {
+        done_ = true;
+    } else if (prefetch_) {
+        sent_us_ = RedisCallRecorder::now_us();
+        if (send()) {
+            token_ = ++cli->next_token_;
+            cli->unread_token_ = token_;
+        }
+    }
+    return rec.done(err);
+}
+
+bool RedisScanner::send() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    bool keyed = verb_ != "SCAN";
+    size_t argc = 2 + (keyed ? 1 : 0) + (match_.empty() ? 0 : 2) + (count_ > 0 ? 2 : 0)
+                  + (type_.empty() || keyed ? 0 : 2);
+    buf_.clear();
+    RedisCommandEncoder enc(buf_);
+    enc.begin(argc);
+    enc.arg(verb_);
+    if (keyed) {
+        enc.arg(key_);
+    }
+    enc.arg(cursor_);
+    if (!match_.empty()) {
+        enc.arg("MATCH");
+        enc.arg(match_);
+    }
+    if (count_ > 0) {
+        enc.arg("COUNT");
+        enc.arg(count_);
+    }
+    if (!type_.empty() && !keyed) {
+        enc.arg("TYPE");
+        enc.arg(type_);
+    }
+    if (!cli->append_formatted(buf_)) {
+        return false;
+    }
+    // written now so the server starts on it, not when the reply is asked for
+    redisContext* ctx = cli->get_context();
+    int done = 0;
+    do {
+        if (redisBufferWrite(ctx, &done) == REDIS_ERR) {
+            return false;
+        }
+    } while (!done);
+    return true;
+}
+
+void RedisScanner::adapt(int64_t sent_us, int64_t asked_us, int64_t done_us) {
+    if (budget_us_ == 0) {
+        return;
+    }
+    int64_t took_us = std::max<int64_t>(done_us - sent_us, 1);
+    if (took_us > budget_us_ && done_us - asked_us < budget_us_ / 2) {
+        // the reply was waiting when the caller asked for it, the time went to
+        // the caller and says nothing about the server
+        return;
+    }
+    // proportional step, at most halving or doubling per batch
+    double next = (double) count_ * budget_us_ / (double) took_us;
+    next = std::min(std::max(next, count_ / 2.0), count_ * 2.0);
+    count_ = (uint32_t) std::min(std::max(next, (double) min_count_), (double) max_count_);
+}
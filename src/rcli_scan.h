@@ -0,0 +1,83 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+// Walk the keyspace with SCAN, or one hash, set or sorted set with HSCAN, SSCAN
+// or ZSCAN, a batch at a time instead of reading it whole with HKEYS or
+// ZRANGE 0 -1, which blocks the server and the client on large collections.
+//
+//     RedisScanner it = rcli->hscan("key");
+//     it.match("user:*").count(500).budget_us(2000);
+//     std::vector<std::string> batch;
+//     while (it.next(batch)) {
+//         // field value field value ...
+//     }
+//     if (it.status() != RCLI_RET_OK) { ... rcli->get_last_error() ... }
+//
+// The SCAN of the next batch is sent before next() returns, so the server works
+// on it while the caller consumes the current one. Any other command on the
+// client first reads and drops that reply, next() then sends it again.
+//
+// With a budget, COUNT follows the time a batch takes from being sent to being
+// read: it grows while batches come back within the budget and shrinks when
+// they do not. Batches that were waiting for a caller slower than the server
+// say nothing about the server and leave it as it is. Like SCAN itself,
+// elements changed during the walk may be missed or returned twice.
+class RedisScanner {
+public:
+    // verb is SCAN, HSCAN, SSCAN or ZSCAN, key is ignored by SCAN
+    RedisScanner(RedisClient* cli, const char* verb, const std::string& key);
+
+    // options, set before the first next()
+    RedisScanner& match(const std::string& pattern);
+    // SCAN only, e.g. "hash", redis 6+
+    RedisScanner& type(const std::string& type);
+    // COUNT of the first batch, of every batch without a budget
+    RedisScanner& count(uint32_t count);
+    // target time of one batch, COUNT is kept within [min_count, max_count]. 0 disables
+    RedisScanner& budget_us(uint32_t budget_us, uint32_t min_count = 10, uint32_t max_count = 10000);
+    // send the next SCAN before returning a batch, on by default
+    RedisScanner& prefetch(bool on);
+
+    // the next non-empty batch, out is replaced. HSCAN and ZSCAN return field
+    // value and member score pairs flattened. false once the walk is over or failed
+    bool next(std::vector<std::string>& out);
+    // the elements of the next non-empty batch are streamed into visitor at
+    // depth 1, e.g. into a RedisFlatReply
+    bool next(RedisReplyVisitor& visitor);
+
+    bool done() const { return done_; }
+    // RCLI_RET_OK until a SCAN failed, then its RCLI_* status
+    int status() const { return status_; }
+    // COUNT sent with the next SCAN
+    uint32_t get_count() const { return count_; }
+
+private:
+    // one SCAN round trip, or the read of the one sent ahead
+    int fetch(RedisReplyVisitor& visitor, size_t& elements);
+    // write the SCAN of cursor_ without waiting for its reply
+    bool send();
+    void adapt(int64_t sent_us, int64_t asked_us, int64_t done_us);
+
+    RedisClient* cli_;
+    std::string verb_;
+    std::string key_;
+    std::string match_;
+    std::string type_;
+    uint32_t count_ = 0;  // 0 leaves COUNT to the server
+    uint32_t budget_us_ = 0;
+    uint32_t min_count_ = 10;
+    uint32_t max_count_ = 10000;
+    bool prefetch_ = true;
+
+    std::string cursor_ = "0";
+    bool done_ = false;
+    int status_ = RCLI_RET_OK;
+    // matches RedisClientImpl::unread_token_ while the SCAN sent ahead is unread
+    uint64_t token_ = 0;
+    int64_t sent_us_ = 0;
+    std::string buf_;
+};
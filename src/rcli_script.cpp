@@ -0,0 +1,118 @@
+#include "rcli_script.h"
+
+namespace {
+
+inline uint32_t rotl(uint32_t val, int bits) { return (val << bits) | (val >> (32 - bits)); }
+
+// FIPS 180-1, one 64 byte block
+void sha1_block(uint32_t state[5], const unsigned char* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16 | (uint32_t) block[i * 4 + 2] << 8
+               | (uint32_t) block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+}  // namespace
+
+RedisScript::RedisScript(const std::string& source) : source_(source), sha1_(sha1_hex(source)) {}
+
+std::string RedisScript::sha1_hex(const RedisStringView& data) {
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    const unsigned char* p = (const unsigned char*) data.data();
+    size_t len = data.size();
+    size_t full = len / 64 * 64;
+    for (size_t i = 0; i < full; i += 64) {
+        sha1_block(state, p + i);
+    }
+
+    // the rest, 0x80, zeros and the length in bits fill one or two more blocks
+    unsigned char tail[128] = {0};
+    size_t rest = len - full;
+    if (rest > 0) {
+        memcpy(tail, p + full, rest);
+    }
+    tail[rest] = 0x80;
+    size_t tail_len = rest + 9 > 64 ? 128 : 64;
+    uint64_t bits = (uint64_t) len * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tail_len - 1 - i] = (unsigned char) (bits >> (i * 8));
+    }
+    for (size_t i = 0; i < tail_len; i += 64) {
+        sha1_block(state, tail + i);
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(40, '0');
+    for (int i = 0; i < 20; i++) {
+        unsigned char byte = (unsigned char) (state[i / 4] >> (24 - (i % 4) * 8));
+        hex[i * 2] = digits[byte >> 4];
+        hex[i * 2 + 1] = digits[byte & 0xf];
+    }
+    return hex;
+}
+
+const RedisScript* RedisScriptRegistry::add(const std::string& source) {
+    RedisScript script(source);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_sha1_.find(script.sha1());
+    if (it != by_sha1_.end()) {
+        return it->second;
+    }
+    scripts_.emplace_back(std::move(script));
+    const RedisScript* ret = &scripts_.back();
+    by_sha1_.emplace(ret->sha1(), ret);
+    return ret;
+}
+
+const RedisScript* RedisScriptRegistry::find(const std::string& sha1) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_sha1_.find(sha1);
+    return it == by_sha1_.end() ? nullptr : it->second;
+}
+
+size_t RedisScriptRegistry::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return scripts_.size();
+}
+
+std::vector<const RedisScript*> RedisScriptRegistry::scripts() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<const RedisScript*> ret;
+    ret.reserve(scripts_.size());
+    for (auto& script : scripts_) {
+        ret.push_back(&script);
+    }
+    return ret;
+}
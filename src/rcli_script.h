@@ -0,0 +1,59 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+// a Lua script and the SHA1 EVALSHA names it by, computed locally
+class RedisScript {
+public:
+    explicit RedisScript(const std::string& source);
+
+    const std::string& source() const { return source_; }
+    // 40 lowercase hex digits, what SCRIPT LOAD replies
+    const std::string& sha1() const { return sha1_; }
+
+    static std::string sha1_hex(const RedisStringView& data);
+
+private:
+    std::string source_;
+    std::string sha1_;
+};
+
+// Scripts every attached client loads in one pipelined round trip after it
+// connected or reconnected, so that compound operations cost a single EVALSHA
+// carrying 40 bytes instead of the source.
+//
+//     RedisScriptRegistry scripts;
+//     const RedisScript* zadd_ttl = scripts.add(
+//       "redis.call('ZADD', KEYS[1], ARGV[1], ARGV[2]) return redis.call('EXPIRE', KEYS[1], ARGV[3])");
+//     rcli->set_scripts(&scripts);
+//     rcli->connect();
+//     rcli->eval_for_integer(out, *zadd_ttl, {key}, {"1.5", member, "60"});
+//
+// A script the server does not know, added after the client connected or lost
+// to SCRIPT FLUSH, is sent once more with EVAL, which also caches it. The
+// registry is shared by any number of clients and must outlive them.
+class RedisScriptRegistry {
+public:
+    RedisScriptRegistry() = default;
+    RedisScriptRegistry(const RedisScriptRegistry&) = delete;
+    RedisScriptRegistry& operator=(const RedisScriptRegistry&) = delete;
+
+    // the script with this source, registered on first use. valid as long as the registry
+    const RedisScript* add(const std::string& source);
+    // nullptr when no script has this SHA1
+    const RedisScript* find(const std::string& sha1);
+    size_t size();
+    // in the order added
+    std::vector<const RedisScript*> scripts();
+
+private:
+    std::mutex mutex_;
+    std::deque<RedisScript> scripts_;  // never erased, addresses stay valid
+    std::unordered_map<std::string, const RedisScript*> by_sha1_;
+};
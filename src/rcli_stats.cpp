@@ -0,0 +1,260 @@
+#include "rcli_stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+namespace {
+
+typedef struct stats_entry {
+    // written once by the owning thread before the entry is published
+    char verb[RCLI_STATS_VERB_LEN];
+    size_t len = 0;
+
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<uint64_t> total_us{0};
+    std::atomic<uint64_t> max_us{0};
+    std::atomic<uint64_t> histogram[RedisStats::HISTOGRAM_SIZE];
+
+    stats_entry() {
+        for (auto& bucket : histogram) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+} stats_entry_t;
+
+// entries of one thread, open addressing on the verb. Only the owning thread
+// inserts, readers see an entry once its pointer is published.
+typedef struct stats_shard {
+    std::atomic<stats_entry_t*> entries[RCLI_STATS_MAX_COMMANDS];
+    std::atomic<stats_entry_t*> other{nullptr};
+
+    stats_shard() {
+        for (auto& entry : entries) {
+            entry.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    ~stats_shard() {
+        for (auto& entry : entries) {
+            delete entry.load();
+        }
+        delete other.load();
+    }
+} stats_shard_t;
+
+typedef struct stats_impl {
+    uint64_t id;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<stats_shard_t>> shards;
+} stats_impl_t;
+
+std::atomic<uint64_t> g_stats_id(1);
+
+// the shard of this thread, per RedisStats. The raw pointer is only used while
+// the RedisStats is alive, ids are never reused.
+typedef struct local_shard {
+    uint64_t id;
+    stats_shard_t* shard;
+    std::weak_ptr<stats_shard_t> owner;
+} local_shard_t;
+thread_local std::vector<local_shard_t> t_local_shards;
+
+stats_shard_t* local_shard(stats_impl_t* impl) {
+    for (auto& local : t_local_shards) {
+        if (local.id == impl->id) {
+            return local.shard;
+        }
+    }
+    std::shared_ptr<stats_shard_t> shard(new stats_shard_t);
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex);
+        impl->shards.push_back(shard);
+    }
+    t_local_shards.erase(std::remove_if(t_local_shards.begin(), t_local_shards.end(),
+                                        [](const local_shard_t& local) { return local.owner.expired(); }),
+                         t_local_shards.end());
+    t_local_shards.push_back({impl->id, shard.get(), shard});
+    return shard.get();
+}
+
+size_t verb_hash(const char* verb, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t) verb[i]) * 16777619u;
+    }
+    return hash;
+}
+
+stats_entry_t* new_entry(const char* verb, size_t len) {
+    stats_entry_t* entry = new stats_entry_t;
+    memcpy(entry->verb, verb, len);
+    entry->len = len;
+    return entry;
+}
+
+stats_entry_t* find_entry(stats_shard_t* shard, const char* verb, size_t len) {
+    size_t index = verb_hash(verb, len) % RCLI_STATS_MAX_COMMANDS;
+    for (size_t n = 0; n < RCLI_STATS_MAX_COMMANDS; n++) {
+        std::atomic<stats_entry_t*>& slot = shard->entries[(index + n) % RCLI_STATS_MAX_COMMANDS];
+        stats_entry_t* entry = slot.load(std::memory_order_relaxed);
+        if (entry == nullptr) {
+            entry = new_entry(verb, len);
+            slot.store(entry, std::memory_order_release);
+            return entry;
+        }
+        if (entry->len == len && memcmp(entry->verb, verb, len) == 0) {
+            return entry;
+        }
+    }
+    stats_entry_t* entry = shard->other.load(std::memory_order_relaxed);
+    if (entry == nullptr) {
+        entry = new_entry("OTHER", 5);
+        shard->other.store(entry, std::memory_order_release);
+    }
+    return entry;
+}
+
+void add(std::atomic<uint64_t>& counter, uint64_t val) {
+    if (val) {
+        counter.fetch_add(val, std::memory_order_relaxed);
+    }
+}
+
+// add entry to out, zeroing its counters on the way when reset
+void merge(stats_entry_t* entry, RedisStats::command_stats_t& out, bool reset) {
+    auto take = [reset](std::atomic<uint64_t>& val) {
+        return reset ? val.exchange(0, std::memory_order_relaxed) : val.load(std::memory_order_relaxed);
+    };
+    out.calls += take(entry->calls);
+    out.errors += take(entry->errors);
+    out.bytes_sent += take(entry->bytes_sent);
+    out.bytes_received += take(entry->bytes_received);
+    out.total_us += take(entry->total_us);
+    out.max_us = std::max(out.max_us, take(entry->max_us));
+    out.histogram.resize(RedisStats::HISTOGRAM_SIZE);
+    for (size_t i = 0; i < RedisStats::HISTOGRAM_SIZE; i++) {
+        out.histogram[i] += take(entry->histogram[i]);
+    }
+}
+
+// visit every published entry of every shard
+template <class Fn>
+void for_each_entry(stats_impl_t* impl, Fn fn) {
+    std::vector<std::shared_ptr<stats_shard_t>> shards;
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex);
+        shards = impl->shards;
+    }
+    for (auto& shard : shards) {
+        for (auto& slot : shard->entries) {
+            stats_entry_t* entry = slot.load(std::memory_order_acquire);
+            if (entry) {
+                fn(entry);
+            }
+        }
+        stats_entry_t* other = shard->other.load(std::memory_order_acquire);
+        if (other) {
+            fn(other);
+        }
+    }
+}
+
+}  // namespace
+
+uint64_t RedisStats::command_stats_t::percentile(double p) const {
+    uint64_t total = 0;
+    for (auto count : histogram) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) std::ceil(total * std::min(std::max(p, 0.0), 100.0) / 100.0);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram.size(); i++) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return std::min(bucket_upper(i), max_us);
+        }
+    }
+    return max_us;
+}
+
+RedisStats::RedisStats() {
+    stats_impl_t* impl = new stats_impl_t;
+    impl->id = g_stats_id++;
+    impl_ = impl;
+}
+
+RedisStats::~RedisStats() {
+    stats_impl_t* impl = (stats_impl_t*) impl_;
+    delete impl;
+}
+
+size_t RedisStats::bucket_index(uint64_t us) {
+    if (us < HISTOGRAM_LINEAR) {
+        return (size_t) us;
+    }
+    // highest set bit, at least 6 here
+    int exp = 6;
+    while (exp < 63 && (us >> (exp + 1)) != 0) {
+        exp++;
+    }
+    size_t index = HISTOGRAM_LINEAR + (exp - 6) * HISTOGRAM_SUB + (size_t) ((us >> (exp - 5)) - HISTOGRAM_SUB);
+    return std::min<size_t>(index, HISTOGRAM_SIZE - 1);
+}
+
+uint64_t RedisStats::bucket_upper(size_t index) {
+    if (index < HISTOGRAM_LINEAR) {
+        return index;
+    }
+    int exp = (int) ((index - HISTOGRAM_LINEAR) / HISTOGRAM_SUB) + 6;
+    uint64_t sub = (index - HISTOGRAM_LINEAR) % HISTOGRAM_SUB;
+    return ((HISTOGRAM_SUB + sub + 1) << (exp - 5)) - 1;
+}
+
+void RedisStats::record(const RedisStringView& verb, uint64_t latency_us, bool error, uint64_t bytes_sent,
+                        uint64_t bytes_received) {
+    char name[RCLI_STATS_VERB_LEN];
+    size_t len = std::min<size_t>(verb.size(), RCLI_STATS_VERB_LEN);
+    for (size_t i = 0; i < len; i++) {
+        name[i] = (char) toupper((unsigned char) verb.data()[i]);
+    }
+
+    stats_entry_t* entry = find_entry(local_shard((stats_impl_t*) impl_), name, len);
+    add(entry->calls, 1);
+    add(entry->errors, error ? 1 : 0);
+    add(entry->bytes_sent, bytes_sent);
+    add(entry->bytes_received, bytes_received);
+    add(entry->total_us, latency_us);
+    add(entry->histogram[bucket_index(latency_us)], 1);
+    // single writer per shard, reset() may race and lose one maximum
+    if (latency_us > entry->max_us.load(std::memory_order_relaxed)) {
+        entry->max_us.store(latency_us, std::memory_order_relaxed);
+    }
+}
+
+void RedisStats::snapshot(std::vector<command_stats_t>& out) {
+    std::map<std::string, command_stats_t> merged;
+    for_each_entry((stats_impl_t*) impl_, [&](stats_entry_t* entry) {
+        command_stats_t& stats = merged[std::string(entry->verb, entry->len)];
+        merge(entry, stats, false);
+    });
+    out.clear();
+    out.reserve(merged.size());
+    for (auto& kv : merged) {
+        kv.second.command = kv.first;
+        out.emplace_back(std::move(kv.second));
+    }
+}
+
+void RedisStats::reset() {
+    command_stats_t discard;
+    for_each_entry((stats_impl_t*) impl_, [&](stats_entry_t* entry) { merge(entry, discard, true); });
+}
@@ -0,0 +1,71 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+// distinct verbs tracked per thread, any further verb is counted as "OTHER"
+#define RCLI_STATS_MAX_COMMANDS 128
+// longer verbs are truncated
+#define RCLI_STATS_VERB_LEN 32
+
+// Call and error counts, bytes on the wire and a latency histogram per command
+// verb. One RedisStats can be shared by any number of clients and threads: each
+// thread records into its own shard with relaxed atomics and no lock, snapshot()
+// merges the shards.
+//
+//     RedisStats stats;
+//     rcli->set_stats(&stats);
+//     ...
+//     std::vector<RedisStats::command_stats_t> out;
+//     stats.snapshot(out);
+//     fprintf(stdout, "%s p99 %lluus\n", out[0].command.c_str(), out[0].percentile(99));
+//
+// The stats must outlive the clients recording into it.
+class RedisStats {
+public:
+    // log-linear latency buckets in microseconds: one per value below 64us,
+    // then 32 per power of two, which keeps the error of a percentile near 3%
+    enum {
+        HISTOGRAM_LINEAR = 64,
+        HISTOGRAM_SUB = 32,
+        HISTOGRAM_SIZE = HISTOGRAM_LINEAR + 34 * HISTOGRAM_SUB,  // up to ~12 days
+    };
+
+    typedef struct command_stats {
+        std::string command;
+        uint64_t calls = 0;
+        uint64_t errors = 0;  // error replies and connection errors, nil is not an error
+        uint64_t bytes_sent = 0;
+        uint64_t bytes_received = 0;
+        uint64_t total_us = 0;
+        uint64_t max_us = 0;
+        std::vector<uint64_t> histogram;  // HISTOGRAM_SIZE buckets
+
+        double avg_us() const { return calls ? (double) total_us / calls : 0; }
+        // latency in us below which p percent (0-100) of the calls fall
+        uint64_t percentile(double p) const;
+    } command_stats_t;
+
+    RedisStats();
+    virtual ~RedisStats();
+
+    RedisStats(const RedisStats&) = delete;
+    RedisStats& operator=(const RedisStats&) = delete;
+
+    void record(const RedisStringView& verb, uint64_t latency_us, bool error, uint64_t bytes_sent,
+                uint64_t bytes_received);
+
+    // merged totals of every thread, sorted by command
+    void snapshot(std::vector<command_stats_t>& out);
+    // zero all counters, calls recorded meanwhile may survive partially
+    void reset();
+
+    static size_t bucket_index(uint64_t us);
+    // largest latency falling into bucket index
+    static uint64_t bucket_upper(size_t index);
+
+private:
+    void* impl_;
+};
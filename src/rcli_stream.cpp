@@ -0,0 +1,251 @@
+#include "rcli_stream.h"
+#include "rcli_impl.h"
+
+namespace {
+
+// sums the integer replies of XACK
+class RedisAckVisitor : public RedisReplyVisitor {
+public:
+    explicit RedisAckVisitor(uint64_t& acked) : acked_(acked) {}
+
+    void on_integer(int depth, int64_t val) override {
+        if (depth == 0 && val > 0) {
+            acked_ += (uint64_t) val;
+        }
+    }
+
+private:
+    uint64_t& acked_;
+};
+
+}  // namespace
+
+void RedisStreamBatch::clear() {
+    data_.clear();
+    offsets_.clear();
+    entries_.clear();
+    streams_.clear();
+    cursor_.clear();
+    deleted_.clear();
+}
+
+void RedisStreamBatch::reset(int kind, const std::string* key) {
+    clear();
+    kind_ = kind;
+    entry_depth_ = 2;
+    if (key) {
+        streams_.push_back(*key);
+    }
+}
+
+void RedisStreamBatch::on_array(int depth, size_t len) {
+    // a RESP2 XREADGROUP nests the entries in [key, entries] pairs, one level
+    // deeper than a RESP3 map or an XAUTOCLAIM
+    if (depth == 0 && kind_ == READ) {
+        entry_depth_ = 3;
+    } else if (depth == entry_depth_ - 1 && len > 0) {
+        entries_.reserve(entries_.size() + len);
+    }
+}
+
+void RedisStreamBatch::on_map(int /*depth*/, size_t /*pairs*/) {}
+
+void RedisStreamBatch::on_string(int depth, const char* str, size_t len) {
+    if (depth == entry_depth_ + 1) {
+        entry_t entry;
+        entry.stream = streams_.empty() ? 0 : streams_.size() - 1;
+        entry.first = offsets_.size();
+        entries_.push_back(entry);
+    } else if (depth == entry_depth_ + 2 && !entries_.empty()) {
+        entries_.back().strings++;
+    } else {
+        if (kind_ == READ && depth == entry_depth_ - 1) {
+            streams_.emplace_back(str, len);
+        } else if (kind_ == AUTOCLAIM && depth == 1) {
+            cursor_.assign(str, len);
+        } else if (kind_ == AUTOCLAIM && depth == entry_depth_) {
+            deleted_.emplace_back(str, len);
+        }
+        return;
+    }
+    data_.append(str, len);
+    offsets_.push_back(data_.size());
+}
+
+void RedisStreamBatch::on_integer(int depth, int64_t val) {
+    std::string str = std::to_string(val);
+    on_string(depth, str.data(), str.size());
+}
+
+RedisStreamConsumer::RedisStreamConsumer(RedisClient* cli, const std::string& group, const std::string& consumer)
+  : cli_(cli), group_(group), consumer_(consumer) {}
+
+RedisStreamConsumer& RedisStreamConsumer::count(uint32_t count) {
+    count_ = count;
+    return *this;
+}
+
+RedisStreamConsumer& RedisStreamConsumer::block_ms(uint32_t block_ms) {
+    block_ms_ = block_ms;
+    return *this;
+}
+
+RedisStreamConsumer& RedisStreamConsumer::ack_batch(size_t ack_batch) {
+    ack_batch_ = ack_batch > 0 ? ack_batch : 1;
+    return *this;
+}
+
+RedisStreamConsumer& RedisStreamConsumer::noack(bool on) {
+    noack_ = on;
+    return *this;
+}
+
+int RedisStreamConsumer::create_group(const std::string& key, const std::string& id) {
+    int err = RCLI_ERROR;
+    for (int n = RCLI_TRY_COUNT; n >= 0 && cli_->check_alive(); n--) {
+        err = cli_->commanda_for_status("XGROUP", "CREATE", key, group_, id, "MKSTREAM");
+        if (err != RCLI_ERROR || n == 0 || !cli_->recover()) {
+            break;
+        }
+    }
+    // also when the reply of a CREATE sent before the reconnect was lost
+    if (err == RCLI_RET_ERROR && cli_->get_last_error().compare(0, 9, "BUSYGROUP") == 0) {
+        err = RCLI_RET_OK;
+    }
+    return err;
+}
+
+int RedisStreamConsumer::read(const std::vector<std::string>& keys, RedisStreamBatch& out) {
+    // XREADGROUP GROUP group consumer [COUNT n] [BLOCK ms] [NOACK] STREAMS key ... > ...
+    cmd_.clear();
+    RedisCommandEncoder enc(cmd_);
+    enc.begin(5 + (count_ > 0 ? 2 : 0) + (block_ms_ > 0 ? 2 : 0) + (noack_ ? 1 : 0) + keys.size() * 2);
+    enc.arg("XREADGROUP");
+    enc.arg("GROUP");
+    enc.arg(group_);
+    enc.arg(consumer_);
+    if (count_ > 0) {
+        enc.arg("COUNT");
+        enc.arg(count_);
+    }
+    if (block_ms_ > 0) {
+        enc.arg("BLOCK");
+        enc.arg(block_ms_);
+    }
+    if (noack_) {
+        enc.arg("NOACK");
+    }
+    enc.arg("STREAMS");
+    for (auto& key : keys) {
+        enc.arg(key);
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        enc.arg(">");
+    }
+    return round_trip("XREADGROUP", &out, RedisStreamBatch::READ, nullptr);
+}
+
+int RedisStreamConsumer::autoclaim(const std::string& key, uint32_t min_idle_ms, RedisStreamBatch& out) {
+    std::string& cursor = cursors_[key];
+    if (cursor.empty()) {
+        cursor = "0-0";
+    }
+    cmd_.clear();
+    RedisCommandEncoder enc(cmd_);
+    enc.command("XAUTOCLAIM", key, group_, consumer_, min_idle_ms, cursor, "COUNT", count_ > 0 ? count_ : 100);
+    int err = round_trip("XAUTOCLAIM", &out, RedisStreamBatch::AUTOCLAIM, &key);
+    if (err == RCLI_RET_OK && !out.cursor().empty()) {
+        cursor = out.cursor();
+    }
+    return err;
+}
+
+int RedisStreamConsumer::ack(const std::string& key, const RedisStringView& id) {
+    ack_queue_t* queue = nullptr;
+    for (auto& q : acks_) {
+        if (q.key == key) {
+            queue = &q;
+            break;
+        }
+    }
+    if (queue == nullptr) {
+        acks_.emplace_back();
+        queue = &acks_.back();
+        queue->key = key;
+    }
+    RedisCommandEncoder(queue->ids).arg(id);
+    queue->count++;
+    if (++pending_acks_ < ack_batch_) {
+        return RCLI_RET_OK;
+    }
+    return flush_acks();
+}
+
+int RedisStreamConsumer::flush_acks() {
+    if (pending_acks_ == 0) {
+        return RCLI_RET_OK;
+    }
+    cmd_.clear();
+    return round_trip("XACK", nullptr, RedisStreamBatch::READ, nullptr);
+}
+
+int RedisStreamConsumer::round_trip(const char* verb, RedisStreamBatch* out, int kind, const std::string* key) {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    RedisCallRecorder rec(cli, verb);
+    int err = RCLI_ERROR;
+    for (int n = RCLI_TRY_COUNT; n >= 0; n--) {
+        if (!cli_->check_alive()) {
+            return rec.done(RCLI_ERROR);
+        }
+        // one XACK per stream in front of the command, all in one write
+        buf_.clear();
+        RedisCommandEncoder enc(buf_);
+        size_t commands = 0;
+        for (auto& q : acks_) {
+            if (q.count > 0) {
+                enc.begin(3 + q.count);
+                enc.arg("XACK");
+                enc.arg(q.key);
+                enc.arg(group_);
+                buf_.append(q.ids);
+                commands++;
+            }
+        }
+        buf_.append(cmd_);
+        if (!cli->append_formatted(buf_)) {
+            err = cli->check_reply_type(nullptr);
+        } else {
+            err = read_acks(commands);
+            // the reply of the command follows even after an XACK failed, its status is returned
+            if (out && err != RCLI_ERROR && err != RCLI_TIMEOUT) {
+                out->reset(kind, key);
+                err = cli->read_reply(*out);
+            }
+        }
+        // a lost XREADGROUP left its entries pending, they are not read twice
+        if (err != RCLI_ERROR || n == 0 || !cli_->recover()) {
+            break;
+        }
+    }
+    return rec.done(err);
+}
+
+int RedisStreamConsumer::read_acks(size_t commands) {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    int first = RCLI_RET_OK;
+    for (size_t i = 0; i < commands; i++) {
+        RedisAckVisitor visitor(acked_);
+        int err = cli->read_reply(visitor);
+        if (err == RCLI_ERROR || err == RCLI_TIMEOUT) {
+            // still queued, sent again with the next round trip
+            return err;
+        }
+        if (first == RCLI_RET_OK) {
+            first = err;
+        }
+    }
+    // an XACK the server refused would be refused again, it is dropped too
+    acks_.clear();
+    pending_acks_ = 0;
+    return first;
+}
@@ -0,0 +1,163 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+class RedisStreamConsumer;
+
+// Entries of an XREADGROUP or XAUTOCLAIM reply, decoded while hiredis parses
+// it. All ids, fields and values are packed into one buffer and handed out as
+// views, no string is allocated per field. Views stay valid until the batch is
+// cleared or read into again.
+//
+//     for (size_t i = 0; i < batch.size(); i++) {
+//         batch.stream(i);  // key the entry came from
+//         batch.id(i);
+//         for (size_t j = 0; j < batch.fields(i); j++) {
+//             batch.field(i, j); batch.value(i, j);
+//         }
+//     }
+class RedisStreamBatch : public RedisReplyVisitor {
+    friend class RedisStreamConsumer;
+
+public:
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+    void clear();
+
+    const std::string& stream(size_t index) const { return streams_[entries_[index].stream]; }
+    RedisStringView id(size_t index) const { return view(entries_[index].first); }
+    // field value pairs, 0 for an entry deleted from the stream after it was delivered
+    size_t fields(size_t index) const { return entries_[index].strings / 2; }
+    RedisStringView field(size_t index, size_t pair) const { return view(entries_[index].first + 1 + pair * 2); }
+    RedisStringView value(size_t index, size_t pair) const { return view(entries_[index].first + 2 + pair * 2); }
+
+    // XAUTOCLAIM only: where the next call starts, "0-0" once the pending list
+    // was walked through, and the pending ids whose entries no longer exist
+    const std::string& cursor() const { return cursor_; }
+    const std::vector<std::string>& deleted() const { return deleted_; }
+
+    void on_array(int depth, size_t len) override;
+    void on_map(int depth, size_t pairs) override;
+    void on_string(int depth, const char* str, size_t len) override;
+    void on_integer(int depth, int64_t val) override;
+
+private:
+    enum {
+        READ = 0,   // XREADGROUP, [[key, entries] ...] or a RESP3 map of key to entries
+        AUTOCLAIM,  // XAUTOCLAIM, [cursor, entries, deleted ids]
+    };
+
+    typedef struct entry {
+        size_t stream;
+        size_t first;        // index of the id in offsets_, the fields follow
+        size_t strings = 0;  // fields and values
+    } entry_t;
+
+    // clear and expect the reply of kind, the entries of an XAUTOCLAIM come from key
+    void reset(int kind, const std::string* key);
+    RedisStringView view(size_t index) const {
+        size_t begin = index == 0 ? 0 : offsets_[index - 1];
+        return RedisStringView(data_.data() + begin, offsets_[index] - begin);
+    }
+
+    int kind_ = READ;
+    // depth of the [id, fields] arrays, the id is one deeper and the fields two
+    int entry_depth_ = 2;
+    std::string data_;
+    std::vector<size_t> offsets_;  // end of each string in data_
+    std::vector<entry_t> entries_;
+    std::vector<std::string> streams_;
+    std::string cursor_;
+    std::vector<std::string> deleted_;
+};
+
+// Reads streams as one consumer of a consumer group.
+//
+//     RedisStreamConsumer consumer(rcli, "workers", "worker-1");
+//     consumer.count(100).block_ms(2000).ack_batch(64);
+//     consumer.create_group("orders");
+//     RedisStreamBatch batch;
+//     while (consumer.read({"orders"}, batch) != RCLI_ERROR) {
+//         for (size_t i = 0; i < batch.size(); i++) {
+//             ... batch.value(i, 0) ...
+//             consumer.ack(batch, i);
+//         }
+//     }
+//
+// Acknowledgements are queued and sent as one XACK per stream, either when
+// ack_batch of them are queued or in front of the next XREADGROUP or
+// XAUTOCLAIM, in the same write. They stay queued until the server replied,
+// and are sent again after a connection error: XACK of an id no longer
+// pending does nothing.
+//
+// Entries delivered by a read that failed with the connection stay pending for
+// this consumer, autoclaim() hands them to a consumer again once they were
+// idle long enough. The command timeout of the client must be longer than
+// block_ms. Like RedisClient, a consumer is not thread safe.
+class RedisStreamConsumer {
+public:
+    RedisStreamConsumer(RedisClient* cli, const std::string& group, const std::string& consumer);
+
+    // entries per read and per autoclaim, 100 by default
+    RedisStreamConsumer& count(uint32_t count);
+    // wait up to block_ms for new entries, 0 returns at once
+    RedisStreamConsumer& block_ms(uint32_t block_ms);
+    // acknowledgements sent together, 1 sends each at once
+    RedisStreamConsumer& ack_batch(size_t ack_batch);
+    // NOACK, entries are not added to the pending list and need no ack
+    RedisStreamConsumer& noack(bool on);
+
+    // XGROUP CREATE key group id MKSTREAM, "$" delivers only entries added
+    // later and "0" the whole stream. an existing group is left as it is
+    int create_group(const std::string& key, const std::string& id = "$");
+
+    // entries never delivered to the group, out is replaced. RCLI_RET_NIL when
+    // none arrived within block_ms
+    int read(const std::vector<std::string>& keys, RedisStreamBatch& out);
+    // entries of key pending for at least min_idle_ms, whoever they were
+    // delivered to, claimed for this consumer. successive calls walk the
+    // pending list, starting over after it was walked through
+    int autoclaim(const std::string& key, uint32_t min_idle_ms, RedisStreamBatch& out);
+
+    // queue an acknowledgement, RCLI_* of the XACK round trip when ack_batch was reached
+    int ack(const std::string& key, const RedisStringView& id);
+    int ack(const RedisStreamBatch& batch, size_t index) { return ack(batch.stream(index), batch.id(index)); }
+    // send the queued acknowledgements now
+    int flush_acks();
+
+    size_t pending_acks() const { return pending_acks_; }
+    // entries the server removed from the pending list on our XACKs
+    uint64_t acked() const { return acked_; }
+
+private:
+    typedef struct ack_queue {
+        std::string key;
+        size_t count = 0;
+        std::string ids;  // RESP encoded
+    } ack_queue_t;
+
+    // send the queued acks followed by the command in cmd_, if any, and read
+    // the replies, the last one into out. retried after a connection error
+    int round_trip(const char* verb, RedisStreamBatch* out, int kind, const std::string* key);
+    // the XACK replies, the acks are dequeued once all were read
+    int read_acks(size_t commands);
+
+    RedisClient* cli_;
+    std::string group_;
+    std::string consumer_;
+    uint32_t count_ = 100;
+    uint32_t block_ms_ = 0;
+    size_t ack_batch_ = 64;
+    bool noack_ = false;
+
+    std::vector<ack_queue_t> acks_;
+    size_t pending_acks_ = 0;
+    uint64_t acked_ = 0;
+    // XAUTOCLAIM start of each key
+    std::unordered_map<std::string, std::string> cursors_;
+    std::string cmd_;
+    std::string buf_;
+};
@@ -0,0 +1,232 @@
+#include "rcli_tls.h"
+#include <atomic>
+#include <hiredis/hiredis.h>
+#include <map>
+#include <mutex>
+#ifdef RCLI_WITH_SSL
+#    include <hiredis/hiredis_ssl.h>
+#    include <hiredis/sockcompat.h>
+#    include <openssl/err.h>
+#    include <openssl/ssl.h>
+#    include <openssl/x509v3.h>
+
+namespace {
+
+bool is_ip(const std::string& host) {
+    unsigned char addr[16];
+    return inet_pton(AF_INET, host.c_str(), addr) == 1 || inet_pton(AF_INET6, host.c_str(), addr) == 1;
+}
+
+std::string ssl_error(const char* what) {
+    unsigned long err = ERR_get_error();
+    char buf[256] = "unknown error";
+    if (err != 0) {
+        ERR_error_string_n(err, buf, sizeof(buf));
+    }
+    ERR_clear_error();
+    return std::string(what) + ": " + buf;
+}
+
+}  // namespace
+#endif
+
+class RedisTlsContextImpl {
+public:
+#ifdef RCLI_WITH_SSL
+    // peer -> its latest session, entries are never erased, an SSL points at its own
+    typedef std::map<std::string, SSL_SESSION*>::value_type session_entry_t;
+
+    ~RedisTlsContextImpl() {
+        clear_sessions();
+        if (ctx_) {
+            SSL_CTX_free(ctx_);
+        }
+    }
+
+    void clear_sessions() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& entry : sessions_) {
+            if (entry.second) {
+                SSL_SESSION_free(entry.second);
+                entry.second = nullptr;
+            }
+        }
+    }
+
+    // sessions arrive during the handshake with TLS 1.2 and after it with TLS 1.3.
+    // a copy is kept: hiredis frees connections without SSL_shutdown, which makes
+    // OpenSSL mark the connection's own session not resumable
+    static int new_session(SSL* ssl, SSL_SESSION* session) {
+        RedisTlsContextImpl* impl = (RedisTlsContextImpl*) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+        session_entry_t* entry = (session_entry_t*) SSL_get_app_data(ssl);
+        SSL_SESSION* copy = impl && entry ? SSL_SESSION_dup(session) : nullptr;
+        if (copy == nullptr) {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        if (entry->second) {
+            SSL_SESSION_free(entry->second);
+        }
+        entry->second = copy;
+        return 0;
+    }
+
+    SSL_CTX* ctx_ = nullptr;
+    std::mutex mutex_;
+    std::map<std::string, SSL_SESSION*> sessions_;
+#else
+    void clear_sessions() {}
+#endif
+
+    RedisTlsContext::tls_options_t opts_;
+    std::atomic<uint64_t> handshakes_{0};
+    std::atomic<uint64_t> resumed_{0};
+    std::string error_str_;
+};
+
+RedisTlsContext::RedisTlsContext() { impl_ = new RedisTlsContextImpl; }
+
+RedisTlsContext::~RedisTlsContext() { delete (RedisTlsContextImpl*) impl_; }
+
+const std::string& RedisTlsContext::get_last_error() {
+    RedisTlsContextImpl* impl = (RedisTlsContextImpl*) impl_;
+    return impl->error_str_;
+}
+
+uint64_t RedisTlsContext::handshakes() {
+    RedisTlsContextImpl* impl = (RedisTlsContextImpl*) impl_;
+    return impl->handshakes_.load();
+}
+
+uint64_t RedisTlsContext::resumed() {
+    RedisTlsContextImpl* impl = (RedisTlsContextImpl*) impl_;
+    return impl->resumed_.load();
+}
+
+void RedisTlsContext::clear_sessions() {
+    RedisTlsContextImpl* impl = (RedisTlsContextImpl*) impl_;
+    impl->clear_sessions();
+}
+
+#ifdef RCLI_WITH_SSL
+
+bool RedisTlsContext::init(const tls_options_t& opts) {
+    RedisTlsContextImpl* impl = (RedisTlsContextImpl*) impl_;
+    if (impl->ctx_) {
+        impl->error_str_ = "RedisTlsContext already initialized";
+        return false;
+    }
+    static std::once_flag once;
+    std::call_once(once, [] { redisInitOpenSSL(); });
+
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == nullptr) {
+        impl->error_str_ = ssl_error("SSL_CTX_new");
+        return false;
+    }
+    SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+    SSL_CTX_set_verify(ctx, opts.verify_peer ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
+
+    const char* failed = nullptr;
+    if (opts.ca_file.empty() && opts.ca_path.empty()) {
+        if (opts.verify_peer && SSL_CTX_set_default_verify_paths(ctx) != 1) {
+            failed = "SSL_CTX_set_default_verify_paths";
+        }
+    } else if (SSL_CTX_load_verify_locations(ctx, opts.ca_file.empty() ? nullptr : opts.ca_file.c_str(),
+                                             opts.ca_path.empty() ? nullptr : opts.ca_path.c_str())
+               != 1) {
+        failed = "CA";
+    }
+    if (!failed && !opts.cert_file.empty()) {
+        if (SSL_CTX_use_certificate_chain_file(ctx, opts.cert_file.c_str()) != 1) {
+            failed = "client certificate";
+        } else if (SSL_CTX_use_PrivateKey_file(ctx, opts.key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
+            failed = "client key";
+        }
+    }
+    if (failed) {
+        impl->error_str_ = ssl_error(failed);
+        SSL_CTX_free(ctx);
+        return false;
+    }
+
+    if (opts.resume) {
+        // kept by new_session per server, not in OpenSSL's cache keyed by nothing useful to a client
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, &RedisTlsContextImpl::new_session);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+    SSL_CTX_set_app_data(ctx, impl);
+    impl->opts_ = opts;
+    impl->ctx_ = ctx;
+    return true;
+}
+
+bool RedisTlsContext::handshake(redisContext* ctx, const std::string& host, const std::string& peer,
+                                std::string& error) {
+    RedisTlsContextImpl* impl = (RedisTlsContextImpl*) impl_;
+    if (impl->ctx_ == nullptr) {
+        error = "RedisTlsContext not initialized";
+        return false;
+    }
+    SSL* ssl = SSL_new(impl->ctx_);
+    if (ssl == nullptr) {
+        error = ssl_error("SSL_new");
+        return false;
+    }
+
+    // SNI carries names only, an IP is checked against the certificate's IP addresses
+    const tls_options_t& opts = impl->opts_;
+    const std::string& name = opts.server_name.empty() ? host : opts.server_name;
+    if (!is_ip(name)) {
+        SSL_set_tlsext_host_name(ssl, name.c_str());
+        if (opts.verify_peer) {
+            SSL_set1_host(ssl, name.c_str());
+        }
+    } else if (opts.verify_peer) {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), name.c_str());
+    }
+
+    if (opts.resume) {
+        std::lock_guard<std::mutex> lock(impl->mutex_);
+        RedisTlsContextImpl::session_entry_t* entry = &*impl->sessions_.emplace(peer, nullptr).first;
+        // a copy again, OpenSSL spends the TLS 1.3 session it resumes while the
+        // ticket stays good for the other connections opened before the next one arrives
+        SSL_SESSION* copy = entry->second ? SSL_SESSION_dup(entry->second) : nullptr;
+        if (copy) {
+            SSL_set_session(ssl, copy);
+            SSL_SESSION_free(copy);
+        }
+        SSL_set_app_data(ssl, entry);
+    }
+
+    // owns ssl from here on success, frees it with the connection
+    if (redisInitiateSSL(ctx, ssl) != REDIS_OK) {
+        error.assign(ctx->errstr);
+        SSL_free(ssl);
+        return false;
+    }
+    impl->handshakes_++;
+    if (SSL_session_reused(ssl)) {
+        impl->resumed_++;
+    }
+    return true;
+}
+
+#else
+
+bool RedisTlsContext::init(const tls_options_t& /*opts*/) {
+    RedisTlsContextImpl* impl = (RedisTlsContextImpl*) impl_;
+    impl->error_str_ = "rcli built without TLS, configure with -Drcli_ENABLE_SSL=ON";
+    return false;
+}
+
+bool RedisTlsContext::handshake(redisContext* /*ctx*/, const std::string& /*host*/, const std::string& /*peer*/,
+                                std::string& error) {
+    error = "rcli built without TLS, configure with -Drcli_ENABLE_SSL=ON";
+    return false;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+
+struct redisContext;
+
+// TLS settings and the sessions of past handshakes, shared by every client and
+// pool whose options_t::tls points here. A reconnect, or a new pool connection,
+// resumes the session of the server it reaches instead of paying a full
+// handshake.
+//
+//     RedisTlsContext tls;
+//     RedisTlsContext::tls_options_t tls_opts;
+//     tls_opts.ca_file = "/etc/redis/ca.crt";
+//     tls_opts.server_name = "redis.internal";
+//     if (!tls.init(tls_opts)) { ... tls.get_last_error() ... }
+//     RedisClient::options_t opts;
+//     opts.tls = &tls;
+//     rcli->init(host, port, pwd, opts);
+//
+// Needs rcli built with rcli_ENABLE_SSL, init() fails otherwise. The context
+// must outlive the clients using it.
+class RedisTlsContext {
+    friend class RedisClientImpl;
+
+public:
+    typedef struct tls_options {
+        std::string ca_file;    // PEM CA bundle, the system's CAs when both are empty
+        std::string ca_path;    // directory of hashed CA certificates
+        std::string cert_file;  // client certificate chain, for servers requiring one
+        std::string key_file;   // its private key
+        // sent as SNI and matched against the certificate, empty uses the host the client connects to
+        std::string server_name;
+        bool verify_peer = true;
+        bool resume = true;  // reuse sessions across connections
+    } tls_options_t;
+
+    RedisTlsContext();
+    ~RedisTlsContext();
+    RedisTlsContext(const RedisTlsContext&) = delete;
+    RedisTlsContext& operator=(const RedisTlsContext&) = delete;
+
+    bool init(const tls_options_t& opts);
+    const std::string& get_last_error();
+
+    // handshakes completed and how many of them resumed a session
+    uint64_t handshakes();
+    uint64_t resumed();
+    // forget the sessions, the next handshakes are full ones
+    void clear_sessions();
+
+private:
+    // TLS over the connected ctx, peer names the server in the session cache
+    bool handshake(redisContext* ctx, const std::string& host, const std::string& peer, std::string& error);
+
+    void* impl_;
+};
@@ -0,0 +1,139 @@
+#include "rcli_transaction.h"
+#include "rcli_impl.h"
+
+RedisTransaction::RedisTransaction(RedisClient* cli) : RedisPipeline(cli) {}
+
+void RedisTransaction::fail_all(int err, const std::string& error) {
+    for (auto& slot : slots_) {
+        // commands refused while queueing keep their own error
+        if (slot.error.empty()) {
+            slot.err = err;
+            slot.error = error;
+        }
+    }
+}
+
+int RedisTransaction::exec() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    executed_ = true;
+    sent_ = false;
+    RedisCallRecorder rec(cli, "MULTI");
+
+    std::string cmds;
+    cmds.swap(buf_);
+    RedisCommandEncoder enc(buf_);
+    enc.command("MULTI");
+    buf_.append(cmds);
+    enc.command("EXEC");
+
+    // resent only when it could not be written, a prefix without its EXEC is
+    // discarded with the connection. never under WATCH: a new connection has lost it
+    int err = RCLI_ERROR;
+    if (cli_->check_alive()) {
+        if (watching_ && cli->connects_ != watch_connects_) {
+            err = RCLI_RET_NIL;
+            cli->error_str_ = "Redis WATCH lost with the connection";
+        } else {
+            err = flush();
+            for (int n = RCLI_TRY_COUNT; err == RCLI_ERROR && !watching_ && n > 0 && cli_->recover(); n--) {
+                err = flush();
+            }
+        }
+    }
+    buf_.clear();
+    if (err != RCLI_RET_OK) {
+        fail_all(err, cli->error_str_);
+        return rec.done(err);
+    }
+    sent_ = true;
+    return rec.done(drain_exec());
+}
+
+int RedisTransaction::drain_exec() {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    redisContext* ctx = cli->get_context();
+    std::string first_error;
+    for (size_t i = 0; i <= slots_.size(); i++) {
+        void* reply = nullptr;
+        redisGetReply(ctx, &reply);
+        CSmartPtr<void, freeReplyObject> reply_sp(reply);
+        int err = cli->check_reply_type((const redisReply*) reply);
+        if (err == RCLI_ERROR || err == RCLI_TIMEOUT) {
+            fail_all(err, cli->error_str_);
+            return err;
+        }
+        if (i > 0 && err == RCLI_RET_ERROR) {
+            slots_[i - 1].err = err;
+            slots_[i - 1].error = cli->error_str_;
+            if (first_error.empty()) {
+                first_error = cli->error_str_;
+            }
+        }
+    }
+
+    void* reply = nullptr;
+    redisGetReply(ctx, &reply);
+    CSmartPtr<void, freeReplyObject> reply_sp(reply);
+    const redisReply* r = (const redisReply*) reply;
+    int err = cli->check_reply_type(r);
+    if (err == RCLI_RET_OK && (r->type == REDIS_REPLY_ARRAY || r->type == REDIS_REPLY_SET)) {
+        for (size_t i = 0; i < slots_.size() && i < r->elements; i++) {
+            slot_t& slot = slots_[i];
+            if (slot.type == SLOT_SKIP) {
+                continue;
+            }
+            decode(slot, r->element[i]);
+            if (slot.err != RCLI_RET_OK && slot.err != RCLI_RET_FAIL) {
+                slot.error = cli->error_str_;
+                if (first_error.empty()) {
+                    first_error = slot.error;
+                }
+            }
+        }
+        cli->error_str_ = first_error;
+        return RCLI_RET_OK;
+    }
+
+    // nothing ran: a watched key changed (nil), EXECABORT or a lost connection
+    if (err == RCLI_RET_NIL) {
+        cli->error_str_ = "Redis transaction aborted, a watched key changed";
+    }
+    fail_all(err, cli->error_str_);
+    return err;
+}
+
+int RedisTransaction::watch(const std::vector<std::string>& keys, const body_t& body, int max_tries) {
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    std::vector<std::string> cmd;
+    cmd.reserve(keys.size() + 1);
+    cmd.emplace_back("WATCH");
+    cmd.insert(cmd.end(), keys.begin(), keys.end());
+
+    int err = RCLI_RET_NIL;
+    for (tries_ = 0; tries_ < max_tries;) {
+        clear();
+        if (!cli_->check_alive()) {
+            return RCLI_ERROR;
+        }
+        err = cli_->commandv_for_status(cmd);
+        if (err != RCLI_RET_OK) {
+            return err;
+        }
+        watching_ = true;
+        watch_connects_ = cli->connects_;
+        tries_++;
+        if (!body(*this)) {
+            watching_ = false;
+            clear();
+            cli_->commanda_for_status("UNWATCH");
+            return RCLI_RET_FAIL;
+        }
+        err = exec();
+        watching_ = false;
+        // a transaction that could not be written did not run either
+        if (err != RCLI_RET_NIL && (sent_ || err != RCLI_ERROR)) {
+            return err;
+        }
+    }
+    return err;
+}
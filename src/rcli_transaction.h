@@ -0,0 +1,63 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli_pipeline.h"
+#include <functional>
+
+// Queue commands like a RedisPipeline and run them atomically: MULTI, the
+// commands and EXEC go out in one write, and the EXEC reply is decoded into the
+// typed slots.
+//
+//     RedisTransaction tx = rcli->transaction();
+//     int64_t out;
+//     tx.hincrby("key", "f1", 1, out);
+//     tx.expire("key", 60);
+//     if (tx.exec() == RCLI_RET_OK && tx.status(0) == RCLI_RET_OK) { ... }
+//
+// watch() adds optimistic locking: the body reads through the client and
+// queues its writes, and is run again when a watched key changed before EXEC.
+//
+//     int64_t balance = 0;
+//     int err = tx.watch({"balance"}, [&](RedisTransaction& tx) {
+//         rcli->commanda_for_integer(balance, "GET", "balance");
+//         if (balance < 10) {
+//             return false;
+//         }
+//         tx.appenda_for_status("DECRBY", "balance", 10);
+//         return true;
+//     });
+class RedisTransaction : public RedisPipeline {
+public:
+    // false gives up, nothing is sent
+    typedef std::function<bool(RedisTransaction& tx)> body_t;
+
+    explicit RedisTransaction(RedisClient* cli);
+
+    // RCLI_RET_OK when committed, status(i) then tells each command's result.
+    // RCLI_RET_NIL when a watched key changed and nothing ran, RCLI_RET_ERROR
+    // when the server refused a command while queueing and discarded the
+    // transaction, RCLI_ERROR or RCLI_TIMEOUT on connection errors.
+    int exec();
+
+    // WATCH keys, run body, EXEC, up to max_tries times while EXEC finds a
+    // watched key changed. returns what the last exec() did, or RCLI_RET_FAIL
+    // when body gave up. losing the connection loses the WATCH, that try
+    // counts as a conflict
+    int watch(const std::vector<std::string>& keys, const body_t& body, int max_tries = 5);
+    // bodies run by the last watch()
+    int tries() const { return tries_; }
+
+private:
+    // +OK of MULTI, +QUEUED or an error per command, then the EXEC reply
+    int drain_exec();
+    void fail_all(int err, const std::string& error);
+
+    bool watching_ = false;
+    // RedisClientImpl::connects_ when WATCH was sent
+    uint64_t watch_connects_ = 0;
+    // the transaction was written, it may have run
+    bool sent_ = false;
+    int tries_ = 0;
+};
@@ -0,0 +1,229 @@
+#include "rcli_window.h"
+#include "rcli_impl.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <hiredis/sds.h>
+
+#ifdef _WIN32
+#    include <hiredis/sockcompat.h>
+#else
+#    include <fcntl.h>
+#    include <poll.h>
+#endif
+
+#define RCLI_WINDOW_POLL_MS 100
+// what redisBufferRead() reads at most, a full read may have left more behind
+#define RCLI_WINDOW_READ_SIZE (16 * 1024)
+
+namespace {
+
+void set_nonblock(redisContext* ctx, bool on) {
+#ifdef _WIN32
+    u_long mode = on ? 1 : 0;
+    ioctlsocket(ctx->fd, FIONBIO, &mode);
+#else
+    int flags = fcntl(ctx->fd, F_GETFL);
+    fcntl(ctx->fd, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+#endif
+    // hiredis takes EAGAIN for "try again later" only without REDIS_BLOCK
+    if (on) {
+        ctx->flags &= ~REDIS_BLOCK;
+    } else {
+        ctx->flags |= REDIS_BLOCK;
+    }
+}
+
+}  // namespace
+
+RedisWindowPipeline::RedisWindowPipeline(RedisClient* cli) : RedisWindowPipeline(cli, window_options_t()) {}
+
+RedisWindowPipeline::RedisWindowPipeline(RedisClient* cli, const window_options_t& opts) : cli_(cli), opts_(opts) {
+    opts_.max_in_flight = std::max<size_t>(opts_.max_in_flight, 1);
+}
+
+RedisWindowPipeline::~RedisWindowPipeline() {
+    if (!started_) {
+        return;
+    }
+    drain();
+    redisContext* ctx = ((RedisClientImpl*) cli_->impl_)->get_context();
+    if (ctx) {
+        set_nonblock(ctx, false);
+    }
+}
+
+void RedisWindowPipeline::on_reply(reply_cb_t cb, RedisReplyVisitor* visitor) {
+    cb_ = std::move(cb);
+    visitor_ = visitor;
+}
+
+int RedisWindowPipeline::start() {
+    if (started_) {
+        return status_;
+    }
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    if (!cli_->check_alive()) {
+        return fail(RCLI_ERROR, cli->error_str_);
+    }
+    // a SCAN sent ahead would take the first reply
+    cli->drop_unread();
+    redisContext* ctx = cli->get_context();
+    if (ctx == nullptr) {
+        return fail(RCLI_ERROR, "Redis Context nullptr!");
+    }
+    if (ctx->err) {
+        return fail(RCLI_ERROR, ctx->errstr);
+    }
+    set_nonblock(ctx, true);
+    started_ = true;
+    return RCLI_RET_OK;
+}
+
+bool RedisWindowPipeline::full() const {
+    return in_flight_ >= opts_.max_in_flight || (started_ && obuf_bytes() >= opts_.max_obuf);
+}
+
+size_t RedisWindowPipeline::obuf_bytes() const {
+    redisContext* ctx = ((RedisClientImpl*) cli_->impl_)->get_context();
+    return ctx && ctx->obuf ? sdslen(ctx->obuf) : 0;
+}
+
+int RedisWindowPipeline::add_formatted(const RedisStringView& cmd, size_t commands) {
+    int err = start();
+    if (err != RCLI_RET_OK) {
+        return err;
+    }
+    if (full()) {
+        stats_.stalls++;
+    }
+    while (full()) {
+        err = pump(RCLI_WINDOW_POLL_MS);
+        if (err != RCLI_RET_OK) {
+            return err;
+        }
+    }
+
+    redisContext* ctx = ((RedisClientImpl*) cli_->impl_)->get_context();
+    if (redisAppendFormattedCommand(ctx, cmd.data(), cmd.size()) != REDIS_OK) {
+        return fail(RCLI_ERROR, ctx->errstr);
+    }
+    if (in_flight_ == 0) {
+        progress_us_ = RedisCallRecorder::now_us();
+    }
+    in_flight_ += commands;
+    stats_.commands += commands;
+    stats_.max_in_flight = std::max(stats_.max_in_flight, in_flight_);
+    // written now, and what replies arrived meanwhile read, so that the first
+    // reply does not wait for the window to fill
+    return sdslen(ctx->obuf) >= opts_.write_bytes ? pump(0) : RCLI_RET_OK;
+}
+
+int RedisWindowPipeline::try_add_formatted(const RedisStringView& cmd, size_t commands) {
+    if (full()) {
+        stats_.stalls++;
+        return RCLI_RET_FAIL;
+    }
+    return add_formatted(cmd, commands);
+}
+
+int RedisWindowPipeline::pump(int timeout_ms) {
+    if (status_ != RCLI_RET_OK || in_flight_ == 0) {
+        return status_;
+    }
+    redisContext* ctx = ((RedisClientImpl*) cli_->impl_)->get_context();
+    struct pollfd pfd;
+    pfd.fd = ctx->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (sdslen(ctx->obuf) > 0) {
+        pfd.events |= POLLOUT;
+    }
+    int n = poll(&pfd, 1, timeout_ms);
+    if (n < 0 && errno != EINTR) {
+        return fail(RCLI_ERROR, strerror(errno));
+    }
+    if (n <= 0) {
+        int64_t timeout_us = ((RedisClientImpl*) cli_->impl_)->command_timeout_us_;
+        if (n == 0 && timeout_us > 0 && RedisCallRecorder::now_us() - progress_us_ >= timeout_us) {
+            // the replies still to come would be taken for those of the next commands
+            ctx->err = REDIS_ERR_TIMEOUT;
+            snprintf(ctx->errstr, sizeof(ctx->errstr), "%s", "command timeout");
+            return fail(RCLI_TIMEOUT, ctx->errstr);
+        }
+        return RCLI_RET_OK;
+    }
+    if (pfd.revents & POLLOUT) {
+        size_t before = sdslen(ctx->obuf);
+        int done = 0;
+        if (redisBufferWrite(ctx, &done) != REDIS_OK) {
+            return fail(RCLI_ERROR, ctx->errstr);
+        }
+        if (sdslen(ctx->obuf) < before) {
+            progress_us_ = RedisCallRecorder::now_us();
+        }
+    }
+    if (pfd.revents & (POLLIN | POLLERR | POLLHUP)) {
+        return read_replies();
+    }
+    return RCLI_RET_OK;
+}
+
+int RedisWindowPipeline::read_replies() {
+    static RedisReplyVisitor ignore;
+    RedisClientImpl* cli = (RedisClientImpl*) cli_->impl_;
+    redisContext* ctx = cli->get_context();
+    uint64_t read = 0;
+    do {
+        uint64_t before = cli->bytes_read_;
+        if (redisBufferRead(ctx) != REDIS_OK) {
+            return fail(RCLI_ERROR, ctx->errstr);
+        }
+        read = cli->bytes_read_ - before;
+        // a reply split over two reads is finished under another sink
+        RedisReplySink sink(ctx, visitor_ ? *visitor_ : ignore);
+        while (in_flight_ > 0) {
+            void* reply = nullptr;
+            if (redisGetReplyFromReader(ctx, &reply) != REDIS_OK) {
+                return fail(RCLI_ERROR, ctx->errstr);
+            }
+            if (reply == nullptr) {
+                break;
+            }
+            if (!RedisReplySink::is_marker(reply)) {
+                // a PUSH, handled the way redisGetReply() does
+                if (ctx->push_cb) {
+                    ctx->push_cb(ctx->privdata, reply);
+                } else {
+                    freeReplyObject(reply);
+                }
+                continue;
+            }
+            int status = sink.status();
+            in_flight_--;
+            stats_.replies++;
+            stats_.errors += status == RCLI_RET_ERROR ? 1 : 0;
+            progress_us_ = RedisCallRecorder::now_us();
+            if (cb_) {
+                static const std::string no_error;
+                cb_(stats_.replies - 1, status, status == RCLI_RET_ERROR ? sink.error() : no_error);
+            }
+        }
+    } while (read == RCLI_WINDOW_READ_SIZE && in_flight_ > 0);
+    return RCLI_RET_OK;
+}
+
+int RedisWindowPipeline::drain() {
+    while (in_flight_ > 0 && status_ == RCLI_RET_OK) {
+        pump(RCLI_WINDOW_POLL_MS);
+    }
+    return status_;
+}
+
+int RedisWindowPipeline::fail(int err, const std::string& error) {
+    if (status_ == RCLI_RET_OK) {
+        status_ = err;
+        error_str_ = error;
+    }
+    return status_;
+}
@@ -0,0 +1,117 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include "rcli.h"
+#include <functional>
+
+// Streaming pipeline with a bounded window.
+//
+// A RedisPipeline queues every command in hiredis's output buffer before the
+// first byte is written, so a huge batch grows client memory without limit and
+// its first reply waits for the last command. Here the commands are written
+// while they are added and the replies are read while more are written: at
+// most max_in_flight commands wait for a reply and at most about max_obuf bytes
+// wait for the socket. A full window is the backpressure: add() does the I/O
+// until there is room again, try_add() returns RCLI_RET_FAIL instead and leaves
+// it to the producer to pump().
+//
+//     RedisWindowPipeline window(rcli);
+//     window.on_reply([&](uint64_t seq, int status, const std::string& error) { ... });
+//     for (auto& kv : rows) {
+//         if (window.add("SET", kv.first, kv.second) != RCLI_RET_OK) { ... connection error }
+//     }
+//     window.drain();
+//
+// The socket is non-blocking while the window lives and the client must not be
+// used for anything else meanwhile. Nothing is retried: after a connection
+// error or a command timeout every call returns it, and the in_flight()
+// commands may or may not have been executed. recover() the client and start
+// over with a new window.
+class RedisWindowPipeline {
+public:
+    typedef struct window_options {
+        size_t max_in_flight = 1024;   // commands without a reply
+        size_t max_obuf = 256 * 1024;  // bytes waiting for the socket, one command may go past it
+        // bytes queued that make add() write at once instead of leaving it to pump()
+        size_t write_bytes = 16 * 1024;
+    } window_options_t;
+
+    typedef struct window_stats {
+        uint64_t commands = 0;
+        uint64_t replies = 0;
+        uint64_t errors = 0;       // error replies
+        uint64_t stalls = 0;       // add() calls that waited for room, try_add() calls refused
+        size_t max_in_flight = 0;  // most commands waiting for a reply at once
+    } window_stats_t;
+
+    // seq counts the commands from 0 in the order they were added, status is
+    // RCLI_RET_OK, RCLI_RET_NIL or RCLI_RET_ERROR with the error text
+    typedef std::function<void(uint64_t seq, int status, const std::string& error)> reply_cb_t;
+
+    explicit RedisWindowPipeline(RedisClient* cli);
+    RedisWindowPipeline(RedisClient* cli, const window_options_t& opts);
+    // drain() what is in flight and make the socket blocking again
+    virtual ~RedisWindowPipeline();
+
+    RedisWindowPipeline(const RedisWindowPipeline&) = delete;
+    RedisWindowPipeline& operator=(const RedisWindowPipeline&) = delete;
+
+    // every reply is handed to visitor element by element, see RedisClient::commanda_for_visitor(),
+    // then cb is called. both optional, set them before the first add
+    void on_reply(reply_cb_t cb, RedisReplyVisitor* visitor = nullptr);
+
+    // arguments are encoded by RedisCommandEncoder, see RedisClient::commanda_for_*.
+    // RCLI_RET_OK once queued, RCLI_ERROR or RCLI_TIMEOUT after a connection error
+    template <class... Args>
+    int add(const Args&... args) {
+        buf_.clear();
+        RedisCommandEncoder(buf_).command(args...);
+        return add_formatted(buf_);
+    }
+    // RCLI_RET_FAIL without waiting while the window is full
+    template <class... Args>
+    int try_add(const Args&... args) {
+        if (full()) {
+            stats_.stalls++;
+            return RCLI_RET_FAIL;
+        }
+        return add(args...);
+    }
+    // commands RESP encoded back to back in cmd
+    int add_formatted(const RedisStringView& cmd, size_t commands = 1);
+    int try_add_formatted(const RedisStringView& cmd, size_t commands = 1);
+
+    // write what the socket takes and handle the replies that arrived, waiting
+    // up to timeout_ms for the socket. RCLI_TIMEOUT once nothing moved for the
+    // client's command timeout
+    int pump(int timeout_ms);
+    // pump() until every command got its reply
+    int drain();
+
+    bool full() const;
+    size_t in_flight() const { return in_flight_; }
+    size_t obuf_bytes() const;
+    const window_stats_t& stats() const { return stats_; }
+    const std::string& get_last_error() const { return error_str_; }
+
+private:
+    // switch the socket to non-blocking on first use
+    int start();
+    int read_replies();
+    int fail(int err, const std::string& error);
+
+    RedisClient* cli_;
+    window_options_t opts_;
+    reply_cb_t cb_;
+    RedisReplyVisitor* visitor_ = nullptr;
+    bool started_ = false;
+    int status_ = RCLI_RET_OK;
+    std::string error_str_;
+    size_t in_flight_ = 0;
+    // when a write or a reply last made progress, in steady_clock microseconds
+    int64_t progress_us_ = 0;
+    std::string buf_;
+    window_stats_t stats_;
+};
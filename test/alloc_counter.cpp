@@ -0,0 +1,24 @@
+#include <cstdlib>
+#include <new>
+
+// count every operator new of the calling thread, see test_alloc(). Per thread
+// so an embedded RespServer (-s) does not show up in the numbers.
+
+namespace {
+
+thread_local size_t g_alloc_count = 0;
+
+}  // namespace
+
+size_t test_alloc_count() { return g_alloc_count; }
+
+void* operator new(size_t size) {
+    g_alloc_count++;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
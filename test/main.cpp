@@ -3,6 +3,11 @@
 #include <iostream>
 #include <memory>
 
+#ifdef RCLI_WITH_TEST_SERVER
+// the embedded server of -s, for tests that inject latency or faults
+static RespServer* g_resp_server = nullptr;
+#endif
+
 void split(const std::string& s, std::string delim, std::vector<std::string>* ret) {
     size_t last = 0;
     size_t index = s.find_first_of(delim, last);
@@ -54,13 +59,162 @@ std::unique_ptr<RedisClient> create_redis_cli(const std::string& redis_host) {
     return redis_cli;
 }
 
-void run_test(RedisClient* rcli, const std::string& cmd) {
+std::unique_ptr<RedisClientPool> create_redis_pool(const std::string& redis_host) {
+    std::vector<std::string> host_vec;
+    split(redis_host, ":", &host_vec);
+    if (host_vec.size() != 3) {
+        fprintf(stderr, "RedisClientPool host error!\n");
+        return nullptr;
+    }
+    std::unique_ptr<RedisClientPool> redis_pool(new RedisClientPool);
+    int port = atoi(host_vec[1].c_str());
+    redis_pool->init(host_vec[0], port, host_vec[2], 2, 4);
+    if (!redis_pool->connect()) {
+        fprintf(stderr, "[RedisClientPool] connect error: %s\n", redis_pool->get_last_error().c_str());
+        return nullptr;
+    }
+    return redis_pool;
+}
+
+std::unique_ptr<AsyncRedisClient> create_redis_async(const std::string& redis_host) {
+    std::vector<std::string> host_vec;
+    split(redis_host, ":", &host_vec);
+    if (host_vec.size() != 3) {
+        fprintf(stderr, "AsyncRedisClient host error!\n");
+        return nullptr;
+    }
+    std::unique_ptr<AsyncRedisClient> redis_async(new AsyncRedisClient);
+    int port = atoi(host_vec[1].c_str());
+    redis_async->init(host_vec[0], port, host_vec[2]);
+    if (!redis_async->connect()) {
+        fprintf(stderr, "[AsyncRedisClient] connect error: %s\n", redis_async->get_last_error().c_str());
+        return nullptr;
+    }
+    return redis_async;
+}
+
+std::unique_ptr<RedisClusterClient> create_redis_cluster(const std::string& redis_seeds) {
+    // 127.0.0.1:7001:pwd,127.0.0.1:7002:pwd
+    std::vector<std::string> seed_vec;
+    split(redis_seeds, ",", &seed_vec);
+    std::vector<std::string> seeds;
+    std::string pwd;
+    for (auto& seed : seed_vec) {
+        std::vector<std::string> host_vec;
+        split(seed, ":", &host_vec);
+        if (host_vec.size() != 3) {
+            fprintf(stderr, "RedisClusterClient host error!\n");
+            return nullptr;
+        }
+        seeds.push_back(host_vec[0] + ":" + host_vec[1]);
+        pwd = host_vec[2];
+    }
+    std::unique_ptr<RedisClusterClient> redis_cluster(new RedisClusterClient);
+    redis_cluster->init(seeds, pwd);
+    if (!redis_cluster->connect()) {
+        fprintf(stderr, "[RedisClusterClient] connect error: %s\n", redis_cluster->get_last_error().c_str());
+        return nullptr;
+    }
+    return redis_cluster;
+}
+
+void run_test(RedisClient* rcli, const std::string& redis_host, const std::string& cmd) {
+    // 127.0.0.1:6380:hzmcdba, for the tests that open connections of their own
+    std::vector<std::string> host_vec;
+    split(redis_host, ":", &host_vec);
+    if (host_vec.size() != 3) {
+        fprintf(stderr, "host error: %s\n", redis_host.c_str());
+        return;
+    }
+    const std::string& host = host_vec[0];
+    uint32_t port = (uint32_t) atoi(host_vec[1].c_str());
+    const std::string& pwd = host_vec[2];
+
     if (cmd == "*" || cmd == "hash") {
         test_hash(rcli);
     }
     if (cmd == "*" || cmd == "zset") {
         test_set(rcli);
     }
+    if (cmd == "*" || cmd == "pipeline") {
+        test_pipeline(rcli);
+    }
+    if (cmd == "*" || cmd == "reply") {
+        test_reply(rcli);
+    }
+    if (cmd == "*" || cmd == "encoder") {
+        test_encoder(rcli);
+    }
+    if (cmd == "*" || cmd == "alloc") {
+        test_alloc(rcli);
+    }
+    if (cmd == "*" || cmd == "stats") {
+        test_stats(rcli);
+    }
+    if (cmd == "*" || cmd == "scan") {
+        test_scan(rcli);
+    }
+    if (cmd == "*" || cmd == "multikey") {
+        test_multikey(rcli);
+    }
+    if (cmd == "*" || cmd == "script") {
+        test_script(rcli);
+    }
+    if (cmd == "*" || cmd == "health") {
+        test_health(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "resp3") {
+        test_resp3(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "transaction") {
+        test_transaction(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "cache") {
+        test_cache(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "pubsub") {
+        test_pubsub(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "streams") {
+        test_streams(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "autopipe") {
+        test_autopipe(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "loader") {
+        test_loader(host, port, pwd);
+    }
+    if (cmd == "*" || cmd == "window") {
+        test_window(host, port, pwd);
+    }
+#ifdef RCLI_WITH_TEST_SERVER
+    if ((cmd == "*" || cmd == "timeout") && g_resp_server) {
+        test_timeout(g_resp_server, host, port, pwd);
+    }
+    if ((cmd == "*" || cmd == "socket") && g_resp_server) {
+        test_socket();
+    }
+    if ((cmd == "*" || cmd == "cluster") && g_resp_server) {
+        test_cluster_nodes();
+    }
+#    ifdef RCLI_WITH_SSL
+    if ((cmd == "*" || cmd == "tls") && g_resp_server) {
+        test_tls();
+    }
+#    endif
+#endif
+    if (cmd == "*" || cmd == "pool") {
+        auto pool = create_redis_pool(redis_host);
+        if (pool) {
+            test_pool(pool.get());
+        }
+    }
+    if (cmd == "*" || cmd == "async") {
+        auto acli = create_redis_async(redis_host);
+        if (acli) {
+            test_async(acli.get());
+        }
+    }
     if (cmd == "*" || cmd == "expire") {
         test_expire_key(rcli);
     }
@@ -72,13 +226,46 @@ void run_test(RedisClient* rcli, const std::string& cmd) {
 int main(int argc, char* argv[]) {
     std::cout << "Hello world!" << std::endl;
     std::string host_;
+    std::string cluster_;
     bool test_ = false;
+    bool server_ = false;
 
     OptionParser optr;
     optr.add_opt("-h", true, [&](int id, const char* str) { host_.assign(str); });
     optr.add_opt("-t", false, [&](int id, const char* str) { test_ = true; });
+    optr.add_opt("-c", true, [&](int id, const char* str) { cluster_.assign(str); });
+    optr.add_opt("-s", false, [&](int id, const char* str) { server_ = true; });
     optr.cmdline(argc, argv);
 
+#ifdef RCLI_WITH_TEST_SERVER
+    // -s: run against an embedded server instead of -h
+    RespServer server;
+    if (server_) {
+        server.set_password("rcli");
+        if (!server.listen_tcp("127.0.0.1", 0) || !server.start()) {
+            fprintf(stderr, "[RespServer] start error: %s\n", server.get_last_error().c_str());
+            return 0;
+        }
+        host_ = "127.0.0.1:" + std::to_string(server.port()) + ":rcli";
+        g_resp_server = &server;
+        fprintf(stdout, "[RespServer] listen: %s\n", host_.c_str());
+    }
+#else
+    if (server_) {
+        fprintf(stderr, "-s is not supported on this platform\n");
+        return 0;
+    }
+#endif
+
+    if (!cluster_.empty()) {
+        auto cluster = create_redis_cluster(cluster_);
+        if (cluster) {
+            test_cluster(cluster.get());
+        }
+        std::cout << "Bye!" << std::endl;
+        return 0;
+    }
+
     auto rcli = create_redis_cli(host_);
     if (rcli == nullptr) {
         fprintf(stderr, "host error: %s\n", host_.c_str());
@@ -86,7 +273,7 @@ int main(int argc, char* argv[]) {
     }
 
     if (test_) {
-        run_test(rcli.get(), "*");
+        run_test(rcli.get(), host_, "*");
         std::cout << "Bye!" << std::endl;
         return 0;
     }
@@ -97,7 +284,7 @@ int main(int argc, char* argv[]) {
         if (cmd == "q") {
             break;
         } else {
-            run_test(rcli.get(), cmd);
+            run_test(rcli.get(), host_, cmd);
         }
     }
     std::cout << "Bye!" << std::endl;
@@ -27,7 +27,7 @@ public:
 
     int cmdline(int argc, char* argv[]) {
         char cmd_string[1024] = {0};
-        char* cmd_argv[16] = {0};
+        char* cmd_argv[128] = {0};
         int cmd_argc = 0;
         int opt_c = 0;
         int cmd_nums = argc - 1;
@@ -62,7 +62,7 @@ public:
             }
             opt_c++;
 
-            if (cmd_argc > 0 && impl->isval_) {
+            if (cmd_argc > 0 && impl && impl->isval_) {
                  cmd_argc--;
                  impl->handler_(opt_c, cmd_argv[opt_c]);
                  opt_c++;
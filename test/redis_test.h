@@ -4,13 +4,65 @@
 #pragma once
 
 #include "rcli.h"
+#include "rcli_async.h"
+#include "rcli_autopipe.h"
+#include "rcli_cache.h"
+#include "rcli_cluster.h"
+#include "rcli_health.h"
+#include "rcli_loader.h"
+#include "rcli_pipeline.h"
+#include "rcli_pool.h"
+#include "rcli_pubsub.h"
+#include "rcli_scan.h"
+#include "rcli_script.h"
+#include "rcli_stats.h"
+#include "rcli_stream.h"
+#include "rcli_tls.h"
+#include "rcli_transaction.h"
+#include "rcli_window.h"
+#include <atomic>
 #include <chrono>
 #include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <thread>
+#include <vector>
+#ifdef RCLI_WITH_TEST_SERVER
+#    include "resp_server.h"
+#    include <unistd.h>
+#endif
+
+// operator new calls so far, defined in alloc_counter.cpp
+size_t test_alloc_count();
 
 #define T_HASH_KEY "cs_test_hash"
 #define T_ZSET_KEY "cs_test_zset"
 #define T_EXPIRE_KEY "cs_test_expire"
+#define T_PIPE_KEY "cs_test_pipe"
+#define T_REPLY_KEY "cs_test_reply"
+#define T_ENCODER_KEY "cs_test_encoder"
+#define T_ALLOC_KEY "cs_test_alloc"
+#define T_STATS_KEY "cs_test_stats"
+#define T_HEALTH_KEY "cs_test_health"
+#define T_TIMEOUT_KEY "cs_test_timeout"
+#define T_CACHE_KEY "cs_test_cache"
+#define T_SCAN_KEY "cs_test_scan"
+#define T_SCRIPT_KEY "cs_test_script"
+#define T_RESP3_KEY "cs_test_resp3"
+#define T_TX_KEY "cs_test_tx"
+#define T_SOCKET_KEY "cs_test_socket"
+#define T_TLS_KEY "cs_test_tls"
+#define T_POOL_KEY "cs_test_pool"
+#define T_ASYNC_KEY "cs_test_async"
+#define T_CLUSTER_KEY "cs_test_cluster"
+#define T_PUBSUB_KEY "cs_test_pubsub"
+#define T_STREAM_KEY "cs_test_stream"
+#define T_AUTO_KEY "cs_test_auto"
+#define T_MULTI_KEY "cs_test_multi"
+#define T_LOAD_KEY "cs_test_load"
+#define T_WINDOW_KEY "cs_test_window"
 
 static void test_exist(RedisClient* rcli, const char* key) {
     if (rcli->exist(key)) {
@@ -171,4 +223,1809 @@ static void test_expire_key(RedisClient* rcli) {
     } else {
         fprintf(stdout, "[exist    ] %s, ret = false\n", key);
     }
-}
\ No newline at end of file
+}
+static void test_pipeline(RedisClient* rcli) {
+    const char key[] = T_PIPE_KEY;
+    fprintf(stdout, "================[%s]================\n", key);
+
+    RedisPipeline pipe = rcli->pipeline();
+    pipe.del(key);
+    std::vector<int64_t> hset_out(10);
+    for (int i = 0; i < 10; i++) {
+        pipe.hset(key, "field" + std::to_string(i), std::to_string(i), hset_out[i]);
+    }
+    std::string val;
+    size_t idx_hget = pipe.hget(key, "field5", val);
+    std::vector<std::string> field_vec;
+    size_t idx_hkeys = pipe.hkeys(key, field_vec);
+    size_t idx_nil = pipe.hget(key, "nofield", val);
+
+    if (pipe.exec() == RCLI_RET_OK) {
+        fprintf(stdout, "[exec   ] %zu commands\n", pipe.size());
+    } else {
+        fprintf(stderr, "[exec   ] error: %s\n", rcli->get_last_error().c_str());
+    }
+    if (pipe.status(idx_hget) == RCLI_RET_OK) {
+        fprintf(stdout, "[hget   ] field5 : %s\n", val.c_str());
+    } else {
+        fprintf(stderr, "[hget   ] error: %s\n", pipe.error(idx_hget).c_str());
+    }
+    if (pipe.status(idx_hkeys) == RCLI_RET_OK) {
+        fprintf(stdout, "[hkeys  ] count: %zu\n", field_vec.size());
+    } else {
+        fprintf(stderr, "[hkeys  ] error: %s\n", pipe.error(idx_hkeys).c_str());
+    }
+    if (pipe.status(idx_nil) == RCLI_RET_NIL) {
+        fprintf(stdout, "[hget   ] nofield : nil\n");
+    } else {
+        fprintf(stderr, "[hget   ] nofield, status = %d\n", pipe.status(idx_nil));
+    }
+
+    pipe.clear();
+    pipe.del(key);
+    if (pipe.exec() != RCLI_RET_OK) {
+        fprintf(stderr, "[del    ] error: %s\n", rcli->get_last_error().c_str());
+    }
+}
+
+static void test_reply(RedisClient* rcli) {
+    const char key[] = T_REPLY_KEY;
+    fprintf(stdout, "================[%s]================\n", key);
+
+    rcli->del(key);
+    std::vector<RedisClient::score_member_t> members;
+    for (int i = 0; i < 1000; i++) {
+        members.emplace_back(i, "member" + std::to_string(i));
+    }
+    int64_t count = 0;
+    if (!rcli->zadd(key, members, count)) {
+        fprintf(stderr, "[zadd   ] error: %s\n", rcli->get_last_error().c_str());
+        return;
+    }
+
+    RedisFlatReply flat;
+    if (rcli->zrange(key, 0, -1, flat, true) && flat.size() == 2000) {
+        fprintf(stdout, "[zrange ] flat count: %zu, last: %s %s\n", flat.size(), flat[1998].to_string().c_str(),
+                flat[1999].to_string().c_str());
+    } else {
+        fprintf(stderr, "[zrange ] flat error: %s, count: %zu\n", rcli->get_last_error().c_str(), flat.size());
+    }
+
+    std::vector<std::string> vec;
+    if (rcli->zrange(key, 0, -1, vec) && vec.size() == 1000 && RedisStringView(vec[10]) == flat[20]) {
+        fprintf(stdout, "[zrange ] vector count: %zu\n", vec.size());
+    } else {
+        fprintf(stderr, "[zrange ] vector error: %s, count: %zu\n", rcli->get_last_error().c_str(), vec.size());
+    }
+
+    std::string str_key = key + std::string("_str");
+    rcli->set(str_key, "value");
+    flat.clear();
+    int err = rcli->commandv_for_visitor(flat, {"MGET", key + std::string("_nokey"), str_key});
+    rcli->del(str_key);
+    if (err == RCLI_RET_OK && flat.size() == 2 && flat[0].empty() && flat[1] == "value") {
+        fprintf(stdout, "[mget   ] nil element kept\n");
+    } else {
+        fprintf(stderr, "[mget   ] status = %d, count: %zu\n", err, flat.size());
+    }
+
+    flat.clear();
+    err = rcli->command_for_visitor(flat, "NOSUCHCMD %s", key);
+    if (err == RCLI_RET_ERROR) {
+        fprintf(stdout, "[error  ] %s\n", rcli->get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[error  ] status = %d\n", err);
+    }
+
+    // an array asked for as a double, directly and in a pipeline
+    double score = 0;
+    err = rcli->commanda_for_double(score, "ZRANGE", key, 0, 1);
+    RedisPipeline pipe = rcli->pipeline();
+    size_t slot = pipe.appenda_for_double(score, "ZRANGE", key, 0, 1);
+    if (err == RCLI_RET_UNKNOWN && pipe.exec() == RCLI_RET_OK && pipe.status(slot) == RCLI_RET_UNKNOWN) {
+        fprintf(stdout, "[double ] array: %s\n", rcli->get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[double ] array status = %d, pipeline %d\n", err, pipe.status(slot));
+    }
+
+    rcli->del(key);
+}
+
+static void test_encoder(RedisClient* rcli) {
+    const char key[] = T_ENCODER_KEY;
+    fprintf(stdout, "================[%s]================\n", key);
+
+    std::string buf;
+    RedisCommandEncoder(buf).command("HINCRBY", "k", std::string("f\0g", 3), -12);
+    if (buf == std::string("*4\r\n$7\r\nHINCRBY\r\n$1\r\nk\r\n$3\r\nf\0g\r\n$3\r\n-12\r\n", 42)) {
+        fprintf(stdout, "[encode ] %zu bytes\n", buf.size());
+    } else {
+        fprintf(stderr, "[encode ] unexpected: %s\n", buf.c_str());
+    }
+
+    // binary value survives the round trip
+    std::string in("a\0b\r\nc", 6);
+    std::string out;
+    if (rcli->set(key, in) && rcli->get(key, out) && out == in) {
+        fprintf(stdout, "[set    ] binary value, %zu bytes\n", out.size());
+    } else {
+        fprintf(stderr, "[set    ] binary value, got %zu bytes: %s\n", out.size(), rcli->get_last_error().c_str());
+    }
+    rcli->del(key);
+
+    // scores keep full precision
+    int64_t count = 0;
+    double score = 0;
+    RedisClient::score_member_t member(0.1 + 0.2, "member");
+    if (rcli->zadd(key, member, count) && rcli->zscore(key, "member", score) && score == member.first) {
+        fprintf(stdout, "[zscore ] %.17g\n", score);
+    } else {
+        fprintf(stderr, "[zscore ] %.17g, expect %.17g\n", score, member.first);
+    }
+    RedisClient::incre_member_t incre(1.5, "member");
+    if (rcli->zincrby(key, incre, score) && score == member.first + incre.first) {
+        fprintf(stdout, "[zincrby] %.17g\n", score);
+    } else {
+        fprintf(stderr, "[zincrby] %.17g, expect %.17g: %s\n", score, member.first + incre.first,
+                rcli->get_last_error().c_str());
+    }
+    rcli->del(key);
+}
+
+static void test_alloc(RedisClient* rcli) {
+    const std::string key(T_ALLOC_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    std::string field("field");
+    std::string value(256, 'v');
+    std::string out;
+    int64_t ret = 0;
+    // warm up the scratch buffers and out
+    rcli->hset(key, field, value, ret);
+    rcli->hget(key, field, out);
+    rcli->commandv_for_integer(ret, {"HSET", key, field, value});
+
+    size_t before = test_alloc_count();
+    for (int i = 0; i < 1000; i++) {
+        rcli->hset(key, field, value, ret);
+        rcli->hget(key, field, out);
+        rcli->commandv_for_string(out, {"HGET", key, field});
+    }
+    size_t allocs = test_alloc_count() - before;
+    if (allocs == 0 && out == value) {
+        fprintf(stdout, "[hset   ] 3000 commands, 0 allocations\n");
+    } else {
+        fprintf(stderr, "[hset   ] 3000 commands, %zu allocations\n", allocs);
+    }
+    rcli->del(key);
+}
+
+static void test_stats(RedisClient* rcli) {
+    const std::string key(T_STATS_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisStats stats;
+    rcli->set_stats(&stats);
+    std::string out;
+    int64_t ret = 0;
+    for (int i = 0; i < 100; i++) {
+        rcli->hset(key, "field", std::to_string(i), ret);
+        rcli->hget(key, "field", out);
+    }
+    rcli->commanda_for_status("NOSUCHCMD", key);
+    RedisPipeline pipe = rcli->pipeline();
+    for (int i = 0; i < 10; i++) {
+        pipe.hget(key, "field", out);
+    }
+    pipe.exec();
+    rcli->del(key);
+    rcli->set_stats(nullptr);
+
+    std::vector<RedisStats::command_stats_t> snapshot;
+    stats.snapshot(snapshot);
+    for (auto& cmd : snapshot) {
+        fprintf(stdout, "[stats  ] %-9s calls %llu, errors %llu, sent %lluB, recv %lluB, p50 %lluus, p99 %lluus\n",
+                cmd.command.c_str(), (unsigned long long) cmd.calls, (unsigned long long) cmd.errors,
+                (unsigned long long) cmd.bytes_sent, (unsigned long long) cmd.bytes_received,
+                (unsigned long long) cmd.percentile(50), (unsigned long long) cmd.percentile(99));
+    }
+    if (snapshot.size() != 5 || snapshot[1].command != "HGET" || snapshot[1].calls != 100
+        || snapshot[3].command != "NOSUCHCMD" || snapshot[3].errors != 1) {
+        fprintf(stderr, "[stats  ] unexpected snapshot of %zu commands\n", snapshot.size());
+    }
+
+    stats.reset();
+    stats.snapshot(snapshot);
+    uint64_t calls = 0;
+    for (auto& cmd : snapshot) {
+        calls += cmd.calls;
+    }
+    if (calls == 0) {
+        fprintf(stdout, "[reset  ] 0 calls\n");
+    } else {
+        fprintf(stderr, "[reset  ] %llu calls left\n", (unsigned long long) calls);
+    }
+}
+
+static void test_scan(RedisClient* rcli) {
+    const std::string key(T_SCAN_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    const std::string hkey = key + ":hash";
+    const std::string zkey = key + ":zset";
+    const std::string skey = key + ":set";
+    rcli->del(hkey);
+    rcli->del(zkey);
+    rcli->del(skey);
+    RedisPipeline pipe = rcli->pipeline();
+    std::vector<int64_t> outs(1000 * 3);
+    for (int i = 0; i < 1000; i++) {
+        std::string id = std::to_string(i);
+        pipe.hset(hkey, "field" + id, id, outs[i * 3]);
+        pipe.zadd(zkey, RedisClient::score_member_t(i, "member" + id), outs[i * 3 + 1]);
+        pipe.appenda_for_integer(outs[i * 3 + 2], "SADD", skey, "member" + id);
+    }
+    if (pipe.exec() != RCLI_RET_OK) {
+        fprintf(stderr, "[pipe   ] error: %s\n", rcli->get_last_error().c_str());
+        return;
+    }
+
+    // every field once, even with another command between two batches
+    std::set<std::string> fields;
+    std::vector<std::string> batch;
+    size_t batches = 0;
+    RedisScanner hscan = rcli->hscan(hkey);
+    hscan.count(100);
+    while (hscan.next(batch)) {
+        for (size_t i = 0; i + 1 < batch.size(); i += 2) {
+            fields.insert(batch[i]);
+        }
+        if (++batches == 2) {
+            std::string val;
+            rcli->hget(hkey, "field1", val);
+        }
+    }
+    if (hscan.status() == RCLI_RET_OK && fields.size() == 1000) {
+        fprintf(stdout, "[hscan  ] %zu fields in %zu batches\n", fields.size(), batches);
+    } else {
+        fprintf(stderr, "[hscan  ] error: %s, %zu fields\n", rcli->get_last_error().c_str(), fields.size());
+    }
+
+    // field1, field10 to field19 and field100 to field199
+    size_t matched = 0;
+    RedisScanner mscan = rcli->hscan(hkey);
+    mscan.match("field1*").count(50);
+    while (mscan.next(batch)) {
+        matched += batch.size() / 2;
+    }
+    if (mscan.status() == RCLI_RET_OK && matched == 111) {
+        fprintf(stdout, "[hscan  ] match field1*: %zu\n", matched);
+    } else {
+        fprintf(stderr, "[hscan  ] match field1*: %zu, expect 111\n", matched);
+    }
+
+    size_t members = 0;
+    RedisScanner zscan = rcli->zscan(zkey);
+    zscan.prefetch(false);
+    while (zscan.next(batch)) {
+        members += batch.size() / 2;
+    }
+    if (zscan.status() == RCLI_RET_OK && members == 1000) {
+        fprintf(stdout, "[zscan  ] %zu members\n", members);
+    } else {
+        fprintf(stderr, "[zscan  ] error: %s, %zu members\n", rcli->get_last_error().c_str(), members);
+    }
+
+    // COUNT grows while batches come back within the budget
+    members = 0;
+    RedisFlatReply flat;
+    RedisScanner sscan = rcli->sscan(skey);
+    sscan.budget_us(1000000, 10, 400);
+    while (sscan.next(flat)) {
+        members = flat.size();
+    }
+    if (sscan.status() == RCLI_RET_OK && members == 1000 && sscan.get_count() > 10) {
+        fprintf(stdout, "[sscan  ] %zu members, count %u\n", members, sscan.get_count());
+    } else {
+        fprintf(stderr, "[sscan  ] error: %s, %zu members, count %u\n", rcli->get_last_error().c_str(), members,
+                sscan.get_count());
+    }
+
+    std::vector<std::string> keys;
+    RedisScanner scan = rcli->scan();
+    scan.match(key + ":*").type("zset").count(1000);
+    while (scan.next(batch)) {
+        keys.insert(keys.end(), batch.begin(), batch.end());
+    }
+    if (scan.status() == RCLI_RET_OK && keys.size() == 1 && keys[0] == zkey) {
+        fprintf(stdout, "[scan   ] type zset: %s\n", keys[0].c_str());
+    } else {
+        fprintf(stderr, "[scan   ] error: %s, %zu keys\n", rcli->get_last_error().c_str(), keys.size());
+    }
+
+    rcli->del(hkey);
+    rcli->del(zkey);
+    rcli->del(skey);
+}
+
+static void test_multikey(RedisClient* rcli) {
+    const std::string key(T_MULTI_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    // 250 keys in chunks of 100, every other one written, one of them empty
+    std::vector<std::string> keys;
+    std::vector<RedisClient::key_value_t> kvs;
+    for (int i = 0; i < 250; i++) {
+        keys.push_back(key + ":" + std::to_string(i));
+        if (i % 2 == 0) {
+            kvs.emplace_back(keys.back(), i == 0 ? std::string() : std::to_string(i));
+        }
+    }
+    int64_t removed = 0;
+    rcli->del(keys, removed);
+    if (!rcli->mset(kvs)) {
+        fprintf(stderr, "[mset   ] error: %s\n", rcli->get_last_error().c_str());
+    }
+
+    std::vector<std::string> vals;
+    std::vector<bool> found;
+    int bad = 0;
+    if (rcli->mget(keys, vals, found, 100)) {
+        for (int i = 0; i < 250; i++) {
+            bool expect = i % 2 == 0;
+            std::string val = expect && i > 0 ? std::to_string(i) : std::string();
+            bad += found[i] != expect || vals[i] != val ? 1 : 0;
+        }
+    }
+    if (vals.size() == keys.size() && bad == 0) {
+        fprintf(stdout, "[mget   ] %zu keys aligned, %s found empty\n", vals.size(), keys[0].c_str());
+    } else {
+        fprintf(stderr, "[mget   ] %d misplaced of %zu: %s\n", bad, vals.size(), rcli->get_last_error().c_str());
+    }
+
+    std::vector<bool> exists;
+    size_t count = 0;
+    if (rcli->exist(keys, exists)) {
+        for (size_t i = 0; i < exists.size(); i++) {
+            count += exists[i] && i % 2 == 0 ? 1 : 0;
+        }
+    }
+    if (count != kvs.size()) {
+        fprintf(stderr, "[exists ] expect %zu, %zu: %s\n", kvs.size(), count, rcli->get_last_error().c_str());
+    }
+
+    // a chunk refused by the server does not stop the others
+    rcli->hset(key + ":hash", "f", "v", removed);
+    std::vector<std::string> mixed{keys[2], key + ":hash", keys[4]};
+    if (!rcli->mget(mixed, vals, found, 1) && found[0] && found[2]) {
+        fprintf(stderr, "[mget   ] expect a wrong type to read nil: %s\n", rcli->get_last_error().c_str());
+    }
+
+    keys.push_back(key + ":hash");
+    if (rcli->del(keys, removed, 64) && removed == (int64_t) kvs.size() + 1) {
+        fprintf(stdout, "[del    ] %lld removed\n", removed);
+    } else {
+        fprintf(stderr, "[del    ] expect %zu removed, %lld: %s\n", kvs.size() + 1, removed,
+                rcli->get_last_error().c_str());
+    }
+}
+
+static void test_script(RedisClient* rcli) {
+    const std::string key(T_SCRIPT_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisScriptRegistry scripts;
+    const RedisScript* zadd_ttl = scripts.add("redis.call('ZADD', KEYS[1], ARGV[1], ARGV[2])\n"
+                                              "return redis.call('EXPIRE', KEYS[1], ARGV[3])");
+    if (scripts.add(zadd_ttl->source()) != zadd_ttl || RedisScript::sha1_hex("return 1")
+                                                         != "e0e1f9fabfc9d4800c877a703b823ac0578ff8db") {
+        fprintf(stderr, "[sha1   ] error: %s\n", zadd_ttl->sha1().c_str());
+    }
+
+    // loaded together with the connection
+    rcli->set_scripts(&scripts);
+    rcli->reconnect();
+    std::vector<std::string> exists;
+    rcli->commanda_for_vector(exists, "SCRIPT", "EXISTS", zadd_ttl->sha1());
+    if (exists.size() == 1 && exists[0] == "1") {
+        fprintf(stdout, "[load   ] %s\n", zadd_ttl->sha1().c_str());
+    } else {
+        fprintf(stderr, "[load   ] error: %s\n", rcli->get_last_error().c_str());
+    }
+
+    rcli->del(key);
+    int64_t out = 0;
+    int64_t ttl = 0;
+    std::string member("member\0one", 10);
+    if (rcli->eval_for_integer(out, *zadd_ttl, {key}, {"1.5", member, "60"}) == RCLI_RET_OK && out == 1
+        && rcli->commanda_for_integer(ttl, "TTL", key) == RCLI_RET_OK && ttl > 0) {
+        fprintf(stdout, "[evalsha] zadd + expire: %lld, ttl %lld\n", out, ttl);
+    } else {
+        fprintf(stderr, "[evalsha] error: %s\n", rcli->get_last_error().c_str());
+    }
+    std::vector<std::string> members;
+    rcli->zrange(key, 0, -1, members);
+    if (members.size() != 1 || members[0] != member) {
+        fprintf(stderr, "[evalsha] binary member lost, %zu members\n", members.size());
+    }
+
+    // flushed scripts and ones added after connecting are sent once with EVAL
+    rcli->commanda_for_status("SCRIPT", "FLUSH");
+    const RedisScript* get_key = scripts.add("return redis.call('GET', KEYS[1])");
+    rcli->set(key + ":str", "val");
+    std::string val;
+    if (rcli->eval_for_integer(out, *zadd_ttl, {key}, {"2.5", "m2", "60"}) == RCLI_RET_OK
+        && rcli->eval_for_string(val, *get_key, {key + ":str"}) == RCLI_RET_OK && val == "val") {
+        fprintf(stdout, "[noscript] reloaded, get: %s\n", val.c_str());
+    } else {
+        fprintf(stderr, "[noscript] error: %s\n", rcli->get_last_error().c_str());
+    }
+    exists.clear();
+    rcli->commanda_for_vector(exists, "SCRIPT", "EXISTS", zadd_ttl->sha1(), get_key->sha1());
+    if (exists.size() != 2 || exists[0] != "1" || exists[1] != "1") {
+        fprintf(stderr, "[noscript] scripts not cached by EVAL\n");
+    }
+
+    const RedisScript* bad = scripts.add("return redis.call('HGET', KEYS[1], 'field')");
+    if (rcli->eval_for_string(val, *bad, {key}) == RCLI_RET_ERROR) {
+        fprintf(stdout, "[error  ] %s\n", rcli->get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[error  ] expect an error from a script against a zset\n");
+    }
+
+    rcli->del(key);
+    rcli->del(key + ":str");
+    rcli->set_scripts(nullptr);
+}
+
+static void test_transaction(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_TX_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisClient cli;
+    cli.init(host, port, pwd);
+    RedisClient other;
+    other.init(host, port, pwd);
+    if (!cli.connect() || !other.connect()) {
+        fprintf(stderr, "[tx     ] connect error: %s\n", cli.get_last_error().c_str());
+        return;
+    }
+    cli.del(key);
+
+    RedisTransaction tx = cli.transaction();
+    int64_t field = 0;
+    std::string val;
+    tx.hincrby(key, "f1", 5, field);
+    tx.hget(key, "f1", val);
+    tx.expire(key, 60);
+    if (tx.exec() == RCLI_RET_OK && tx.status(0) == RCLI_RET_OK && field == 5 && val == "5"
+        && tx.status(2) == RCLI_RET_OK) {
+        fprintf(stdout, "[multi  ] hincrby %lld, hget %s\n", field, val.c_str());
+    } else {
+        fprintf(stderr, "[multi  ] error: %s\n", cli.get_last_error().c_str());
+    }
+
+    // refused while queueing, nothing runs
+    tx.hincrby(key, "f1", 1, field);
+    tx.appenda_for_status("NOSUCHCOMMAND", key);
+    if (tx.exec() == RCLI_RET_ERROR && tx.status(1) == RCLI_RET_ERROR) {
+        fprintf(stdout, "[abort  ] %s\n", tx.error(1).c_str());
+    } else {
+        fprintf(stderr, "[abort  ] expect EXECABORT: %s\n", cli.get_last_error().c_str());
+    }
+    cli.hget(key, "f1", val);
+    if (val != "5") {
+        fprintf(stderr, "[abort  ] discarded transaction ran, f1 %s\n", val.c_str());
+    }
+
+    // another client writes the watched key between the read and EXEC once
+    int64_t balance = 0;
+    int err = tx.watch({key + ":balance"}, [&](RedisTransaction& tx) {
+        std::string cur;
+        cli.get(key + ":balance", cur);
+        balance = cur.empty() ? 100 : atoll(cur.c_str());
+        if (tx.tries() == 1) {
+            other.set(key + ":balance", "50");
+        }
+        tx.set(key + ":balance", std::to_string(balance - 10));
+        return true;
+    });
+    std::string left;
+    cli.get(key + ":balance", left);
+    if (err == RCLI_RET_OK && tx.tries() == 2 && left == "40") {
+        fprintf(stdout, "[watch  ] committed after %d tries, balance %s\n", tx.tries(), left.c_str());
+    } else {
+        fprintf(stderr, "[watch  ] error %d after %d tries, balance %s: %s\n", err, tx.tries(), left.c_str(),
+                cli.get_last_error().c_str());
+    }
+
+    // conflicts every time, gives up after max_tries
+    err = tx.watch({key + ":balance"}, [&](RedisTransaction& tx) {
+        other.set(key + ":balance", "0");
+        tx.set(key + ":balance", "1");
+        return true;
+    }, 3);
+    if (err == RCLI_RET_NIL && tx.tries() == 3) {
+        fprintf(stdout, "[watch  ] conflict %d times: %s\n", tx.tries(), cli.get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[watch  ] expect RCLI_RET_NIL after 3 tries, %d after %d\n", err, tx.tries());
+    }
+
+    // the body gives up, UNWATCH leaves the connection usable
+    err = tx.watch({key + ":balance"}, [&](RedisTransaction& tx) { return false; });
+    if (err == RCLI_RET_FAIL && cli.set(key + ":balance", "7")) {
+        fprintf(stdout, "[watch  ] body gave up\n");
+    } else {
+        fprintf(stderr, "[watch  ] expect RCLI_RET_FAIL, %d: %s\n", err, cli.get_last_error().c_str());
+    }
+
+    cli.del(key);
+    cli.del(key + ":balance");
+}
+
+static void test_health(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_HEALTH_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisHealthMonitor monitor;
+    monitor.init(host, port, pwd, 100, 500);
+    if (!monitor.start()) {
+        fprintf(stderr, "[health ] start error: %s\n", monitor.get_last_error().c_str());
+        return;
+    }
+    RedisClient cli;
+    cli.init(host, port, pwd);
+    cli.set_health(&monitor);
+    std::string out;
+    if (cli.connect() && cli.set(key, "up") && cli.get(key, out) && cli.del(key)) {
+        RedisHealthMonitor::health_stats_t stats = monitor.stats();
+        fprintf(stdout, "[health ] up, get = %s, probes: %llu, rtt: %lluus\n", out.c_str(),
+                (unsigned long long) stats.probes, (unsigned long long) stats.last_rtt_us);
+    } else {
+        fprintf(stderr, "[health ] error: %s\n", cli.get_last_error().c_str());
+    }
+
+    // nothing listens on port 1, every command must fail without touching the network
+    RedisHealthMonitor down;
+    down.init("127.0.0.1", 1, pwd, 100, 200);
+    if (down.start()) {
+        fprintf(stderr, "[health ] 127.0.0.1:1 is up\n");
+        return;
+    }
+    RedisClient dcli;
+    dcli.init("127.0.0.1", 1, pwd);
+    dcli.set_health(&down);
+    dcli.connect();
+    auto start = std::chrono::steady_clock::now();
+    int failed = 0;
+    for (int i = 0; i < 1000; i++) {
+        failed += dcli.get(key, out) ? 0 : 1;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stdout, "[health ] down, %d of 1000 failed in %lldms: %s\n", failed, (long long) ms,
+            dcli.get_last_error().c_str());
+}
+
+#ifdef RCLI_WITH_TEST_SERVER
+static void test_timeout(RespServer* server, const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_TIMEOUT_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisClient::options_t opts;
+    opts.command_timeout_ms = 50;
+    RedisClient cli;
+    cli.init(host, port, pwd, opts);
+    if (!cli.connect() || !cli.set(key, "value")) {
+        fprintf(stderr, "[timeout] error: %s\n", cli.get_last_error().c_str());
+        return;
+    }
+
+    std::string out;
+    auto elapsed_ms = [](std::chrono::steady_clock::time_point start) {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return (long long) std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    };
+    server->set_latency_us(200 * 1000);
+    auto start = std::chrono::steady_clock::now();
+    bool ok = cli.get(key, out);
+    if (!ok && cli.get_last_status() == RCLI_TIMEOUT) {
+        fprintf(stdout, "[get    ] command timeout 50ms, failed after %lldms: %s\n", elapsed_ms(start),
+                cli.get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[get    ] expect RCLI_TIMEOUT, got %d\n", cli.get_last_status());
+    }
+
+    server->set_latency_us(20 * 1000);
+    start = std::chrono::steady_clock::now();
+    {
+        RedisDeadline deadline(&cli, 5);
+        ok = cli.get(key, out);
+    }
+    if (!ok && cli.get_last_status() == RCLI_TIMEOUT) {
+        fprintf(stdout, "[get    ] deadline 5ms, failed after %lldms: %s\n", elapsed_ms(start),
+                cli.get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[get    ] expect RCLI_TIMEOUT, got %d\n", cli.get_last_status());
+    }
+
+    {
+        RedisDeadline deadline(&cli, 200);
+        ok = cli.get(key, out);
+    }
+    if (ok && out == "value") {
+        fprintf(stdout, "[get    ] deadline 200ms, %s = %s\n", key.c_str(), out.c_str());
+    } else {
+        fprintf(stderr, "[get    ] error: %s\n", cli.get_last_error().c_str());
+    }
+
+    // the async client fails what is in flight and reconnects for the next command
+    AsyncRedisClient acli;
+    acli.init(host, port, pwd, opts);
+    if (!acli.connect()) {
+        fprintf(stderr, "[async  ] connect error: %s\n", acli.get_last_error().c_str());
+    } else {
+        server->set_latency_us(200 * 1000);
+        start = std::chrono::steady_clock::now();
+        auto slow = acli.get(key).get();
+        long long slow_ms = elapsed_ms(start);
+        server->set_latency_us(0);
+        auto fast = acli.get(key).get();
+        if (slow.err == RCLI_TIMEOUT && fast.err == RCLI_RET_OK && fast.value == "value") {
+            fprintf(stdout, "[async  ] command timeout 50ms, failed after %lldms: %s\n", slow_ms, slow.error.c_str());
+        } else {
+            fprintf(stderr, "[async  ] expect RCLI_TIMEOUT then a reply, got %d and %d\n", slow.err, fast.err);
+        }
+    }
+    server->set_latency_us(0);
+    cli.del(key);
+
+    // a batch cut off after the server ran part of it is not sent again, that
+    // part would run twice
+    RedisClient plain;
+    plain.init(host, port, pwd);
+    if (!plain.connect()) {
+        fprintf(stderr, "[timeout] error: %s\n", plain.get_last_error().c_str());
+        return;
+    }
+    const size_t count = 400000;
+    std::vector<int64_t> outs(count);
+    RedisPipeline pipe = plain.pipeline();
+    for (size_t i = 0; i < count; i++) {
+        pipe.hincrby(key, "n", 1, outs[i]);
+    }
+    server->set_fault(RESP_FAULT_CLOSE, (uint32_t) server->commands() + 1000);
+    int err = pipe.exec();
+    server->set_fault(RESP_FAULT_NONE, 0);
+    if (err == RCLI_ERROR && pipe.status(count - 1) == RCLI_ERROR && plain.hget(key, "n", out) && out == "999") {
+        fprintf(stdout, "[pipe   ] closed after 999 commands, not resent: %s\n", pipe.error(0).c_str());
+    } else {
+        fprintf(stderr, "[pipe   ] expect 999 increments and RCLI_ERROR, got %d and %s\n", err, out.c_str());
+    }
+    plain.del(key);
+}
+
+// a server of its own listening on both TCP and a unix socket
+static void test_socket() {
+    const std::string key(T_SOCKET_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    const std::string path = "/tmp/rcli_test_" + std::to_string(getpid()) + ".sock";
+    RespServer server;
+    if (!server.listen_tcp("127.0.0.1", 0) || !server.listen_unix(path) || !server.start()) {
+        fprintf(stderr, "[socket ] server error: %s\n", server.get_last_error().c_str());
+        return;
+    }
+
+    RedisClient::options_t unix_opts;
+    unix_opts.unix_path = path;
+    unix_opts.sndbuf = 256 * 1024;
+    RedisClient::options_t tcp_opts;
+    tcp_opts.source_addr = "127.0.0.1";
+    tcp_opts.tcp_nodelay = false;
+    tcp_opts.keepalive_interval_s = 5;
+    tcp_opts.sndbuf = 128 * 1024;
+    tcp_opts.rcvbuf = 128 * 1024;
+    const char* names[] = {"unix", "tcp"};
+    const RedisClient::options_t* opts[] = {&unix_opts, &tcp_opts};
+    for (int i = 0; i < 2; i++) {
+        RedisClient cli;
+        cli.init("127.0.0.1", server.port(), "", *opts[i]);
+        std::string out;
+        if (cli.connect() && cli.set(key, names[i]) && cli.reconnect() && cli.get(key, out) && out == names[i]) {
+            fprintf(stdout, "[socket ] %s: %s\n", names[i], out.c_str());
+        } else {
+            fprintf(stderr, "[socket ] %s error: %s\n", names[i], cli.get_last_error().c_str());
+        }
+    }
+
+    // the monitor and the cache connect like the clients do, nothing listens on port 1
+    RedisHealthMonitor monitor;
+    monitor.init("127.0.0.1", 1, "", unix_opts, 100, 1000);
+    RedisNearCache cache;
+    cache.init("127.0.0.1", 1, "", RedisNearCache::cache_options_t(), unix_opts);
+    if (monitor.start() && cache.start()) {
+        fprintf(stdout, "[socket ] monitor and cache: unix\n");
+    } else {
+        fprintf(stderr, "[socket ] monitor and cache error: %s %s\n", monitor.get_last_error().c_str(),
+                cache.get_last_error().c_str());
+    }
+    monitor.stop();
+    cache.stop();
+
+    // TEST-NET-1 is never a local address
+    RedisClient bad;
+    tcp_opts.source_addr = "192.0.2.1";
+    bad.init("127.0.0.1", server.port(), "", tcp_opts);
+    if (!bad.connect()) {
+        fprintf(stdout, "[socket ] bind 192.0.2.1: %s\n", bad.get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[socket ] expect bind error for a foreign source address\n");
+    }
+    RedisClusterClient bad_cluster;
+    bad_cluster.init({"127.0.0.1:" + std::to_string(server.port())}, "", tcp_opts);
+    if (!bad_cluster.connect()) {
+        fprintf(stdout, "[socket ] cluster bind 192.0.2.1: %s\n", bad_cluster.get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[socket ] expect bind error for the cluster topology\n");
+    }
+    server.stop();
+    unlink(path.c_str());
+}
+
+#    ifdef RCLI_WITH_SSL
+// a TLS server of its own that requires client certificates
+static void test_tls() {
+    const std::string key(T_TLS_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    const std::string cert = "/tmp/rcli_test_" + std::to_string(getpid()) + ".crt";
+    const std::string pkey = "/tmp/rcli_test_" + std::to_string(getpid()) + ".key";
+    RespServer server;
+    if (!server.listen_tls("127.0.0.1", 0, true) || !server.write_tls_cert(cert, pkey) || !server.start()) {
+        fprintf(stderr, "[tls    ] server error: %s\n", server.get_last_error().c_str());
+        return;
+    }
+
+    RedisTlsContext tls;
+    RedisTlsContext::tls_options_t tls_opts;
+    tls_opts.ca_file = cert;
+    tls_opts.cert_file = cert;
+    tls_opts.key_file = pkey;
+    tls_opts.server_name = "localhost";
+    if (!tls.init(tls_opts)) {
+        fprintf(stderr, "[tls    ] init error: %s\n", tls.get_last_error().c_str());
+        return;
+    }
+    RedisClient::options_t opts;
+    opts.tls = &tls;
+    RedisClient cli;
+    cli.init("127.0.0.1", server.tls_port(), "", opts);
+    std::string out;
+    if (cli.connect() && cli.set(key, "secret") && cli.get(key, out) && out == "secret") {
+        fprintf(stdout, "[tls    ] get: %s\n", out.c_str());
+    } else {
+        fprintf(stderr, "[tls    ] error: %s\n", cli.get_last_error().c_str());
+    }
+
+    // reconnects and new pool connections resume the session
+    bool ok = true;
+    for (int i = 0; i < 3; i++) {
+        ok = ok && cli.reconnect() && cli.ping();
+    }
+    RedisClientPool pool;
+    pool.init("127.0.0.1", server.tls_port(), "", 2, 2);
+    pool.set_options(opts);
+    ok = ok && pool.connect() && pool.acquire()->get(key, out);
+    if (ok && tls.handshakes() == 6 && tls.resumed() == 5) {
+        fprintf(stdout, "[resume ] %llu handshakes, %llu resumed\n", (unsigned long long) tls.handshakes(),
+                (unsigned long long) tls.resumed());
+    } else {
+        fprintf(stderr, "[resume ] %llu handshakes, %llu resumed: %s\n", (unsigned long long) tls.handshakes(),
+                (unsigned long long) tls.resumed(), cli.get_last_error().c_str());
+    }
+    uint64_t resumed = tls.resumed();
+    tls.clear_sessions();
+    if (!cli.reconnect() || tls.resumed() != resumed) {
+        fprintf(stderr, "[resume ] expect a full handshake after clear_sessions()\n");
+    }
+
+    // the monitor, the cache and the cluster handshake like the clients do
+    RedisHealthMonitor monitor;
+    monitor.init("127.0.0.1", server.tls_port(), "", opts, 100, 1000);
+    RedisNearCache cache;
+    cache.init("127.0.0.1", server.tls_port(), "", RedisNearCache::cache_options_t(), opts);
+    const std::string addr = "127.0.0.1:" + std::to_string(server.tls_port());
+    server.assign_slots(0, RCLI_CLUSTER_SLOTS - 1, addr);
+    RedisClusterClient cluster;
+    cluster.init({addr}, "", opts);
+    if (monitor.start() && cache.start() && cluster.connect() && cluster.get(key, out) && out == "secret") {
+        fprintf(stdout, "[tls    ] monitor, cache and cluster: %s\n", out.c_str());
+    } else {
+        fprintf(stderr, "[tls    ] monitor, cache and cluster error: %s %s %s\n", monitor.get_last_error().c_str(),
+                cache.get_last_error().c_str(), cluster.get_last_error().c_str());
+    }
+    cluster.close();
+    cache.stop();
+    monitor.stop();
+
+    // the certificate is for localhost, and the server wants one from the client
+    RedisTlsContext wrong_name;
+    tls_opts.server_name = "redis.example.com";
+    wrong_name.init(tls_opts);
+    RedisTlsContext no_cert;
+    tls_opts.server_name.clear();
+    tls_opts.cert_file.clear();
+    tls_opts.key_file.clear();
+    no_cert.init(tls_opts);
+    RedisTlsContext* bad[] = {&wrong_name, &no_cert};
+    for (auto* ctx : bad) {
+        opts.tls = ctx;
+        RedisClient bad_cli;
+        bad_cli.init("127.0.0.1", server.tls_port(), "", opts);
+        // TLS 1.3 clients learn of a refused certificate with the first reply
+        if (!bad_cli.connect() || !bad_cli.ping()) {
+            fprintf(stdout, "[refuse ] %s\n", bad_cli.get_last_error().c_str());
+        } else {
+            fprintf(stderr, "[refuse ] expect a TLS error\n");
+        }
+    }
+    cli.del(key);
+    server.stop();
+    unlink(cert.c_str());
+    unlink(pkey.c_str());
+}
+#    endif
+#endif
+
+static void test_cache(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_CACHE_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisNearCache::cache_options_t opts;
+    opts.max_entries = 64;
+    RedisNearCache cache;
+    cache.init(host, port, pwd, opts);
+    if (!cache.start()) {
+        fprintf(stderr, "[cache  ] start error: %s\n", cache.get_last_error().c_str());
+        return;
+    }
+    RedisClient cli;
+    cli.init(host, port, pwd);
+    cli.set_cache(&cache);
+    // writes from another connection reach the cache only through invalidations
+    RedisClient writer;
+    writer.init(host, port, pwd);
+    if (!cli.connect() || !writer.connect() || !writer.set(key, "v1")) {
+        fprintf(stderr, "[cache  ] connect error: %s %s\n", cli.get_last_error().c_str(),
+                writer.get_last_error().c_str());
+        return;
+    }
+
+    std::string out;
+    for (int i = 0; i < 100; i++) {
+        cli.get(key, out);
+    }
+    RedisNearCache::cache_stats_t stats = cache.stats();
+    fprintf(stdout, "[get    ] %s = %s, hits: %llu, misses: %llu\n", key.c_str(), out.c_str(),
+            (unsigned long long) stats.hits, (unsigned long long) stats.misses);
+
+    writer.set(key, "v2");
+    auto start = std::chrono::steady_clock::now();
+    while (cache.stats().invalidations == stats.invalidations
+           && std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (cli.get(key, out) && out == "v2") {
+        fprintf(stdout, "[invalid] %s = %s after a write from another client\n", key.c_str(), out.c_str());
+    } else {
+        fprintf(stderr, "[invalid] expect v2, got %s: %s\n", out.c_str(), cli.get_last_error().c_str());
+    }
+
+    // own writes are dropped locally, without waiting for the push
+    cli.set(key, "v3");
+    if (cli.get(key, out) && out == "v3") {
+        fprintf(stdout, "[set    ] %s = %s\n", key.c_str(), out.c_str());
+    } else {
+        fprintf(stderr, "[set    ] expect v3, got %s\n", out.c_str());
+    }
+    if (cli.del(key) && !cli.get(key, out) && !cli.get(key, out) && cli.get_last_status() == RCLI_RET_NIL) {
+        fprintf(stdout, "[del    ] %s is nil\n", key.c_str());
+    } else {
+        fprintf(stderr, "[del    ] expect nil, got %d\n", cli.get_last_status());
+    }
+
+    // a reconnect loses the tracking, what was read before is no longer served
+    writer.set(key, "v4");
+    cli.get(key, out);
+    cli.get(key, out);
+    bool reconnected = cli.reconnect();
+    writer.set(key, "v5");
+    // no invalidation comes, the server forgot what the old connection read
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    uint64_t hits = cache.stats().hits;
+    if (reconnected && cli.get(key, out) && out == "v5" && cache.stats().hits == hits) {
+        fprintf(stdout, "[reconn ] %s = %s after a reconnect\n", key.c_str(), out.c_str());
+    } else {
+        fprintf(stderr, "[reconn ] expect v5, got %s: %s\n", out.c_str(), cli.get_last_error().c_str());
+    }
+    // a failed read leaves nothing behind
+    int64_t added = 0;
+    writer.hset(key + ":hash", "f", "v", added);
+    size_t entries = cache.stats().entries;
+    if (!cli.get(key + ":hash", out) && cli.get_last_status() == RCLI_RET_ERROR && cache.stats().entries == entries) {
+        fprintf(stdout, "[error  ] GET of a hash not cached: %s\n", cli.get_last_error().c_str());
+    } else {
+        fprintf(stderr, "[error  ] expect WRONGTYPE, got %d\n", cli.get_last_status());
+    }
+    writer.del(key + ":hash");
+
+    for (int i = 0; i < 200; i++) {
+        cli.get(key + std::to_string(i), out);
+    }
+    stats = cache.stats();
+    fprintf(stdout, "[stats  ] hits: %llu, misses: %llu, invalidations: %llu, evictions: %llu, entries: %zu\n",
+            (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+            (unsigned long long) stats.invalidations, (unsigned long long) stats.evictions, stats.entries);
+}
+
+// waits up to 2 s for done()
+template <class Fn>
+static bool wait_for(Fn done) {
+    auto start = std::chrono::steady_clock::now();
+    while (!done()) {
+        if (std::chrono::steady_clock::now() - start > std::chrono::seconds(2)) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void test_pubsub(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_PUBSUB_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    const std::string ch_a = key + ".a";
+    const std::string ch_b = key + ".b";
+    const std::string shard = key + ".shard";
+    std::mutex mutex;
+    std::map<std::string, std::vector<int64_t>> seen;  // payloads per channel, in arrival order
+    std::atomic<int> patterns(0);
+
+    RedisSubscriber::subscriber_options_t opts;
+    opts.threads = 2;
+    opts.queue_size = 64;
+    opts.interval_ms = 100;
+    RedisSubscriber sub;
+    sub.init(host, port, pwd, opts);
+    sub.set_handler([&](const RedisSubscriber::message_t& msg) {
+        if (msg.kind == RedisSubscriber::PMESSAGE) {
+            patterns++;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        seen[msg.channel.to_string()].push_back(atoll(msg.payload.to_string().c_str()));
+    });
+    sub.subscribe({ch_a, ch_b});
+    sub.psubscribe({key + ".p*"});
+    sub.ssubscribe({shard});
+    RedisClient cli;
+    cli.init(host, port, pwd);
+    if (!sub.start() || !cli.connect() || !wait_for([&] { return sub.stats().subscriptions == 4; })) {
+        fprintf(stderr, "[pubsub ] start error: %s %s\n", sub.get_last_error().c_str(), cli.get_last_error().c_str());
+        return;
+    }
+
+    // more than the queues hold, the reader waits for the handlers
+    const int n = 1000;
+    RedisPipeline pipe = cli.pipeline();
+    std::vector<int64_t> receivers(2 * n + 2);
+    for (int i = 0; i < n; i++) {
+        pipe.appenda_for_integer(receivers[2 * i], "PUBLISH", ch_a, i);
+        pipe.appenda_for_integer(receivers[2 * i + 1], "PUBLISH", ch_b, i);
+    }
+    pipe.appenda_for_integer(receivers[2 * n], "PUBLISH", key + ".pattern", "p");
+    pipe.appenda_for_integer(receivers[2 * n + 1], "SPUBLISH", shard, 0);
+    pipe.exec();
+    bool ordered = wait_for([&] { return sub.stats().handled == 2 * n + 2; });
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& kv : seen) {
+            for (size_t i = 0; i < kv.second.size(); i++) {
+                ordered = ordered && kv.second[i] == (int64_t) i;
+            }
+        }
+        ordered = ordered && seen[ch_a].size() == (size_t) n && seen[ch_b].size() == (size_t) n;
+        ordered = ordered && seen[shard].size() == 1;
+    }
+    RedisSubscriber::subscriber_stats_t stats = sub.stats();
+    if (ordered && patterns == 1 && receivers[0] == 1) {
+        fprintf(stdout, "[message] %llu handled in order, %llu stalls\n", (unsigned long long) stats.handled,
+                (unsigned long long) stats.stalls);
+    } else {
+        fprintf(stderr, "[message] expect %d in order, handled %llu, patterns %d\n", 2 * n + 2,
+                (unsigned long long) stats.handled, patterns.load());
+    }
+
+    // the subscriber reconnects and subscribes again
+    int64_t killed = 0;
+    cli.commanda_for_integer(killed, "CLIENT", "KILL", "TYPE", "pubsub");
+    int64_t count = 0;
+    if (killed == 1 && wait_for([&] { return sub.stats().reconnects == 1 && sub.stats().subscriptions == 4; })
+        && cli.commanda_for_integer(count, "PUBLISH", ch_a, n) == RCLI_RET_OK && count == 1
+        && wait_for([&] { return sub.stats().handled == stats.handled + 1; })) {
+        fprintf(stdout, "[resub  ] %lld receiver after %llu reconnect\n", (long long) count,
+                (unsigned long long) sub.stats().reconnects);
+    } else {
+        fprintf(stderr, "[resub  ] killed %lld, receivers %lld: %s\n", (long long) killed, (long long) count,
+                sub.get_last_error().c_str());
+    }
+
+    sub.unsubscribe({ch_b});
+    if (wait_for([&] { return sub.stats().subscriptions == 3; })
+        && cli.commanda_for_integer(count, "PUBLISH", ch_b, 0) == RCLI_RET_OK && count == 0) {
+        fprintf(stdout, "[unsub  ] %s: %lld receivers\n", ch_b.c_str(), (long long) count);
+    } else {
+        fprintf(stderr, "[unsub  ] expect no receiver on %s, got %lld\n", ch_b.c_str(), (long long) count);
+    }
+    sub.stop();
+
+    // RESP3 delivers the same messages as pushes
+    opts.conn.protocol = 3;
+    RedisSubscriber sub3;
+    sub3.init(host, port, pwd, opts);
+    std::string payload;
+    sub3.set_handler([&](const RedisSubscriber::message_t& msg) {
+        std::lock_guard<std::mutex> lock(mutex);
+        payload = msg.payload.to_string();
+    });
+    sub3.subscribe({ch_a});
+    if (sub3.start() && wait_for([&] { return sub3.stats().subscriptions == 1; })
+        && cli.commanda_for_integer(count, "PUBLISH", ch_a, "resp3") == RCLI_RET_OK
+        && wait_for([&] { return sub3.stats().handled == 1; })) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (payload == "resp3") {
+            fprintf(stdout, "[resp3  ] %s: %s\n", ch_a.c_str(), payload.c_str());
+        } else {
+            fprintf(stderr, "[resp3  ] expect resp3, got %s\n", payload.c_str());
+        }
+    } else {
+        fprintf(stderr, "[resp3  ] expect a message: %s\n", sub3.get_last_error().c_str());
+    }
+    sub3.stop();
+
+    // handlers slower than the PING timeout keep the reader waiting, the connection must survive it
+    opts.conn.protocol = 2;
+    opts.threads = 1;
+    opts.queue_size = 4;
+    opts.interval_ms = 10;
+    opts.timeout_ms = 30;
+    RedisSubscriber slow;
+    slow.init(host, port, pwd, opts);
+    slow.set_handler([](const RedisSubscriber::message_t&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    });
+    slow.subscribe({ch_a});
+    const int m = 200;
+    std::vector<int64_t> slow_receivers(m);
+    if (slow.start() && wait_for([&] { return slow.stats().subscriptions == 1; })) {
+        // more than one socket read, a PING sent between reads is answered behind the rest
+        const std::string body(1024, 'x');
+        RedisPipeline slow_pipe = cli.pipeline();
+        for (int i = 0; i < m; i++) {
+            slow_pipe.appenda_for_integer(slow_receivers[i], "PUBLISH", ch_a, body);
+        }
+        slow_pipe.exec();
+    }
+    bool handled = wait_for([&] { return slow.stats().handled == (uint64_t) m; });
+    stats = slow.stats();
+    if (handled && stats.reconnects == 0 && stats.stalls > 0) {
+        fprintf(stdout, "[slow   ] %llu handled, %llu stalls, no reconnect\n", (unsigned long long) stats.handled,
+                (unsigned long long) stats.stalls);
+    } else {
+        fprintf(stderr, "[slow   ] expect %d handled without reconnect, handled %llu, reconnects %llu: %s\n", m,
+                (unsigned long long) stats.handled, (unsigned long long) stats.reconnects,
+                slow.get_last_error().c_str());
+    }
+    slow.stop();
+}
+
+static void test_streams(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_STREAM_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisClient cli;
+    cli.init(host, port, pwd);
+    RedisClient other;
+    other.init(host, port, pwd);
+    if (!cli.connect() || !other.connect()) {
+        fprintf(stderr, "[stream ] connect error: %s\n", cli.get_last_error().c_str());
+        return;
+    }
+    cli.del(key);
+    cli.del(key + ":2");
+
+    // trimmed to the 5 newest exactly
+    std::string id;
+    for (int i = 0; i < 10; i++) {
+        cli.xadd(key, {{"n", std::to_string(i)}, {"pad", "x"}}, id, 5, false);
+    }
+    int64_t len = 0;
+    if (cli.xlen(key, len) && len == 5) {
+        fprintf(stdout, "[xadd   ] maxlen 5, last %s\n", id.c_str());
+    } else {
+        fprintf(stderr, "[xadd   ] expect 5 entries, %lld: %s\n", len, cli.get_last_error().c_str());
+    }
+
+    RedisStreamConsumer a(&cli, "cs_group", "a");
+    a.count(3);
+    if (a.create_group(key, "0") != RCLI_RET_OK || a.create_group(key, "0") != RCLI_RET_OK) {
+        fprintf(stderr, "[group  ] create error: %s\n", cli.get_last_error().c_str());
+    }
+    RedisStreamBatch batch;
+    int err = a.read({key}, batch);
+    if (err == RCLI_RET_OK && batch.size() == 3 && batch.stream(0) == key && batch.fields(0) == 2
+        && batch.field(0, 0) == "n" && batch.value(0, 0) == "5" && batch.value(2, 1) == "x") {
+        fprintf(stdout, "[read   ] %zu entries, first %s\n", batch.size(), batch.id(0).to_string().c_str());
+    } else {
+        fprintf(stderr, "[read   ] expect n 5..7, %d %zu: %s\n", err, batch.size(), cli.get_last_error().c_str());
+    }
+
+    // queued, then sent in front of the next read
+    a.ack(batch, 0);
+    a.ack(batch, 1);
+    size_t queued = a.pending_acks();
+    err = a.read({key}, batch);
+    if (err == RCLI_RET_OK && queued == 2 && a.acked() == 2 && a.pending_acks() == 0 && batch.size() == 2
+        && batch.value(1, 0) == "9") {
+        fprintf(stdout, "[ack    ] %llu acked with the next read\n", (unsigned long long) a.acked());
+    } else {
+        fprintf(stderr, "[ack    ] expect 2 acked, %llu queued %zu: %s\n", (unsigned long long) a.acked(), queued,
+                cli.get_last_error().c_str());
+    }
+    a.ack(batch, 0);
+    a.ack(batch, 1);
+    if (a.flush_acks() != RCLI_RET_OK || a.acked() != 4) {
+        fprintf(stderr, "[ack    ] flush error: %s\n", cli.get_last_error().c_str());
+    }
+
+    // nothing new within BLOCK, then woken by an XADD of another client
+    auto start = std::chrono::steady_clock::now();
+    err = a.block_ms(100).read({key}, batch);
+    int64_t waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start)
+                       .count();
+    if (err != RCLI_RET_NIL || waited < 90) {
+        fprintf(stderr, "[block  ] expect nil after 100 ms, %d after %lld ms\n", err, waited);
+    }
+    std::thread writer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::string added;
+        other.xadd(key, {{"n", "10"}}, added);
+    });
+    err = a.block_ms(2000).read({key}, batch);
+    writer.join();
+    if (err == RCLI_RET_OK && batch.size() == 1 && batch.value(0, 0) == "10") {
+        fprintf(stdout, "[block  ] timed out after %lld ms, woken by xadd\n", waited);
+        a.ack(batch, 0);
+        a.flush_acks();
+    } else {
+        fprintf(stderr, "[block  ] expect n 10, %d %zu: %s\n", err, batch.size(), cli.get_last_error().c_str());
+    }
+    a.block_ms(0);
+
+    // n 7 is still pending for a but trimmed away, n 11 is pending and idle
+    cli.xadd(key, {{"n", "11"}}, id, 1, false);
+    a.read({key}, batch);
+    RedisStreamConsumer b(&cli, "cs_group", "b");
+    err = b.autoclaim(key, 0, batch);
+    if (err == RCLI_RET_OK && batch.size() == 1 && batch.value(0, 0) == "11" && batch.stream(0) == key
+        && batch.deleted().size() == 1 && batch.cursor() == "0-0") {
+        fprintf(stdout, "[claim  ] %s claimed, %s deleted\n", batch.id(0).to_string().c_str(),
+                batch.deleted()[0].c_str());
+        b.ack(batch, 0);
+        b.flush_acks();
+    } else {
+        fprintf(stderr, "[claim  ] expect n 11 and one deleted, %d %zu %zu: %s\n", err, batch.size(),
+                batch.deleted().size(), cli.get_last_error().c_str());
+    }
+    RedisFlatReply pending;
+    if (cli.commanda_for_visitor(pending, "XPENDING", key, "cs_group") != RCLI_RET_OK || pending.empty()
+        || pending[0] != "0") {
+        fprintf(stderr, "[claim  ] expect nothing pending: %s\n", cli.get_last_error().c_str());
+    }
+
+    // RESP3 replies a map of key to entries
+    RedisClient::options_t opts;
+    opts.protocol = 3;
+    RedisClient cli3;
+    cli3.init(host, port, pwd, opts);
+    cli3.connect();
+    RedisStreamConsumer c(&cli3, "cs_group", "c");
+    c.create_group(key + ":2", "0");
+    cli.xadd(key, {{"n", "12"}}, id);
+    cli.xadd(key + ":2", {{"m", "0"}}, id);
+    err = c.read({key, key + ":2"}, batch);
+    if (err == RCLI_RET_OK && batch.size() == 2 && batch.stream(0) == key && batch.value(0, 0) == "12"
+        && batch.stream(1) == key + ":2" && batch.field(1, 0) == "m") {
+        fprintf(stdout, "[resp%d  ] 2 streams in one read\n", cli3.get_protocol());
+    } else {
+        fprintf(stderr, "[resp3  ] expect 2 entries, %d %zu: %s\n", err, batch.size(), cli3.get_last_error().c_str());
+    }
+
+    cli.del(key);
+    cli.del(key + ":2");
+}
+
+static void test_autopipe(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_AUTO_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    // the flusher waits for the other callers, batches fill up to the thread count
+    RedisAutoPipeline shared;
+    RedisAutoPipeline::auto_options_t opts;
+    opts.window_us = 2000;
+    opts.max_batch = 8;
+    shared.init(host, port, pwd, opts);
+    if (!shared.connect()) {
+        fprintf(stderr, "[auto   ] connect error: %s\n", shared.get_last_error().c_str());
+        return;
+    }
+
+    const int threads = 8;
+    const int calls = 200;
+    std::atomic<int> errors(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::string own = key + ":" + std::to_string(t);
+            std::string val;
+            for (int i = 0; i < calls; i++) {
+                // every caller gets its own reply back
+                std::string in = std::to_string(t * calls + i);
+                if (!shared.set(own, in) || !shared.get(own, val) || val != in) {
+                    errors++;
+                }
+                if (i % 50 == 0 && (shared.commanda_for_status("NOSUCHCOMMAND", own) != RCLI_RET_ERROR
+                                    || shared.get_last_error().empty())) {
+                    errors++;
+                }
+            }
+            shared.del(own);
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    RedisAutoPipeline::auto_stats_t st = shared.stats();
+    if (errors == 0 && st.commands >= (uint64_t) threads * calls * 2 && st.max_batch > 1 && st.max_batch <= 8) {
+        fprintf(stdout, "[auto   ] %llu commands in %llu batches, avg %.1f max %llu\n",
+                (unsigned long long) st.commands, (unsigned long long) st.batches, st.avg_batch(),
+                (unsigned long long) st.max_batch);
+    } else {
+        fprintf(stderr, "[auto   ] %d errors, %llu commands in %llu batches max %llu\n", errors.load(),
+                (unsigned long long) st.commands, (unsigned long long) st.batches,
+                (unsigned long long) st.max_batch);
+    }
+
+    // a missing key is nil for its caller only
+    std::string val;
+    if (shared.get(key + ":missing", val) || shared.get_last_status() != RCLI_RET_NIL) {
+        fprintf(stderr, "[auto   ] expect nil, %d\n", shared.get_last_status());
+    }
+}
+
+static void test_loader(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_LOAD_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisClient cli;
+    cli.init(host, port, pwd);
+    if (!cli.connect()) {
+        fprintf(stderr, "[load   ] connect error: %s\n", cli.get_last_error().c_str());
+        return;
+    }
+
+    // small windows and chunks over three connections, one command refused
+    const int count = 5000;
+    std::string tsv("# generated\n");
+    std::vector<std::string> keys;
+    for (int i = 0; i < count; i++) {
+        keys.push_back(key + ":" + std::to_string(i));
+        if (i == 1234) {
+            tsv.append("NOSUCHCOMMAND\t" + keys.back() + "\n");
+        } else if (i == 0) {
+            tsv.append("SET\t" + keys.back() + "\ta\\tb\\\\n\r\n");
+        } else {
+            tsv.append("SET\t" + keys.back() + "\t" + std::to_string(i) + (i + 1 < count ? "\n" : ""));
+        }
+    }
+    RedisBulkLoader loader;
+    RedisBulkLoader::loader_options_t opts;
+    opts.connections = 3;
+    opts.window = 64;
+    opts.max_obuf = 8192;
+    opts.chunk_bytes = 4096;
+    loader.init(host, port, pwd, opts);
+    std::vector<uint64_t> refused;
+    loader.set_error_callback([&](uint64_t index, const std::string& error) { refused.push_back(index); });
+
+    RedisBulkLoader::loader_stats_t st;
+    std::istringstream in(tsv);
+    int err = loader.load(in, RedisBulkLoader::FORMAT_AUTO, st);
+    std::vector<std::string> vals;
+    std::vector<bool> found;
+    cli.mget(keys, vals, found);
+    if (err == RCLI_RET_ERROR && st.commands == count && st.replies == count && st.errors == 1 && refused.size() == 1
+        && refused[0] == 1234 && vals.size() == count && vals[0] == "a\tb\\n" && vals[count - 1] == "4999"
+        && !found[1234]) {
+        fprintf(stdout, "[load   ] tsv %llu commands, %.0f/s, %s\n", (unsigned long long) st.commands, st.qps(),
+                st.first_error.c_str());
+    } else {
+        fprintf(stderr, "[load   ] tsv %d, %llu commands %llu replies %llu errors: %s\n", err,
+                (unsigned long long) st.commands, (unsigned long long) st.replies, (unsigned long long) st.errors,
+                loader.get_last_error().c_str());
+    }
+
+    // the same keys deleted from RESP
+    std::string resp;
+    RedisCommandEncoder enc(resp);
+    for (auto& k : keys) {
+        enc.command("DEL", k);
+    }
+    in.clear();
+    in.str(resp);
+    err = loader.load(in, RedisBulkLoader::FORMAT_RESP, st);
+    int64_t removed = 0;
+    cli.del(keys, removed);
+    if (err != RCLI_RET_OK || st.replies != count || st.bytes != resp.size() || removed != 0) {
+        fprintf(stderr, "[load   ] resp %d, %llu replies, %lld left: %s\n", err, (unsigned long long) st.replies,
+                removed, loader.get_last_error().c_str());
+    }
+
+    // malformed and truncated input stop the load
+    const char* bad[] = {"*2\r\n$3\r\nGET\r\n$x\r\n", "*1\r\n$4\r\nPI"};
+    for (auto b : bad) {
+        in.clear();
+        in.str(b);
+        err = loader.load(in, RedisBulkLoader::FORMAT_AUTO, st);
+        if (err != RCLI_ERROR || loader.get_last_error().empty()) {
+            fprintf(stderr, "[load   ] expect an input error, %d\n", err);
+        } else {
+            fprintf(stdout, "[load   ] %s\n", loader.get_last_error().c_str());
+        }
+    }
+}
+
+// top level strings and nils of the replies, in order
+class WindowValues : public RedisReplyVisitor {
+public:
+    void on_string(int depth, const char* str, size_t len) override {
+        if (depth == 0) {
+            values.emplace_back(str, len);
+        }
+    }
+    void on_nil(int depth) override { values.emplace_back("(nil)"); }
+
+    std::vector<std::string> values;
+};
+
+static void test_window(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_WINDOW_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisClient cli;
+    cli.init(host, port, pwd);
+    if (!cli.connect()) {
+        fprintf(stderr, "[window ] connect error: %s\n", cli.get_last_error().c_str());
+        return;
+    }
+
+    // a window far smaller than the batch, add() waits for room
+    const int count = 2000;
+    std::vector<std::string> keys;
+    {
+        RedisWindowPipeline::window_options_t opts;
+        opts.max_in_flight = 16;
+        opts.max_obuf = 1024;
+        RedisWindowPipeline window(&cli, opts);
+        uint64_t next = 0;
+        bool ordered = true;
+        size_t most = 0;
+        window.on_reply([&](uint64_t seq, int status, const std::string& error) {
+            ordered = ordered && seq == next++ && status == RCLI_RET_OK;
+        });
+        int err = RCLI_RET_OK;
+        for (int i = 0; i < count && err == RCLI_RET_OK; i++) {
+            keys.push_back(key + ":" + std::to_string(i));
+            err = window.add("SET", keys.back(), std::to_string(i));
+            most = std::max(most, window.in_flight());
+        }
+        if (err == RCLI_RET_OK) {
+            err = window.drain();
+        }
+        const RedisWindowPipeline::window_stats_t& st = window.stats();
+        if (err == RCLI_RET_OK && ordered && next == count && st.replies == count && most <= 16 && st.stalls > 0) {
+            fprintf(stdout, "[window ] %llu sets, %llu stalls, %zu in flight at most\n",
+                    (unsigned long long) st.replies, (unsigned long long) st.stalls, st.max_in_flight);
+        } else {
+            fprintf(stderr, "[window ] set %d, %llu replies, %zu in flight: %s\n", err,
+                    (unsigned long long) st.replies, most, window.get_last_error().c_str());
+        }
+    }
+
+    // try_add() leaves the waiting to the caller, values larger than a read
+    // arrive split over several
+    std::string big(40000, 'w');
+    cli.set(keys[7], big);
+    {
+        WindowValues visitor;
+        std::vector<int> statuses;
+        std::string error;
+        RedisWindowPipeline::window_options_t opts;
+        opts.max_in_flight = 8;
+        RedisWindowPipeline window(&cli, opts);
+        window.on_reply(
+            [&](uint64_t seq, int status, const std::string& err) {
+                statuses.push_back(status);
+                if (status == RCLI_RET_ERROR) {
+                    error = err;
+                }
+            },
+            &visitor);
+        int err = RCLI_RET_OK;
+        int refused = 0;
+        for (int i = 0; i < 100 && err == RCLI_RET_OK;) {
+            err = window.try_add("GET", keys[i]);
+            if (err == RCLI_RET_FAIL) {
+                refused++;
+                err = window.pump(100);
+            } else {
+                i++;
+            }
+        }
+        window.add("GET", key + ":nosuchkey");
+        window.add("HGET", keys[0], "field");
+        err = window.drain();
+        bool same = visitor.values.size() == 101 && visitor.values[7] == big && visitor.values[99] == "99"
+                    && visitor.values[100] == "(nil)";
+        if (err == RCLI_RET_OK && same && statuses.size() == 102 && statuses[100] == RCLI_RET_NIL
+            && statuses[101] == RCLI_RET_ERROR && error.find("WRONGTYPE") == 0 && refused > 0) {
+            fprintf(stdout, "[window ] try_add refused %d times, %s\n", refused, error.c_str());
+        } else {
+            fprintf(stderr, "[window ] get %d, %zu values %zu replies: %s\n", err, visitor.values.size(),
+                    statuses.size(), window.get_last_error().c_str());
+        }
+    }
+
+    // blocking again once the window is gone
+    int64_t removed = 0;
+    if (!cli.del(keys, removed) || removed != count) {
+        fprintf(stderr, "[window ] del after the window %lld: %s\n", removed, cli.get_last_error().c_str());
+    }
+}
+
+static void test_resp3(const std::string& host, uint32_t port, const std::string& pwd) {
+    const std::string key(T_RESP3_KEY);
+    fprintf(stdout, "================[%s]================\n", key.c_str());
+
+    RedisClient::options_t opts;
+    opts.protocol = 3;
+    RedisClient cli;
+    cli.init(host, port, pwd, opts);
+    if (!cli.connect()) {
+        fprintf(stderr, "[hello  ] error: %s\n", cli.get_last_error().c_str());
+        return;
+    }
+    fprintf(stdout, "[hello  ] protocol: %d\n", cli.get_protocol());
+
+    int64_t count = 0;
+    cli.del(key);
+    cli.hset(key, "f1", "v1", count);
+    cli.hset(key, "f2", "v2", count);
+    std::unordered_map<std::string, std::string> map;
+    if (cli.hgetall(key, map) && map.size() == 2 && map["f1"] == "v1" && map["f2"] == "v2") {
+        fprintf(stdout, "[hgetall] %zu fields\n", map.size());
+    } else {
+        fprintf(stderr, "[hgetall] error: %s, %zu fields\n", cli.get_last_error().c_str(), map.size());
+    }
+    std::string out;
+    if (!cli.hget(key, "nofield", out) && cli.get_last_status() == RCLI_RET_NIL) {
+        fprintf(stdout, "[hget   ] nofield is nil\n");
+    } else {
+        fprintf(stderr, "[hget   ] expect nil, got %d\n", cli.get_last_status());
+    }
+    cli.del(key);
+
+    double score = 0;
+    cli.zadd(key, RedisClient::score_member_t(1.5, "m1"), count);
+    cli.zadd(key, RedisClient::score_member_t(0.1 + 0.2, "m2"), count);
+    if (cli.zscore(key, "m2", score) && score == 0.1 + 0.2) {
+        fprintf(stdout, "[zscore ] %.17g\n", score);
+    } else {
+        fprintf(stderr, "[zscore ] error: %s, %.17g\n", cli.get_last_error().c_str(), score);
+    }
+    std::vector<std::string> vec;
+    if (cli.zrange(key, 0, -1, vec, true) && vec.size() == 4 && vec[2] == "m1" && vec[3] == "1.5") {
+        fprintf(stdout, "[zrange ] withscores: %s %s %s %s\n", vec[0].c_str(), vec[1].c_str(), vec[2].c_str(),
+                vec[3].c_str());
+    } else {
+        fprintf(stderr, "[zrange ] error: %s, count: %zu\n", cli.get_last_error().c_str(), vec.size());
+    }
+    RedisPipeline pipe = cli.pipeline();
+    pipe.zscore(key, "m1", score);
+    pipe.zrange(key, 0, -1, vec);
+    if (pipe.exec() == RCLI_RET_OK && pipe.status(0) == RCLI_RET_OK && score == 1.5) {
+        fprintf(stdout, "[pipe   ] zscore %g\n", score);
+    } else {
+        fprintf(stderr, "[pipe   ] error: %s\n", cli.get_last_error().c_str());
+    }
+    cli.del(key);
+}
+
+static void test_pool(RedisClientPool* pool) {
+    const char key[] = T_POOL_KEY;
+    fprintf(stdout, "================[%s]================\n", key);
+
+    {
+        RedisClientPool::Lease cli = pool->acquire();
+        int64_t out = 0;
+        if (!cli || !cli->hset(key, "count", "0", out)) {
+            fprintf(stderr, "[hset   ] error: %s\n", pool->get_last_error().c_str());
+            return;
+        }
+    }
+
+    const int thread_count = 8;
+    const int loop_count = 100;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([pool, key, loop_count]() {
+            for (int i = 0; i < loop_count; i++) {
+                int64_t out = 0;
+                RedisClientPool::Lease cli = pool->acquire();
+                if (!cli) {
+                    fprintf(stderr, "[acquire] error: %s\n", pool->get_last_error().c_str());
+                } else if (!cli->hincrby(key, "count", 1, out)) {
+                    fprintf(stderr, "[hincrby] error: %s\n", cli->get_last_error().c_str());
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::string count;
+    RedisClientPool::Lease cli = pool->acquire();
+    if (cli && cli->hget(key, "count", count)) {
+        fprintf(stdout, "[hget   ] count : %s, expect %d\n", count.c_str(), thread_count * loop_count);
+    } else {
+        fprintf(stderr, "[hget   ] error: %s\n", pool->get_last_error().c_str());
+    }
+    if (cli) {
+        cli->del(key);
+    }
+    cli.release();
+
+    RedisClientPool::pool_stats_t st = pool->stats();
+    fprintf(stdout, "[stats  ] acquire: %llu, fast: %llu, wait: %llu, timeout: %llu, max_wait: %lluus\n",
+            (unsigned long long) st.acquire_count, (unsigned long long) st.fast_count,
+            (unsigned long long) st.wait_count, (unsigned long long) st.timeout_count,
+            (unsigned long long) st.max_wait_us);
+    fprintf(stdout, "[stats  ] size: %zu, idle: %zu, created: %llu\n", st.size, st.idle,
+            (unsigned long long) st.created_count);
+}
+
+static void test_async(AsyncRedisClient* acli) {
+    const char key[] = T_ASYNC_KEY;
+    fprintf(stdout, "================[%s]================\n", key);
+
+    acli->del(key).wait();
+
+    const int count = 1000;
+    std::atomic<int> done(0);
+    std::atomic<int> failed(0);
+    for (int i = 0; i < count; i++) {
+        acli->hset(key, "field" + std::to_string(i), std::to_string(i),
+                   [&done, &failed](AsyncRedisClient::integer_result_t& r) {
+                       if (r.err != RCLI_RET_OK) {
+                           failed++;
+                       }
+                       done++;
+                   });
+    }
+    fprintf(stdout, "[hset   ] %d queued, in flight: %zu\n", count, acli->pending());
+    while (done.load() < count) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (failed.load() == 0) {
+        fprintf(stdout, "[hset   ] %d done\n", count);
+    } else {
+        fprintf(stderr, "[hset   ] error: %d failed\n", failed.load());
+    }
+
+    auto val = acli->hget(key, "field7").get();
+    if (val.err == RCLI_RET_OK) {
+        fprintf(stdout, "[hget   ] field7 : %s\n", val.value.c_str());
+    } else {
+        fprintf(stderr, "[hget   ] error: %s\n", val.error.c_str());
+    }
+    auto keys = acli->hkeys(key).get();
+    if (keys.err == RCLI_RET_OK) {
+        fprintf(stdout, "[hkeys  ] count: %zu\n", keys.value.size());
+    } else {
+        fprintf(stderr, "[hkeys  ] error: %s\n", keys.error.c_str());
+    }
+
+    // scores go out with every digit
+    const std::string zkey = std::string(key) + ":z";
+    acli->zadd(zkey, std::make_pair(1e-7, std::string("tiny"))).wait();
+    acli->zincrby(zkey, std::make_pair(0.1, std::string("sum"))).wait();
+    auto sum = acli->zincrby(zkey, std::make_pair(0.2, std::string("sum"))).get();
+    auto tiny = acli->zscore(zkey, "tiny").get();
+    if (tiny.err == RCLI_RET_OK && tiny.value == 1e-7 && sum.err == RCLI_RET_OK && sum.value == 0.1 + 0.2) {
+        fprintf(stdout, "[zscore ] tiny : %.17g, sum : %.17g\n", tiny.value, sum.value);
+    } else {
+        fprintf(stderr, "[zscore ] error: %.17g %.17g %s\n", tiny.value, sum.value, tiny.error.c_str());
+    }
+    acli->del(zkey).wait();
+    acli->del(key).wait();
+}
+
+static void test_cluster(RedisClusterClient* cluster) {
+    const char key[] = T_CLUSTER_KEY;
+    fprintf(stdout, "================[%s]================\n", key);
+
+    const int count = 100;
+    int ok = 0;
+    for (int i = 0; i < count; i++) {
+        std::string k = key + std::to_string(i);
+        if (cluster->set(k, std::to_string(i))) {
+            ok++;
+        } else {
+            fprintf(stderr, "[set    ] %s error: %s\n", k.c_str(), cluster->get_last_error().c_str());
+        }
+    }
+    fprintf(stdout, "[set    ] %d/%d\n", ok, count);
+
+    ok = 0;
+    for (int i = 0; i < count; i++) {
+        std::string k = key + std::to_string(i);
+        std::string val;
+        if (cluster->get(k, val) && val == std::to_string(i)) {
+            ok++;
+        } else {
+            fprintf(stderr, "[get    ] %s error: %s\n", k.c_str(), cluster->get_last_error().c_str());
+        }
+        cluster->del(k);
+    }
+    fprintf(stdout, "[get    ] %d/%d\n", ok, count);
+
+    // grouped by slot, results in key order
+    std::vector<std::string> keys;
+    std::vector<RedisClient::key_value_t> kvs;
+    for (int i = 0; i < count; i++) {
+        keys.push_back(key + std::to_string(i));
+        kvs.emplace_back(keys.back(), std::to_string(i));
+    }
+    std::vector<std::string> vals;
+    int64_t removed = 0;
+    ok = 0;
+    if (cluster->mset(kvs, 10) && cluster->mget(keys, vals, 10)) {
+        for (int i = 0; i < count; i++) {
+            ok += vals[i] == std::to_string(i) ? 1 : 0;
+        }
+    }
+    cluster->del(keys, removed);
+    if (ok == count && removed == count) {
+        fprintf(stdout, "[mget   ] %d/%d aligned\n", ok, count);
+    } else {
+        fprintf(stderr, "[mget   ] %d/%d aligned, %lld removed: %s\n", ok, count, removed,
+                cluster->get_last_error().c_str());
+    }
+
+    // keys sharing a hash tag live in the same slot
+    std::string tag_key1 = std::string("{") + key + "}.a";
+    std::string tag_key2 = std::string("{") + key + "}.b";
+    fprintf(stdout, "[slot   ] %s = %u, %s = %u\n", tag_key1.c_str(), RedisClusterClient::key_slot(tag_key1),
+            tag_key2.c_str(), RedisClusterClient::key_slot(tag_key2));
+}
+
+#ifdef RCLI_WITH_TEST_SERVER
+// two servers of its own sharing the slots
+static void test_cluster_nodes() {
+    const std::string key(T_CLUSTER_KEY);
+    RespServer node_a;
+    RespServer node_b;
+    if (!node_a.listen_tcp("127.0.0.1", 0) || !node_b.listen_tcp("127.0.0.1", 0) || !node_a.start()
+        || !node_b.start()) {
+        fprintf(stderr, "[cluster] server error: %s %s\n", node_a.get_last_error().c_str(),
+                node_b.get_last_error().c_str());
+        return;
+    }
+    const std::string addr_a = "127.0.0.1:" + std::to_string(node_a.port());
+    const std::string addr_b = "127.0.0.1:" + std::to_string(node_b.port());
+    for (auto* node : {&node_a, &node_b}) {
+        node->assign_slots(0, RCLI_CLUSTER_SLOTS / 2 - 1, addr_a);
+        node->assign_slots(RCLI_CLUSTER_SLOTS / 2, RCLI_CLUSTER_SLOTS - 1, addr_b);
+    }
+
+    RedisClusterClient cluster;
+    cluster.init({addr_a}, "");
+    if (!cluster.connect()) {
+        fprintf(stderr, "[cluster] connect error: %s\n", cluster.get_last_error().c_str());
+        return;
+    }
+    test_cluster(&cluster);
+
+    const int count = 100;
+    std::vector<std::string> keys;
+    std::vector<RedisClient::key_value_t> kvs;
+    for (int i = 0; i < count; i++) {
+        keys.push_back(key + std::to_string(i));
+        kvs.emplace_back(keys.back(), std::to_string(i));
+    }
+    auto check = [&](const char* name) {
+        std::vector<std::string> vals;
+        std::vector<bool> exists;
+        int64_t removed = 0;
+        int ok = 0;
+        if (cluster.mset(kvs, 10) && cluster.mget(keys, vals, 10) && cluster.exist(keys, exists)) {
+            for (int i = 0; i < count; i++) {
+                ok += vals[i] == std::to_string(i) && exists[i] ? 1 : 0;
+            }
+        }
+        std::string error = cluster.get_last_error();
+        cluster.del(keys, removed);
+        if (ok == count && removed == count) {
+            fprintf(stdout, "[%s] %d/%d aligned\n", name, ok, count);
+        } else {
+            fprintf(stderr, "[%s] %d/%d aligned, %lld removed: %s\n", name, ok, count, removed, error.c_str());
+        }
+    };
+
+    // one pipeline per node, not one round trip per slot
+    node_a.set_latency_us(5000);
+    node_b.set_latency_us(5000);
+    auto start = std::chrono::steady_clock::now();
+    check("latency");
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    node_a.set_latency_us(0);
+    node_b.set_latency_us(0);
+    if (ms < 500) {
+        fprintf(stdout, "[latency] mset, mget, exist and del of %d slots in %lld ms\n", count, (long long) ms);
+    } else {
+        fprintf(stderr, "[latency] %d slots took %lld ms, expect a round trip per node\n", count, (long long) ms);
+    }
+
+    // the client still sends the first half to node a, which answers MOVED
+    for (auto* node : {&node_a, &node_b}) {
+        node->assign_slots(0, RCLI_CLUSTER_SLOTS - 1, addr_b);
+    }
+    check("moved  ");
+
+    // a slot migrating back to node a answers ASK, the chunk follows it alone
+    uint16_t slot = RedisClusterClient::key_slot(keys[0]);
+    node_b.migrate_slot(slot, addr_a);
+    std::string out;
+    if (cluster.mset(kvs) && cluster.get(keys[1], out) && out == "1") {
+        RedisClient plain;
+        plain.init("127.0.0.1", node_a.port(), "");
+        if (plain.connect() && plain.commanda_for_status("ASKING") == RCLI_RET_OK && plain.get(keys[0], out)
+            && out == "0") {
+            fprintf(stdout, "[ask    ] slot %u written to %s\n", slot, addr_a.c_str());
+        } else {
+            fprintf(stderr, "[ask    ] expect %s on %s: %s\n", keys[0].c_str(), addr_a.c_str(),
+                    plain.get_last_error().c_str());
+        }
+    } else {
+        fprintf(stderr, "[ask    ] error: %s\n", cluster.get_last_error().c_str());
+    }
+    check("ask    ");
+    node_b.migrate_slot(slot, "");
+
+    cluster.close();
+    node_a.stop();
+    node_b.stop();
+}
+#endif
@@ -0,0 +1,2836 @@
+#include "resp_server.h"
+#include "rcli_cluster.h"
+#include "rcli_script.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef RCLI_WITH_SSL
+#    include <openssl/err.h>
+#    include <openssl/pem.h>
+#    include <openssl/ssl.h>
+#    include <openssl/x509v3.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#    define MSG_NOSIGNAL 0
+#endif
+
+#define RESP_MAX_BULK (512 * 1024 * 1024)
+
+enum {
+    VALUE_STRING = 1,
+    VALUE_HASH,
+    VALUE_ZSET,
+    VALUE_SET,
+    VALUE_STREAM,
+};
+
+// command_t::flags, keys are argv[1] unless CMD_KEYS_ALL or CMD_KEYS_PAIRS says otherwise
+enum {
+    CMD_READ = 1,
+    CMD_WRITE = 2,
+    CMD_KEYS_ALL = 4,    // every argument after the name
+    CMD_KEYS_PAIRS = 8,  // key value key value ...
+};
+
+struct RespServer::conn {
+    int fd = -1;
+    uint64_t id = 0;
+    bool authed = false;
+    bool resp3 = false;
+    // CLIENT TRACKING
+    bool tracking = false;
+    bool bcast = false;
+    uint64_t redirect = 0;
+    std::vector<std::string> prefixes;
+    bool closing = false;  // close once out is written
+    bool dead = false;     // close now
+    std::string in;
+    size_t in_pos = 0;
+    std::string out;
+    // replies held back by the injected latency, in order
+    std::deque<std::pair<int64_t, std::string>> delayed;
+    bool in_multi = false;
+    bool multi_error = false;
+    std::vector<argv_t> queued;
+    bool asking = false;  // ASKING, for the next command only
+    // WATCH, dirty once one of the keys was written
+    std::set<std::string> watched;
+    bool watch_dirty = false;
+    // SUBSCRIBE, PSUBSCRIBE and SSUBSCRIBE
+    std::set<std::string> channels;
+    std::set<std::string> patterns;
+    std::set<std::string> shard_channels;
+    // XREADGROUP waiting for entries, no other command is read meanwhile
+    argv_t blocked;
+    int64_t blocked_until_us = 0;
+    void* ssl = nullptr;  // SSL of a TLS connection
+
+#ifdef RCLI_WITH_SSL
+    ~conn() {
+        if (ssl) {
+            SSL_free((SSL*) ssl);
+        }
+    }
+#endif
+};
+
+namespace {
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string upper(const std::string& s) {
+    std::string ret(s);
+    for (auto& ch : ret) {
+        ch = (char) toupper((unsigned char) ch);
+    }
+    return ret;
+}
+
+void reply_status(std::string& out, const char* str) {
+    out.push_back('+');
+    out.append(str);
+    out.append("\r\n");
+}
+
+void reply_error(std::string& out, const std::string& str) {
+    out.push_back('-');
+    out.append(str);
+    out.append("\r\n");
+}
+
+void reply_integer(std::string& out, int64_t val) {
+    out.push_back(':');
+    out.append(std::to_string(val));
+    out.append("\r\n");
+}
+
+void reply_bulk(std::string& out, const std::string& str) {
+    out.push_back('$');
+    out.append(std::to_string(str.size()));
+    out.append("\r\n");
+    out.append(str);
+    out.append("\r\n");
+}
+
+void reply_nil(std::string& out, bool resp3) { out.append(resp3 ? "_\r\n" : "$-1\r\n"); }
+
+void reply_array(std::string& out, size_t len) {
+    out.push_back('*');
+    out.append(std::to_string(len));
+    out.append("\r\n");
+}
+
+// a map of len pairs, a flat array of keys and values before RESP3
+void reply_map(std::string& out, size_t len, bool resp3) {
+    out.push_back(resp3 ? '%' : '*');
+    out.append(std::to_string(resp3 ? len : len * 2));
+    out.append("\r\n");
+}
+
+void reply_wrong_type(std::string& out) {
+    reply_error(out, "WRONGTYPE Operation against a key holding the wrong kind of value");
+}
+
+std::string format_double(double val) {
+    if (std::isinf(val)) {
+        return val > 0 ? "inf" : "-inf";
+    }
+    char str[32];
+    snprintf(str, sizeof(str), "%.15g", val);
+    if (strtod(str, nullptr) != val) {
+        snprintf(str, sizeof(str), "%.17g", val);
+    }
+    return str;
+}
+
+void reply_double(std::string& out, double val, bool resp3) {
+    if (resp3) {
+        out.push_back(',');
+        out.append(format_double(val));
+        out.append("\r\n");
+    } else {
+        reply_bulk(out, format_double(val));
+    }
+}
+
+bool parse_integer(const std::string& str, int64_t& val) {
+    if (str.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    long long ret = strtoll(str.c_str(), &end, 10);
+    if (errno || *end != '\0') {
+        return false;
+    }
+    val = ret;
+    return true;
+}
+
+bool parse_double(const std::string& str, double& val) {
+    if (str.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    double ret = strtod(str.c_str(), &end);
+    if (*end != '\0' || std::isnan(ret)) {
+        return false;
+    }
+    val = ret;
+    return true;
+}
+
+// "(1.5" is exclusive, "-inf" and "+inf" are accepted
+bool parse_score_bound(const std::string& str, double& val, bool& exclusive) {
+    exclusive = !str.empty() && str[0] == '(';
+    return parse_double(exclusive ? str.substr(1) : str, val);
+}
+
+void set_nonblock(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK); }
+
+#ifdef RCLI_WITH_SSL
+// recv() and send() results out of an SSL call, EAGAIN while the handshake or a record is incomplete
+ssize_t ssl_result(SSL* ssl, int n) {
+    if (n > 0) {
+        return n;
+    }
+    switch (SSL_get_error(ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE: errno = EAGAIN; return -1;
+        case SSL_ERROR_ZERO_RETURN: return 0;
+        default: ERR_clear_error(); errno = EIO; return -1;
+    }
+}
+#endif
+
+ssize_t recv_conn(int fd, void* ssl, char* buf, size_t len) {
+#ifdef RCLI_WITH_SSL
+    if (ssl) {
+        return ssl_result((SSL*) ssl, SSL_read((SSL*) ssl, buf, (int) len));
+    }
+#endif
+    return recv(fd, buf, len, 0);
+}
+
+ssize_t send_conn(int fd, void* ssl, const char* buf, size_t len) {
+#ifdef RCLI_WITH_SSL
+    if (ssl) {
+        return ssl_result((SSL*) ssl, SSL_write((SSL*) ssl, buf, (int) len));
+    }
+#endif
+    return send(fd, buf, len, MSG_NOSIGNAL);
+}
+
+}  // namespace
+
+RespServer::RespServer()
+  : latency_us_(0), fault_mode_(RESP_FAULT_NONE), fault_every_(0), running_(false), commands_(0), connections_(0) {
+    wake_fds_[0] = wake_fds_[1] = -1;
+    commands_table_ = {
+      {"PING", {&RespServer::cmd_ping, -1}},
+      {"ECHO", {&RespServer::cmd_echo, 2}},
+      {"SELECT", {&RespServer::cmd_ok, 2}},
+      {"CLIENT", {&RespServer::cmd_client, -2}},
+      {"AUTH", {&RespServer::cmd_auth, -2}},
+      {"HELLO", {&RespServer::cmd_hello, -1}},
+      {"QUIT", {&RespServer::cmd_quit, 1}},
+      {"FLUSHALL", {&RespServer::cmd_flushall, -1}},
+      {"FLUSHDB", {&RespServer::cmd_flushall, -1}},
+      {"DBSIZE", {&RespServer::cmd_dbsize, 1}},
+      {"CLUSTER", {&RespServer::cmd_cluster, -2}},
+      {"ASKING", {&RespServer::cmd_asking, 1}},
+      {"GET", {&RespServer::cmd_get, 2, CMD_READ}},
+      {"SET", {&RespServer::cmd_set, -3, CMD_WRITE}},
+      {"MGET", {&RespServer::cmd_mget, -2, CMD_READ | CMD_KEYS_ALL}},
+      {"MSET", {&RespServer::cmd_mset, -3, CMD_WRITE | CMD_KEYS_PAIRS}},
+      {"INCR", {&RespServer::cmd_incrby, 2, CMD_WRITE}},
+      {"INCRBY", {&RespServer::cmd_incrby, 3, CMD_WRITE}},
+      {"DEL", {&RespServer::cmd_del, -2, CMD_WRITE | CMD_KEYS_ALL}},
+      {"UNLINK", {&RespServer::cmd_del, -2, CMD_WRITE | CMD_KEYS_ALL}},
+      {"EXISTS", {&RespServer::cmd_exists, -2, CMD_READ | CMD_KEYS_ALL}},
+      {"EXPIRE", {&RespServer::cmd_expire, 3, CMD_WRITE}},
+      {"PEXPIRE", {&RespServer::cmd_expire, 3, CMD_WRITE}},
+      {"EXPIREAT", {&RespServer::cmd_expire, 3, CMD_WRITE}},
+      {"PEXPIREAT", {&RespServer::cmd_expire, 3, CMD_WRITE}},
+      {"TTL", {&RespServer::cmd_ttl, 2, CMD_READ}},
+      {"PTTL", {&RespServer::cmd_ttl, 2, CMD_READ}},
+      {"HSET", {&RespServer::cmd_hset, -4, CMD_WRITE}},
+      {"HMSET", {&RespServer::cmd_hset, -4, CMD_WRITE}},
+      {"HGET", {&RespServer::cmd_hget, 3, CMD_READ}},
+      {"HEXISTS", {&RespServer::cmd_hexists, 3, CMD_READ}},
+      {"HDEL", {&RespServer::cmd_hdel, -3, CMD_WRITE}},
+      {"HLEN", {&RespServer::cmd_hlen, 2, CMD_READ}},
+      {"HKEYS", {&RespServer::cmd_hkeys, 2, CMD_READ}},
+      {"HGETALL", {&RespServer::cmd_hgetall, 2, CMD_READ}},
+      {"HINCRBY", {&RespServer::cmd_hincrby, 4, CMD_WRITE}},
+      {"ZADD", {&RespServer::cmd_zadd, -4, CMD_WRITE}},
+      {"ZINCRBY", {&RespServer::cmd_zincrby, 4, CMD_WRITE}},
+      {"ZCARD", {&RespServer::cmd_zcard, 2, CMD_READ}},
+      {"ZSCORE", {&RespServer::cmd_zscore, 3, CMD_READ}},
+      {"ZREM", {&RespServer::cmd_zrem, -3, CMD_WRITE}},
+      {"ZRANK", {&RespServer::cmd_zrank, 3, CMD_READ}},
+      {"ZRANGE", {&RespServer::cmd_zrange, -4, CMD_READ}},
+      {"ZRANGEBYSCORE", {&RespServer::cmd_zrangebyscore, -4, CMD_READ}},
+      {"SADD", {&RespServer::cmd_sadd, -3, CMD_WRITE}},
+      {"SREM", {&RespServer::cmd_srem, -3, CMD_WRITE}},
+      {"SCARD", {&RespServer::cmd_scard, 2, CMD_READ}},
+      {"SISMEMBER", {&RespServer::cmd_sismember, 3, CMD_READ}},
+      {"SMEMBERS", {&RespServer::cmd_smembers, 2, CMD_READ}},
+      {"SCAN", {&RespServer::cmd_scan, -2}},
+      {"HSCAN", {&RespServer::cmd_hscan, -3, CMD_READ}},
+      {"SSCAN", {&RespServer::cmd_sscan, -3, CMD_READ}},
+      {"ZSCAN", {&RespServer::cmd_zscan, -3, CMD_READ}},
+      {"EVAL", {&RespServer::cmd_eval, -3}},
+      {"EVALSHA", {&RespServer::cmd_evalsha, -3}},
+      {"SCRIPT", {&RespServer::cmd_script, -2}},
+      {"WATCH", {&RespServer::cmd_watch, -2}},
+      {"UNWATCH", {&RespServer::cmd_unwatch, 1}},
+      {"MULTI", {&RespServer::cmd_multi, 1}},
+      {"EXEC", {&RespServer::cmd_exec, 1}},
+      {"DISCARD", {&RespServer::cmd_discard, 1}},
+      {"XADD", {&RespServer::cmd_xadd, -5, CMD_WRITE}},
+      {"XLEN", {&RespServer::cmd_xlen, 2, CMD_READ}},
+      {"XRANGE", {&RespServer::cmd_xrange, -4, CMD_READ}},
+      {"XGROUP", {&RespServer::cmd_xgroup, -4}},
+      {"XREADGROUP", {&RespServer::cmd_xreadgroup, -7}},
+      {"XACK", {&RespServer::cmd_xack, -4}},
+      {"XPENDING", {&RespServer::cmd_xpending, 3}},
+      {"XAUTOCLAIM", {&RespServer::cmd_xautoclaim, -6}},
+      {"SUBSCRIBE", {&RespServer::cmd_subscribe, -2}},
+      {"PSUBSCRIBE", {&RespServer::cmd_subscribe, -2}},
+      {"SSUBSCRIBE", {&RespServer::cmd_subscribe, -2}},
+      {"UNSUBSCRIBE", {&RespServer::cmd_subscribe, -1}},
+      {"PUNSUBSCRIBE", {&RespServer::cmd_subscribe, -1}},
+      {"SUNSUBSCRIBE", {&RespServer::cmd_subscribe, -1}},
+      {"PUBLISH", {&RespServer::cmd_publish, 3}},
+      {"SPUBLISH", {&RespServer::cmd_publish, 3}},
+    };
+}
+
+RespServer::~RespServer() {
+    stop();
+    for (int fd : listen_fds_) {
+        close(fd);
+    }
+    if (!unix_path_.empty()) {
+        unlink(unix_path_.c_str());
+    }
+#ifdef RCLI_WITH_SSL
+    conns_.clear();
+    SSL_CTX_free((SSL_CTX*) tls_ctx_);
+    EVP_PKEY_free((EVP_PKEY*) tls_key_);
+    X509_free((X509*) tls_cert_);
+#endif
+}
+
+bool RespServer::listen_tcp(const std::string& host, uint32_t port) {
+    if (!open_tcp(host, port, port_)) {
+        return false;
+    }
+    addrs_.insert(host + ":" + std::to_string(port_));
+    return true;
+}
+
+void RespServer::assign_slots(uint16_t start, uint16_t end, const std::string& addr) {
+    std::lock_guard<std::mutex> lock(db_mutex_);
+    slot_owner_.resize(RCLI_CLUSTER_SLOTS);
+    for (uint32_t slot = start; slot <= end && slot < RCLI_CLUSTER_SLOTS; slot++) {
+        slot_owner_[slot] = addr;
+    }
+}
+
+void RespServer::migrate_slot(uint16_t slot, const std::string& addr) {
+    std::lock_guard<std::mutex> lock(db_mutex_);
+    if (addr.empty()) {
+        migrating_.erase(slot);
+    } else {
+        migrating_[slot] = addr;
+    }
+}
+
+bool RespServer::open_tcp(const std::string& host, uint32_t port, uint32_t& bound) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error_str_ = strerror(errno);
+        return false;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t) port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        error_str_ = "invalid address: " + host;
+        close(fd);
+        return false;
+    }
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr*) &addr, len) != 0 || listen(fd, 128) != 0
+        || getsockname(fd, (struct sockaddr*) &addr, &len) != 0) {
+        error_str_ = strerror(errno);
+        close(fd);
+        return false;
+    }
+    set_nonblock(fd);
+    bound = ntohs(addr.sin_port);
+    listen_fds_.push_back(fd);
+    return true;
+}
+
+bool RespServer::listen_unix(const std::string& path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path)) {
+        error_str_ = "unix socket path too long: " + path;
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error_str_ = strerror(errno);
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        error_str_ = strerror(errno);
+        close(fd);
+        return false;
+    }
+    set_nonblock(fd);
+    unix_path_ = path;
+    listen_fds_.push_back(fd);
+    return true;
+}
+
+#ifdef RCLI_WITH_SSL
+bool RespServer::listen_tls(const std::string& host, uint32_t port, bool require_client_cert) {
+    if (tls_ctx_ == nullptr) {
+        // P-256 key and a self-signed certificate that is its own CA
+        EVP_PKEY* key = nullptr;
+        EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        if (pctx == nullptr || EVP_PKEY_keygen_init(pctx) <= 0
+            || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) <= 0
+            || EVP_PKEY_keygen(pctx, &key) <= 0) {
+            EVP_PKEY_CTX_free(pctx);
+            error_str_ = "TLS key generation failed";
+            return false;
+        }
+        EVP_PKEY_CTX_free(pctx);
+        tls_key_ = key;
+
+        X509* cert = X509_new();
+        tls_cert_ = cert;
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 86400L * 365);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*) "localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        X509V3_CTX v3;
+        X509V3_set_ctx_nodb(&v3);
+        X509V3_set_ctx(&v3, cert, cert, nullptr, nullptr, 0);
+        const std::pair<int, const char*> exts[] = {{NID_basic_constraints, "critical,CA:TRUE"},
+                                                     {NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1"}};
+        for (auto& ext : exts) {
+            X509_EXTENSION* x = X509V3_EXT_conf_nid(nullptr, &v3, ext.first, ext.second);
+            X509_add_ext(cert, x, -1);
+            X509_EXTENSION_free(x);
+        }
+        SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+        if (X509_sign(cert, key, EVP_sha256()) <= 0 || ctx == nullptr || SSL_CTX_use_certificate(ctx, cert) != 1
+            || SSL_CTX_use_PrivateKey(ctx, key) != 1) {
+            SSL_CTX_free(ctx);
+            error_str_ = "TLS certificate setup failed";
+            return false;
+        }
+        // clients resume with tickets (TLS 1.3) or session ids (TLS 1.2), both need the id context
+        static const unsigned char sid_ctx[] = "RespServer";
+        SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        tls_ctx_ = ctx;
+    }
+    SSL_CTX* ctx = (SSL_CTX*) tls_ctx_;
+    if (require_client_cert) {
+        X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx), (X509*) tls_cert_);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+    }
+    if (!open_tcp(host, port, tls_port_)) {
+        return false;
+    }
+    addrs_.insert(host + ":" + std::to_string(tls_port_));
+    // SSL_write has no MSG_NOSIGNAL, a client gone away would kill the process
+    signal(SIGPIPE, SIG_IGN);
+    tls_fds_.insert(listen_fds_.back());
+    return true;
+}
+
+bool RespServer::write_tls_cert(const std::string& cert_file, const std::string& key_file) {
+    if (tls_cert_ == nullptr) {
+        error_str_ = "no TLS listener";
+        return false;
+    }
+    bool ok = false;
+    FILE* fp = fopen(cert_file.c_str(), "w");
+    if (fp) {
+        ok = PEM_write_X509(fp, (X509*) tls_cert_) == 1;
+        fclose(fp);
+    }
+    fp = ok ? fopen(key_file.c_str(), "w") : nullptr;
+    if (fp) {
+        ok = PEM_write_PrivateKey(fp, (EVP_PKEY*) tls_key_, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+        fclose(fp);
+    } else {
+        ok = false;
+    }
+    if (!ok) {
+        error_str_ = "cannot write " + cert_file + " or " + key_file;
+    }
+    return ok;
+}
+#endif
+
+bool RespServer::start() {
+    if (running_) {
+        return true;
+    }
+    if (listen_fds_.empty()) {
+        error_str_ = "RespServer is not listening!";
+        return false;
+    }
+    if (pipe(wake_fds_) != 0) {
+        error_str_ = strerror(errno);
+        return false;
+    }
+    set_nonblock(wake_fds_[0]);
+    running_ = true;
+    thread_ = std::thread(&RespServer::run, this);
+    return true;
+}
+
+void RespServer::stop() {
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    char ch = 0;
+    if (write(wake_fds_[1], &ch, 1) < 0) {
+        // the loop also wakes up on its poll timeout
+    }
+    thread_.join();
+    for (auto& c : conns_) {
+        close(c->fd);
+    }
+    conns_.clear();
+    close(wake_fds_[0]);
+    close(wake_fds_[1]);
+    wake_fds_[0] = wake_fds_[1] = -1;
+}
+
+void RespServer::flush_all() {
+    std::lock_guard<std::mutex> lock(db_mutex_);
+    db_.clear();
+}
+
+void RespServer::run() {
+    std::vector<struct pollfd> fds;
+    while (running_) {
+        fds.clear();
+        fds.push_back({wake_fds_[0], POLLIN, 0});
+        for (int fd : listen_fds_) {
+            fds.push_back({fd, POLLIN, 0});
+        }
+        int timeout_ms = 100;
+        int64_t now = now_us();
+        for (auto& c : conns_) {
+            while (!c->delayed.empty() && c->delayed.front().first <= now) {
+                c->out.append(c->delayed.front().second);
+                c->delayed.pop_front();
+            }
+            if (!c->delayed.empty()) {
+                // rounded down, sub-millisecond delays spin instead of oversleeping
+                int64_t wait_ms = (c->delayed.front().first - now) / 1000;
+                timeout_ms = std::min<int64_t>(timeout_ms, wait_ms);
+            }
+            if (!c->blocked.empty()) {
+                int64_t wait_ms = std::max<int64_t>(c->blocked_until_us - now, 0) / 1000;
+                timeout_ms = std::min<int64_t>(timeout_ms, wait_ms);
+            }
+            fds.push_back({c->fd, (short) (POLLIN | (c->out.empty() ? 0 : POLLOUT)), 0});
+        }
+
+        if (poll(&fds[0], fds.size(), timeout_ms) < 0 && errno != EINTR) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(wake_fds_[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+        for (size_t i = 0; i < listen_fds_.size(); i++) {
+            if (fds[1 + i].revents & POLLIN) {
+                accept_conn(listen_fds_[i]);
+            }
+        }
+        size_t base = 1 + listen_fds_.size();
+        size_t polled = fds.size() - base;  // conns accepted above were not polled yet
+        for (size_t i = 0; i < polled; i++) {
+            conn& c = *conns_[i];
+            short revents = fds[base + i].revents;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (!read_conn(c)) {
+                    c.dead = true;
+                }
+            }
+            if (!c.dead && !c.out.empty() && !write_conn(c)) {
+                c.dead = true;
+            }
+            if (c.closing && c.out.empty() && c.delayed.empty()) {
+                c.dead = true;
+            }
+        }
+        // after every read, the commands just run may have added what they wait for
+        now = now_us();
+        for (auto& c : conns_) {
+            if (!c->blocked.empty() && !c->dead) {
+                retry_blocked(*c, now);
+            }
+        }
+        for (auto it = conns_.begin(); it != conns_.end();) {
+            if ((*it)->dead) {
+                close((*it)->fd);
+                it = conns_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+void RespServer::accept_conn(int listen_fd) {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            return;
+        }
+        set_nonblock(fd);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        std::unique_ptr<conn> c(new conn);
+        c->fd = fd;
+        c->id = ++next_id_;
+        c->authed = pwd_.empty();
+#ifdef RCLI_WITH_SSL
+        if (tls_fds_.count(listen_fd)) {
+            SSL* ssl = SSL_new((SSL_CTX*) tls_ctx_);
+            if (ssl == nullptr) {
+                close(fd);
+                continue;
+            }
+            SSL_set_fd(ssl, fd);
+            SSL_set_accept_state(ssl);
+            c->ssl = ssl;
+        }
+#endif
+        conns_.emplace_back(std::move(c));
+        connections_++;
+    }
+}
+
+bool RespServer::read_conn(conn& c) {
+    char buf[16 * 1024];
+    while (true) {
+        ssize_t n = recv_conn(c.fd, c.ssl, buf, sizeof(buf));
+        if (n > 0) {
+            // run what arrived before reading on, as redis does, so that a fault
+            // drops the rest of a batch the client is still writing
+            c.in.append(buf, (size_t) n);
+            process_input(c);
+            if (c.dead) {
+                return true;
+            }
+            continue;
+        }
+        if (n == 0) {
+            return false;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void RespServer::process_input(conn& c) {
+    argv_t argv;
+    bool error = false;
+    while (!c.closing && !c.dead && c.blocked.empty() && parse(c, argv, error)) {
+        if (!argv.empty()) {
+            dispatch(c, argv);
+        }
+    }
+    if (error) {
+        c.out.append("-ERR Protocol error\r\n");
+        c.closing = true;
+    }
+    if (c.in_pos > 0) {
+        c.in.erase(0, c.in_pos);
+        c.in_pos = 0;
+    }
+}
+
+bool RespServer::parse(conn& c, argv_t& argv, bool& error) {
+    argv.clear();
+    size_t pos = c.in_pos;
+    size_t eol = c.in.find("\r\n", pos);
+    if (eol == std::string::npos) {
+        return false;
+    }
+    if (c.in[pos] != '*') {
+        // inline command
+        size_t start = pos;
+        for (size_t i = pos; i <= eol; i++) {
+            if (i == eol || c.in[i] == ' ') {
+                if (i > start) {
+                    argv.emplace_back(c.in, start, i - start);
+                }
+                start = i + 1;
+            }
+        }
+        c.in_pos = eol + 2;
+        return true;
+    }
+
+    int64_t argc = 0;
+    if (!parse_integer(c.in.substr(pos + 1, eol - pos - 1), argc) || argc > 1024 * 1024) {
+        error = true;
+        return false;
+    }
+    pos = eol + 2;
+    argv.reserve((size_t) std::max<int64_t>(argc, 0));
+    for (int64_t i = 0; i < argc; i++) {
+        eol = c.in.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            return false;
+        }
+        int64_t len = 0;
+        if (c.in[pos] != '$' || !parse_integer(c.in.substr(pos + 1, eol - pos - 1), len) || len < 0
+            || len > RESP_MAX_BULK) {
+            error = true;
+            return false;
+        }
+        pos = eol + 2;
+        if (c.in.size() < pos + (size_t) len + 2) {
+            return false;
+        }
+        argv.emplace_back(c.in, pos, (size_t) len);
+        pos += (size_t) len + 2;
+    }
+    c.in_pos = pos;
+    return true;
+}
+
+void RespServer::dispatch(conn& c, const argv_t& argv) {
+    uint64_t n = ++commands_;
+    uint32_t every = fault_every_.load();
+    int fault = every > 0 && n % every == 0 ? fault_mode_.load() : RESP_FAULT_NONE;
+
+    std::string reply;
+    switch (fault) {
+        case RESP_FAULT_ERROR: reply_error(reply, "ERR injected fault"); break;
+        case RESP_FAULT_CLOSE: c.dead = true; return;
+        case RESP_FAULT_TIMEOUT: return;
+        default: {
+            std::lock_guard<std::mutex> lock(db_mutex_);
+            execute(c, argv, reply);
+            break;
+        }
+    }
+
+    uint32_t latency_us = latency_us_.load();
+    if (latency_us == 0 && c.delayed.empty()) {
+        c.out.append(reply);
+        return;
+    }
+    int64_t due = now_us() + latency_us;
+    if (!c.delayed.empty()) {
+        due = std::max(due, c.delayed.back().first);
+    }
+    c.delayed.emplace_back(due, std::move(reply));
+}
+
+void RespServer::execute(conn& c, const argv_t& argv, std::string& out) {
+    std::string name = upper(argv[0]);
+    if (!c.authed && name != "AUTH" && name != "HELLO" && name != "QUIT") {
+        reply_error(out, "NOAUTH Authentication required.");
+        return;
+    }
+
+    auto it = commands_table_.find(name);
+    if (it == commands_table_.end()) {
+        reply_error(out, "ERR unknown command '" + argv[0] + "'");
+        c.multi_error = c.in_multi;
+        return;
+    }
+    int arity = it->second.arity;
+    if ((arity > 0 && (int) argv.size() != arity) || (arity < 0 && (int) argv.size() < -arity)) {
+        reply_error(out, "ERR wrong number of arguments for '" + argv[0] + "' command");
+        c.multi_error = c.in_multi;
+        return;
+    }
+
+    bool redirected = !slot_owner_.empty() && (it->second.flags & (CMD_READ | CMD_WRITE))
+                      && redirect_keys(c, argv, it->second.flags, out);
+    c.asking = c.asking && name == "ASKING";
+    if (redirected) {
+        c.multi_error = c.in_multi;
+        return;
+    }
+
+    if (c.in_multi && name != "EXEC" && name != "DISCARD" && name != "MULTI" && name != "WATCH") {
+        c.queued.push_back(argv);
+        reply_status(out, "QUEUED");
+        return;
+    }
+    (this->*(it->second.handler))(c, argv, out);
+    int flags = it->second.flags;
+    if (flags & CMD_WRITE) {
+        invalidate(argv, flags);
+    } else if ((flags & CMD_READ) && c.tracking && !c.bcast) {
+        track(c, argv, flags);
+    }
+}
+
+bool RespServer::write_conn(conn& c) {
+    size_t sent = 0;
+    while (sent < c.out.size()) {
+        ssize_t n = send_conn(c.fd, c.ssl, c.out.data() + sent, c.out.size() - sent);
+        if (n > 0) {
+            sent += (size_t) n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    c.out.erase(0, sent);
+    return true;
+}
+
+RespServer::value_t* RespServer::lookup(const std::string& key, int type, bool& wrong_type) {
+    wrong_type = false;
+    auto it = db_.find(key);
+    if (it == db_.end()) {
+        return nullptr;
+    }
+    if (it->second.expire_ms > 0 && it->second.expire_ms <= now_ms()) {
+        db_.erase(it);
+        invalidate_key(key);
+        return nullptr;
+    }
+    if (type != 0 && it->second.type != type) {
+        wrong_type = true;
+        return nullptr;
+    }
+    return &it->second;
+}
+
+RespServer::value_t& RespServer::create(const std::string& key, int type) {
+    value_t& v = db_[key];
+    v = value_t();
+    v.type = type;
+    return v;
+}
+
+// client tracking
+
+namespace {
+
+// the keys of argv selected by flags
+template <class Fn>
+void for_each_key(const RespServer::argv_t& argv, int flags, Fn fn) {
+    size_t step = (flags & CMD_KEYS_PAIRS) ? 2 : 1;
+    size_t end = (flags & (CMD_KEYS_ALL | CMD_KEYS_PAIRS)) ? argv.size() : std::min<size_t>(argv.size(), 2);
+    for (size_t i = 1; i < end; i += step) {
+        fn(argv[i]);
+    }
+}
+
+}  // namespace
+
+void RespServer::track(conn& c, const argv_t& argv, int flags) {
+    for_each_key(argv, flags, [&](const std::string& key) { tracking_table_[key].insert(c.id); });
+}
+
+bool RespServer::redirect_keys(conn& c, const argv_t& argv, int flags, std::string& out) {
+    int slot = -1;
+    bool cross = false;
+    for_each_key(argv, flags, [&](const std::string& key) {
+        int key_slot = RedisClusterClient::key_slot(key);
+        cross = cross || (slot >= 0 && key_slot != slot);
+        slot = key_slot;
+    });
+    if (slot < 0) {
+        return false;
+    } else if (cross) {
+        reply_error(out, "CROSSSLOT Keys in request don't hash to the same slot");
+        return true;
+    }
+    const std::string& owner = slot_owner_[slot];
+    if (owner.empty()) {
+        reply_error(out, "CLUSTERDOWN Hash slot not served");
+        return true;
+    } else if (addrs_.count(owner) == 0) {
+        if (c.asking) {
+            return false;
+        }
+        reply_error(out, "MOVED " + std::to_string(slot) + " " + owner);
+        return true;
+    }
+    auto it = migrating_.find((uint16_t) slot);
+    if (it != migrating_.end()) {
+        reply_error(out, "ASK " + std::to_string(slot) + " " + it->second);
+        return true;
+    }
+    return false;
+}
+
+uint64_t RespServer::tracking_target(uint64_t reader) {
+    for (auto& c : conns_) {
+        if (c->id == reader) {
+            return c->tracking && !c->dead ? (c->redirect ? c->redirect : c->id) : 0;
+        }
+    }
+    return 0;
+}
+
+void RespServer::invalidate(const argv_t& argv, int flags) {
+    for_each_key(argv, flags, [&](const std::string& key) {
+        invalidate_key(key);
+        touch_watched(&key);
+    });
+}
+
+void RespServer::invalidate_key(const std::string& key) {
+    auto it = tracking_table_.find(key);
+    if (it != tracking_table_.end()) {
+        for (uint64_t reader : it->second) {
+            uint64_t target = tracking_target(reader);
+            if (target != 0) {
+                push_invalidate(target, &key);
+            }
+        }
+        tracking_table_.erase(it);
+    }
+    for (auto& c : conns_) {
+        if (!c->tracking || !c->bcast) {
+            continue;
+        }
+        bool match = c->prefixes.empty();
+        for (size_t i = 0; !match && i < c->prefixes.size(); i++) {
+            match = key.compare(0, c->prefixes[i].size(), c->prefixes[i]) == 0;
+        }
+        if (match) {
+            push_invalidate(c->redirect ? c->redirect : c->id, &key);
+        }
+    }
+}
+
+void RespServer::invalidate_all() {
+    std::set<uint64_t> targets;
+    for (auto& kv : tracking_table_) {
+        for (uint64_t reader : kv.second) {
+            uint64_t target = tracking_target(reader);
+            if (target != 0) {
+                targets.insert(target);
+            }
+        }
+    }
+    tracking_table_.clear();
+    for (auto& c : conns_) {
+        if (c->tracking && c->bcast) {
+            targets.insert(c->redirect ? c->redirect : c->id);
+        }
+    }
+    for (uint64_t target : targets) {
+        push_invalidate(target, nullptr);
+    }
+}
+
+void RespServer::push_invalidate(uint64_t target, const std::string* key) {
+    for (auto& c : conns_) {
+        // RESP2 clients would need SUBSCRIBE __redis__:invalidate, which is not served
+        if (c->id != target || !c->resp3 || c->dead) {
+            continue;
+        }
+        c->out.append(">2\r\n");
+        reply_bulk(c->out, "invalidate");
+        if (key) {
+            reply_array(c->out, 1);
+            reply_bulk(c->out, *key);
+        } else {
+            c->out.append("_\r\n");
+        }
+        return;
+    }
+}
+
+void RespServer::touch_watched(const std::string* key) {
+    for (auto& c : conns_) {
+        if (!c->watched.empty() && (key == nullptr || c->watched.count(*key))) {
+            c->watch_dirty = true;
+        }
+    }
+}
+
+// keys
+
+void RespServer::cmd_ping(conn& c, const argv_t& argv, std::string& out) {
+    bool subscribed = !c.channels.empty() || !c.patterns.empty() || !c.shard_channels.empty();
+    if (subscribed && !c.resp3) {
+        // a RESP2 subscriber only gets arrays
+        reply_array(out, 2);
+        reply_bulk(out, "pong");
+        reply_bulk(out, argv.size() > 1 ? argv[1] : std::string());
+    } else if (argv.size() > 1) {
+        reply_bulk(out, argv[1]);
+    } else {
+        reply_status(out, "PONG");
+    }
+}
+
+void RespServer::cmd_echo(conn& c, const argv_t& argv, std::string& out) { reply_bulk(out, argv[1]); }
+
+void RespServer::cmd_ok(conn& c, const argv_t& argv, std::string& out) { reply_status(out, "OK"); }
+
+void RespServer::cmd_cluster(conn& c, const argv_t& argv, std::string& out) {
+    if (upper(argv[1]) != "SLOTS") {
+        reply_error(out, "ERR unknown subcommand '" + argv[1] + "'");
+        return;
+    }
+    // [[start, end, [host, port, id]], ...] over the runs of slots with the same owner
+    std::vector<std::pair<size_t, size_t>> runs;
+    for (size_t slot = 0; slot < slot_owner_.size(); slot++) {
+        if (slot_owner_[slot].empty()) {
+            continue;
+        }
+        if (!runs.empty() && runs.back().second + 1 == slot && slot_owner_[runs.back().second] == slot_owner_[slot]) {
+            runs.back().second = slot;
+        } else {
+            runs.emplace_back(slot, slot);
+        }
+    }
+    reply_array(out, runs.size());
+    for (auto& run : runs) {
+        const std::string& owner = slot_owner_[run.first];
+        size_t pos = owner.rfind(':');
+        reply_array(out, 3);
+        reply_integer(out, (int64_t) run.first);
+        reply_integer(out, (int64_t) run.second);
+        reply_array(out, 3);
+        reply_bulk(out, owner.substr(0, pos));
+        reply_integer(out, atoll(owner.c_str() + pos + 1));
+        reply_bulk(out, owner);
+    }
+}
+
+void RespServer::cmd_asking(conn& c, const argv_t& argv, std::string& out) {
+    c.asking = true;
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_auth(conn& c, const argv_t& argv, std::string& out) {
+    if (pwd_.empty()) {
+        reply_error(out, "ERR AUTH <password> called without any password configured for the default user.");
+    } else if (argv.back() == pwd_ && (argv.size() == 2 || argv[1] == "default")) {
+        c.authed = true;
+        reply_status(out, "OK");
+    } else {
+        reply_error(out, "WRONGPASS invalid username-password pair or user is disabled.");
+    }
+}
+
+void RespServer::cmd_hello(conn& c, const argv_t& argv, std::string& out) {
+    int64_t proto = c.resp3 ? 3 : 2;
+    if (argv.size() > 1 && (!parse_integer(argv[1], proto) || proto < 2 || proto > 3)) {
+        reply_error(out, "NOPROTO unsupported protocol version");
+        return;
+    }
+    for (size_t i = 2; i < argv.size(); i++) {
+        std::string opt = upper(argv[i]);
+        if (opt == "AUTH" && i + 2 < argv.size()) {
+            if (pwd_.empty() || argv[i + 2] != pwd_ || argv[i + 1] != "default") {
+                reply_error(out, "WRONGPASS invalid username-password pair or user is disabled.");
+                return;
+            }
+            c.authed = true;
+            i += 2;
+        } else if (opt == "SETNAME" && i + 1 < argv.size()) {
+            i++;
+        } else {
+            reply_error(out, "ERR syntax error in HELLO option '" + argv[i] + "'");
+            return;
+        }
+    }
+    if (!c.authed) {
+        reply_error(out, "NOAUTH HELLO must be called with the client already authenticated, otherwise the HELLO "
+                         "<proto> AUTH <user> <pass> option can be used to authenticate the client and select the "
+                         "RESP protocol version at the same time");
+        return;
+    }
+    c.resp3 = proto == 3;
+    reply_map(out, 7, c.resp3);
+    reply_bulk(out, "server");
+    reply_bulk(out, "redis");
+    reply_bulk(out, "version");
+    reply_bulk(out, "7.0.0");
+    reply_bulk(out, "proto");
+    reply_integer(out, proto);
+    reply_bulk(out, "id");
+    reply_integer(out, (int64_t) c.id);
+    reply_bulk(out, "mode");
+    reply_bulk(out, "standalone");
+    reply_bulk(out, "role");
+    reply_bulk(out, "master");
+    reply_bulk(out, "modules");
+    reply_array(out, 0);
+}
+
+void RespServer::cmd_client(conn& c, const argv_t& argv, std::string& out) {
+    std::string sub = upper(argv[1]);
+    if (sub == "ID") {
+        reply_integer(out, (int64_t) c.id);
+        return;
+    }
+    if (sub == "KILL") {
+        // CLIENT KILL ID id or TYPE pubsub, the killer itself included
+        std::string filter = argv.size() == 4 ? upper(argv[2]) : std::string();
+        int64_t id = 0;
+        if ((filter != "ID" || !parse_integer(argv[3], id)) && (filter != "TYPE" || upper(argv[3]) != "PUBSUB")) {
+            reply_error(out, "ERR syntax error");
+            return;
+        }
+        int64_t killed = 0;
+        for (auto& other : conns_) {
+            bool pubsub = !other->channels.empty() || !other->patterns.empty() || !other->shard_channels.empty();
+            if (filter == "ID" ? other->id == (uint64_t) id : pubsub) {
+                other->closing = true;
+                killed++;
+            }
+        }
+        reply_integer(out, killed);
+        return;
+    }
+    if (sub != "TRACKING") {
+        reply_status(out, "OK");
+        return;
+    }
+    if (argv.size() < 3) {
+        reply_error(out, "ERR wrong number of arguments for 'client|tracking' command");
+        return;
+    }
+    std::string onoff = upper(argv[2]);
+    if (onoff == "OFF") {
+        c.tracking = false;
+        c.bcast = false;
+        c.redirect = 0;
+        c.prefixes.clear();
+        reply_status(out, "OK");
+        return;
+    } else if (onoff != "ON") {
+        reply_error(out, "ERR syntax error");
+        return;
+    }
+    bool bcast = false;
+    int64_t redirect = 0;
+    std::vector<std::string> prefixes;
+    for (size_t i = 3; i < argv.size(); i++) {
+        std::string opt = upper(argv[i]);
+        if (opt == "BCAST") {
+            bcast = true;
+        } else if (opt == "REDIRECT" && i + 1 < argv.size() && parse_integer(argv[i + 1], redirect)) {
+            i++;
+        } else if (opt == "PREFIX" && i + 1 < argv.size()) {
+            prefixes.push_back(argv[++i]);
+        } else if (opt != "OPTIN" && opt != "OPTOUT" && opt != "NOLOOP") {
+            reply_error(out, "ERR syntax error");
+            return;
+        }
+    }
+    if (!prefixes.empty() && !bcast) {
+        reply_error(out, "ERR PREFIX option requires BCAST mode to be enabled");
+        return;
+    }
+    if (redirect > 0) {
+        bool found = false;
+        for (auto& other : conns_) {
+            found = found || other->id == (uint64_t) redirect;
+        }
+        if (!found) {
+            reply_error(out, "ERR The client ID you want redirect to does not exist");
+            return;
+        }
+    }
+    c.tracking = true;
+    c.bcast = bcast;
+    c.redirect = (uint64_t) redirect;
+    c.prefixes = prefixes;
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_quit(conn& c, const argv_t& argv, std::string& out) {
+    reply_status(out, "OK");
+    c.closing = true;
+}
+
+void RespServer::cmd_flushall(conn& c, const argv_t& argv, std::string& out) {
+    db_.clear();
+    invalidate_all();
+    touch_watched(nullptr);
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_dbsize(conn& c, const argv_t& argv, std::string& out) { reply_integer(out, (int64_t) db_.size()); }
+
+void RespServer::cmd_get(conn& c, const argv_t& argv, std::string& out) {
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_STRING, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+    } else if (v == nullptr) {
+        reply_nil(out, c.resp3);
+    } else {
+        reply_bulk(out, v->str);
+    }
+}
+
+void RespServer::cmd_set(conn& c, const argv_t& argv, std::string& out) {
+    int64_t expire_ms = 0;
+    bool nx = false;
+    bool xx = false;
+    for (size_t i = 3; i < argv.size(); i++) {
+        std::string opt = upper(argv[i]);
+        int64_t val = 0;
+        if (opt == "NX") {
+            nx = true;
+        } else if (opt == "XX") {
+            xx = true;
+        } else if ((opt == "EX" || opt == "PX") && i + 1 < argv.size() && parse_integer(argv[i + 1], val)
+                   && val > 0) {
+            expire_ms = now_ms() + (opt == "EX" ? val * 1000 : val);
+            i++;
+        } else {
+            reply_error(out, "ERR syntax error");
+            return;
+        }
+    }
+    bool wrong_type = false;
+    bool exists = lookup(argv[1], 0, wrong_type) != nullptr;
+    if ((nx && exists) || (xx && !exists)) {
+        reply_nil(out, c.resp3);
+        return;
+    }
+    value_t& v = create(argv[1], VALUE_STRING);
+    v.str = argv[2];
+    v.expire_ms = expire_ms;
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_mget(conn& c, const argv_t& argv, std::string& out) {
+    reply_array(out, argv.size() - 1);
+    for (size_t i = 1; i < argv.size(); i++) {
+        bool wrong_type = false;
+        value_t* v = lookup(argv[i], VALUE_STRING, wrong_type);
+        if (v) {
+            reply_bulk(out, v->str);
+        } else {
+            reply_nil(out, c.resp3);
+        }
+    }
+}
+
+void RespServer::cmd_mset(conn& c, const argv_t& argv, std::string& out) {
+    if (argv.size() % 2 == 0) {
+        reply_error(out, "ERR wrong number of arguments for 'mset' command");
+        return;
+    }
+    for (size_t i = 1; i + 1 < argv.size(); i += 2) {
+        create(argv[i], VALUE_STRING).str = argv[i + 1];
+    }
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_incrby(conn& c, const argv_t& argv, std::string& out) {
+    int64_t by = 1;
+    if (argv.size() > 2 && !parse_integer(argv[2], by)) {
+        reply_error(out, "ERR value is not an integer or out of range");
+        return;
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_STRING, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    int64_t val = 0;
+    if (v && !parse_integer(v->str, val)) {
+        reply_error(out, "ERR value is not an integer or out of range");
+        return;
+    }
+    if (v == nullptr) {
+        v = &create(argv[1], VALUE_STRING);
+    }
+    val += by;
+    v->str = std::to_string(val);
+    reply_integer(out, val);
+}
+
+void RespServer::cmd_del(conn& c, const argv_t& argv, std::string& out) {
+    int64_t count = 0;
+    for (size_t i = 1; i < argv.size(); i++) {
+        bool wrong_type = false;
+        if (lookup(argv[i], 0, wrong_type)) {
+            db_.erase(argv[i]);
+            count++;
+        }
+    }
+    reply_integer(out, count);
+}
+
+void RespServer::cmd_exists(conn& c, const argv_t& argv, std::string& out) {
+    int64_t count = 0;
+    for (size_t i = 1; i < argv.size(); i++) {
+        bool wrong_type = false;
+        count += lookup(argv[i], 0, wrong_type) ? 1 : 0;
+    }
+    reply_integer(out, count);
+}
+
+void RespServer::cmd_expire(conn& c, const argv_t& argv, std::string& out) {
+    int64_t val = 0;
+    if (!parse_integer(argv[2], val)) {
+        reply_error(out, "ERR value is not an integer or out of range");
+        return;
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], 0, wrong_type);
+    if (v == nullptr) {
+        reply_integer(out, 0);
+        return;
+    }
+    std::string name = upper(argv[0]);
+    if (name == "EXPIRE") {
+        v->expire_ms = now_ms() + val * 1000;
+    } else if (name == "PEXPIRE") {
+        v->expire_ms = now_ms() + val;
+    } else if (name == "EXPIREAT") {
+        v->expire_ms = val * 1000;
+    } else {
+        v->expire_ms = val;
+    }
+    // a deadline in the past deletes the key right away, like redis
+    if (v->expire_ms <= now_ms()) {
+        db_.erase(argv[1]);
+    }
+    reply_integer(out, 1);
+}
+
+void RespServer::cmd_ttl(conn& c, const argv_t& argv, std::string& out) {
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], 0, wrong_type);
+    if (v == nullptr) {
+        reply_integer(out, -2);
+    } else if (v->expire_ms == 0) {
+        reply_integer(out, -1);
+    } else {
+        int64_t left = v->expire_ms - now_ms();
+        reply_integer(out, upper(argv[0]) == "TTL" ? (left + 999) / 1000 : left);
+    }
+}
+
+// hash map
+
+#define LOOKUP_OR_REPLY(v, key, type, missing)                                                                         \
+    bool wrong_type = false;                                                                                           \
+    value_t* v = lookup(key, type, wrong_type);                                                                        \
+    if (wrong_type) {                                                                                                  \
+        reply_wrong_type(out);                                                                                         \
+        return;                                                                                                        \
+    }                                                                                                                  \
+    if (v == nullptr) {                                                                                                \
+        missing;                                                                                                       \
+        return;                                                                                                        \
+    }
+
+void RespServer::cmd_hset(conn& c, const argv_t& argv, std::string& out) {
+    if (argv.size() % 2 != 0) {
+        reply_error(out, "ERR wrong number of arguments for '" + argv[0] + "' command");
+        return;
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_HASH, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    if (v == nullptr) {
+        v = &create(argv[1], VALUE_HASH);
+    }
+    int64_t added = 0;
+    for (size_t i = 2; i + 1 < argv.size(); i += 2) {
+        auto ret = v->hash.insert(std::make_pair(argv[i], argv[i + 1]));
+        if (ret.second) {
+            added++;
+        } else {
+            ret.first->second = argv[i + 1];
+        }
+    }
+    if (upper(argv[0]) == "HMSET") {
+        reply_status(out, "OK");
+    } else {
+        reply_integer(out, added);
+    }
+}
+
+void RespServer::cmd_hget(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_HASH, reply_nil(out, c.resp3));
+    auto it = v->hash.find(argv[2]);
+    if (it == v->hash.end()) {
+        reply_nil(out, c.resp3);
+    } else {
+        reply_bulk(out, it->second);
+    }
+}
+
+void RespServer::cmd_hexists(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_HASH, reply_integer(out, 0));
+    reply_integer(out, v->hash.count(argv[2]) ? 1 : 0);
+}
+
+void RespServer::cmd_hdel(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_HASH, reply_integer(out, 0));
+    int64_t count = 0;
+    for (size_t i = 2; i < argv.size(); i++) {
+        count += (int64_t) v->hash.erase(argv[i]);
+    }
+    if (v->hash.empty()) {
+        db_.erase(argv[1]);
+    }
+    reply_integer(out, count);
+}
+
+void RespServer::cmd_hlen(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_HASH, reply_integer(out, 0));
+    reply_integer(out, (int64_t) v->hash.size());
+}
+
+void RespServer::cmd_hkeys(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_HASH, reply_array(out, 0));
+    reply_array(out, v->hash.size());
+    for (auto& kv : v->hash) {
+        reply_bulk(out, kv.first);
+    }
+}
+
+void RespServer::cmd_hgetall(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_HASH, reply_map(out, 0, c.resp3));
+    reply_map(out, v->hash.size(), c.resp3);
+    for (auto& kv : v->hash) {
+        reply_bulk(out, kv.first);
+        reply_bulk(out, kv.second);
+    }
+}
+
+void RespServer::cmd_hincrby(conn& c, const argv_t& argv, std::string& out) {
+    int64_t by = 0;
+    if (!parse_integer(argv[3], by)) {
+        reply_error(out, "ERR value is not an integer or out of range");
+        return;
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_HASH, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    if (v == nullptr) {
+        v = &create(argv[1], VALUE_HASH);
+    }
+    std::string& field = v->hash[argv[2]];
+    int64_t val = 0;
+    if (!field.empty() && !parse_integer(field, val)) {
+        reply_error(out, "ERR hash value is not an integer");
+        return;
+    }
+    val += by;
+    field = std::to_string(val);
+    reply_integer(out, val);
+}
+
+// sorted set
+
+void RespServer::cmd_zadd(conn& c, const argv_t& argv, std::string& out) {
+    if (argv.size() % 2 != 0) {
+        reply_error(out, "ERR syntax error");
+        return;
+    }
+    std::vector<double> scores;
+    for (size_t i = 2; i + 1 < argv.size(); i += 2) {
+        double score = 0;
+        if (!parse_double(argv[i], score)) {
+            reply_error(out, "ERR value is not a valid float");
+            return;
+        }
+        scores.push_back(score);
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_ZSET, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    if (v == nullptr) {
+        v = &create(argv[1], VALUE_ZSET);
+    }
+    int64_t added = 0;
+    for (size_t i = 0; i < scores.size(); i++) {
+        const std::string& member = argv[3 + i * 2];
+        auto it = v->zscore.find(member);
+        if (it == v->zscore.end()) {
+            added++;
+            v->zscore[member] = scores[i];
+        } else {
+            v->zorder.erase(std::make_pair(it->second, member));
+            it->second = scores[i];
+        }
+        v->zorder.insert(std::make_pair(scores[i], member));
+    }
+    reply_integer(out, added);
+}
+
+void RespServer::cmd_zincrby(conn& c, const argv_t& argv, std::string& out) {
+    double by = 0;
+    if (!parse_double(argv[2], by)) {
+        reply_error(out, "ERR value is not a valid float");
+        return;
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_ZSET, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    if (v == nullptr) {
+        v = &create(argv[1], VALUE_ZSET);
+    }
+    const std::string& member = argv[3];
+    double score = by;
+    auto it = v->zscore.find(member);
+    if (it != v->zscore.end()) {
+        v->zorder.erase(std::make_pair(it->second, member));
+        score += it->second;
+    }
+    v->zscore[member] = score;
+    v->zorder.insert(std::make_pair(score, member));
+    reply_double(out, score, c.resp3);
+}
+
+void RespServer::cmd_zcard(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_ZSET, reply_integer(out, 0));
+    reply_integer(out, (int64_t) v->zscore.size());
+}
+
+void RespServer::cmd_zscore(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_ZSET, reply_nil(out, c.resp3));
+    auto it = v->zscore.find(argv[2]);
+    if (it == v->zscore.end()) {
+        reply_nil(out, c.resp3);
+    } else {
+        reply_double(out, it->second, c.resp3);
+    }
+}
+
+void RespServer::cmd_zrem(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_ZSET, reply_integer(out, 0));
+    int64_t count = 0;
+    for (size_t i = 2; i < argv.size(); i++) {
+        auto it = v->zscore.find(argv[i]);
+        if (it != v->zscore.end()) {
+            v->zorder.erase(std::make_pair(it->second, argv[i]));
+            v->zscore.erase(it);
+            count++;
+        }
+    }
+    if (v->zscore.empty()) {
+        db_.erase(argv[1]);
+    }
+    reply_integer(out, count);
+}
+
+void RespServer::cmd_zrank(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_ZSET, reply_nil(out, c.resp3));
+    auto it = v->zscore.find(argv[2]);
+    if (it == v->zscore.end()) {
+        reply_nil(out, c.resp3);
+        return;
+    }
+    auto pos = v->zorder.find(std::make_pair(it->second, argv[2]));
+    reply_integer(out, (int64_t) std::distance(v->zorder.begin(), pos));
+}
+
+void RespServer::cmd_zrange(conn& c, const argv_t& argv, std::string& out) {
+    int64_t start = 0;
+    int64_t stop = 0;
+    if (!parse_integer(argv[2], start) || !parse_integer(argv[3], stop)) {
+        reply_error(out, "ERR value is not an integer or out of range");
+        return;
+    }
+    bool withscores = argv.size() > 4 && upper(argv[4]) == "WITHSCORES";
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_ZSET, reply_array(out, 0));
+    int64_t size = (int64_t) v->zorder.size();
+    start = start < 0 ? std::max<int64_t>(start + size, 0) : start;
+    stop = stop < 0 ? stop + size : std::min(stop, size - 1);
+    if (start > stop || start >= size) {
+        reply_array(out, 0);
+        return;
+    }
+    // RESP3 nests each member and its score in a pair
+    reply_array(out, (size_t) (stop - start + 1) * (withscores && !c.resp3 ? 2 : 1));
+    auto it = v->zorder.begin();
+    std::advance(it, start);
+    for (int64_t i = start; i <= stop; i++, ++it) {
+        if (withscores && c.resp3) {
+            reply_array(out, 2);
+        }
+        reply_bulk(out, it->second);
+        if (withscores) {
+            reply_double(out, it->first, c.resp3);
+        }
+    }
+}
+
+void RespServer::cmd_zrangebyscore(conn& c, const argv_t& argv, std::string& out) {
+    double min = 0;
+    double max = 0;
+    bool min_ex = false;
+    bool max_ex = false;
+    if (!parse_score_bound(argv[2], min, min_ex) || !parse_score_bound(argv[3], max, max_ex)) {
+        reply_error(out, "ERR min or max is not a float");
+        return;
+    }
+    bool withscores = false;
+    int64_t offset = 0;
+    int64_t count = -1;
+    for (size_t i = 4; i < argv.size(); i++) {
+        std::string opt = upper(argv[i]);
+        if (opt == "WITHSCORES") {
+            withscores = true;
+        } else if (opt == "LIMIT" && i + 2 < argv.size() && parse_integer(argv[i + 1], offset)
+                   && parse_integer(argv[i + 2], count)) {
+            i += 2;
+        } else {
+            reply_error(out, "ERR syntax error");
+            return;
+        }
+    }
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_ZSET, reply_array(out, 0));
+    std::vector<const std::pair<double, std::string>*> items;
+    for (auto& item : v->zorder) {
+        if (item.first < min || (min_ex && item.first == min)) {
+            continue;
+        }
+        if (item.first > max || (max_ex && item.first == max)) {
+            break;
+        }
+        if (offset > 0) {
+            offset--;
+            continue;
+        }
+        if (count >= 0 && (int64_t) items.size() >= count) {
+            break;
+        }
+        items.push_back(&item);
+    }
+    reply_array(out, items.size() * (withscores && !c.resp3 ? 2 : 1));
+    for (auto item : items) {
+        if (withscores && c.resp3) {
+            reply_array(out, 2);
+        }
+        reply_bulk(out, item->second);
+        if (withscores) {
+            reply_double(out, item->first, c.resp3);
+        }
+    }
+}
+
+// set
+
+void RespServer::cmd_sadd(conn& c, const argv_t& argv, std::string& out) {
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_SET, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    if (v == nullptr) {
+        v = &create(argv[1], VALUE_SET);
+    }
+    int64_t count = 0;
+    for (size_t i = 2; i < argv.size(); i++) {
+        count += v->members.insert(argv[i]).second ? 1 : 0;
+    }
+    reply_integer(out, count);
+}
+
+void RespServer::cmd_srem(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_SET, reply_integer(out, 0));
+    int64_t count = 0;
+    for (size_t i = 2; i < argv.size(); i++) {
+        count += (int64_t) v->members.erase(argv[i]);
+    }
+    if (v->members.empty()) {
+        db_.erase(argv[1]);
+    }
+    reply_integer(out, count);
+}
+
+void RespServer::cmd_scard(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_SET, reply_integer(out, 0));
+    reply_integer(out, (int64_t) v->members.size());
+}
+
+void RespServer::cmd_sismember(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_SET, reply_integer(out, 0));
+    reply_integer(out, v->members.count(argv[2]) ? 1 : 0);
+}
+
+void RespServer::cmd_smembers(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_SET, reply_array(out, 0));
+    reply_array(out, v->members.size());
+    for (auto& member : v->members) {
+        reply_bulk(out, member);
+    }
+}
+
+// scan, the cursor is the position in the ordered container, so unlike redis
+// elements added before it shift the walk
+
+namespace {
+
+typedef struct scan_args {
+    uint64_t cursor = 0;
+    int64_t count = 10;
+    std::string match;
+    int type = 0;  // VALUE_*, 0 for every type
+} scan_args_t;
+
+// redis glob: * ? [abc] [^a-c] and \ escapes
+bool glob_match(const char* p, const char* pend, const char* s, const char* send) {
+    while (p < pend) {
+        switch (*p) {
+            case '*': {
+                while (p + 1 < pend && p[1] == '*') {
+                    p++;
+                }
+                for (const char* t = s; t <= send; t++) {
+                    if (glob_match(p + 1, pend, t, send)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            case '?': {
+                if (s == send) {
+                    return false;
+                }
+                s++;
+                break;
+            }
+            case '[': {
+                if (s == send) {
+                    return false;
+                }
+                p++;
+                bool negate = p < pend && *p == '^';
+                p += negate ? 1 : 0;
+                bool found = false;
+                for (; p < pend && *p != ']'; p++) {
+                    if (*p == '\\' && p + 1 < pend) {
+                        p++;
+                        found = found || *p == *s;
+                    } else if (p + 2 < pend && p[1] == '-' && p[2] != ']') {
+                        char lo = std::min(p[0], p[2]);
+                        char hi = std::max(p[0], p[2]);
+                        found = found || (*s >= lo && *s <= hi);
+                        p += 2;
+                    } else {
+                        found = found || *p == *s;
+                    }
+                }
+                if (found == negate) {
+                    return false;
+                }
+                s++;
+                break;
+            }
+            default: {
+                if (*p == '\\' && p + 1 < pend) {
+                    p++;
+                }
+                if (s == send || *p != *s) {
+                    return false;
+                }
+                s++;
+                break;
+            }
+        }
+        p++;
+    }
+    return s == send;
+}
+
+// VALUE_* of a TYPE name, 0 when unknown
+int type_value(const std::string& name) {
+    std::string type = upper(name);
+    if (type == "STRING") {
+        return VALUE_STRING;
+    } else if (type == "HASH") {
+        return VALUE_HASH;
+    } else if (type == "ZSET") {
+        return VALUE_ZSET;
+    } else if (type == "SET") {
+        return VALUE_SET;
+    } else if (type == "STREAM") {
+        return VALUE_STREAM;
+    }
+    return 0;
+}
+
+bool scan_match(const scan_args_t& args, const std::string& str) {
+    return args.match.empty()
+           || glob_match(args.match.data(), args.match.data() + args.match.size(), str.data(), str.data() + str.size());
+}
+
+// argv[first] is the cursor, options follow
+bool parse_scan_args(const RespServer::argv_t& argv, size_t first, bool keyspace, scan_args_t& args,
+                     std::string& err) {
+    int64_t cursor = 0;
+    if (!parse_integer(argv[first], cursor) || cursor < 0) {
+        err = "ERR invalid cursor";
+        return false;
+    }
+    args.cursor = (uint64_t) cursor;
+    for (size_t i = first + 1; i < argv.size(); i += 2) {
+        std::string opt = upper(argv[i]);
+        if (i + 1 >= argv.size()) {
+            err = "ERR syntax error";
+            return false;
+        }
+        if (opt == "MATCH") {
+            args.match = argv[i + 1];
+        } else if (opt == "COUNT") {
+            if (!parse_integer(argv[i + 1], args.count) || args.count < 1) {
+                err = "ERR value is out of range, must be positive";
+                return false;
+            }
+        } else if (opt == "TYPE" && keyspace) {
+            args.type = type_value(argv[i + 1]);
+            if (args.type == 0) {
+                err = "ERR unknown type name '" + argv[i + 1] + "'";
+                return false;
+            }
+        } else {
+            err = "ERR syntax error";
+            return false;
+        }
+    }
+    return true;
+}
+
+// walk count slots of container from the cursor, fn(item) collects the matches.
+// returns the next cursor, 0 at the end
+template <class Container, class Fn>
+uint64_t scan_slots(const Container& container, const scan_args_t& args, Fn fn) {
+    if (args.cursor >= container.size()) {
+        return 0;
+    }
+    auto it = container.begin();
+    std::advance(it, args.cursor);
+    uint64_t pos = args.cursor;
+    for (int64_t n = 0; n < args.count && it != container.end(); n++, ++it, ++pos) {
+        fn(*it);
+    }
+    return it == container.end() ? 0 : pos;
+}
+
+void reply_scan(std::string& out, uint64_t cursor, const std::vector<const std::string*>& items) {
+    reply_array(out, 2);
+    reply_bulk(out, std::to_string(cursor));
+    reply_array(out, items.size());
+    for (auto item : items) {
+        reply_bulk(out, *item);
+    }
+}
+
+}  // namespace
+
+void RespServer::cmd_scan(conn& c, const argv_t& argv, std::string& out) {
+    scan_args_t args;
+    std::string err;
+    if (!parse_scan_args(argv, 1, true, args, err)) {
+        reply_error(out, err);
+        return;
+    }
+    int64_t now = now_ms();
+    std::vector<const std::string*> items;
+    uint64_t cursor = scan_slots(db_, args, [&](const std::pair<const std::string, value_t>& kv) {
+        if (kv.second.expire_ms > 0 && kv.second.expire_ms <= now) {
+            return;
+        }
+        if (args.type != 0 && kv.second.type != args.type) {
+            return;
+        }
+        if (scan_match(args, kv.first)) {
+            items.push_back(&kv.first);
+        }
+    });
+    reply_scan(out, cursor, items);
+}
+
+void RespServer::cmd_hscan(conn& c, const argv_t& argv, std::string& out) {
+    scan_args_t args;
+    std::string err;
+    if (!parse_scan_args(argv, 2, false, args, err)) {
+        reply_error(out, err);
+        return;
+    }
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_HASH, reply_scan(out, 0, {}));
+    std::vector<const std::string*> items;
+    uint64_t cursor = scan_slots(v->hash, args, [&](const std::pair<const std::string, std::string>& kv) {
+        if (scan_match(args, kv.first)) {
+            items.push_back(&kv.first);
+            items.push_back(&kv.second);
+        }
+    });
+    reply_scan(out, cursor, items);
+}
+
+void RespServer::cmd_sscan(conn& c, const argv_t& argv, std::string& out) {
+    scan_args_t args;
+    std::string err;
+    if (!parse_scan_args(argv, 2, false, args, err)) {
+        reply_error(out, err);
+        return;
+    }
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_SET, reply_scan(out, 0, {}));
+    std::vector<const std::string*> items;
+    uint64_t cursor = scan_slots(v->members, args, [&](const std::string& member) {
+        if (scan_match(args, member)) {
+            items.push_back(&member);
+        }
+    });
+    reply_scan(out, cursor, items);
+}
+
+void RespServer::cmd_zscan(conn& c, const argv_t& argv, std::string& out) {
+    scan_args_t args;
+    std::string err;
+    if (!parse_scan_args(argv, 2, false, args, err)) {
+        reply_error(out, err);
+        return;
+    }
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_ZSET, reply_scan(out, 0, {}));
+    // scores are formatted into scores, items point into it
+    std::vector<std::string> scores;
+    std::vector<const std::string*> items;
+    scores.reserve((size_t) std::min<int64_t>(args.count, (int64_t) v->zorder.size()));
+    uint64_t cursor = scan_slots(v->zorder, args, [&](const std::pair<double, std::string>& item) {
+        if (scan_match(args, item.second)) {
+            scores.push_back(format_double(item.first));
+            items.push_back(&item.second);
+            items.push_back(&scores.back());
+        }
+    });
+    reply_scan(out, cursor, items);
+}
+
+// scripting
+
+namespace {
+
+// reads the subset of Lua run_script() understands:
+//     redis.call('ZADD', KEYS[1], ARGV[1], ARGV[2]); return redis.call("EXPIRE", KEYS[1], 60)
+class ScriptReader {
+public:
+    ScriptReader(const std::string& src, const RespServer::argv_t& keys, const RespServer::argv_t& args)
+      : src_(src), keys_(keys), args_(args) {}
+
+    bool end() {
+        skip();
+        return pos_ >= src_.size();
+    }
+
+    // [return] redis.call(arg, ...) or return arg
+    bool statement(bool& ret, bool& call, RespServer::argv_t& argv) {
+        argv.clear();
+        ret = word("return");
+        call = word("redis.call") || word("redis.pcall");
+        if (!call) {
+            argv.emplace_back();
+            return ret && arg(argv.back());
+        }
+        if (!punct('(')) {
+            return false;
+        }
+        do {
+            argv.emplace_back();
+            if (!arg(argv.back())) {
+                return false;
+            }
+        } while (punct(','));
+        return punct(')');
+    }
+
+private:
+    // whitespace, ; and -- comments
+    void skip() {
+        while (pos_ < src_.size()) {
+            if (isspace((unsigned char) src_[pos_]) || src_[pos_] == ';') {
+                pos_++;
+            } else if (src_.compare(pos_, 2, "--") == 0) {
+                pos_ = src_.find('\n', pos_);
+                pos_ = pos_ == std::string::npos ? src_.size() : pos_;
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool punct(char ch) {
+        skip();
+        if (pos_ < src_.size() && src_[pos_] == ch) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool word(const char* w) {
+        skip();
+        size_t len = strlen(w);
+        if (src_.compare(pos_, len, w) != 0) {
+            return false;
+        }
+        if (pos_ + len < src_.size() && (isalnum((unsigned char) src_[pos_ + len]) || src_[pos_ + len] == '_')) {
+            return false;
+        }
+        pos_ += len;
+        return true;
+    }
+
+    // 'string', "string", a number, KEYS[i] or ARGV[i]
+    bool arg(std::string& out) {
+        skip();
+        if (pos_ >= src_.size()) {
+            return false;
+        }
+        char quote = src_[pos_];
+        if (quote == '\'' || quote == '"') {
+            size_t end = src_.find(quote, pos_ + 1);
+            if (end == std::string::npos) {
+                return false;
+            }
+            out = src_.substr(pos_ + 1, end - pos_ - 1);
+            pos_ = end + 1;
+            return true;
+        }
+        const RespServer::argv_t* table = word("KEYS") ? &keys_ : word("ARGV") ? &args_ : nullptr;
+        if (table) {
+            int64_t index = 0;
+            if (!punct('[') || !number(out) || !parse_integer(out, index) || !punct(']')) {
+                return false;
+            }
+            if (index < 1 || index > (int64_t) table->size()) {
+                return false;
+            }
+            out = (*table)[(size_t) index - 1];
+            return true;
+        }
+        return number(out);
+    }
+
+    bool number(std::string& out) {
+        skip();
+        size_t end = pos_;
+        while (end < src_.size() && (isdigit((unsigned char) src_[end]) || src_[end] == '-' || src_[end] == '.')) {
+            end++;
+        }
+        if (end == pos_) {
+            return false;
+        }
+        out = src_.substr(pos_, end - pos_);
+        pos_ = end;
+        return true;
+    }
+
+    const std::string& src_;
+    const RespServer::argv_t& keys_;
+    const RespServer::argv_t& args_;
+    size_t pos_ = 0;
+};
+
+}  // namespace
+
+void RespServer::run_script(conn& c, const std::string& source, const argv_t& argv, std::string& out) {
+    int64_t numkeys = 0;
+    if (!parse_integer(argv[2], numkeys) || numkeys < 0) {
+        reply_error(out, "ERR value is not an integer or out of range");
+        return;
+    }
+    if (numkeys > (int64_t) argv.size() - 3) {
+        reply_error(out, "ERR Number of keys can't be greater than number of args");
+        return;
+    }
+    argv_t keys(argv.begin() + 3, argv.begin() + 3 + numkeys);
+    argv_t args(argv.begin() + 3 + numkeys, argv.end());
+    ScriptReader reader(source, keys, args);
+    std::vector<std::pair<bool, argv_t>> calls;
+    bool ret = false;
+    while (!ret && !reader.end()) {
+        bool call = false;
+        argv_t call_argv;
+        if (!reader.statement(ret, call, call_argv)) {
+            reply_error(out, "ERR Error compiling script, RespServer only runs redis.call() statements");
+            return;
+        }
+        calls.emplace_back(call, std::move(call_argv));
+    }
+    std::string reply;
+    for (auto& call : calls) {
+        reply.clear();
+        if (!call.first) {
+            int64_t val = 0;
+            if (parse_integer(call.second[0], val)) {
+                reply_integer(reply, val);
+            } else {
+                reply_bulk(reply, call.second[0]);
+            }
+        } else {
+            execute(c, call.second, reply);
+        }
+        if (!reply.empty() && reply[0] == '-') {
+            // a failed redis.call() raises, the script stops there
+            reply_error(out, "ERR Error running script: " + reply.substr(1, reply.size() - 3));
+            return;
+        }
+    }
+    // a script that returns nothing replies nil
+    if (ret) {
+        out.append(reply);
+    } else {
+        reply_nil(out, c.resp3);
+    }
+}
+
+void RespServer::cmd_eval(conn& c, const argv_t& argv, std::string& out) {
+    scripts_[RedisScript::sha1_hex(argv[1])] = argv[1];
+    run_script(c, argv[1], argv, out);
+}
+
+void RespServer::cmd_evalsha(conn& c, const argv_t& argv, std::string& out) {
+    auto it = scripts_.find(argv[1]);
+    if (it == scripts_.end()) {
+        reply_error(out, "NOSCRIPT No matching script. Please use EVAL.");
+        return;
+    }
+    run_script(c, it->second, argv, out);
+}
+
+void RespServer::cmd_script(conn& c, const argv_t& argv, std::string& out) {
+    std::string sub = upper(argv[1]);
+    if (sub == "LOAD" && argv.size() == 3) {
+        std::string sha1 = RedisScript::sha1_hex(argv[2]);
+        scripts_[sha1] = argv[2];
+        reply_bulk(out, sha1);
+    } else if (sub == "EXISTS" && argv.size() > 2) {
+        reply_array(out, argv.size() - 2);
+        for (size_t i = 2; i < argv.size(); i++) {
+            reply_integer(out, scripts_.count(argv[i]) ? 1 : 0);
+        }
+    } else if (sub == "FLUSH") {
+        scripts_.clear();
+        reply_status(out, "OK");
+    } else {
+        reply_error(out, "ERR unknown subcommand or wrong number of arguments for 'script|" + argv[1] + "' command");
+    }
+}
+
+// transaction
+
+void RespServer::cmd_watch(conn& c, const argv_t& argv, std::string& out) {
+    if (c.in_multi) {
+        reply_error(out, "ERR WATCH inside MULTI is not allowed");
+        return;
+    }
+    c.watched.insert(argv.begin() + 1, argv.end());
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_unwatch(conn& c, const argv_t& argv, std::string& out) {
+    c.watched.clear();
+    c.watch_dirty = false;
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_multi(conn& c, const argv_t& argv, std::string& out) {
+    if (c.in_multi) {
+        reply_error(out, "ERR MULTI calls can not be nested");
+        return;
+    }
+    c.in_multi = true;
+    c.multi_error = false;
+    c.queued.clear();
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_exec(conn& c, const argv_t& argv, std::string& out) {
+    if (!c.in_multi) {
+        reply_error(out, "ERR EXEC without MULTI");
+        return;
+    }
+    c.in_multi = false;
+    std::vector<argv_t> queued;
+    queued.swap(c.queued);
+    // EXEC unwatches everything, whatever the outcome
+    bool dirty = c.watch_dirty;
+    c.watched.clear();
+    c.watch_dirty = false;
+    if (c.multi_error) {
+        reply_error(out, "EXECABORT Transaction discarded because of previous errors.");
+        return;
+    }
+    if (dirty) {
+        out.append(c.resp3 ? "_\r\n" : "*-1\r\n");
+        return;
+    }
+    reply_array(out, queued.size());
+    for (auto& cmd : queued) {
+        execute(c, cmd, out);
+    }
+}
+
+void RespServer::cmd_discard(conn& c, const argv_t& argv, std::string& out) {
+    if (!c.in_multi) {
+        reply_error(out, "ERR DISCARD without MULTI");
+        return;
+    }
+    c.in_multi = false;
+    c.queued.clear();
+    c.watched.clear();
+    c.watch_dirty = false;
+    reply_status(out, "OK");
+}
+
+// stream
+
+namespace {
+
+typedef std::pair<uint64_t, uint64_t> stream_id_t;
+typedef std::vector<std::pair<stream_id_t, const std::vector<std::string>*>> stream_entries_t;
+
+// ms-seq, or ms alone with seq missing_seq
+bool parse_stream_id(const std::string& str, stream_id_t& id, uint64_t missing_seq = 0) {
+    int64_t ms = 0;
+    int64_t seq = 0;
+    size_t dash = str.find('-');
+    if (dash == std::string::npos) {
+        if (!parse_integer(str, ms) || ms < 0) {
+            return false;
+        }
+        id = stream_id_t((uint64_t) ms, missing_seq);
+        return true;
+    }
+    if (!parse_integer(str.substr(0, dash), ms) || !parse_integer(str.substr(dash + 1), seq) || ms < 0 || seq < 0) {
+        return false;
+    }
+    id = stream_id_t((uint64_t) ms, (uint64_t) seq);
+    return true;
+}
+
+std::string format_stream_id(const stream_id_t& id) {
+    return std::to_string(id.first) + "-" + std::to_string(id.second);
+}
+
+void reply_invalid_stream_id(std::string& out) {
+    reply_error(out, "ERR Invalid stream ID specified as stream command argument");
+}
+
+// [id, [field value ...]], nil instead of the fields of a deleted entry
+void reply_stream_entries(std::string& out, const stream_entries_t& entries, bool resp3) {
+    reply_array(out, entries.size());
+    for (auto& entry : entries) {
+        reply_array(out, 2);
+        reply_bulk(out, format_stream_id(entry.first));
+        if (entry.second == nullptr) {
+            out.append(resp3 ? "_\r\n" : "*-1\r\n");
+            continue;
+        }
+        reply_array(out, entry.second->size());
+        for (auto& str : *entry.second) {
+            reply_bulk(out, str);
+        }
+    }
+}
+
+}  // namespace
+
+void RespServer::cmd_xadd(conn& c, const argv_t& argv, std::string& out) {
+    bool nomkstream = false;
+    int64_t maxlen = -1;
+    size_t i = 2;
+    for (; i < argv.size(); i++) {
+        std::string opt = upper(argv[i]);
+        if (opt == "NOMKSTREAM") {
+            nomkstream = true;
+        } else if (opt == "MAXLEN") {
+            // = and ~ trim alike, to exactly maxlen entries
+            if (i + 1 < argv.size() && (argv[i + 1] == "=" || argv[i + 1] == "~")) {
+                i++;
+            }
+            if (i + 1 >= argv.size() || !parse_integer(argv[i + 1], maxlen) || maxlen < 0) {
+                reply_error(out, "ERR value is out of range, must be positive");
+                return;
+            }
+            i++;
+        } else {
+            break;
+        }
+    }
+    // the id, then field value pairs
+    if (i + 1 >= argv.size() || (argv.size() - i - 1) % 2 != 0) {
+        reply_error(out, "ERR wrong number of arguments for 'xadd' command");
+        return;
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_STREAM, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    stream_id_t last = v ? v->last_id : stream_id_t(0, 0);
+    stream_id_t id;
+    if (argv[i] == "*") {
+        uint64_t ms = (uint64_t) now_ms();
+        id = ms > last.first ? stream_id_t(ms, 0) : stream_id_t(last.first, last.second + 1);
+    } else if (!parse_stream_id(argv[i], id)) {
+        reply_invalid_stream_id(out);
+        return;
+    } else if (id <= last) {
+        reply_error(out, "ERR The ID specified in XADD is equal or smaller than the target stream top item");
+        return;
+    }
+    if (v == nullptr) {
+        if (nomkstream) {
+            reply_nil(out, c.resp3);
+            return;
+        }
+        v = &create(argv[1], VALUE_STREAM);
+    }
+    v->entries[id].assign(argv.begin() + i + 1, argv.end());
+    v->last_id = id;
+    while (maxlen >= 0 && v->entries.size() > (size_t) maxlen) {
+        v->entries.erase(v->entries.begin());
+    }
+    reply_bulk(out, format_stream_id(id));
+}
+
+void RespServer::cmd_xlen(conn& c, const argv_t& argv, std::string& out) {
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_STREAM, reply_integer(out, 0));
+    reply_integer(out, (int64_t) v->entries.size());
+}
+
+void RespServer::cmd_xrange(conn& c, const argv_t& argv, std::string& out) {
+    stream_id_t start(0, 0);
+    stream_id_t end(UINT64_MAX, UINT64_MAX);
+    int64_t count = -1;
+    if ((argv[2] != "-" && !parse_stream_id(argv[2], start))
+        || (argv[3] != "+" && !parse_stream_id(argv[3], end, UINT64_MAX))) {
+        reply_invalid_stream_id(out);
+        return;
+    }
+    if (argv.size() == 6 && upper(argv[4]) == "COUNT") {
+        parse_integer(argv[5], count);
+    } else if (argv.size() != 4) {
+        reply_error(out, "ERR syntax error");
+        return;
+    }
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_STREAM, reply_array(out, 0));
+    stream_entries_t entries;
+    for (auto it = v->entries.lower_bound(start); it != v->entries.end() && it->first <= end; ++it) {
+        if (count >= 0 && (int64_t) entries.size() >= count) {
+            break;
+        }
+        entries.emplace_back(it->first, &it->second);
+    }
+    reply_stream_entries(out, entries, c.resp3);
+}
+
+void RespServer::cmd_xgroup(conn& c, const argv_t& argv, std::string& out) {
+    std::string sub = upper(argv[1]);
+    if (sub == "DESTROY") {
+        LOOKUP_OR_REPLY(v, argv[2], VALUE_STREAM, reply_integer(out, 0));
+        reply_integer(out, (int64_t) v->groups.erase(argv[3]));
+        return;
+    }
+    if (sub != "CREATE" || argv.size() < 5) {
+        reply_error(out, "ERR unknown subcommand or wrong number of arguments for '" + argv[1] + "'");
+        return;
+    }
+    // XGROUP CREATE key group id [MKSTREAM]
+    bool mkstream = argv.size() > 5 && upper(argv[5]) == "MKSTREAM";
+    bool wrong_type = false;
+    value_t* v = lookup(argv[2], VALUE_STREAM, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    stream_id_t id = v ? v->last_id : stream_id_t(0, 0);
+    if (argv[4] != "$" && !parse_stream_id(argv[4], id)) {
+        reply_invalid_stream_id(out);
+        return;
+    }
+    if (v == nullptr) {
+        if (!mkstream) {
+            reply_error(out, "ERR The XGROUP subcommand requires the key to exist. Note that for CREATE you may want "
+                             "to use the MKSTREAM option to create an empty stream automatically.");
+            return;
+        }
+        v = &create(argv[2], VALUE_STREAM);
+    }
+    if (v->groups.count(argv[3])) {
+        reply_error(out, "BUSYGROUP Consumer Group name already exists");
+        return;
+    }
+    v->groups[argv[3]].last_delivered = id;
+    reply_status(out, "OK");
+}
+
+void RespServer::cmd_xreadgroup(conn& c, const argv_t& argv, std::string& out) {
+    if (upper(argv[1]) != "GROUP") {
+        reply_error(out, "ERR syntax error");
+        return;
+    }
+    const std::string& group = argv[2];
+    const std::string& consumer = argv[3];
+    int64_t count = 0;
+    int64_t block_ms = -1;
+    bool noack = false;
+    size_t i = 4;
+    for (; i < argv.size(); i++) {
+        std::string opt = upper(argv[i]);
+        if (opt == "COUNT" && i + 1 < argv.size() && parse_integer(argv[i + 1], count)) {
+            i++;
+        } else if (opt == "BLOCK" && i + 1 < argv.size() && parse_integer(argv[i + 1], block_ms) && block_ms >= 0) {
+            i++;
+        } else if (opt == "NOACK") {
+            noack = true;
+        } else if (opt == "STREAMS") {
+            i++;
+            break;
+        } else {
+            reply_error(out, "ERR syntax error");
+            return;
+        }
+    }
+    size_t streams = (argv.size() - i) / 2;
+    if (i >= argv.size() || (argv.size() - i) % 2 != 0) {
+        reply_error(out, "ERR Unbalanced 'xreadgroup' list of streams: for each stream key an ID or '>' must be "
+                         "specified.");
+        return;
+    }
+
+    // every stream is checked before any entry is handed out
+    std::vector<value_t*> values(streams);
+    std::vector<stream_id_t> starts(streams);
+    bool history = false;
+    for (size_t k = 0; k < streams; k++) {
+        const std::string& key = argv[i + k];
+        const std::string& id = argv[i + streams + k];
+        bool wrong_type = false;
+        values[k] = lookup(key, VALUE_STREAM, wrong_type);
+        if (wrong_type) {
+            c.blocked.clear();
+            reply_wrong_type(out);
+            return;
+        }
+        if (values[k] == nullptr || values[k]->groups.count(group) == 0) {
+            c.blocked.clear();
+            reply_error(out, "NOGROUP No such key '" + key + "' or consumer group '" + group
+                               + "' in XREADGROUP with GROUP option");
+            return;
+        }
+        if (id != ">") {
+            history = true;
+            if (!parse_stream_id(id, starts[k])) {
+                c.blocked.clear();
+                reply_invalid_stream_id(out);
+                return;
+            }
+        }
+    }
+
+    int64_t now = now_ms();
+    std::vector<stream_entries_t> found(streams);
+    size_t total = 0;
+    for (size_t k = 0; k < streams; k++) {
+        value_t& v = *values[k];
+        stream_group_t& g = v.groups[group];
+        stream_entries_t& entries = found[k];
+        if (argv[i + streams + k] == ">") {
+            for (auto it = v.entries.upper_bound(g.last_delivered); it != v.entries.end(); ++it) {
+                if (count > 0 && (int64_t) entries.size() >= count) {
+                    break;
+                }
+                entries.emplace_back(it->first, &it->second);
+                g.last_delivered = it->first;
+                if (!noack) {
+                    pending_entry_t& pending = g.pending[it->first];
+                    pending.consumer = consumer;
+                    pending.delivered_ms = now;
+                    pending.deliveries = 1;
+                }
+            }
+        } else {
+            // this consumer's pending entries, nil fields once deleted from the stream
+            for (auto it = g.pending.upper_bound(starts[k]); it != g.pending.end(); ++it) {
+                if (count > 0 && (int64_t) entries.size() >= count) {
+                    break;
+                }
+                if (it->second.consumer != consumer) {
+                    continue;
+                }
+                auto entry = v.entries.find(it->first);
+                entries.emplace_back(it->first, entry == v.entries.end() ? nullptr : &entry->second);
+                it->second.delivered_ms = now;
+                it->second.deliveries++;
+            }
+        }
+        total += entries.size();
+    }
+
+    if (total == 0 && !history) {
+        if (block_ms >= 0 && !c.in_multi) {
+            // retry_blocked() runs it again until then, the first deadline holds
+            if (c.blocked.empty()) {
+                c.blocked = argv;
+                c.blocked_until_us = block_ms == 0 ? INT64_MAX : now_us() + block_ms * 1000;
+            }
+            return;
+        }
+        c.blocked.clear();
+        out.append(c.resp3 ? "_\r\n" : "*-1\r\n");
+        return;
+    }
+    c.blocked.clear();
+    // [[key, entries] ...], a map of key to entries in RESP3. new entries leave quiet streams out
+    size_t replied = 0;
+    for (size_t k = 0; k < streams; k++) {
+        replied += history || !found[k].empty() ? 1 : 0;
+    }
+    if (c.resp3) {
+        reply_map(out, replied, true);
+    } else {
+        reply_array(out, replied);
+    }
+    for (size_t k = 0; k < streams; k++) {
+        if (!history && found[k].empty()) {
+            continue;
+        }
+        if (!c.resp3) {
+            reply_array(out, 2);
+        }
+        reply_bulk(out, argv[i + k]);
+        reply_stream_entries(out, found[k], c.resp3);
+    }
+}
+
+void RespServer::retry_blocked(conn& c, int64_t now) {
+    argv_t argv = c.blocked;
+    std::string reply;
+    {
+        std::lock_guard<std::mutex> lock(db_mutex_);
+        cmd_xreadgroup(c, argv, reply);
+    }
+    if (!c.blocked.empty()) {
+        if (now < c.blocked_until_us) {
+            return;
+        }
+        c.blocked.clear();
+        reply.assign(c.resp3 ? "_\r\n" : "*-1\r\n");
+    }
+    if (c.delayed.empty()) {
+        c.out.append(reply);
+    } else {
+        c.delayed.emplace_back(c.delayed.back().first, std::move(reply));
+    }
+    // the commands that arrived meanwhile
+    process_input(c);
+}
+
+void RespServer::cmd_xack(conn& c, const argv_t& argv, std::string& out) {
+    std::vector<stream_id_t> ids(argv.size() - 3);
+    for (size_t i = 3; i < argv.size(); i++) {
+        if (!parse_stream_id(argv[i], ids[i - 3])) {
+            reply_invalid_stream_id(out);
+            return;
+        }
+    }
+    LOOKUP_OR_REPLY(v, argv[1], VALUE_STREAM, reply_integer(out, 0));
+    auto g = v->groups.find(argv[2]);
+    int64_t acked = 0;
+    for (size_t i = 0; g != v->groups.end() && i < ids.size(); i++) {
+        acked += (int64_t) g->second.pending.erase(ids[i]);
+    }
+    reply_integer(out, acked);
+}
+
+void RespServer::cmd_xpending(conn& c, const argv_t& argv, std::string& out) {
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_STREAM, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    auto g = v ? v->groups.find(argv[2]) : std::map<std::string, stream_group_t>::iterator();
+    if (v == nullptr || g == v->groups.end()) {
+        reply_error(out, "NOGROUP No such key '" + argv[1] + "' or consumer group '" + argv[2] + "'");
+        return;
+    }
+    // summary: count, smallest and largest id, entries per consumer
+    const std::map<stream_id_t, pending_entry_t>& pending = g->second.pending;
+    reply_array(out, 4);
+    reply_integer(out, (int64_t) pending.size());
+    if (pending.empty()) {
+        reply_nil(out, c.resp3);
+        reply_nil(out, c.resp3);
+        out.append(c.resp3 ? "_\r\n" : "*-1\r\n");
+        return;
+    }
+    reply_bulk(out, format_stream_id(pending.begin()->first));
+    reply_bulk(out, format_stream_id(pending.rbegin()->first));
+    std::map<std::string, int64_t> consumers;
+    for (auto& kv : pending) {
+        consumers[kv.second.consumer]++;
+    }
+    reply_array(out, consumers.size());
+    for (auto& kv : consumers) {
+        reply_array(out, 2);
+        reply_bulk(out, kv.first);
+        reply_bulk(out, std::to_string(kv.second));
+    }
+}
+
+void RespServer::cmd_xautoclaim(conn& c, const argv_t& argv, std::string& out) {
+    // XAUTOCLAIM key group consumer min-idle-time start [COUNT count] [JUSTID]
+    int64_t min_idle = 0;
+    stream_id_t start;
+    if (!parse_integer(argv[4], min_idle) || min_idle < 0) {
+        reply_error(out, "ERR Invalid min-idle-time argument for XAUTOCLAIM");
+        return;
+    }
+    if (argv[5] != "-" && !parse_stream_id(argv[5], start)) {
+        reply_invalid_stream_id(out);
+        return;
+    }
+    int64_t count = 100;
+    bool justid = false;
+    for (size_t i = 6; i < argv.size(); i++) {
+        std::string opt = upper(argv[i]);
+        if (opt == "COUNT" && i + 1 < argv.size() && parse_integer(argv[i + 1], count) && count > 0) {
+            i++;
+        } else if (opt == "JUSTID") {
+            justid = true;
+        } else {
+            reply_error(out, "ERR syntax error");
+            return;
+        }
+    }
+    bool wrong_type = false;
+    value_t* v = lookup(argv[1], VALUE_STREAM, wrong_type);
+    if (wrong_type) {
+        reply_wrong_type(out);
+        return;
+    }
+    auto g = v ? v->groups.find(argv[2]) : std::map<std::string, stream_group_t>::iterator();
+    if (v == nullptr || g == v->groups.end()) {
+        reply_error(out, "NOGROUP No such key '" + argv[1] + "' or consumer group '" + argv[2] + "'");
+        return;
+    }
+
+    int64_t now = now_ms();
+    std::map<stream_id_t, pending_entry_t>& pending = g->second.pending;
+    stream_entries_t claimed;
+    std::vector<stream_id_t> deleted;
+    auto it = pending.lower_bound(start);
+    while (it != pending.end() && (int64_t) claimed.size() < count) {
+        if (now - it->second.delivered_ms < min_idle) {
+            ++it;
+            continue;
+        }
+        // entries gone from the stream leave the pending list too
+        auto entry = v->entries.find(it->first);
+        if (entry == v->entries.end()) {
+            deleted.push_back(it->first);
+            it = pending.erase(it);
+            continue;
+        }
+        it->second.consumer = argv[3];
+        it->second.delivered_ms = now;
+        it->second.deliveries += justid ? 0 : 1;
+        claimed.emplace_back(it->first, &entry->second);
+        ++it;
+    }
+
+    // [next start or 0-0, claimed entries, deleted ids]
+    reply_array(out, 3);
+    reply_bulk(out, it == pending.end() ? "0-0" : format_stream_id(it->first));
+    if (justid) {
+        reply_array(out, claimed.size());
+        for (auto& entry : claimed) {
+            reply_bulk(out, format_stream_id(entry.first));
+        }
+    } else {
+        reply_stream_entries(out, claimed, c.resp3);
+    }
+    reply_array(out, deleted.size());
+    for (auto& id : deleted) {
+        reply_bulk(out, format_stream_id(id));
+    }
+}
+
+#undef LOOKUP_OR_REPLY
+
+// pub/sub
+
+namespace {
+
+// RESP3 connections get pub/sub replies and messages as pushes
+void reply_push(std::string& out, size_t len, bool resp3) {
+    out.append(resp3 ? ">" : "*");
+    out.append(std::to_string(len));
+    out.append("\r\n");
+}
+
+std::string lower(const std::string& s) {
+    std::string r(s);
+    std::transform(r.begin(), r.end(), r.begin(), ::tolower);
+    return r;
+}
+
+}  // namespace
+
+void RespServer::cmd_subscribe(conn& c, const argv_t& argv, std::string& out) {
+    std::string name = upper(argv[0]);
+    bool unsubscribe = name.find("UNSUBSCRIBE") != std::string::npos;
+    // what comes before SUBSCRIBE or UNSUBSCRIBE: nothing, P or S
+    char kind = name.size() > (unsubscribe ? 11 : 9) ? name[0] : 0;
+    std::set<std::string>& subs = kind == 'P' ? c.patterns : kind == 'S' ? c.shard_channels : c.channels;
+    std::string verb = lower(name);
+
+    argv_t names(argv.begin() + 1, argv.end());
+    if (unsubscribe && names.empty()) {
+        names.assign(subs.begin(), subs.end());
+        if (names.empty()) {
+            reply_push(out, 3, c.resp3);
+            reply_bulk(out, verb);
+            reply_nil(out, c.resp3);
+            reply_integer(out, 0);
+            return;
+        }
+    }
+    for (auto& sub : names) {
+        if (unsubscribe) {
+            subs.erase(sub);
+        } else {
+            subs.insert(sub);
+        }
+        // shard channels are counted apart
+        size_t count = kind == 'S' ? c.shard_channels.size() : c.channels.size() + c.patterns.size();
+        reply_push(out, 3, c.resp3);
+        reply_bulk(out, verb);
+        reply_bulk(out, sub);
+        reply_integer(out, (int64_t) count);
+    }
+}
+
+void RespServer::cmd_publish(conn& c, const argv_t& argv, std::string& out) {
+    bool shard = upper(argv[0]) == "SPUBLISH";
+    const std::string& channel = argv[1];
+    const std::string& payload = argv[2];
+    int64_t receivers = 0;
+    for (auto& other : conns_) {
+        if (other->dead) {
+            continue;
+        }
+        if (shard) {
+            if (other->shard_channels.count(channel)) {
+                reply_push(other->out, 3, other->resp3);
+                reply_bulk(other->out, "smessage");
+                reply_bulk(other->out, channel);
+                reply_bulk(other->out, payload);
+                receivers++;
+            }
+            continue;
+        }
+        if (other->channels.count(channel)) {
+            reply_push(other->out, 3, other->resp3);
+            reply_bulk(other->out, "message");
+            reply_bulk(other->out, channel);
+            reply_bulk(other->out, payload);
+            receivers++;
+        }
+        for (auto& pattern : other->patterns) {
+            if (glob_match(pattern.data(), pattern.data() + pattern.size(), channel.data(),
+                           channel.data() + channel.size())) {
+                reply_push(other->out, 4, other->resp3);
+                reply_bulk(other->out, "pmessage");
+                reply_bulk(other->out, pattern);
+                reply_bulk(other->out, channel);
+                reply_bulk(other->out, payload);
+                receivers++;
+            }
+        }
+    }
+    reply_integer(out, receivers);
+}
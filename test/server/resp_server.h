@@ -0,0 +1,282 @@
+/*
+ *  write by chenshan@mchz.com.cn
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum {
+    RESP_FAULT_NONE = 0,
+    RESP_FAULT_ERROR,    // reply "-ERR injected fault" instead of running the command
+    RESP_FAULT_CLOSE,    // close the connection instead of replying
+    RESP_FAULT_TIMEOUT,  // swallow the command, the client never gets a reply
+};
+
+// Small single-threaded stand-in for redis, serving the commands rcli uses
+// over TCP and Unix sockets so tests and benchmarks can run without a server
+// installed. Built with rcli_ENABLE_SSL it also listens for TLS.
+//
+// Replies can be held back by an injected latency, and every n-th command can
+// be turned into a fault. Both can be changed while the server runs.
+//
+// HELLO 3 and CLIENT TRACKING are understood well enough to send RESP3
+// invalidation pushes, in default mode with REDIRECT and in BCAST mode.
+// PUBLISH and SPUBLISH reach the subscribers of this server, as pushes to
+// RESP3 connections. XREADGROUP BLOCK parks the connection until an entry
+// arrives or the time is up.
+//
+// EVAL does not embed Lua: scripts may only be a sequence of redis.call()
+// statements, the last one optionally returned.
+//
+//     RespServer server;
+//     server.set_password("pwd");
+//     server.listen_tcp("127.0.0.1", 0);
+//     server.start();
+//     cli.init("127.0.0.1", server.port(), "pwd");
+class RespServer {
+public:
+    typedef std::vector<std::string> argv_t;
+
+    RespServer();
+    virtual ~RespServer();
+
+    RespServer(const RespServer&) = delete;
+    RespServer& operator=(const RespServer&) = delete;
+
+    // empty password disables AUTH
+    void set_password(const std::string& pwd) { pwd_ = pwd; }
+    // delay added to every reply
+    void set_latency_us(uint32_t latency_us) { latency_us_ = latency_us; }
+    // apply mode to every n-th command, 0 disables faults
+    void set_fault(int mode, uint32_t every_n) {
+        fault_mode_ = mode;
+        fault_every_ = every_n;
+    }
+
+    // cluster mode, off until slots are assigned. CLUSTER SLOTS lists the
+    // owners, a key of a slot owned by another node gets MOVED and a slot
+    // migrating elsewhere answers ASK. ASKING lets the next command into a
+    // slot this server does not own. addr is "host:port", this server is the
+    // address of any of its TCP and TLS listeners
+    void assign_slots(uint16_t start, uint16_t end, const std::string& addr);
+    // an empty addr ends the migration
+    void migrate_slot(uint16_t slot, const std::string& addr);
+
+    // port 0 picks a free port, read it back with port()
+    bool listen_tcp(const std::string& host, uint32_t port);
+    bool listen_unix(const std::string& path);
+    uint32_t port() const { return port_; }
+#ifdef RCLI_WITH_SSL
+    // TLS on a port of its own, read it back with tls_port(). the certificate is
+    // self-signed for localhost and 127.0.0.1, made on first use, and with
+    // require_client_cert clients must present it too
+    bool listen_tls(const std::string& host, uint32_t port, bool require_client_cert = false);
+    uint32_t tls_port() const { return tls_port_; }
+    // the certificate and its key as PEM files, for clients to trust and present
+    bool write_tls_cert(const std::string& cert_file, const std::string& key_file);
+#endif
+    const std::string& get_last_error() const { return error_str_; }
+
+    bool start();
+    void stop();
+
+    // drop every key
+    void flush_all();
+    // commands received and connections accepted since start
+    uint64_t commands() const { return commands_.load(); }
+    uint64_t connections() const { return connections_.load(); }
+
+private:
+    struct conn;
+
+    // ms-seq of a stream entry
+    typedef std::pair<uint64_t, uint64_t> stream_id_t;
+
+    typedef struct pending_entry {
+        std::string consumer;
+        int64_t delivered_ms = 0;
+        uint64_t deliveries = 0;
+    } pending_entry_t;
+
+    typedef struct stream_group {
+        stream_id_t last_delivered;
+        std::map<stream_id_t, pending_entry_t> pending;
+    } stream_group_t;
+
+    typedef struct value {
+        int type = 0;
+        std::string str;
+        std::map<std::string, std::string> hash;
+        std::map<std::string, double> zscore;
+        std::set<std::pair<double, std::string>> zorder;
+        std::set<std::string> members;
+        // stream: field value field value ... per entry
+        std::map<stream_id_t, std::vector<std::string>> entries;
+        stream_id_t last_id;
+        std::map<std::string, stream_group_t> groups;
+        int64_t expire_ms = 0;  // unix time in ms, 0 never expires
+    } value_t;
+
+    typedef void (RespServer::*handler_t)(conn& c, const argv_t& argv, std::string& out);
+    typedef struct command {
+        handler_t handler;
+        int arity;  // like redis: n requires exactly n arguments, -n at least n
+        int flags;  // CMD_* in resp_server.cpp, which keys are read or written for tracking
+    } command_t;
+
+    // bound port in bound
+    bool open_tcp(const std::string& host, uint32_t port, uint32_t& bound);
+    void run();
+    void accept_conn(int fd);
+    bool read_conn(conn& c);
+    // run the commands buffered in c.in, until one blocks
+    void process_input(conn& c);
+    // run a blocked XREADGROUP again, reply nil once its BLOCK time passed
+    void retry_blocked(conn& c, int64_t now);
+    bool parse(conn& c, argv_t& argv, bool& error);
+    void dispatch(conn& c, const argv_t& argv);
+    void execute(conn& c, const argv_t& argv, std::string& out);
+    bool write_conn(conn& c);
+
+    // nullptr when missing, expired or of another type than type
+    value_t* lookup(const std::string& key, int type, bool& wrong_type);
+    value_t& create(const std::string& key, int type);
+
+    // client tracking
+    void track(conn& c, const argv_t& argv, int flags);
+    // keys written by argv, for tracking clients and WATCH
+    void invalidate(const argv_t& argv, int flags);
+    void invalidate_key(const std::string& key);
+    // tell every tracking client to drop its whole cache
+    void invalidate_all();
+    // where the invalidations of the connection reader go, 0 once it closed or
+    // turned tracking off: like redis the tracking dies with the reader
+    uint64_t tracking_target(uint64_t reader);
+    void push_invalidate(uint64_t target, const std::string* key);
+    // reply MOVED, ASK or CROSSSLOT when the keys of argv are not served here
+    bool redirect_keys(conn& c, const argv_t& argv, int flags, std::string& out);
+    // mark the transactions watching key dirty, every one for nullptr
+    void touch_watched(const std::string* key);
+
+    // run the redis.call() statements of a script, see cmd_eval
+    void run_script(conn& c, const std::string& source, const argv_t& argv, std::string& out);
+
+    // keys
+    void cmd_ping(conn& c, const argv_t& argv, std::string& out);
+    void cmd_echo(conn& c, const argv_t& argv, std::string& out);
+    void cmd_ok(conn& c, const argv_t& argv, std::string& out);
+    void cmd_auth(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hello(conn& c, const argv_t& argv, std::string& out);
+    void cmd_client(conn& c, const argv_t& argv, std::string& out);
+    void cmd_quit(conn& c, const argv_t& argv, std::string& out);
+    void cmd_flushall(conn& c, const argv_t& argv, std::string& out);
+    void cmd_cluster(conn& c, const argv_t& argv, std::string& out);
+    void cmd_asking(conn& c, const argv_t& argv, std::string& out);
+    void cmd_dbsize(conn& c, const argv_t& argv, std::string& out);
+    void cmd_get(conn& c, const argv_t& argv, std::string& out);
+    void cmd_set(conn& c, const argv_t& argv, std::string& out);
+    void cmd_mget(conn& c, const argv_t& argv, std::string& out);
+    void cmd_mset(conn& c, const argv_t& argv, std::string& out);
+    void cmd_incrby(conn& c, const argv_t& argv, std::string& out);
+    void cmd_del(conn& c, const argv_t& argv, std::string& out);
+    void cmd_exists(conn& c, const argv_t& argv, std::string& out);
+    void cmd_expire(conn& c, const argv_t& argv, std::string& out);
+    void cmd_ttl(conn& c, const argv_t& argv, std::string& out);
+    // hash map
+    void cmd_hset(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hget(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hexists(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hdel(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hlen(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hkeys(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hgetall(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hincrby(conn& c, const argv_t& argv, std::string& out);
+    // sorted set
+    void cmd_zadd(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zincrby(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zcard(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zscore(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zrem(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zrank(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zrange(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zrangebyscore(conn& c, const argv_t& argv, std::string& out);
+    // set
+    void cmd_sadd(conn& c, const argv_t& argv, std::string& out);
+    void cmd_srem(conn& c, const argv_t& argv, std::string& out);
+    void cmd_scard(conn& c, const argv_t& argv, std::string& out);
+    void cmd_sismember(conn& c, const argv_t& argv, std::string& out);
+    void cmd_smembers(conn& c, const argv_t& argv, std::string& out);
+    // scan
+    void cmd_scan(conn& c, const argv_t& argv, std::string& out);
+    void cmd_hscan(conn& c, const argv_t& argv, std::string& out);
+    void cmd_sscan(conn& c, const argv_t& argv, std::string& out);
+    void cmd_zscan(conn& c, const argv_t& argv, std::string& out);
+    // scripting
+    void cmd_eval(conn& c, const argv_t& argv, std::string& out);
+    void cmd_evalsha(conn& c, const argv_t& argv, std::string& out);
+    void cmd_script(conn& c, const argv_t& argv, std::string& out);
+    // transaction
+    void cmd_watch(conn& c, const argv_t& argv, std::string& out);
+    void cmd_unwatch(conn& c, const argv_t& argv, std::string& out);
+    void cmd_multi(conn& c, const argv_t& argv, std::string& out);
+    void cmd_exec(conn& c, const argv_t& argv, std::string& out);
+    void cmd_discard(conn& c, const argv_t& argv, std::string& out);
+    // stream
+    void cmd_xadd(conn& c, const argv_t& argv, std::string& out);
+    void cmd_xlen(conn& c, const argv_t& argv, std::string& out);
+    void cmd_xrange(conn& c, const argv_t& argv, std::string& out);
+    void cmd_xgroup(conn& c, const argv_t& argv, std::string& out);
+    void cmd_xreadgroup(conn& c, const argv_t& argv, std::string& out);
+    void cmd_xack(conn& c, const argv_t& argv, std::string& out);
+    void cmd_xpending(conn& c, const argv_t& argv, std::string& out);
+    void cmd_xautoclaim(conn& c, const argv_t& argv, std::string& out);
+    // pub/sub
+    void cmd_subscribe(conn& c, const argv_t& argv, std::string& out);
+    void cmd_publish(conn& c, const argv_t& argv, std::string& out);
+
+    std::map<std::string, command_t> commands_table_;
+
+    std::string pwd_;
+    std::atomic<uint32_t> latency_us_;
+    std::atomic<int> fault_mode_;
+    std::atomic<uint32_t> fault_every_;
+
+    std::vector<int> listen_fds_;
+    std::string unix_path_;
+    uint32_t port_ = 0;
+    std::set<std::string> addrs_;  // "host:port" of the TCP and TLS listeners
+    // SSL_CTX, EVP_PKEY and X509 of the TLS listeners in tls_fds_
+    void* tls_ctx_ = nullptr;
+    void* tls_key_ = nullptr;
+    void* tls_cert_ = nullptr;
+    std::set<int> tls_fds_;
+    uint32_t tls_port_ = 0;
+    std::string error_str_;
+
+    int wake_fds_[2];
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::vector<std::unique_ptr<conn>> conns_;
+
+    std::mutex db_mutex_;
+    std::map<std::string, value_t> db_;
+    // key -> ids of the tracking connections that read it, server thread only
+    std::map<std::string, std::set<uint64_t>> tracking_table_;
+    uint64_t next_id_ = 0;
+    // "host:port" owning each slot, empty outside cluster mode, under db_mutex_
+    std::vector<std::string> slot_owner_;
+    std::map<uint16_t, std::string> migrating_;
+    // SHA1 -> source of the scripts loaded by SCRIPT LOAD or EVAL, server thread only
+    std::map<std::string, std::string> scripts_;
+
+    std::atomic<uint64_t> commands_;
+    std::atomic<uint64_t> connections_;
+};
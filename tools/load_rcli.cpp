@@ -0,0 +1,100 @@
+#include "opt_parser.h"
+#include "rcli.h"
+#include "rcli_loader.h"
+#include "rcli_tls.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+static void split(const std::string& s, char delim, std::vector<std::string>* ret) {
+    size_t last = 0;
+    size_t index = s.find(delim, last);
+    while (index != std::string::npos) {
+        ret->push_back(s.substr(last, index - last));
+        last = index + 1;
+        index = s.find(delim, last);
+    }
+    ret->push_back(s.substr(last));
+}
+
+static void usage(const char* app) {
+    fprintf(stderr,
+            "usage: %s -h host:port:pwd -f file [options]\n"
+            "  -f file        commands to load, - for stdin\n"
+            "  --format name  resp or tsv (default: resp when the input starts with '*')\n"
+            "  -c conns       connections, the commands spread over them by key (default 1)\n"
+            "  -W window      commands in flight per connection (default 4096)\n"
+            "  -u path        connect over this unix socket\n"
+            "  -t msec        give up when a connection got no reply for this long (default 30000)\n"
+            "  --tls          connect with TLS\n"
+            "  --cacert file  CA to verify the server with instead of the system's\n"
+            "  --sni name     server name to send and verify instead of the host\n"
+            "  -q             print only the summary, not every error reply\n",
+            app);
+}
+
+int main(int argc, char* argv[]) {
+    std::string host;
+    std::string file;
+    int format = RedisBulkLoader::FORMAT_AUTO;
+    bool help = false;
+    bool quiet = false;
+    bool tls = false;
+    RedisTlsContext::tls_options_t tls_opts;
+    RedisBulkLoader::loader_options_t opts;
+
+    OptionParser optr;
+    optr.add_opt("-h", true, [&](int id, const char* str) { host.assign(str); });
+    optr.add_opt("-f", true, [&](int id, const char* str) { file.assign(str); });
+    optr.add_opt("--format", true, [&](int id, const char* str) {
+        format = std::string(str) == "resp" ? RedisBulkLoader::FORMAT_RESP
+                 : std::string(str) == "tsv" ? RedisBulkLoader::FORMAT_TSV
+                                             : -1;
+    });
+    optr.add_opt("-c", true,
+                 [&](int id, const char* str) { opts.connections = (uint32_t) strtoul(str, nullptr, 10); });
+    optr.add_opt("-W", true, [&](int id, const char* str) { opts.window = strtoul(str, nullptr, 10); });
+    optr.add_opt("-u", true, [&](int id, const char* str) { opts.conn.unix_path.assign(str); });
+    optr.add_opt("-t", true,
+                 [&](int id, const char* str) { opts.conn.command_timeout_ms = (uint32_t) strtoul(str, nullptr, 10); });
+    optr.add_opt("--tls", false, [&](int id, const char* str) { tls = true; });
+    optr.add_opt("--cacert", true, [&](int id, const char* str) { tls_opts.ca_file.assign(str); });
+    optr.add_opt("--sni", true, [&](int id, const char* str) { tls_opts.server_name.assign(str); });
+    optr.add_opt("-q", false, [&](int id, const char* str) { quiet = true; });
+    optr.add_opt("--help", false, [&](int id, const char* str) { help = true; });
+    optr.cmdline(argc, argv);
+
+    // 127.0.0.1:6379:pwd
+    std::vector<std::string> host_vec;
+    split(host, ':', &host_vec);
+    if (help || host_vec.size() != 3 || file.empty() || format < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    RedisTlsContext tls_ctx;
+    if (tls) {
+        if (!tls_ctx.init(tls_opts)) {
+            fprintf(stderr, "TLS error: %s\n", tls_ctx.get_last_error().c_str());
+            return 1;
+        }
+        opts.conn.tls = &tls_ctx;
+    }
+
+    RedisBulkLoader loader;
+    loader.init(host_vec[0], (uint32_t) atoi(host_vec[1].c_str()), host_vec[2], opts);
+    if (!quiet) {
+        loader.set_error_callback([](uint64_t index, const std::string& error) {
+            fprintf(stderr, "command %llu: %s\n", (unsigned long long) index, error.c_str());
+        });
+    }
+    RedisBulkLoader::loader_stats_t st;
+    int err = file == "-" ? loader.load(std::cin, format, st) : loader.load_file(file, format, st);
+    fprintf(stdout, "commands: %llu, replies: %llu, errors: %llu, %.2fs, %.0f commands/s, %.1f MB/s\n",
+            (unsigned long long) st.commands, (unsigned long long) st.replies, (unsigned long long) st.errors,
+            st.seconds, st.qps(), st.seconds > 0 ? st.bytes / st.seconds / 1e6 : 0);
+    if (err == RCLI_ERROR) {
+        fprintf(stderr, "load error: %s\n", loader.get_last_error().c_str());
+    }
+    return err == RCLI_RET_OK ? 0 : 1;
+}